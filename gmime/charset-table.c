@@ -0,0 +1,142 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*  GMime
+ *  Copyright (C) 2000-2014 Jeffrey Stedfast
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iconv.h>
+#include <errno.h>
+
+
+/* Generates gmime-charset-table-private.h, the tables that
+ * gmime-charset-table.c uses to convert the common 8bit charsets to
+ * UTF-8 without going through iconv. Every charset listed here must
+ * be a superset of US-ASCII. */
+static struct {
+	const char *name;  /* iconv-friendly charset name */
+	const char *id;    /* C identifier for the table */
+} tables[] = {
+	{ "us-ascii",     "us_ascii"    },
+	{ "iso-8859-1",   "iso_8859_1"  },
+
+	/* the 8bit charsets in gmime-charset-map-private.h */
+	{ "iso-8859-2",   "iso_8859_2"  },
+	{ "iso-8859-4",   "iso_8859_4"  },
+	{ "koi8-r",       "koi8_r"      },
+	{ "koi8-u",       "koi8_u"      },
+	{ "iso-8859-5",   "iso_8859_5"  },
+	{ "iso-8859-6",   "iso_8859_6"  },
+	{ "iso-8859-7",   "iso_8859_7"  },
+	{ "iso-8859-8",   "iso_8859_8"  },
+	{ "iso-8859-9",   "iso_8859_9"  },
+	{ "iso-8859-13",  "iso_8859_13" },
+	{ "iso-8859-15",  "iso_8859_15" },
+	{ "CP1251",       "cp1251"      },
+
+	/* the rest of the Windows code pages */
+	{ "CP1250",       "cp1250"      },
+	{ "CP1252",       "cp1252"      },
+	{ "CP1253",       "cp1253"      },
+	{ "CP1254",       "cp1254"      },
+	{ "CP1256",       "cp1256"      },
+	{ "CP1257",       "cp1257"      },
+	
+	/* Note: CP1255 and CP1258 are left out on purpose: iconv
+	 * composes their combining marks with the preceding character,
+	 * which a byte-to-character table cannot do */
+};
+
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+#define UCS "UCS-4BE"
+#else
+#define UCS "UCS-4LE"
+#endif
+
+int main (int argc, char **argv)
+{
+	size_t inleft, outleft, rc;
+	char *inbuf, *outbuf;
+	guint32 map[128], c;
+	unsigned int i, j;
+	iconv_t cd;
+	char in;
+	
+	printf ("/* This file is automatically generated: DO NOT EDIT */\n\n");
+	
+	for (j = 0; j < G_N_ELEMENTS (tables); j++) {
+		if ((cd = iconv_open (UCS, tables[j].name)) == (iconv_t) -1) {
+			g_warning ("iconv_open (%s, %s): %s", UCS, tables[j].name,
+				   g_strerror (errno));
+			exit (1);
+		}
+		
+		/* convert a byte at a time so that the bytes which have
+		 * no mapping don't shift the ones that follow them */
+		for (i = 0; i < 256; i++) {
+			in = (char) i;
+			inbuf = &in;
+			inleft = 1;
+			outbuf = (char *) &c;
+			outleft = sizeof (c);
+			
+			rc = iconv (cd, &inbuf, &inleft, &outbuf, &outleft);
+			if (rc == (size_t) -1 || outleft != 0 || c > 0xffff) {
+				iconv (cd, NULL, NULL, NULL, NULL);
+				c = 0;
+			}
+			
+			if (i < 128) {
+				if (c != i) {
+					g_warning ("%s is not a superset of US-ASCII", tables[j].name);
+					exit (1);
+				}
+			} else {
+				map[i - 128] = c;
+			}
+		}
+		
+		iconv_close (cd);
+		
+		printf ("static const guint16 %s_table[128] = {\n\t", tables[j].id);
+		for (i = 0; i < 128; i++) {
+			printf ("0x%04x, ", map[i]);
+			if (((i + 1) & 7) == 0 && i < 127)
+				printf ("\n\t");
+		}
+		printf ("\n};\n\n");
+	}
+	
+	printf ("static const struct {\n");
+	printf ("\tconst char *name;\n");
+	printf ("\tconst guint16 *table;\n");
+	printf ("} charset_tables[] = {\n");
+	for (j = 0; j < G_N_ELEMENTS (tables); j++)
+		printf ("\t{ \"%s\", %s_table },\n", tables[j].name, tables[j].id);
+	printf ("};\n");
+	
+	return 0;
+}
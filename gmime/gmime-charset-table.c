@@ -0,0 +1,283 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*  GMime
+ *  Copyright (C) 2000-2014 Jeffrey Stedfast
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <errno.h>
+
+#include "gmime-charset-table.h"
+#include "gmime-charset.h"
+#include "gmime-simd.h"
+
+#include "gmime-charset-table-private.h"
+
+#ifdef GMIME_X86_SIMD
+#include <immintrin.h>
+#endif
+
+
+/* charset names that g_mime_charset_iconv_name() passes through
+ * as they are, but which are the same as one of the tables */
+static const struct {
+	const char *alias;
+	const char *name;
+} charset_aliases[] = {
+	{ "ascii",          "us-ascii"   },
+	{ "ANSI_X3.4-1968", "us-ascii"   },
+	{ "latin1",         "iso-8859-1" },
+};
+
+
+/* Vectorized US-ASCII kernels.
+ *
+ * Even mail in an 8bit charset is mostly markup, whitespace and
+ * punctuation, all of which is the same in UTF-8. These copy such a
+ * run to the output and return its length, leaving the bytes that
+ * need a table lookup to the byte-at-a-time loop. Like the
+ * quoted-printable kernels, they store whole vectors, so the caller
+ * must leave room for one past the end of the run. */
+#ifdef GMIME_X86_SIMD
+typedef size_t (* AsciiCopyFunc) (const unsigned char *inbuf, size_t inlen, unsigned char *outbuf);
+
+GMIME_TARGET ("sse2") static inline size_t
+ascii_copy_sse2_inline (const unsigned char *inbuf, const unsigned char *inptr, size_t inlen, unsigned char *outptr)
+{
+	const unsigned char *inend = inbuf + inlen;
+	unsigned int high;
+	__m128i in;
+	
+	while (inend - inptr >= 16) {
+		in = _mm_loadu_si128 ((const __m128i *) inptr);
+		_mm_storeu_si128 ((__m128i *) outptr, in);
+		
+		if ((high = _mm_movemask_epi8 (in)) != 0)
+			return (inptr - inbuf) + __builtin_ctz (high);
+		
+		outptr += 16;
+		inptr += 16;
+	}
+	
+	return inptr - inbuf;
+}
+
+GMIME_TARGET ("sse2") static size_t
+ascii_copy_sse2 (const unsigned char *inbuf, size_t inlen, unsigned char *outbuf)
+{
+	return ascii_copy_sse2_inline (inbuf, inbuf, inlen, outbuf);
+}
+
+GMIME_TARGET ("avx2") static size_t
+ascii_copy_avx2 (const unsigned char *inbuf, size_t inlen, unsigned char *outbuf)
+{
+	const unsigned char *inptr = inbuf;
+	unsigned int high;
+	__m256i in;
+	
+	while (inlen - (inptr - inbuf) >= 32) {
+		in = _mm256_loadu_si256 ((const __m256i *) inptr);
+		_mm256_storeu_si256 ((__m256i *) outbuf, in);
+		
+		if ((high = (unsigned int) _mm256_movemask_epi8 (in)) != 0)
+			return (inptr - inbuf) + __builtin_ctz (high);
+		
+		outbuf += 32;
+		inptr += 32;
+	}
+	
+	/* inlined rather than called so that it gets the VEX encoding */
+	return ascii_copy_sse2_inline (inbuf, inptr, inlen, outbuf);
+}
+
+static AsciiCopyFunc
+ascii_copy_func (void)
+{
+	if (g_mime_simd_has (GMIME_SIMD_AVX2))
+		return ascii_copy_avx2;
+	
+	if (g_mime_simd_has (GMIME_SIMD_SSE2))
+		return ascii_copy_sse2;
+	
+	return NULL;
+}
+#endif /* GMIME_X86_SIMD */
+
+
+/**
+ * g_mime_charset_table_lookup:
+ * @to: charset to convert to
+ * @from: charset to convert from
+ *
+ * Looks for a built-in table that can be used instead of an iconv
+ * descriptor opened with g_mime_iconv_open() for the same charsets.
+ *
+ * Returns: the table for @from if @to is UTF-8 and @from is one of
+ * the 8bit charsets GMime knows about, or %NULL otherwise.
+ **/
+const guint16 *
+g_mime_charset_table_lookup (const char *to, const char *from)
+{
+	guint i;
+	
+	if (from == NULL || to == NULL)
+		return NULL;
+	
+	if (g_ascii_strcasecmp (g_mime_charset_iconv_name (to), "UTF-8") != 0)
+		return NULL;
+	
+	/* same as g_mime_iconv_open() */
+	if (!g_ascii_strcasecmp (from, "x-unknown"))
+		from = g_mime_locale_charset ();
+	
+	from = g_mime_charset_iconv_name (from);
+	
+	for (i = 0; i < G_N_ELEMENTS (charset_aliases); i++) {
+		if (!g_ascii_strcasecmp (charset_aliases[i].alias, from)) {
+			from = charset_aliases[i].name;
+			break;
+		}
+	}
+	
+	for (i = 0; i < G_N_ELEMENTS (charset_tables); i++) {
+		if (!g_ascii_strcasecmp (charset_tables[i].name, from))
+			return charset_tables[i].table;
+	}
+	
+	return NULL;
+}
+
+
+#define utf8_length(c) ((c) < 0x80 ? 1 : (c) < 0x800 ? 2 : 3)
+
+static inline unsigned char *
+utf8_encode (guint16 c, unsigned char *outptr)
+{
+	if (c < 0x80) {
+		*outptr++ = c;
+	} else if (c < 0x800) {
+		*outptr++ = 0xc0 | (c >> 6);
+		*outptr++ = 0x80 | (c & 0x3f);
+	} else {
+		*outptr++ = 0xe0 | (c >> 12);
+		*outptr++ = 0x80 | ((c >> 6) & 0x3f);
+		*outptr++ = 0x80 | (c & 0x3f);
+	}
+	
+	return outptr;
+}
+
+
+/**
+ * g_mime_charset_table_convert:
+ * @table: a table returned by g_mime_charset_table_lookup()
+ * @inbuf: input buffer
+ * @inleft: number of bytes left in @inbuf
+ * @outbuf: output buffer
+ * @outleft: number of bytes left in @outbuf
+ *
+ * Converts the text in *@inbuf to UTF-8 in *@outbuf, updating the
+ * pointers and counters the same way iconv() does.
+ *
+ * Since the 8bit charsets are stateless, a call with a %NULL @inbuf
+ * (to flush or reset the conversion state) does nothing.
+ *
+ * Returns: %0 on success or (size_t) %-1 on fail, with errno set to
+ * %EILSEQ if *@inbuf points to a byte which has no mapping in @table
+ * or %E2BIG if *@outbuf has no room for the next character.
+ **/
+size_t
+g_mime_charset_table_convert (const guint16 *table, const char **inbuf, size_t *inleft,
+			      char **outbuf, size_t *outleft)
+{
+	register const unsigned char *inptr;
+	register unsigned char *outptr;
+	const unsigned char *inend, *safe;
+	unsigned char *outend;
+	size_t rc = 0;
+	guint16 c;
+#ifdef GMIME_X86_SIMD
+	AsciiCopyFunc copy_ascii = ascii_copy_func ();
+	size_t n;
+#endif
+	
+	if (inbuf == NULL || *inbuf == NULL)
+		return 0;
+	
+	inptr = (const unsigned char *) *inbuf;
+	inend = inptr + *inleft;
+	outptr = (unsigned char *) *outbuf;
+	outend = outptr + *outleft;
+	
+	/* no byte becomes more than 3 bytes of UTF-8, so up until
+	 * @safe there is no need to check for room in the output */
+	safe = inptr + MIN (*inleft, *outleft / 3);
+	
+	while (inptr < safe) {
+		if (*inptr < 128) {
+#ifdef GMIME_X86_SIMD
+			if (copy_ascii != NULL && safe - inptr >= 16) {
+				n = copy_ascii (inptr, safe - inptr, outptr);
+				inptr += n;
+				outptr += n;
+				continue;
+			}
+#endif
+			*outptr++ = *inptr++;
+		} else if ((c = table[*inptr - 128]) != 0) {
+			outptr = utf8_encode (c, outptr);
+			inptr++;
+		} else {
+			errno = EILSEQ;
+			rc = (size_t) -1;
+			goto done;
+		}
+	}
+	
+	while (inptr < inend) {
+		if (*inptr < 128) {
+			c = *inptr;
+		} else if ((c = table[*inptr - 128]) == 0) {
+			errno = EILSEQ;
+			rc = (size_t) -1;
+			break;
+		}
+		
+		if (outend - outptr < utf8_length (c)) {
+			errno = E2BIG;
+			rc = (size_t) -1;
+			break;
+		}
+		
+		outptr = utf8_encode (c, outptr);
+		inptr++;
+	}
+	
+ done:
+	
+	*inleft = inend - inptr;
+	*outleft = outend - outptr;
+	*inbuf = (const char *) inptr;
+	*outbuf = (char *) outptr;
+	
+	return rc;
+}
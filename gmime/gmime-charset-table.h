@@ -0,0 +1,43 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*  GMime
+ *  Copyright (C) 2000-2014 Jeffrey Stedfast
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301, USA.
+ */
+
+
+#ifndef __GMIME_CHARSET_TABLE_H__
+#define __GMIME_CHARSET_TABLE_H__
+
+#include <glib.h>
+#include <sys/types.h>
+
+G_BEGIN_DECLS
+
+/* Built-in converters from the common 8bit charsets to UTF-8. A
+ * table maps the bytes 0x80-0xff of its charset to UCS-2, with 0
+ * marking the bytes that iconv would reject; bytes below 0x80 are
+ * always US-ASCII. g_mime_charset_table_convert() behaves exactly
+ * like iconv() would on a descriptor opened for the same
+ * conversion. */
+G_GNUC_INTERNAL const guint16 *g_mime_charset_table_lookup (const char *to, const char *from);
+
+G_GNUC_INTERNAL size_t g_mime_charset_table_convert (const guint16 *table, const char **inbuf, size_t *inleft,
+						     char **outbuf, size_t *outleft);
+
+G_END_DECLS
+
+#endif /* __GMIME_CHARSET_TABLE_H__ */
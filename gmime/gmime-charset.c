@@ -44,6 +44,11 @@
 #include "gmime-table-private.h"
 #include "gmime-charset.h"
 #include "gmime-iconv.h"
+#include "gmime-simd.h"
+
+#ifdef GMIME_X86_SIMD
+#include <immintrin.h>
+#endif
 
 #ifdef HAVE_ICONV_DETECT_H
 #include "iconv-detect.h"
@@ -693,6 +698,82 @@ g_mime_charset_iso_to_windows (const char *isocharset)
 }
 
 
+/* Vectorized US-ASCII span kernels.
+ *
+ * These return the length of the run of whole vectors of US-ASCII at
+ * the start of @inbuf and the largest byte in it. The masks of the
+ * US-ASCII characters in gmime-charset-map-private.h are nested, each
+ * a subset of those of the smaller characters, so the mask of the
+ * largest one is also the mask of the whole run. */
+#ifdef GMIME_X86_SIMD
+typedef size_t (* AsciiSpanFunc) (const unsigned char *inbuf, size_t inlen, unsigned char *max);
+
+GMIME_TARGET ("sse2") static inline size_t
+ascii_span_sse2_inline (const unsigned char *inbuf, const unsigned char *inptr, size_t inlen, __m128i vmax, unsigned char *max)
+{
+	const unsigned char *inend = inbuf + inlen;
+	__m128i in;
+	
+	while (inend - inptr >= 16) {
+		in = _mm_loadu_si128 ((const __m128i *) inptr);
+		if (_mm_movemask_epi8 (in) != 0)
+			break;
+		
+		vmax = _mm_max_epu8 (vmax, in);
+		inptr += 16;
+	}
+	
+	vmax = _mm_max_epu8 (vmax, _mm_srli_si128 (vmax, 8));
+	vmax = _mm_max_epu8 (vmax, _mm_srli_si128 (vmax, 4));
+	vmax = _mm_max_epu8 (vmax, _mm_srli_si128 (vmax, 2));
+	vmax = _mm_max_epu8 (vmax, _mm_srli_si128 (vmax, 1));
+	*max = _mm_cvtsi128_si32 (vmax) & 0xff;
+	
+	return inptr - inbuf;
+}
+
+GMIME_TARGET ("sse2") static size_t
+ascii_span_sse2 (const unsigned char *inbuf, size_t inlen, unsigned char *max)
+{
+	return ascii_span_sse2_inline (inbuf, inbuf, inlen, _mm_setzero_si128 (), max);
+}
+
+GMIME_TARGET ("avx2") static size_t
+ascii_span_avx2 (const unsigned char *inbuf, size_t inlen, unsigned char *max)
+{
+	const unsigned char *inptr = inbuf;
+	__m256i in, vmax;
+	
+	vmax = _mm256_setzero_si256 ();
+	
+	while (inlen - (inptr - inbuf) >= 32) {
+		in = _mm256_loadu_si256 ((const __m256i *) inptr);
+		if (_mm256_movemask_epi8 (in) != 0)
+			break;
+		
+		vmax = _mm256_max_epu8 (vmax, in);
+		inptr += 32;
+	}
+	
+	/* inlined rather than called so that it gets the VEX encoding */
+	return ascii_span_sse2_inline (inbuf, inptr, inlen, _mm_max_epu8 (_mm256_castsi256_si128 (vmax),
+									 _mm256_extracti128_si256 (vmax, 1)), max);
+}
+
+static AsciiSpanFunc
+ascii_span_func (void)
+{
+	if (g_mime_simd_has (GMIME_SIMD_AVX2))
+		return ascii_span_avx2;
+	
+	if (g_mime_simd_has (GMIME_SIMD_SSE2))
+		return ascii_span_sse2;
+	
+	return NULL;
+}
+#endif /* GMIME_X86_SIMD */
+
+
 /**
  * g_mime_charset_init:
  * @charset: charset mask
@@ -725,6 +806,11 @@ g_mime_charset_step (GMimeCharset *charset, const char *inbuf, size_t inlen)
 	const char *inend = inbuf + inlen;
 	register unsigned int mask;
 	register int level;
+#ifdef GMIME_X86_SIMD
+	AsciiSpanFunc ascii_span = ascii_span_func ();
+	unsigned char max;
+	size_t n;
+#endif
 	
 	mask = charset->mask;
 	level = charset->level;
@@ -733,7 +819,23 @@ g_mime_charset_step (GMimeCharset *charset, const char *inbuf, size_t inlen)
 		const char *newinptr;
 		gunichar c;
 		
+#ifdef GMIME_X86_SIMD
+		if (ascii_span != NULL && inend - inptr >= 16 && !(*inptr & 0x80) &&
+		    (n = ascii_span ((const unsigned char *) inptr, inend - inptr, &max)) > 0) {
+			mask &= charset_mask (max);
+			inptr += n;
+			continue;
+		}
+#endif
+		
 		newinptr = g_utf8_next_char (inptr);
+		if (newinptr > inend) {
+			/* don't read past the end of a sequence that
+			 * has been cut short */
+			inptr++;
+			continue;
+		}
+		
 		c = g_utf8_get_char (inptr);
 		if (newinptr == NULL || !g_unichar_validate (c)) {
 			inptr++;
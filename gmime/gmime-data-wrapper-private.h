@@ -0,0 +1,40 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*  GMime
+ *  Copyright (C) 2000-2014 Jeffrey Stedfast
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301, USA.
+ */
+
+
+#ifndef __GMIME_DATA_WRAPPER_PRIVATE_H__
+#define __GMIME_DATA_WRAPPER_PRIVATE_H__
+
+#include <gmime/gmime-data-wrapper.h>
+#include <gmime/gmime-filter-best.h>
+
+G_BEGIN_DECLS
+
+/* Statistics about the content of a data wrapper, gathered by the
+ * parser as it scanned the content so that the best transfer encoding
+ * can be worked out without reading the content again. They are
+ * dropped whenever the stream or its encoding is replaced. */
+G_GNUC_INTERNAL void g_mime_data_wrapper_set_content_stats (GMimeDataWrapper *wrapper, GMimeFilterBest *best);
+
+G_GNUC_INTERNAL GMimeFilterBest *g_mime_data_wrapper_get_content_stats (GMimeDataWrapper *wrapper);
+
+G_END_DECLS
+
+#endif /* __GMIME_DATA_WRAPPER_PRIVATE_H__ */
@@ -23,9 +23,17 @@
 #include <config.h>
 #endif
 
+#include <string.h>
+#include <errno.h>
+
 #include "gmime-data-wrapper.h"
+#include "gmime-data-wrapper-private.h"
+#include "gmime-stream-base64.h"
 #include "gmime-stream-filter.h"
 #include "gmime-filter-basic.h"
+#include "gmime-charset-table.h"
+#include "gmime-charset.h"
+#include "gmime-iconv.h"
 
 
 /**
@@ -50,6 +58,10 @@ static ssize_t write_to_stream (GMimeDataWrapper *wrapper, GMimeStream *stream);
 
 static GObject *parent_class = NULL;
 
+/* the content statistics are attached to the object rather than kept
+ * in the public struct so as not to change its size */
+static GQuark content_stats_quark = 0;
+
 
 GType
 g_mime_data_wrapper_get_type (void)
@@ -86,6 +98,8 @@ g_mime_data_wrapper_class_init (GMimeDataWrapperClass *klass)
 	object_class->finalize = g_mime_data_wrapper_finalize;
 	
 	klass->write_to_stream = write_to_stream;
+	
+	content_stats_quark = g_quark_from_static_string ("gmime-content-stats");
 }
 
 static void
@@ -175,6 +189,8 @@ g_mime_data_wrapper_set_stream (GMimeDataWrapper *wrapper, GMimeStream *stream)
 		g_object_unref (wrapper->stream);
 	
 	wrapper->stream = stream;
+	
+	g_mime_data_wrapper_set_content_stats (wrapper, NULL);
 }
 
 
@@ -208,6 +224,8 @@ g_mime_data_wrapper_set_encoding (GMimeDataWrapper *wrapper, GMimeContentEncodin
 	g_return_if_fail (GMIME_IS_DATA_WRAPPER (wrapper));
 	
 	wrapper->encoding = encoding;
+	
+	g_mime_data_wrapper_set_content_stats (wrapper, NULL);
 }
 
 
@@ -228,6 +246,42 @@ g_mime_data_wrapper_get_encoding (GMimeDataWrapper *wrapper)
 }
 
 
+/**
+ * g_mime_data_wrapper_set_content_stats:
+ * @wrapper: a #GMimeDataWrapper
+ * @best: (allow-none): a #GMimeFilterBest that the content has been
+ *   filtered through or %NULL
+ *
+ * Records the statistics that @best has gathered about the (decoded)
+ * content of @wrapper, or forgets them if @best is %NULL.
+ **/
+void
+g_mime_data_wrapper_set_content_stats (GMimeDataWrapper *wrapper, GMimeFilterBest *best)
+{
+	if (best != NULL)
+		g_object_ref (best);
+	
+	g_object_set_qdata_full ((GObject *) wrapper, content_stats_quark, best,
+				 best ? (GDestroyNotify) g_object_unref : NULL);
+}
+
+
+/**
+ * g_mime_data_wrapper_get_content_stats:
+ * @wrapper: a #GMimeDataWrapper
+ *
+ * Gets the statistics recorded by g_mime_data_wrapper_set_content_stats().
+ *
+ * Returns: (transfer none): the #GMimeFilterBest holding the
+ * statistics or %NULL if there are none.
+ **/
+GMimeFilterBest *
+g_mime_data_wrapper_get_content_stats (GMimeDataWrapper *wrapper)
+{
+	return g_object_get_qdata ((GObject *) wrapper, content_stats_quark);
+}
+
+
 static ssize_t
 write_to_stream (GMimeDataWrapper *wrapper, GMimeStream *stream)
 {
@@ -279,3 +333,372 @@ g_mime_data_wrapper_write_to_stream (GMimeDataWrapper *wrapper, GMimeStream *str
 	
 	return GMIME_DATA_WRAPPER_GET_CLASS (wrapper)->write_to_stream (wrapper, stream);
 }
+
+
+/**
+ * g_mime_data_wrapper_get_decoded_stream:
+ * @wrapper: a #GMimeDataWrapper
+ *
+ * Gets a new stream of the raw (decoded) content of @wrapper, for when
+ * only part of the content is wanted.
+ *
+ * Base64 encoded content is decoded by a #GMimeStreamBase64, so that
+ * the stream may be seeked to any offset without decoding everything
+ * before it. Content that is not encoded is returned as a substream.
+ * Quoted-printable and uuencoded content is decoded through a
+ * #GMimeStreamFilter, which can only be read from start to end.
+ *
+ * Returns: (transfer full): a stream of the decoded content of
+ * @wrapper.
+ **/
+GMimeStream *
+g_mime_data_wrapper_get_decoded_stream (GMimeDataWrapper *wrapper)
+{
+	GMimeStream *stream, *decoded;
+	GMimeFilter *filter;
+	
+	g_return_val_if_fail (GMIME_IS_DATA_WRAPPER (wrapper), NULL);
+	g_return_val_if_fail (wrapper->stream != NULL, NULL);
+	
+	stream = g_mime_stream_substream (wrapper->stream, wrapper->stream->bound_start, wrapper->stream->bound_end);
+	
+	switch (wrapper->encoding) {
+	case GMIME_CONTENT_ENCODING_BASE64:
+		decoded = g_mime_stream_base64_new (stream);
+		g_object_unref (stream);
+		break;
+	case GMIME_CONTENT_ENCODING_QUOTEDPRINTABLE:
+	case GMIME_CONTENT_ENCODING_UUENCODE:
+		filter = g_mime_filter_basic_new (wrapper->encoding, FALSE);
+		decoded = g_mime_stream_filter_new (stream);
+		g_mime_stream_filter_add (GMIME_STREAM_FILTER (decoded), filter);
+		g_object_unref (filter);
+		g_object_unref (stream);
+		break;
+	default:
+		decoded = stream;
+		break;
+	}
+	
+	return decoded;
+}
+
+
+#define TEXT_BLOCK_SIZE 4096
+#define TEXT_SAVE_SIZE  16	/* room for an incomplete multibyte sequence */
+
+typedef struct {
+	GMimeStream *stream;
+	ssize_t written;
+	gboolean saw_cr;
+	char *outbuf;
+} TextWriter;
+
+static int
+text_writer_write (TextWriter *writer, const char *buf, size_t len)
+{
+	ssize_t n;
+	
+	while (len > 0) {
+		if ((n = g_mime_stream_write (writer->stream, buf, len)) < 0)
+			return -1;
+		
+		writer->written += n;
+		buf += n;
+		len -= n;
+	}
+	
+	return 0;
+}
+
+#define WORD_ONES  G_GUINT64_CONSTANT (0x0101010101010101)
+#define WORD_HIGHS G_GUINT64_CONSTANT (0x8080808080808080)
+
+/* 8 bytes of US-ASCII other than '\r', which need no attention */
+#define plain_ascii_word(w) ((((w) | (((w) ^ (WORD_ONES * '\r')) - WORD_ONES)) & WORD_HIGHS) == 0)
+
+/* converts the bytes of an 8bit charset to UTF-8 and normalizes line
+ * endings in the same sweep; produces exactly what GMimeFilterCharset
+ * followed by a GMimeFilterCRLF decoder would */
+static char *
+text_decode_table (TextWriter *writer, const guint16 *table, const unsigned char *inptr,
+		   size_t inlen, char *outptr)
+{
+	const unsigned char *inend = inptr + inlen;
+	gboolean saw_cr = writer->saw_cr;
+	guint64 word;
+	guint16 u;
+	
+	while (inptr < inend) {
+		if (!saw_cr) {
+			/* copy runs of plain text a word at a time */
+			while (inend - inptr >= 8) {
+				memcpy (&word, inptr, 8);
+				if (!plain_ascii_word (word))
+					break;
+				
+				memcpy (outptr, &word, 8);
+				outptr += 8;
+				inptr += 8;
+			}
+			
+			if (inptr == inend)
+				break;
+		}
+		
+		if (*inptr < 0x80) {
+			u = *inptr++;
+			
+			if (u == '\r') {
+				saw_cr = TRUE;
+				continue;
+			}
+		} else if ((u = table[*inptr++ - 128]) == 0) {
+			/* GMimeFilterCharset drops the bytes iconv can't convert */
+			continue;
+		}
+		
+		if (saw_cr) {
+			if (u != '\n')
+				*outptr++ = '\r';
+			saw_cr = FALSE;
+		}
+		
+		if (u < 0x80) {
+			*outptr++ = (char) u;
+		} else if (u < 0x800) {
+			*outptr++ = (char) (0xc0 | (u >> 6));
+			*outptr++ = (char) (0x80 | (u & 0x3f));
+		} else {
+			*outptr++ = (char) (0xe0 | (u >> 12));
+			*outptr++ = (char) (0x80 | ((u >> 6) & 0x3f));
+			*outptr++ = (char) (0x80 | (u & 0x3f));
+		}
+	}
+	
+	writer->saw_cr = saw_cr;
+	
+	return outptr;
+}
+
+/* normalizes the line endings of UTF-8 text */
+static char *
+text_decode_crlf (TextWriter *writer, const char *inptr, size_t inlen, char *outptr)
+{
+	const char *inend = inptr + inlen;
+	gboolean saw_cr = writer->saw_cr;
+	const char *cr;
+	
+	while (inptr < inend) {
+		if (saw_cr) {
+			if (*inptr == '\r') {
+				inptr++;
+				continue;
+			}
+			
+			if (*inptr != '\n')
+				*outptr++ = '\r';
+			saw_cr = FALSE;
+		}
+		
+		if (!(cr = memchr (inptr, '\r', inend - inptr))) {
+			memcpy (outptr, inptr, inend - inptr);
+			outptr += inend - inptr;
+			break;
+		}
+		
+		memcpy (outptr, inptr, cr - inptr);
+		outptr += cr - inptr;
+		inptr = cr + 1;
+		saw_cr = TRUE;
+	}
+	
+	writer->saw_cr = saw_cr;
+	
+	return outptr;
+}
+
+/* converts with iconv, then normalizes line endings; a trailing
+ * incomplete multibyte sequence is left in @inbuf for the next call */
+static int
+text_decode_iconv (TextWriter *writer, iconv_t cd, char **inbuf, size_t *inleft, char *convbuf, size_t convlen)
+{
+	gboolean incomplete;
+	size_t outleft;
+	char *outbuf;
+	
+	while (*inleft > 0) {
+		outbuf = convbuf;
+		outleft = convlen;
+		incomplete = FALSE;
+		
+		if (iconv (cd, (ICONV_CONST char **) inbuf, inleft, &outbuf, &outleft) == (size_t) -1) {
+			if (errno == EINVAL) {
+				incomplete = TRUE;
+			} else if (errno != E2BIG) {
+				/* eat the invalid byte, like GMimeFilterCharset */
+				(*inbuf)++;
+				(*inleft)--;
+			}
+		}
+		
+		outbuf = text_decode_crlf (writer, convbuf, outbuf - convbuf, writer->outbuf);
+		if (text_writer_write (writer, writer->outbuf, outbuf - writer->outbuf) == -1)
+			return -1;
+		
+		if (incomplete)
+			break;
+	}
+	
+	return 0;
+}
+
+
+/**
+ * g_mime_data_wrapper_write_text_to_stream:
+ * @wrapper: a #GMimeDataWrapper
+ * @stream: output stream
+ * @charset: (allow-none): the charset of the content or %NULL
+ *
+ * Writes the decoded content to the output stream as UTF-8 text with
+ * UNIX line endings: the content is decoded, converted from @charset
+ * to UTF-8 (unless @charset is %NULL or UTF-8 already, or there is no
+ * converter for it) and has its CRLF sequences replaced with LF.
+ *
+ * The output is the same as that of writing the content through a
+ * #GMimeFilterBasic decoder, a #GMimeFilterCharset and a
+ * #GMimeFilterCRLF decoder, but all three steps are done in a single
+ * pass over the content.
+ *
+ * Returns: the number of bytes written or %-1 on failure.
+ **/
+ssize_t
+g_mime_data_wrapper_write_text_to_stream (GMimeDataWrapper *wrapper, GMimeStream *stream, const char *charset)
+{
+	char *inbuf, *decbuf, *decoded, *readbuf, *outptr, *convbuf = NULL;
+	size_t declen, convlen, outleft, saved = 0;
+	const guint16 *table = NULL;
+	iconv_t cd = (iconv_t) -1;
+	GMimeStream *source;
+	GMimeEncoding state;
+	gboolean decode, eos;
+	TextWriter writer;
+	GMimeFilter *filter;
+	ssize_t nread;
+	
+	g_return_val_if_fail (GMIME_IS_DATA_WRAPPER (wrapper), -1);
+	g_return_val_if_fail (GMIME_IS_STREAM (stream), -1);
+	g_return_val_if_fail (wrapper->stream != NULL, -1);
+	
+	if (charset != NULL && g_ascii_strcasecmp (g_mime_charset_iconv_name (charset), "UTF-8") != 0) {
+		if (!(table = g_mime_charset_table_lookup ("UTF-8", charset)))
+			cd = g_mime_iconv_open ("UTF-8", charset);
+	}
+	
+	g_mime_stream_reset (wrapper->stream);
+	
+	switch (wrapper->encoding) {
+	case GMIME_CONTENT_ENCODING_BASE64:
+	case GMIME_CONTENT_ENCODING_QUOTEDPRINTABLE:
+		g_mime_encoding_init_decode (&state, wrapper->encoding);
+		source = wrapper->stream;
+		g_object_ref (source);
+		decode = TRUE;
+		break;
+	case GMIME_CONTENT_ENCODING_UUENCODE:
+		/* uudecoding needs to look for the begin line first */
+		filter = g_mime_filter_basic_new (wrapper->encoding, FALSE);
+		source = g_mime_stream_filter_new (wrapper->stream);
+		g_mime_stream_filter_add (GMIME_STREAM_FILTER (source), filter);
+		g_object_unref (filter);
+		decode = FALSE;
+		break;
+	default:
+		source = wrapper->stream;
+		g_object_ref (source);
+		decode = FALSE;
+		break;
+	}
+	
+	/* an 8bit charset produces at most 3 bytes of UTF-8 per byte */
+	convlen = 4 * TEXT_BLOCK_SIZE;
+	if (cd != (iconv_t) -1)
+		convbuf = g_malloc (convlen);
+	
+	writer.stream = stream;
+	writer.written = 0;
+	writer.saw_cr = FALSE;
+	writer.outbuf = g_malloc (MAX (convlen, 3 * (TEXT_BLOCK_SIZE + 3)) + 1);
+	
+	inbuf = g_malloc (TEXT_BLOCK_SIZE);
+	decbuf = g_malloc (TEXT_SAVE_SIZE + TEXT_BLOCK_SIZE + 3);
+	
+	/* the decoded data goes right after any incomplete multibyte
+	 * sequence left over from the previous block */
+	readbuf = decode ? inbuf : decbuf + TEXT_SAVE_SIZE;
+	
+	do {
+		if ((nread = g_mime_stream_read (source, readbuf, TEXT_BLOCK_SIZE)) < 0)
+			goto error;
+		
+		eos = g_mime_stream_eos (source);
+		
+		decoded = decbuf + TEXT_SAVE_SIZE;
+		if (decode)
+			declen = g_mime_encoding_step (&state, inbuf, nread, decoded);
+		else
+			declen = nread;
+		
+		if (table != NULL) {
+			outptr = text_decode_table (&writer, table, (unsigned char *) decoded, declen, writer.outbuf);
+			if (text_writer_write (&writer, writer.outbuf, outptr - writer.outbuf) == -1)
+				goto error;
+		} else if (cd != (iconv_t) -1) {
+			decoded -= saved;
+			declen += saved;
+			
+			if (text_decode_iconv (&writer, cd, &decoded, &declen, convbuf, convlen) == -1)
+				goto error;
+			
+			/* an incomplete sequence at the very end is dropped,
+			 * just like GMimeFilterCharset does */
+			saved = MIN (declen, TEXT_SAVE_SIZE);
+			memmove (decbuf + TEXT_SAVE_SIZE - saved, decoded + declen - saved, saved);
+		} else {
+			outptr = text_decode_crlf (&writer, decoded, declen, writer.outbuf);
+			if (text_writer_write (&writer, writer.outbuf, outptr - writer.outbuf) == -1)
+				goto error;
+		}
+	} while (!eos);
+	
+	if (cd != (iconv_t) -1) {
+		/* flush the iconv conversion */
+		outptr = convbuf;
+		outleft = convlen;
+		iconv (cd, NULL, NULL, &outptr, &outleft);
+		
+		outptr = text_decode_crlf (&writer, convbuf, outptr - convbuf, writer.outbuf);
+		if (text_writer_write (&writer, writer.outbuf, outptr - writer.outbuf) == -1)
+			goto error;
+	}
+	
+ done:
+	
+	if (cd != (iconv_t) -1)
+		g_mime_iconv_close (cd);
+	
+	g_object_unref (source);
+	g_free (writer.outbuf);
+	g_free (convbuf);
+	g_free (decbuf);
+	g_free (inbuf);
+	
+	g_mime_stream_reset (wrapper->stream);
+	
+	return writer.written;
+	
+ error:
+	
+	writer.written = -1;
+	goto done;
+}
@@ -77,6 +77,9 @@ void g_mime_data_wrapper_set_encoding (GMimeDataWrapper *wrapper, GMimeContentEn
 GMimeContentEncoding g_mime_data_wrapper_get_encoding (GMimeDataWrapper *wrapper);
 
 ssize_t g_mime_data_wrapper_write_to_stream (GMimeDataWrapper *wrapper, GMimeStream *stream);
+ssize_t g_mime_data_wrapper_write_text_to_stream (GMimeDataWrapper *wrapper, GMimeStream *stream, const char *charset);
+
+GMimeStream *g_mime_data_wrapper_get_decoded_stream (GMimeDataWrapper *wrapper);
 
 G_END_DECLS
 
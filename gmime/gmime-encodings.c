@@ -29,6 +29,11 @@
 
 #include "gmime-table-private.h"
 #include "gmime-encodings.h"
+#include "gmime-simd.h"
+
+#ifdef GMIME_X86_SIMD
+#include <immintrin.h>
+#endif
 
 
 #ifdef ENABLE_WARNINGS
@@ -100,6 +105,406 @@ static unsigned char tohex[16] = {
 };
 
 
+/* Vectorized base64 kernels.
+ *
+ * The encoders turn blocks of 12 input bytes into 16 base64
+ * characters (24 into 32 for avx2) and the decoders do the reverse,
+ * following Wojciech Muła's and Daniel Lemire's "Faster Base64
+ * Encoding and Decoding using AVX2 Instructions". The step functions
+ * below only hand them whole blocks and handle line wrapping, saved
+ * state, whitespace, garbage and padding themselves, so the output is
+ * identical to that of the byte-at-a-time loops. */
+#ifdef GMIME_X86_SIMD
+typedef size_t (* Base64EncodeFunc) (const unsigned char *inbuf, size_t nblocks, unsigned char *outbuf);
+typedef size_t (* Base64DecodeFunc) (const unsigned char *inbuf, size_t inlen, unsigned char *outbuf);
+
+/* 12 bytes of input are read as 16, so leave room for the overhang */
+#define BASE64_ENCODE_OVERHANG 4
+
+GMIME_TARGET ("sse4.1") static inline __m128i
+base64_encode_block_sse41 (__m128i in)
+{
+	const __m128i shift = _mm_setr_epi8 ('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+					     '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+					     '/' - 63, 'A', 0, 0);
+	__m128i t0, t1, indices, result;
+	
+	/* split each 3 bytes into 4 6-bit indices, one per byte */
+	in = _mm_shuffle_epi8 (in, _mm_set_epi8 (10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+	t0 = _mm_mulhi_epu16 (_mm_and_si128 (in, _mm_set1_epi32 (0x0fc0fc00)), _mm_set1_epi32 (0x04000040));
+	t1 = _mm_mullo_epi16 (_mm_and_si128 (in, _mm_set1_epi32 (0x003f03f0)), _mm_set1_epi32 (0x01000010));
+	indices = _mm_or_si128 (t0, t1);
+	
+	/* map 0..25 to 13, 26..51 to 0, 52..61 to 1..10, 62 to 11 and
+	 * 63 to 12 so that a table lookup gives the offset to add */
+	result = _mm_subs_epu8 (indices, _mm_set1_epi8 (51));
+	result = _mm_or_si128 (result, _mm_and_si128 (_mm_cmpgt_epi8 (_mm_set1_epi8 (26), indices), _mm_set1_epi8 (13)));
+	
+	return _mm_add_epi8 (_mm_shuffle_epi8 (shift, result), indices);
+}
+
+GMIME_TARGET ("sse4.1") static size_t
+base64_encode_sse41 (const unsigned char *inbuf, size_t nblocks, unsigned char *outbuf)
+{
+	size_t i;
+	
+	for (i = 0; i < nblocks; i++) {
+		__m128i in = _mm_loadu_si128 ((const __m128i *) (inbuf + i * 12));
+		
+		_mm_storeu_si128 ((__m128i *) (outbuf + i * 16), base64_encode_block_sse41 (in));
+	}
+	
+	return nblocks;
+}
+
+GMIME_TARGET ("avx2") static size_t
+base64_encode_avx2 (const unsigned char *inbuf, size_t nblocks, unsigned char *outbuf)
+{
+	const __m256i shift = _mm256_setr_epi8 ('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+						'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+						'/' - 63, 'A', 0, 0,
+						'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+						'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+						'/' - 63, 'A', 0, 0);
+	const __m256i split = _mm256_set_epi8 (10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+					       10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+	__m256i in, t0, t1, indices, result;
+	size_t i;
+	
+	for (i = 0; i + 2 <= nblocks; i += 2) {
+		in = _mm256_inserti128_si256 (_mm256_castsi128_si256 (_mm_loadu_si128 ((const __m128i *) (inbuf + i * 12))),
+					      _mm_loadu_si128 ((const __m128i *) (inbuf + i * 12 + 12)), 1);
+		
+		in = _mm256_shuffle_epi8 (in, split);
+		t0 = _mm256_mulhi_epu16 (_mm256_and_si256 (in, _mm256_set1_epi32 (0x0fc0fc00)), _mm256_set1_epi32 (0x04000040));
+		t1 = _mm256_mullo_epi16 (_mm256_and_si256 (in, _mm256_set1_epi32 (0x003f03f0)), _mm256_set1_epi32 (0x01000010));
+		indices = _mm256_or_si256 (t0, t1);
+		
+		result = _mm256_subs_epu8 (indices, _mm256_set1_epi8 (51));
+		result = _mm256_or_si256 (result, _mm256_and_si256 (_mm256_cmpgt_epi8 (_mm256_set1_epi8 (26), indices), _mm256_set1_epi8 (13)));
+		result = _mm256_add_epi8 (_mm256_shuffle_epi8 (shift, result), indices);
+		
+		_mm256_storeu_si256 ((__m256i *) (outbuf + i * 16), result);
+	}
+	
+	/* the tail is done here rather than by calling base64_encode_sse41()
+	 * so that it gets the VEX encoding and avoids an AVX-SSE transition */
+	if (i < nblocks) {
+		__m128i last = _mm_loadu_si128 ((const __m128i *) (inbuf + i * 12));
+		
+		_mm_storeu_si128 ((__m128i *) (outbuf + i * 16), base64_encode_block_sse41 (last));
+	}
+	
+	return nblocks;
+}
+
+/* translates the base64 characters in @in into their 6-bit values,
+ * unless there is anything else in there */
+GMIME_TARGET ("sse4.1") static inline gboolean
+base64_decode_translate_sse41 (__m128i *in)
+{
+	const __m128i lut_lo = _mm_setr_epi8 (0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+					      0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const __m128i lut_hi = _mm_setr_epi8 (0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+					      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m128i lut_roll = _mm_setr_epi8 (0, 16, 19, 4, -65, -65, -71, -71,
+						0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i nibble = _mm_set1_epi8 (0x0f);
+	__m128i hi_nibbles, lo_nibbles, invalid, roll;
+	
+	hi_nibbles = _mm_and_si128 (_mm_srli_epi32 (*in, 4), nibble);
+	lo_nibbles = _mm_and_si128 (*in, nibble);
+	invalid = _mm_and_si128 (_mm_shuffle_epi8 (lut_lo, lo_nibbles), _mm_shuffle_epi8 (lut_hi, hi_nibbles));
+	
+	if (!_mm_testz_si128 (invalid, invalid))
+		return FALSE;
+	
+	/* '/' shares its high nibble with '+' but needs a different offset */
+	roll = _mm_add_epi8 (_mm_cmpeq_epi8 (*in, _mm_set1_epi8 ('/')), hi_nibbles);
+	*in = _mm_add_epi8 (*in, _mm_shuffle_epi8 (lut_roll, roll));
+	
+	return TRUE;
+}
+
+/* packs 16 6-bit values into 12 bytes at the start of the vector */
+GMIME_TARGET ("sse4.1") static inline __m128i
+base64_decode_pack_sse41 (__m128i in)
+{
+	in = _mm_maddubs_epi16 (in, _mm_set1_epi32 (0x01400140));
+	in = _mm_madd_epi16 (in, _mm_set1_epi32 (0x00011000));
+	
+	return _mm_shuffle_epi8 (in, _mm_setr_epi8 (2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+GMIME_TARGET ("sse4.1") static inline void
+base64_store12_sse41 (unsigned char *outbuf, __m128i out)
+{
+	guint32 last = (guint32) _mm_extract_epi32 (out, 2);
+	
+	_mm_storel_epi64 ((__m128i *) outbuf, out);
+	memcpy (outbuf + 8, &last, 4);
+}
+
+/* decodes whole blocks of 16 base64 characters, stopping at the first
+ * block that contains anything else; returns the number of input
+ * bytes consumed */
+GMIME_TARGET ("sse4.1") static size_t
+base64_decode_sse41 (const unsigned char *inbuf, size_t inlen, unsigned char *outbuf)
+{
+	const unsigned char *inptr = inbuf;
+	__m128i in;
+	
+	while (inlen - (inptr - inbuf) >= 16) {
+		in = _mm_loadu_si128 ((const __m128i *) inptr);
+		if (!base64_decode_translate_sse41 (&in))
+			break;
+		
+		base64_store12_sse41 (outbuf, base64_decode_pack_sse41 (in));
+		outbuf += 12;
+		inptr += 16;
+	}
+	
+	return inptr - inbuf;
+}
+
+GMIME_TARGET ("avx2") static size_t
+base64_decode_avx2 (const unsigned char *inbuf, size_t inlen, unsigned char *outbuf)
+{
+	const __m256i lut_lo = _mm256_setr_epi8 (0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+						 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+						 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+						 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const __m256i lut_hi = _mm256_setr_epi8 (0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+						 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+						 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+						 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m256i lut_roll = _mm256_setr_epi8 (0, 16, 19, 4, -65, -65, -71, -71,
+						   0, 0, 0, 0, 0, 0, 0, 0,
+						   0, 16, 19, 4, -65, -65, -71, -71,
+						   0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i pack = _mm256_setr_epi8 (2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+					       2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	const __m256i nibble = _mm256_set1_epi8 (0x0f);
+	const unsigned char *inptr = inbuf;
+	__m256i in, hi_nibbles, lo_nibbles, invalid, roll;
+	
+	while (inlen - (inptr - inbuf) >= 32) {
+		in = _mm256_loadu_si256 ((const __m256i *) inptr);
+		
+		hi_nibbles = _mm256_and_si256 (_mm256_srli_epi32 (in, 4), nibble);
+		lo_nibbles = _mm256_and_si256 (in, nibble);
+		invalid = _mm256_and_si256 (_mm256_shuffle_epi8 (lut_lo, lo_nibbles), _mm256_shuffle_epi8 (lut_hi, hi_nibbles));
+		
+		if (!_mm256_testz_si256 (invalid, invalid))
+			break;
+		
+		roll = _mm256_add_epi8 (_mm256_cmpeq_epi8 (in, _mm256_set1_epi8 ('/')), hi_nibbles);
+		in = _mm256_add_epi8 (in, _mm256_shuffle_epi8 (lut_roll, roll));
+		
+		in = _mm256_maddubs_epi16 (in, _mm256_set1_epi32 (0x01400140));
+		in = _mm256_madd_epi16 (in, _mm256_set1_epi32 (0x00011000));
+		in = _mm256_shuffle_epi8 (in, pack);
+		
+		base64_store12_sse41 (outbuf, _mm256_castsi256_si128 (in));
+		base64_store12_sse41 (outbuf + 12, _mm256_extracti128_si256 (in, 1));
+		outbuf += 24;
+		inptr += 32;
+	}
+	
+	/* likewise, finish off with 16-byte blocks without leaving AVX */
+	if (inlen - (inptr - inbuf) >= 16) {
+		__m128i last = _mm_loadu_si128 ((const __m128i *) inptr);
+		
+		if (base64_decode_translate_sse41 (&last)) {
+			base64_store12_sse41 (outbuf, base64_decode_pack_sse41 (last));
+			inptr += 16;
+		}
+	}
+	
+	return inptr - inbuf;
+}
+
+static Base64EncodeFunc
+base64_encode_func (void)
+{
+	if (g_mime_simd_has (GMIME_SIMD_AVX2))
+		return base64_encode_avx2;
+	
+	if (g_mime_simd_has (GMIME_SIMD_SSE4_1))
+		return base64_encode_sse41;
+	
+	return NULL;
+}
+
+static Base64DecodeFunc
+base64_decode_func (void)
+{
+	if (g_mime_simd_has (GMIME_SIMD_AVX2))
+		return base64_decode_avx2;
+	
+	if (g_mime_simd_has (GMIME_SIMD_SSE4_1))
+		return base64_decode_sse41;
+	
+	return NULL;
+}
+#endif /* GMIME_X86_SIMD */
+
+
+/* Vectorized quoted-printable kernels.
+ *
+ * Most quoted-printable text is made up of long runs of characters
+ * that pass through unchanged. These copy such a run to the output
+ * and return its length, leaving '=', line endings, whitespace that
+ * ends up at the end of a line and the soft line break limit to the
+ * byte-at-a-time loops. */
+#ifdef GMIME_X86_SIMD
+typedef size_t (* QpCopyFunc) (const unsigned char *inbuf, size_t inlen, unsigned char *outbuf);
+
+/* the characters the encoder copies as they are, same as is_qpsafe() */
+GMIME_TARGET ("sse2") static inline unsigned int
+qp_encode_safe_sse2 (__m128i in)
+{
+	__m128i safe;
+	
+	safe = _mm_and_si128 (_mm_cmpgt_epi8 (in, _mm_set1_epi8 (31)), _mm_cmplt_epi8 (in, _mm_set1_epi8 (127)));
+	safe = _mm_andnot_si128 (_mm_cmpeq_epi8 (in, _mm_set1_epi8 ('=')), safe);
+	safe = _mm_or_si128 (safe, _mm_cmpeq_epi8 (in, _mm_set1_epi8 ('\t')));
+	
+	return _mm_movemask_epi8 (safe);
+}
+
+/* the characters the decoder copies as they are */
+GMIME_TARGET ("sse2") static inline unsigned int
+qp_decode_safe_sse2 (__m128i in)
+{
+	return _mm_movemask_epi8 (_mm_cmpeq_epi8 (in, _mm_set1_epi8 ('='))) ^ 0xffff;
+}
+
+/* copies 16 bytes at a time up to the first character that needs
+ * attention, then finishes off the run a byte at a time.
+ *
+ * Whole vectors are stored even when only part of them is safe: the
+ * decoder never writes more than it has read, and the encoder's
+ * output buffer is at least three times the size of its input, so
+ * this never goes past the end of @outptr, and the step functions
+ * overwrite whatever follows the run. */
+GMIME_TARGET ("sse2") static inline size_t
+qp_copy_sse2 (const unsigned char *inbuf, const unsigned char *inptr, size_t inlen, unsigned char *outptr, gboolean decode)
+{
+	const unsigned char *inend = inbuf + inlen;
+	unsigned int safe;
+	__m128i in;
+	
+	while (inend - inptr >= 16) {
+		in = _mm_loadu_si128 ((const __m128i *) inptr);
+		safe = decode ? qp_decode_safe_sse2 (in) : qp_encode_safe_sse2 (in);
+		_mm_storeu_si128 ((__m128i *) outptr, in);
+		
+		if (safe != 0xffff)
+			return (inptr - inbuf) + __builtin_ctz (~safe);
+		
+		outptr += 16;
+		inptr += 16;
+	}
+	
+	while (inptr < inend && (decode ? *inptr != '=' : is_qpsafe (*inptr)))
+		*outptr++ = *inptr++;
+	
+	return inptr - inbuf;
+}
+
+GMIME_TARGET ("sse2") static size_t
+qp_encode_copy_sse2 (const unsigned char *inbuf, size_t inlen, unsigned char *outbuf)
+{
+	return qp_copy_sse2 (inbuf, inbuf, inlen, outbuf, FALSE);
+}
+
+GMIME_TARGET ("sse2") static size_t
+qp_decode_copy_sse2 (const unsigned char *inbuf, size_t inlen, unsigned char *outbuf)
+{
+	return qp_copy_sse2 (inbuf, inbuf, inlen, outbuf, TRUE);
+}
+
+GMIME_TARGET ("avx2") static inline unsigned int
+qp_encode_safe_avx2 (__m256i in)
+{
+	__m256i safe;
+	
+	safe = _mm256_and_si256 (_mm256_cmpgt_epi8 (in, _mm256_set1_epi8 (31)), _mm256_cmpgt_epi8 (_mm256_set1_epi8 (127), in));
+	safe = _mm256_andnot_si256 (_mm256_cmpeq_epi8 (in, _mm256_set1_epi8 ('=')), safe);
+	safe = _mm256_or_si256 (safe, _mm256_cmpeq_epi8 (in, _mm256_set1_epi8 ('\t')));
+	
+	return (unsigned int) _mm256_movemask_epi8 (safe);
+}
+
+GMIME_TARGET ("avx2") static inline unsigned int
+qp_decode_safe_avx2 (__m256i in)
+{
+	return ~(unsigned int) _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (in, _mm256_set1_epi8 ('=')));
+}
+
+GMIME_TARGET ("avx2") static inline size_t
+qp_copy_avx2 (const unsigned char *inbuf, size_t inlen, unsigned char *outbuf, gboolean decode)
+{
+	const unsigned char *inptr = inbuf;
+	unsigned int safe;
+	__m256i in;
+	
+	while (inlen - (inptr - inbuf) >= 32) {
+		in = _mm256_loadu_si256 ((const __m256i *) inptr);
+		
+		safe = decode ? qp_decode_safe_avx2 (in) : qp_encode_safe_avx2 (in);
+		_mm256_storeu_si256 ((__m256i *) outbuf, in);
+		
+		if (safe != 0xffffffff)
+			return (inptr - inbuf) + __builtin_ctz (~safe);
+		
+		outbuf += 32;
+		inptr += 32;
+	}
+	
+	/* inlined rather than called so that it gets the VEX encoding */
+	return qp_copy_sse2 (inbuf, inptr, inlen, outbuf, decode);
+}
+
+GMIME_TARGET ("avx2") static size_t
+qp_encode_copy_avx2 (const unsigned char *inbuf, size_t inlen, unsigned char *outbuf)
+{
+	return qp_copy_avx2 (inbuf, inlen, outbuf, FALSE);
+}
+
+GMIME_TARGET ("avx2") static size_t
+qp_decode_copy_avx2 (const unsigned char *inbuf, size_t inlen, unsigned char *outbuf)
+{
+	return qp_copy_avx2 (inbuf, inlen, outbuf, TRUE);
+}
+
+static QpCopyFunc
+qp_encode_func (void)
+{
+	if (g_mime_simd_has (GMIME_SIMD_AVX2))
+		return qp_encode_copy_avx2;
+	
+	if (g_mime_simd_has (GMIME_SIMD_SSE2))
+		return qp_encode_copy_sse2;
+	
+	return NULL;
+}
+
+static QpCopyFunc
+qp_decode_func (void)
+{
+	if (g_mime_simd_has (GMIME_SIMD_AVX2))
+		return qp_decode_copy_avx2;
+	
+	if (g_mime_simd_has (GMIME_SIMD_SSE2))
+		return qp_decode_copy_sse2;
+	
+	return NULL;
+}
+#endif /* GMIME_X86_SIMD */
+
+
 /**
  * g_mime_content_encoding_from_string:
  * @str: a string representing a Content-Transfer-Encoding value
@@ -386,6 +791,7 @@ g_mime_encoding_base64_encode_close (const unsigned char *inbuf, size_t inlen, u
 		goto skip;
 	case 1:
 		outptr[2] = '=';
+		c2 = 0; /* save[2] may be left over from an earlier step */
 	skip:
 		outptr[0] = base64_alphabet [c1 >> 2];
 		outptr[1] = base64_alphabet [c2 >> 4 | ((c1 & 0x3) << 4)];
@@ -423,6 +829,10 @@ g_mime_encoding_base64_encode_step (const unsigned char *inbuf, size_t inlen, un
 {
 	register const unsigned char *inptr;
 	register unsigned char *outptr;
+#ifdef GMIME_X86_SIMD
+	Base64EncodeFunc encode_blocks = base64_encode_func ();
+	size_t nblocks;
+#endif
 	
 	if (inlen == 0)
 		return 0;
@@ -445,6 +855,24 @@ g_mime_encoding_base64_encode_step (const unsigned char *inbuf, size_t inlen, un
 		
 		/* yes, we jump into the loop, no i'm not going to change it, its beautiful! */
 		while (inptr < inend) {
+#ifdef GMIME_X86_SIMD
+			/* encode as many whole blocks as fit on this line */
+			if (encode_blocks != NULL && already <= 15 &&
+			    (size_t) ((inend + 2) - inptr) >= 12 + BASE64_ENCODE_OVERHANG) {
+				nblocks = MIN ((size_t) (19 - already) / 4, (size_t) ((inend + 2) - inptr - BASE64_ENCODE_OVERHANG) / 12);
+				encode_blocks (inptr, nblocks, outptr);
+				inptr += nblocks * 12;
+				outptr += nblocks * 16;
+				already += nblocks * 4;
+				
+				if (already >= 19) {
+					*outptr++ = '\n';
+					already = 0;
+				}
+				
+				continue;
+			}
+#endif
 			c1 = *inptr++;
 		skip1:
 			c2 = *inptr++;
@@ -513,6 +941,11 @@ g_mime_encoding_base64_decode_step (const unsigned char *inbuf, size_t inlen, un
 	register guint32 saved;
 	unsigned char c;
 	int npad, n, i;
+#ifdef GMIME_X86_SIMD
+	Base64DecodeFunc decode_blocks = base64_decode_func ();
+	gboolean vectorize = TRUE;
+	size_t nread;
+#endif
 	
 	inend = inbuf + inlen;
 	outptr = outbuf;
@@ -524,6 +957,18 @@ g_mime_encoding_base64_decode_step (const unsigned char *inbuf, size_t inlen, un
 	
 	/* convert 4 base64 bytes to 3 normal bytes */
 	while (inptr < inend) {
+#ifdef GMIME_X86_SIMD
+		/* decode whole blocks until one contains a non-base64
+		 * character, then leave the rest of that block to the
+		 * loop below until it gets past that character */
+		if (decode_blocks != NULL && vectorize && n == 0 && npad == 0 && inend - inptr >= 16) {
+			nread = decode_blocks (inptr, inend - inptr, outptr);
+			outptr += (nread / 16) * 12;
+			inptr += nread;
+			vectorize = FALSE;
+			continue;
+		}
+#endif
 		c = gmime_base64_rank[*inptr++];
 		if (c != 0xff) {
 			saved = (saved << 6) | c;
@@ -540,6 +985,11 @@ g_mime_encoding_base64_decode_step (const unsigned char *inbuf, size_t inlen, un
 				}
 			}
 		}
+#ifdef GMIME_X86_SIMD
+		else {
+			vectorize = TRUE;
+		}
+#endif
 	}
 	
 	/* quickly scan back for '=' on the end somewhere */
@@ -946,8 +1396,28 @@ g_mime_encoding_quoted_encode_step (const unsigned char *inbuf, size_t inlen, un
 	register guint32 sofar = *save;  /* keeps track of how many chars on a line */
 	register int last = *state;  /* keeps track if last char to end was a space cr etc */
 	unsigned char c;
+#ifdef GMIME_X86_SIMD
+	QpCopyFunc copy_safe = qp_encode_func ();
+	size_t n;
+#endif
 	
 	while (inptr < inend) {
+#ifdef GMIME_X86_SIMD
+		/* copy as much as fits on this line as-is, except for
+		 * trailing whitespace which may have to be encoded */
+		if (copy_safe != NULL && last == -1 && sofar < 75 && inend - inptr >= 16) {
+			n = copy_safe (inptr, MIN ((size_t) (inend - inptr), 75 - sofar), outptr);
+			while (n > 0 && is_blank (inptr[n - 1]))
+				n--;
+			
+			inptr += n;
+			outptr += n;
+			sofar += n;
+			
+			if (inptr == inend)
+				break;
+		}
+#endif
 		c = *inptr++;
 		if (c == '\r') {
 			if (last != -1) {
@@ -1046,12 +1516,24 @@ g_mime_encoding_quoted_decode_step (const unsigned char *inbuf, size_t inlen, un
 	guint32 isave = *save;
 	int istate = *state;
 	unsigned char c;
+#ifdef GMIME_X86_SIMD
+	QpCopyFunc copy_plain = qp_decode_func ();
+	size_t n;
+#endif
 	
 	d(printf ("quoted-printable, decoding text '%.*s'\n", inlen, inbuf));
 	
 	while (inptr < inend) {
 		switch (istate) {
 		case 0:
+#ifdef GMIME_X86_SIMD
+			/* copy everything up to the next '=' */
+			if (copy_plain != NULL && inend - inptr >= 16) {
+				n = copy_plain (inptr, inend - inptr, outptr);
+				inptr += n;
+				outptr += n;
+			}
+#endif
 			while (inptr < inend) {
 				c = *inptr++;
 				/* FIXME: use a specials table to avoid 3 comparisons for the common case */
@@ -26,6 +26,11 @@
 #include <string.h>
 
 #include "gmime-filter-best.h"
+#include "gmime-simd.h"
+
+#ifdef GMIME_X86_SIMD
+#include <immintrin.h>
+#endif
 
 
 /**
@@ -117,13 +122,111 @@ filter_copy (GMimeFilter *filter)
 	return g_mime_filter_best_new (best->flags);
 }
 
+/* Vectorized nul and 8bit byte counters.
+ *
+ * Most of what goes through the filter is plain US-ASCII, so a block
+ * without any nul or 8bit bytes costs no more than a compare and a
+ * test; the counts are only worked out for the blocks that have some. */
+#ifdef GMIME_X86_SIMD
+typedef size_t (* CountFunc) (const unsigned char *inbuf, size_t inlen, unsigned int *count0, unsigned int *count8);
+
+GMIME_TARGET ("sse2") static inline size_t
+count_sse2_inline (const unsigned char *inbuf, size_t inlen, unsigned int *count0, unsigned int *count8)
+{
+	const __m128i zero = _mm_setzero_si128 ();
+	const unsigned char *inptr = inbuf;
+	unsigned int nul, high;
+	__m128i in;
+	
+	while (inlen - (inptr - inbuf) >= 16) {
+		in = _mm_loadu_si128 ((const __m128i *) inptr);
+		high = _mm_movemask_epi8 (in);
+		nul = _mm_movemask_epi8 (_mm_cmpeq_epi8 (in, zero));
+		
+		if ((high | nul) != 0) {
+			*count8 += __builtin_popcount (high);
+			*count0 += __builtin_popcount (nul);
+		}
+		
+		inptr += 16;
+	}
+	
+	return inptr - inbuf;
+}
+
+GMIME_TARGET ("sse2") static size_t
+count_sse2 (const unsigned char *inbuf, size_t inlen, unsigned int *count0, unsigned int *count8)
+{
+	return count_sse2_inline (inbuf, inlen, count0, count8);
+}
+
+GMIME_TARGET ("avx2") static size_t
+count_avx2 (const unsigned char *inbuf, size_t inlen, unsigned int *count0, unsigned int *count8)
+{
+	const __m256i zero = _mm256_setzero_si256 ();
+	const unsigned char *inptr = inbuf;
+	unsigned int nul, high;
+	__m256i in;
+	
+	while (inlen - (inptr - inbuf) >= 32) {
+		in = _mm256_loadu_si256 ((const __m256i *) inptr);
+		high = (unsigned int) _mm256_movemask_epi8 (in);
+		nul = (unsigned int) _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (in, zero));
+		
+		if ((high | nul) != 0) {
+			*count8 += __builtin_popcount (high);
+			*count0 += __builtin_popcount (nul);
+		}
+		
+		inptr += 32;
+	}
+	
+	/* inlined rather than called so that it gets the VEX encoding */
+	return (inptr - inbuf) + count_sse2_inline (inptr, inlen - (inptr - inbuf), count0, count8);
+}
+
+static CountFunc
+count_func (void)
+{
+	if (g_mime_simd_has (GMIME_SIMD_AVX2))
+		return count_avx2;
+	
+	if (g_mime_simd_has (GMIME_SIMD_SSE2))
+		return count_sse2;
+	
+	return NULL;
+}
+#endif /* GMIME_X86_SIMD */
+
+static void
+count_nul_8bit (GMimeFilterBest *best, const unsigned char *inbuf, size_t inlen)
+{
+	const unsigned char *inptr = inbuf;
+	const unsigned char *inend = inbuf + inlen;
+#ifdef GMIME_X86_SIMD
+	CountFunc count = count_func ();
+	
+	if (count != NULL)
+		inptr += count (inbuf, inlen, &best->count0, &best->count8);
+#endif
+	
+	while (inptr < inend) {
+		if (*inptr == 0)
+			best->count0++;
+		else if (*inptr & 0x80)
+			best->count8++;
+		
+		inptr++;
+	}
+}
+
 static void
 filter_filter (GMimeFilter *filter, char *inbuf, size_t inlen, size_t prespace,
 	       char **outbuf, size_t *outlen, size_t *outprespace)
 {
 	GMimeFilterBest *best = (GMimeFilterBest *) filter;
 	register unsigned char *inptr, *inend;
-	register unsigned char c;
+	unsigned char *lf;
 	size_t left;
 	
 	if (best->flags & GMIME_FILTER_BEST_CHARSET)
@@ -135,27 +238,24 @@ filter_filter (GMimeFilter *filter, char *inbuf, size_t inlen, size_t prespace,
 		inptr = (unsigned char *) inbuf;
 		inend = inptr + inlen;
 		
+		/* the only bytes that don't get looked at one line at a
+		 * time below are those of a "From " at the start of a
+		 * line, which are neither nul nor 8bit, so the whole
+		 * buffer can be counted in one go */
+		count_nul_8bit (best, inptr, inlen);
+		
 		while (inptr < inend) {
-			c = 0;
-			
 			if (best->midline) {
-				while (inptr < inend && (c = *inptr++) != '\n') {
-					if (c == 0)
-						best->count0++;
-					else if (c & 0x80)
-						best->count8++;
-					
-					if (best->fromlen > 0 && best->fromlen < 5)
-						best->frombuf[best->fromlen++] = c & 0xff;
-					
-					best->linelen++;
-				}
-				
-				if (c == '\n') {
+				if ((lf = memchr (inptr, '\n', inend - inptr))) {
+					best->linelen += lf - inptr;
 					best->maxline = MAX (best->maxline, best->linelen);
 					best->startline = TRUE;
 					best->midline = FALSE;
 					best->linelen = 0;
+					inptr = lf + 1;
+				} else {
+					best->linelen += inend - inptr;
+					inptr = inend;
 				}
 			}
 			
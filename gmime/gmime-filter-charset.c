@@ -26,6 +26,7 @@
 #include <errno.h>
 
 #include "gmime-filter-charset.h"
+#include "gmime-charset-table.h"
 #include "gmime-charset.h"
 #include "gmime-iconv.h"
 
@@ -55,6 +56,10 @@ static void filter_reset (GMimeFilter *filter);
 
 static GMimeFilterClass *parent_class = NULL;
 
+/* key of the built-in table a filter converts with instead of iconv;
+ * the GMimeFilterCharset struct is public and has no room for it */
+static GQuark table_quark = 0;
+
 
 GType
 g_mime_filter_charset_get_type (void)
@@ -95,6 +100,8 @@ g_mime_filter_charset_class_init (GMimeFilterCharsetClass *klass)
 	filter_class->filter = filter_filter;
 	filter_class->complete = filter_complete;
 	filter_class->reset = filter_reset;
+	
+	table_quark = g_quark_from_static_string ("gmime-charset-table");
 }
 
 static void
@@ -133,10 +140,13 @@ filter_filter (GMimeFilter *filter, char *in, size_t len, size_t prespace,
 {
 	GMimeFilterCharset *charset = (GMimeFilterCharset *) filter;
 	size_t inleft, outleft, converted = 0;
+	const guint16 *table;
 	char *inbuf;
 	char *outbuf;
 	
-	if (charset->cd == (iconv_t) -1)
+	table = g_object_get_qdata ((GObject *) filter, table_quark);
+	
+	if (charset->cd == (iconv_t) -1 && table == NULL)
 		goto noop;
 	
 	g_mime_filter_set_size (filter, len * 5 + 16, FALSE);
@@ -147,7 +157,11 @@ filter_filter (GMimeFilter *filter, char *in, size_t len, size_t prespace,
 	inleft = len;
 	
 	do {
-		converted = iconv (charset->cd, (ICONV_CONST char **) &inbuf, &inleft, (ICONV_CONST char **) &outbuf, &outleft);
+		if (table != NULL)
+			converted = g_mime_charset_table_convert (table, (const char **) &inbuf, &inleft, &outbuf, &outleft);
+		else
+			converted = iconv (charset->cd, (ICONV_CONST char **) &inbuf, &inleft, (ICONV_CONST char **) &outbuf, &outleft);
+		
 		if (converted == (size_t) -1) {
 			if (errno == E2BIG || errno == EINVAL)
 				break;
@@ -200,10 +214,13 @@ filter_complete (GMimeFilter *filter, char *in, size_t len, size_t prespace,
 {
 	GMimeFilterCharset *charset = (GMimeFilterCharset *) filter;
 	size_t inleft, outleft, converted = 0;
+	const guint16 *table;
 	char *inbuf;
 	char *outbuf;
 	
-	if (charset->cd == (iconv_t) -1)
+	table = g_object_get_qdata ((GObject *) filter, table_quark);
+	
+	if (charset->cd == (iconv_t) -1 && table == NULL)
 		goto noop;
 	
 	g_mime_filter_set_size (filter, len * 5 + 16, FALSE);
@@ -215,7 +232,11 @@ filter_complete (GMimeFilter *filter, char *in, size_t len, size_t prespace,
 	
 	if (inleft > 0) {
 		do {
-			converted = iconv (charset->cd, (ICONV_CONST char **) &inbuf, &inleft, (ICONV_CONST char **) &outbuf, &outleft);
+			if (table != NULL)
+				converted = g_mime_charset_table_convert (table, (const char **) &inbuf, &inleft, &outbuf, &outleft);
+			else
+				converted = iconv (charset->cd, (ICONV_CONST char **) &inbuf, &inleft, (ICONV_CONST char **) &outbuf, &outleft);
+			
 			if (converted != (size_t) -1)
 				continue;
 			
@@ -258,7 +279,7 @@ filter_complete (GMimeFilter *filter, char *in, size_t len, size_t prespace,
 	}
 	
 	/* flush the iconv conversion */
-	while (iconv (charset->cd, NULL, NULL, &outbuf, &outleft) == (size_t) -1) {
+	while (table == NULL && iconv (charset->cd, NULL, NULL, &outbuf, &outleft) == (size_t) -1) {
 		if (errno != E2BIG)
 			break;
 		
@@ -304,17 +325,25 @@ filter_reset (GMimeFilter *filter)
 GMimeFilter *
 g_mime_filter_charset_new (const char *from_charset, const char *to_charset)
 {
+	iconv_t cd = (iconv_t) -1;
 	GMimeFilterCharset *new;
-	iconv_t cd;
+	const guint16 *table;
 	
-	cd = g_mime_iconv_open (to_charset, from_charset);
-	if (cd == (iconv_t) -1)
-		return NULL;
+	/* the common 8bit charsets are converted to UTF-8 with a
+	 * built-in table rather than with iconv */
+	if ((table = g_mime_charset_table_lookup (to_charset, from_charset)) == NULL) {
+		cd = g_mime_iconv_open (to_charset, from_charset);
+		if (cd == (iconv_t) -1)
+			return NULL;
+	}
 	
 	new = g_object_newv (GMIME_TYPE_FILTER_CHARSET, 0, NULL);
 	new->from_charset = g_strdup (from_charset);
 	new->to_charset = g_strdup (to_charset);
 	new->cd = cd;
 	
+	if (table != NULL)
+		g_object_set_qdata ((GObject *) new, table_quark, (gpointer) table);
+	
 	return (GMimeFilter *) new;
 }
@@ -24,6 +24,7 @@
 #endif
 
 #include "gmime-filter-crlf.h"
+#include "gmime-filter-private.h"
 
 
 /**
@@ -121,7 +122,8 @@ filter_filter (GMimeFilter *filter, char *inbuf, size_t inlen, size_t prespace,
 	GMimeFilterCRLF *crlf = (GMimeFilterCRLF *) filter;
 	register const char *inptr = inbuf;
 	const char *inend = inbuf + inlen;
-	char *outptr;
+	char *outptr, *outstart;
+	size_t outpre;
 	
 	if (crlf->encode) {
 		g_mime_filter_set_size (filter, 3 * inlen, FALSE);
@@ -145,10 +147,24 @@ filter_filter (GMimeFilter *filter, char *inbuf, size_t inlen, size_t prespace,
 			
 			*outptr++ = *inptr++;
 		}
+		
+		outstart = filter->outbuf;
+		outpre = filter->outpre;
 	} else {
-		g_mime_filter_set_size (filter, inlen + 1, FALSE);
+		/* decoding never produces more than it consumes, except
+		 * for a '\r' left pending by the previous buffer, so when
+		 * allowed we decode in place (using a byte of prespace for
+		 * the pending '\r') instead of copying */
+		if (g_mime_filter_input_writable (filter) && (!crlf->saw_cr || prespace > 0)) {
+			outstart = crlf->saw_cr ? inbuf - 1 : inbuf;
+			outpre = crlf->saw_cr ? prespace - 1 : prespace;
+		} else {
+			g_mime_filter_set_size (filter, inlen + 1, FALSE);
+			outstart = filter->outbuf;
+			outpre = filter->outpre;
+		}
 		
-		outptr = filter->outbuf;
+		outptr = outstart;
 		while (inptr < inend) {
 			if (*inptr == '\r') {
 				crlf->saw_dot = FALSE;
@@ -183,9 +199,9 @@ filter_filter (GMimeFilter *filter, char *inbuf, size_t inlen, size_t prespace,
 		}
 	}
 	
-	*outlen = outptr - filter->outbuf;
-	*outprespace = filter->outpre;
-	*outbuf = filter->outbuf;
+	*outlen = outptr - outstart;
+	*outprespace = outpre;
+	*outbuf = outstart;
 }
 
 static void 
@@ -0,0 +1,46 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*  GMime
+ *  Copyright (C) 2000-2014 Jeffrey Stedfast
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301, USA.
+ */
+
+
+#ifndef __GMIME_FILTER_PRIVATE_H__
+#define __GMIME_FILTER_PRIVATE_H__
+
+#include <gmime/gmime-filter.h>
+
+G_BEGIN_DECLS
+
+/* Buffer-passing protocol used by GMimeStreamFilter: the caller says
+ * whether the filter may modify the input buffer it is handed and
+ * learns whether it may in turn modify the output, so that filters
+ * which never grow their input can work in place rather than copy
+ * into their own output buffer. */
+G_GNUC_INTERNAL gboolean g_mime_filter_filter_writable (GMimeFilter *filter, char *inbuf, size_t inlen, size_t prespace,
+							char **outbuf, size_t *outlen, size_t *outprespace,
+							gboolean writable);
+
+G_GNUC_INTERNAL gboolean g_mime_filter_complete_writable (GMimeFilter *filter, char *inbuf, size_t inlen, size_t prespace,
+							  char **outbuf, size_t *outlen, size_t *outprespace,
+							  gboolean writable);
+
+G_GNUC_INTERNAL gboolean g_mime_filter_input_writable (GMimeFilter *filter);
+
+G_END_DECLS
+
+#endif /* __GMIME_FILTER_PRIVATE_H__ */
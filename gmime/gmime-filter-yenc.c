@@ -26,6 +26,11 @@
 #include <string.h>
 
 #include "gmime-filter-yenc.h"
+#include "gmime-simd.h"
+
+#ifdef GMIME_X86_SIMD
+#include <immintrin.h>
+#endif
 
 
 /**
@@ -422,6 +427,331 @@ static const int yenc_crc_table[256] = {
 
 #define YENC_NEWLINE_ESCAPE (GMIME_YDECODE_STATE_EOLN | GMIME_YDECODE_STATE_ESCAPE)
 
+/* yEnc lines are wrapped once they reach this many characters */
+#define YENC_LINE_LENGTH 128
+
+
+/* CRC32 of whole buffers.
+ *
+ * The portable code is the slice-by-8 algorithm, which looks up 8
+ * bytes at a time in 8 tables derived from yenc_crc_table. Where the
+ * cpu has carry-less multiplication, 64 bytes at a time are folded
+ * together instead, following Intel's "Fast CRC Computation for
+ * Generic Polynomials Using PCLMULQDQ Instruction". Either way, the
+ * result is the same as that of yenc_crc_add() for every byte. */
+static guint32 yenc_crc_slices[8][256];
+
+static void
+yenc_crc_slices_init (void)
+{
+	static gsize initialized = 0;
+	guint32 crc;
+	int i, j;
+	
+	if (!g_once_init_enter (&initialized))
+		return;
+	
+	for (i = 0; i < 256; i++) {
+		crc = yenc_crc_slices[0][i] = (guint32) yenc_crc_table[i];
+		for (j = 1; j < 8; j++) {
+			crc = (crc >> 8) ^ (guint32) yenc_crc_table[crc & 0xff];
+			yenc_crc_slices[j][i] = crc;
+		}
+	}
+	
+	g_once_init_leave (&initialized, 1);
+}
+
+#ifdef GMIME_X86_SIMD
+/* folds @inlen bytes, which must be a multiple of 16 and at least 64,
+ * into @crc */
+GMIME_TARGET ("sse4.1,pclmul") static guint32
+yenc_crc_update_pclmul (guint32 crc, const unsigned char *inbuf, size_t inlen)
+{
+	const __m128i k1k2 = _mm_set_epi64x (0x01c6e41596, 0x0154442bd4);
+	const __m128i k3k4 = _mm_set_epi64x (0x00ccaa009e, 0x01751997d0);
+	const __m128i k5k0 = _mm_set_epi64x (0x0000000000, 0x0163cd6124);
+	const __m128i poly = _mm_set_epi64x (0x01f7011641, 0x01db710641);
+	const __m128i mask32 = _mm_setr_epi32 (~0, 0, ~0, 0);
+	__m128i x1, x2, x3, x4, t1, t2, t3, t4;
+	
+	x1 = _mm_xor_si128 (_mm_loadu_si128 ((const __m128i *) inbuf), _mm_cvtsi32_si128 (crc));
+	x2 = _mm_loadu_si128 ((const __m128i *) (inbuf + 16));
+	x3 = _mm_loadu_si128 ((const __m128i *) (inbuf + 32));
+	x4 = _mm_loadu_si128 ((const __m128i *) (inbuf + 48));
+	inbuf += 64;
+	inlen -= 64;
+	
+	/* fold 4 lanes in parallel */
+	while (inlen >= 64) {
+		t1 = _mm_clmulepi64_si128 (x1, k1k2, 0x00);
+		t2 = _mm_clmulepi64_si128 (x2, k1k2, 0x00);
+		t3 = _mm_clmulepi64_si128 (x3, k1k2, 0x00);
+		t4 = _mm_clmulepi64_si128 (x4, k1k2, 0x00);
+		
+		x1 = _mm_xor_si128 (_mm_clmulepi64_si128 (x1, k1k2, 0x11), t1);
+		x2 = _mm_xor_si128 (_mm_clmulepi64_si128 (x2, k1k2, 0x11), t2);
+		x3 = _mm_xor_si128 (_mm_clmulepi64_si128 (x3, k1k2, 0x11), t3);
+		x4 = _mm_xor_si128 (_mm_clmulepi64_si128 (x4, k1k2, 0x11), t4);
+		
+		x1 = _mm_xor_si128 (x1, _mm_loadu_si128 ((const __m128i *) inbuf));
+		x2 = _mm_xor_si128 (x2, _mm_loadu_si128 ((const __m128i *) (inbuf + 16)));
+		x3 = _mm_xor_si128 (x3, _mm_loadu_si128 ((const __m128i *) (inbuf + 32)));
+		x4 = _mm_xor_si128 (x4, _mm_loadu_si128 ((const __m128i *) (inbuf + 48)));
+		
+		inbuf += 64;
+		inlen -= 64;
+	}
+	
+	/* fold the 4 lanes into one */
+	t1 = _mm_clmulepi64_si128 (x1, k3k4, 0x00);
+	x1 = _mm_xor_si128 (_mm_xor_si128 (_mm_clmulepi64_si128 (x1, k3k4, 0x11), x2), t1);
+	t1 = _mm_clmulepi64_si128 (x1, k3k4, 0x00);
+	x1 = _mm_xor_si128 (_mm_xor_si128 (_mm_clmulepi64_si128 (x1, k3k4, 0x11), x3), t1);
+	t1 = _mm_clmulepi64_si128 (x1, k3k4, 0x00);
+	x1 = _mm_xor_si128 (_mm_xor_si128 (_mm_clmulepi64_si128 (x1, k3k4, 0x11), x4), t1);
+	
+	while (inlen >= 16) {
+		t1 = _mm_clmulepi64_si128 (x1, k3k4, 0x00);
+		x1 = _mm_xor_si128 (_mm_clmulepi64_si128 (x1, k3k4, 0x11), _mm_loadu_si128 ((const __m128i *) inbuf));
+		x1 = _mm_xor_si128 (x1, t1);
+		inbuf += 16;
+		inlen -= 16;
+	}
+	
+	/* reduce 128 bits to 64... */
+	t1 = _mm_clmulepi64_si128 (x1, k3k4, 0x10);
+	x1 = _mm_xor_si128 (_mm_srli_si128 (x1, 8), t1);
+	t1 = _mm_srli_si128 (x1, 4);
+	x1 = _mm_clmulepi64_si128 (_mm_and_si128 (x1, mask32), k5k0, 0x00);
+	x1 = _mm_xor_si128 (x1, t1);
+	
+	/* ...and then to 32 with a Barrett reduction */
+	t1 = _mm_clmulepi64_si128 (_mm_and_si128 (x1, mask32), poly, 0x10);
+	t1 = _mm_clmulepi64_si128 (_mm_and_si128 (t1, mask32), poly, 0x00);
+	x1 = _mm_xor_si128 (x1, t1);
+	
+	return (guint32) _mm_extract_epi32 (x1, 1);
+}
+#endif /* GMIME_X86_SIMD */
+
+static guint32
+yenc_crc_update (guint32 crc, const unsigned char *inbuf, size_t inlen)
+{
+	const unsigned char *inptr = inbuf;
+	const unsigned char *inend = inbuf + inlen;
+	guint32 lo, hi;
+	
+#ifdef GMIME_X86_SIMD
+	if (inlen >= 64 && g_mime_simd_has (GMIME_SIMD_SSE4_1 | GMIME_SIMD_PCLMUL)) {
+		crc = yenc_crc_update_pclmul (crc, inptr, inlen & ~((size_t) 15));
+		inptr += inlen & ~((size_t) 15);
+	}
+#endif
+	
+	if (inend - inptr >= 8) {
+		yenc_crc_slices_init ();
+		
+		do {
+			memcpy (&lo, inptr, 4);
+			memcpy (&hi, inptr + 4, 4);
+			lo = GUINT32_FROM_LE (lo) ^ crc;
+			hi = GUINT32_FROM_LE (hi);
+			
+			crc = yenc_crc_slices[7][lo & 0xff] ^ yenc_crc_slices[6][(lo >> 8) & 0xff] ^
+				yenc_crc_slices[5][(lo >> 16) & 0xff] ^ yenc_crc_slices[4][lo >> 24] ^
+				yenc_crc_slices[3][hi & 0xff] ^ yenc_crc_slices[2][(hi >> 8) & 0xff] ^
+				yenc_crc_slices[1][(hi >> 16) & 0xff] ^ yenc_crc_slices[0][hi >> 24];
+			
+			inptr += 8;
+		} while (inend - inptr >= 8);
+	}
+	
+	while (inptr < inend)
+		crc = yenc_crc_add (crc, *inptr++);
+	
+	return crc;
+}
+
+/* adds @inbuf to both the part and the combined crc, which are usually
+ * the same when only a single part is being encoded or decoded */
+static void
+yenc_crc_update2 (guint32 *pcrc, guint32 *crc, const unsigned char *inbuf, size_t inlen)
+{
+	if (*pcrc == *crc) {
+		*pcrc = *crc = yenc_crc_update (*crc, inbuf, inlen);
+	} else {
+		*pcrc = yenc_crc_update (*pcrc, inbuf, inlen);
+		*crc = yenc_crc_update (*crc, inbuf, inlen);
+	}
+}
+
+
+/* Vectorized yEnc kernels.
+ *
+ * Almost every byte of yEncoded data is just the input byte plus 42,
+ * so these translate and copy runs of bytes 16 or 32 at a time and
+ * return the length of the run, leaving the escapes, line endings and
+ * the =yend line to the byte-at-a-time loops.
+ *
+ * Whole vectors are stored even when only part of them belongs to the
+ * run: the decoder never writes more than it reads, and the encoder
+ * writes at least one byte for each byte that is still to come, so
+ * the step functions overwrite the rest. */
+#ifdef GMIME_X86_SIMD
+typedef size_t (* YencCopyFunc) (const unsigned char *inbuf, size_t inlen, unsigned char *outbuf);
+
+/* the encoded characters that have to be escaped */
+GMIME_TARGET ("sse2") static inline unsigned int
+yencode_special_sse2 (__m128i out)
+{
+	__m128i special;
+	
+	special = _mm_or_si128 (_mm_cmpeq_epi8 (out, _mm_setzero_si128 ()), _mm_cmpeq_epi8 (out, _mm_set1_epi8 ('\t')));
+	special = _mm_or_si128 (special, _mm_cmpeq_epi8 (out, _mm_set1_epi8 ('\r')));
+	special = _mm_or_si128 (special, _mm_cmpeq_epi8 (out, _mm_set1_epi8 ('\n')));
+	special = _mm_or_si128 (special, _mm_cmpeq_epi8 (out, _mm_set1_epi8 ('=')));
+	
+	return _mm_movemask_epi8 (special);
+}
+
+/* the characters that interrupt a run of ydecoding */
+GMIME_TARGET ("sse2") static inline unsigned int
+ydecode_special_sse2 (__m128i in)
+{
+	return _mm_movemask_epi8 (_mm_or_si128 (_mm_cmpeq_epi8 (in, _mm_set1_epi8 ('\n')),
+						_mm_cmpeq_epi8 (in, _mm_set1_epi8 ('='))));
+}
+
+GMIME_TARGET ("sse2") static inline size_t
+yenc_copy_sse2 (const unsigned char *inbuf, const unsigned char *inptr, size_t inlen, unsigned char *outptr, gboolean decode)
+{
+	const unsigned char *inend = inbuf + inlen;
+	unsigned int special;
+	unsigned char c;
+	__m128i out;
+	
+	while (inend - inptr >= 16) {
+		out = _mm_loadu_si128 ((const __m128i *) inptr);
+		if (decode) {
+			special = ydecode_special_sse2 (out);
+			out = _mm_sub_epi8 (out, _mm_set1_epi8 (42));
+		} else {
+			out = _mm_add_epi8 (out, _mm_set1_epi8 (42));
+			special = yencode_special_sse2 (out);
+		}
+		
+		_mm_storeu_si128 ((__m128i *) outptr, out);
+		
+		if (special != 0)
+			return (inptr - inbuf) + __builtin_ctz (special);
+		
+		outptr += 16;
+		inptr += 16;
+	}
+	
+	while (inptr < inend) {
+		if (decode) {
+			if ((c = *inptr) == '\n' || c == '=')
+				break;
+			c -= 42;
+		} else {
+			c = *inptr + 42;
+			if (c == '\0' || c == '\t' || c == '\r' || c == '\n' || c == '=')
+				break;
+		}
+		
+		*outptr++ = c;
+		inptr++;
+	}
+	
+	return inptr - inbuf;
+}
+
+GMIME_TARGET ("sse2") static size_t
+yencode_copy_sse2 (const unsigned char *inbuf, size_t inlen, unsigned char *outbuf)
+{
+	return yenc_copy_sse2 (inbuf, inbuf, inlen, outbuf, FALSE);
+}
+
+GMIME_TARGET ("sse2") static size_t
+ydecode_copy_sse2 (const unsigned char *inbuf, size_t inlen, unsigned char *outbuf)
+{
+	return yenc_copy_sse2 (inbuf, inbuf, inlen, outbuf, TRUE);
+}
+
+GMIME_TARGET ("avx2") static inline size_t
+yenc_copy_avx2 (const unsigned char *inbuf, size_t inlen, unsigned char *outbuf, gboolean decode)
+{
+	const unsigned char *inptr = inbuf;
+	__m256i out, special;
+	unsigned int mask;
+	
+	while (inlen - (inptr - inbuf) >= 32) {
+		out = _mm256_loadu_si256 ((const __m256i *) inptr);
+		if (decode) {
+			special = _mm256_or_si256 (_mm256_cmpeq_epi8 (out, _mm256_set1_epi8 ('\n')),
+						   _mm256_cmpeq_epi8 (out, _mm256_set1_epi8 ('=')));
+			out = _mm256_sub_epi8 (out, _mm256_set1_epi8 (42));
+		} else {
+			out = _mm256_add_epi8 (out, _mm256_set1_epi8 (42));
+			special = _mm256_or_si256 (_mm256_cmpeq_epi8 (out, _mm256_setzero_si256 ()),
+						   _mm256_cmpeq_epi8 (out, _mm256_set1_epi8 ('\t')));
+			special = _mm256_or_si256 (special, _mm256_cmpeq_epi8 (out, _mm256_set1_epi8 ('\r')));
+			special = _mm256_or_si256 (special, _mm256_cmpeq_epi8 (out, _mm256_set1_epi8 ('\n')));
+			special = _mm256_or_si256 (special, _mm256_cmpeq_epi8 (out, _mm256_set1_epi8 ('=')));
+		}
+		
+		_mm256_storeu_si256 ((__m256i *) outbuf, out);
+		
+		if ((mask = (unsigned int) _mm256_movemask_epi8 (special)) != 0)
+			return (inptr - inbuf) + __builtin_ctz (mask);
+		
+		outbuf += 32;
+		inptr += 32;
+	}
+	
+	/* inlined rather than called so that it gets the VEX encoding */
+	return yenc_copy_sse2 (inbuf, inptr, inlen, outbuf, decode);
+}
+
+GMIME_TARGET ("avx2") static size_t
+yencode_copy_avx2 (const unsigned char *inbuf, size_t inlen, unsigned char *outbuf)
+{
+	return yenc_copy_avx2 (inbuf, inlen, outbuf, FALSE);
+}
+
+GMIME_TARGET ("avx2") static size_t
+ydecode_copy_avx2 (const unsigned char *inbuf, size_t inlen, unsigned char *outbuf)
+{
+	return yenc_copy_avx2 (inbuf, inlen, outbuf, TRUE);
+}
+
+static YencCopyFunc
+yencode_func (void)
+{
+	if (g_mime_simd_has (GMIME_SIMD_AVX2))
+		return yencode_copy_avx2;
+	
+	if (g_mime_simd_has (GMIME_SIMD_SSE2))
+		return yencode_copy_sse2;
+	
+	return NULL;
+}
+
+static YencCopyFunc
+ydecode_func (void)
+{
+	if (g_mime_simd_has (GMIME_SIMD_AVX2))
+		return ydecode_copy_avx2;
+	
+	if (g_mime_simd_has (GMIME_SIMD_SSE2))
+		return ydecode_copy_sse2;
+	
+	return NULL;
+}
+#endif /* GMIME_X86_SIMD */
+
 
 /**
  * g_mime_ydecode_step:
@@ -453,6 +783,10 @@ g_mime_ydecode_step (const unsigned char *inbuf, size_t inlen, unsigned char *ou
 	const unsigned char *inend;
 	unsigned char c;
 	int ystate;
+#ifdef GMIME_X86_SIMD
+	YencCopyFunc copy_run = ydecode_func ();
+	size_t n;
+#endif
 	
 	if (*state & GMIME_YDECODE_STATE_END)
 		return 0;
@@ -464,6 +798,19 @@ g_mime_ydecode_step (const unsigned char *inbuf, size_t inlen, unsigned char *ou
 	
 	inptr = inbuf;
 	while (inptr < inend) {
+#ifdef GMIME_X86_SIMD
+		/* decode everything up to the next newline or escape */
+		if (copy_run != NULL && !(ystate & GMIME_YDECODE_STATE_ESCAPE) && inend - inptr >= 16) {
+			if ((n = copy_run (inptr, inend - inptr, outptr)) > 0) {
+				ystate &= ~GMIME_YDECODE_STATE_EOLN;
+				inptr += n;
+				outptr += n;
+				
+				if (inptr == inend)
+					break;
+			}
+		}
+#endif
 		c = *inptr++;
 		
 		if ((ystate & YENC_NEWLINE_ESCAPE) == YENC_NEWLINE_ESCAPE) {
@@ -491,12 +838,11 @@ g_mime_ydecode_step (const unsigned char *inbuf, size_t inlen, unsigned char *ou
 		
 		ystate &= ~GMIME_YDECODE_STATE_EOLN;
 		
-		*outptr++ = c -= 42;
-		
-		*pcrc = yenc_crc_add (*pcrc, c);
-		*crc = yenc_crc_add (*crc, c);
+		*outptr++ = c - 42;
 	}
 	
+	yenc_crc_update2 (pcrc, crc, outbuf, outptr - outbuf);
+	
 	*state = ystate;
 	
 	return outptr - outbuf;
@@ -533,19 +879,40 @@ g_mime_yencode_step (const unsigned char *inbuf, size_t inlen, unsigned char *ou
 	const unsigned char *inend;
 	register int already;
 	unsigned char c;
+#ifdef GMIME_X86_SIMD
+	YencCopyFunc copy_run = yencode_func ();
+	size_t n, max;
+#endif
 	
 	inend = inbuf + inlen;
 	outptr = outbuf;
 	
 	already = *state;
 	
+	yenc_crc_update2 (pcrc, crc, inbuf, inlen);
+	
 	inptr = inbuf;
 	while (inptr < inend) {
+#ifdef GMIME_X86_SIMD
+		/* encode as much as fits on this line without escaping */
+		if (copy_run != NULL && already < YENC_LINE_LENGTH && inend - inptr >= 16) {
+			max = MIN ((size_t) (inend - inptr), (size_t) (YENC_LINE_LENGTH - already));
+			n = copy_run (inptr, max, outptr);
+			inptr += n;
+			outptr += n;
+			already += n;
+			
+			if (already >= YENC_LINE_LENGTH) {
+				*outptr++ = '\n';
+				already = 0;
+			}
+			
+			if (n == max)
+				continue;
+		}
+#endif
 		c = *inptr++;
 		
-		*pcrc = yenc_crc_add (*pcrc, c);
-		*crc = yenc_crc_add (*crc, c);
-		
 		c += 42;
 		
 		if (c == '\0' || c == '\t' || c == '\r' || c == '\n' || c == '=') {
@@ -557,7 +924,7 @@ g_mime_yencode_step (const unsigned char *inbuf, size_t inlen, unsigned char *ou
 			already++;
 		}
 		
-		if (already >= 128) {
+		if (already >= YENC_LINE_LENGTH) {
 			*outptr++ = '\n';
 			already = 0;
 		}
@@ -26,6 +26,7 @@
 #include <string.h> /* for memcpy */
 
 #include "gmime-filter.h"
+#include "gmime-filter-private.h"
 
 
 /**
@@ -42,6 +43,8 @@
 struct _GMimeFilterPrivate {
 	char *inbuf;
 	size_t inlen;
+	
+	gboolean writable;	/* may the input be modified in place? */
 };
 
 #define PRE_HEAD (64)
@@ -156,17 +159,18 @@ g_mime_filter_copy (GMimeFilter *filter)
 }
 
 
-static void
+static gboolean
 filter_run (GMimeFilter *filter, char *inbuf, size_t inlen, size_t prespace,
-	    char **outbuf, size_t *outlen, size_t *outprespace,
+	    char **outbuf, size_t *outlen, size_t *outprespace, gboolean writable,
 	    void (*filterfunc) (GMimeFilter *filter,
 				char *inbuf, size_t inlen, size_t prespace,
 				char **outbuf, size_t *outlen, size_t *outprespace))
 {
+	struct _GMimeFilterPrivate *p = _PRIVATE (filter);
+	
 	/* here we take a performance hit, if the input buffer doesn't
 	   have the pre-space required.  We make a buffer that does... */
 	if (prespace < filter->backlen) {
-		struct _GMimeFilterPrivate *p = _PRIVATE (filter);
 		size_t newlen = inlen + prespace + filter->backlen;
 		
 		if (p->inlen < newlen) {
@@ -180,6 +184,9 @@ filter_run (GMimeFilter *filter, char *inbuf, size_t inlen, size_t prespace,
 		memcpy (p->inbuf + p->inlen - inlen, inbuf, inlen);
 		inbuf = p->inbuf + p->inlen - inlen;
 		prespace = p->inlen - inlen;
+		
+		/* this copy is ours to do with as we please */
+		writable = TRUE;
 	}
 	
 	/* preload any backed up data */
@@ -191,7 +198,21 @@ filter_run (GMimeFilter *filter, char *inbuf, size_t inlen, size_t prespace,
 		filter->backlen = 0;
 	}
 	
+	p->writable = writable;
 	filterfunc (filter, inbuf, inlen, prespace, outbuf, outlen, outprespace);
+	p->writable = FALSE;
+	
+	/* the next filter may write to the output if it is our own
+	 * output buffer or if it is (part of) an input buffer that we
+	 * were allowed to write to */
+	if (filter->outreal && *outbuf >= filter->outreal &&
+	    *outbuf + *outlen <= filter->outbuf + filter->outsize)
+		return TRUE;
+	
+	if (writable && *outbuf >= inbuf - prespace && *outbuf + *outlen <= inbuf + inlen)
+		return TRUE;
+	
+	return FALSE;
 }
 
 
@@ -222,11 +243,37 @@ g_mime_filter_filter (GMimeFilter *filter, char *inbuf, size_t inlen, size_t pre
 {
 	g_return_if_fail (GMIME_IS_FILTER (filter));
 	
-	filter_run (filter, inbuf, inlen, prespace, outbuf, outlen, outprespace,
+	filter_run (filter, inbuf, inlen, prespace, outbuf, outlen, outprespace, FALSE,
 		    GMIME_FILTER_GET_CLASS (filter)->filter);
 }
 
 
+/**
+ * g_mime_filter_filter_writable:
+ * @filter: filter
+ * @inbuf: input buffer
+ * @inlen: input buffer length
+ * @prespace: prespace buffer length
+ * @outbuf: pointer to output buffer
+ * @outlen: pointer to output length
+ * @outprespace: pointer to output prespace buffer length
+ * @writable: %TRUE if @filter may modify @inbuf (and its prespace)
+ *
+ * Same as g_mime_filter_filter(), except that filters which never
+ * produce more output than they are given may work in place when
+ * @writable is %TRUE instead of copying into their own output buffer.
+ *
+ * Returns: %TRUE if the output may in turn be modified in place.
+ **/
+gboolean
+g_mime_filter_filter_writable (GMimeFilter *filter, char *inbuf, size_t inlen, size_t prespace,
+			       char **outbuf, size_t *outlen, size_t *outprespace, gboolean writable)
+{
+	return filter_run (filter, inbuf, inlen, prespace, outbuf, outlen, outprespace, writable,
+			   GMIME_FILTER_GET_CLASS (filter)->filter);
+}
+
+
 static void
 filter_complete (GMimeFilter *filter, char *inbuf, size_t inlen, size_t prespace,
 		 char **outbuf, size_t *outlen, size_t *outprespace)
@@ -255,11 +302,53 @@ g_mime_filter_complete (GMimeFilter *filter,
 {
 	g_return_if_fail (GMIME_IS_FILTER (filter));
 	
-	filter_run (filter, inbuf, inlen, prespace, outbuf, outlen, outprespace,
+	filter_run (filter, inbuf, inlen, prespace, outbuf, outlen, outprespace, FALSE,
 		    GMIME_FILTER_GET_CLASS (filter)->complete);
 }
 
 
+/**
+ * g_mime_filter_complete_writable:
+ * @filter: filter
+ * @inbuf: input buffer
+ * @inlen: input buffer length
+ * @prespace: prespace buffer length
+ * @outbuf: pointer to output buffer
+ * @outlen: pointer to output length
+ * @outprespace: pointer to output prespace buffer length
+ * @writable: %TRUE if @filter may modify @inbuf (and its prespace)
+ *
+ * Same as g_mime_filter_complete(), but see
+ * g_mime_filter_filter_writable().
+ *
+ * Returns: %TRUE if the output may in turn be modified in place.
+ **/
+gboolean
+g_mime_filter_complete_writable (GMimeFilter *filter, char *inbuf, size_t inlen, size_t prespace,
+				 char **outbuf, size_t *outlen, size_t *outprespace, gboolean writable)
+{
+	return filter_run (filter, inbuf, inlen, prespace, outbuf, outlen, outprespace, writable,
+			   GMIME_FILTER_GET_CLASS (filter)->complete);
+}
+
+
+/**
+ * g_mime_filter_input_writable:
+ * @filter: filter
+ *
+ * Checks whether the filter that is currently being run may modify
+ * its input buffer in place. Only meaningful from within the filter
+ * and complete methods.
+ *
+ * Returns: %TRUE if the input buffer may be modified.
+ **/
+gboolean
+g_mime_filter_input_writable (GMimeFilter *filter)
+{
+	return _PRIVATE (filter)->writable;
+}
+
+
 static void
 filter_reset (GMimeFilter *filter)
 {
@@ -32,8 +32,6 @@
 #include "gmime-events.h"
 #include "gmime-utils.h"
 
-#include "list.h"
-
 
 /**
  * SECTION: gmime-header
@@ -48,76 +46,431 @@
 
 /**
  * GMimeHeader:
- * @next: pointer to the next header
- * @prev: pointer to the previous header
- * @offset: file/stream offset
  * @name: header name
  * @value: header value
+ * @id: the index of @name in known_names (plus one) or %0 if unknown
+ * @block: the block of the header list that holds this header
  *
  * A message/rfc822 header.
  **/
 
 struct _GMimeHeader {
-	GMimeHeader *next;
-	GMimeHeader *prev;
-	/*gint64 offset;*/
 	char *name;
 	char *value;
+	guint id;
+	struct _HeaderBlock *block;
 };
 
+/* Headers are stored in order in a chain of contiguous blocks. Only
+ * the used range [first, last) of each block holds headers and empty
+ * blocks are freed. Headers never move when a header is appended or
+ * prepended, so iterators stay valid until a header is removed (which
+ * bumps the list's version). Each header points back at its block so
+ * that stepping an iterator doesn't have to search the chain. */
+typedef struct _HeaderBlock {
+	struct _HeaderBlock *next;
+	struct _HeaderBlock *prev;
+	guint first, last, size;
+	GMimeHeader headers[1];
+} HeaderBlock;
+
+/* an open-addressed (linear-probe) table mapping each header name to
+ * the first header with that name, used once a list grows large */
+typedef struct {
+	guint hash;
+	GMimeHeader *header;
+} HeaderIndexSlot;
+
 struct _GMimeHeaderList {
 	GMimeStream *stream;
 	GHashTable *writers;
 	GMimeEvent *changed;
-	GHashTable *hash;
 	guint32 version;
-	List list;
+	
+	HeaderBlock *head;
+	HeaderBlock *tail;
+	guint count;
+	
+	HeaderIndexSlot *index;
+	guint index_size;
+	guint index_used;
 };
 
+#define HEADER_BLOCK_MIN  8
+#define HEADER_BLOCK_MAX  256
+
+/* the number of headers at which lookups start using the index */
+#define HEADER_INDEX_THRESHOLD 16
+
+/* number of default-formatted header lines written per writev */
+#define HEADER_IOV_MAX 32
+
+#define header_block_new(size) ((HeaderBlock *) g_malloc (G_STRUCT_OFFSET (HeaderBlock, headers) + (size) * sizeof (GMimeHeader)))
+
+
+/* Commonly seen header names, sorted for a case-insensitive binary
+ * search. Headers with one of these names (spelled exactly like this)
+ * share a static copy of the name, and all headers with a known name
+ * can be compared by id rather than by name. */
+static const char *known_names[] = {
+	"ARC-Authentication-Results",
+	"ARC-Message-Signature",
+	"ARC-Seal",
+	"Authentication-Results",
+	"Bcc",
+	"Cc",
+	"Content-Description",
+	"Content-Disposition",
+	"Content-ID",
+	"Content-Language",
+	"Content-Length",
+	"Content-Location",
+	"Content-MD5",
+	"Content-Transfer-Encoding",
+	"Content-Type",
+	"Date",
+	"Delivered-To",
+	"DKIM-Signature",
+	"From",
+	"In-Reply-To",
+	"List-Archive",
+	"List-Help",
+	"List-Id",
+	"List-Post",
+	"List-Subscribe",
+	"List-Unsubscribe",
+	"Message-ID",
+	"MIME-Version",
+	"Precedence",
+	"Received",
+	"Received-SPF",
+	"References",
+	"Reply-To",
+	"Resent-Date",
+	"Resent-From",
+	"Resent-Message-ID",
+	"Resent-To",
+	"Return-Path",
+	"Sender",
+	"Subject",
+	"Thread-Index",
+	"Thread-Topic",
+	"To",
+	"User-Agent",
+	"X-Mailer",
+	"X-Original-To",
+	"X-Spam-Status",
+};
 
-static GMimeHeader *g_mime_header_new (const char *name, const char *value, gint64 offset);
-static void g_mime_header_free (GMimeHeader *header);
+static guint
+header_name_id (const char *name)
+{
+	int lo = 0, hi = G_N_ELEMENTS (known_names) - 1;
+	int mid, cmp;
+	
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		
+		if ((cmp = g_ascii_strcasecmp (name, known_names[mid])) == 0)
+			return mid + 1;
+		else if (cmp < 0)
+			hi = mid - 1;
+		else
+			lo = mid + 1;
+	}
+	
+	return 0;
+}
 
+static gboolean
+header_name_equal (const GMimeHeader *header, const char *name, guint id)
+{
+	if (id != 0 || header->id != 0)
+		return header->id == id;
+	
+	return !g_ascii_strcasecmp (header->name, name);
+}
+
+
+static void
+g_mime_header_init (GMimeHeader *header, const char *name, const char *value)
+{
+	header->id = header_name_id (name);
+	
+	if (header->id != 0 && !strcmp (name, known_names[header->id - 1]))
+		header->name = (char *) known_names[header->id - 1];
+	else
+		header->name = g_strdup (name);
+	
+	header->value = g_strdup (value);
+}
+
+static void
+g_mime_header_clear (GMimeHeader *header)
+{
+	if (header->id == 0 || header->name != known_names[header->id - 1])
+		g_free (header->name);
+	
+	g_free (header->value);
+}
+
+
+static GMimeHeader *
+header_list_first (const GMimeHeaderList *headers)
+{
+	return headers->head ? headers->head->headers + headers->head->first : NULL;
+}
+
+static GMimeHeader *
+header_list_last (const GMimeHeaderList *headers)
+{
+	return headers->tail ? headers->tail->headers + headers->tail->last - 1 : NULL;
+}
+
+static GMimeHeader *
+header_list_next (const GMimeHeaderList *headers, const GMimeHeader *header)
+{
+	HeaderBlock *block = header->block;
+	
+	if (header + 1 < block->headers + block->last)
+		return (GMimeHeader *) header + 1;
+	
+	if (!(block = block->next))
+		return NULL;
+	
+	return block->headers + block->first;
+}
+
+static GMimeHeader *
+header_list_prev (const GMimeHeaderList *headers, const GMimeHeader *header)
+{
+	HeaderBlock *block = header->block;
+	
+	if (header > block->headers + block->first)
+		return (GMimeHeader *) header - 1;
+	
+	if (!(block = block->prev))
+		return NULL;
+	
+	return block->headers + block->last - 1;
+}
+
+static void
+header_list_index_clear (GMimeHeaderList *headers)
+{
+	g_free (headers->index);
+	headers->index = NULL;
+	headers->index_size = 0;
+	headers->index_used = 0;
+}
+
+/* returns the slot for @name, which is empty if there is no such header */
+static HeaderIndexSlot *
+header_list_index_lookup (const GMimeHeaderList *headers, const char *name, guint hash, guint id)
+{
+	guint mask = headers->index_size - 1;
+	HeaderIndexSlot *slot;
+	guint i = hash & mask;
+	
+	slot = headers->index + i;
+	while (slot->header != NULL) {
+		if (slot->hash == hash && header_name_equal (slot->header, name, id))
+			break;
+		
+		i = (i + 1) & mask;
+		slot = headers->index + i;
+	}
+	
+	return slot;
+}
+
+/* adds @header to the index unless an earlier header has the same name */
+static void
+header_list_index_add (GMimeHeaderList *headers, GMimeHeader *header)
+{
+	HeaderIndexSlot *slot;
+	guint hash;
+	
+	hash = g_mime_strcase_hash (header->name);
+	slot = header_list_index_lookup (headers, header->name, hash, header->id);
+	
+	if (slot->header == NULL) {
+		slot->header = header;
+		slot->hash = hash;
+		headers->index_used++;
+	}
+}
+
+static void
+header_list_index_build (GMimeHeaderList *headers)
+{
+	HeaderBlock *block;
+	guint i;
+	
+	g_free (headers->index);
+	
+	headers->index_size = 32;
+	while (headers->index_size < headers->count * 2)
+		headers->index_size <<= 1;
+	
+	headers->index = g_new0 (HeaderIndexSlot, headers->index_size);
+	headers->index_used = 0;
+	
+	for (block = headers->head; block; block = block->next) {
+		for (i = block->first; i < block->last; i++)
+			header_list_index_add (headers, block->headers + i);
+	}
+}
+
+/* keeps the index up to date after appending @header */
+static void
+header_list_index_append (GMimeHeaderList *headers, GMimeHeader *header)
+{
+	if (headers->index == NULL)
+		return;
+	
+	if ((headers->index_used + 1) * 2 > headers->index_size)
+		header_list_index_clear (headers);
+	else
+		header_list_index_add (headers, header);
+}
 
-/**
- * g_mime_header_new:
- * @name: header name
- * @value: header value
- * @offset: file/stream offset for the start of the header (or %-1 if unknown)
- *
- * Creates a new #GMimeHeader.
- *
- * Returns: a new #GMimeHeader with the specified values.
- **/
 static GMimeHeader *
-g_mime_header_new (const char *name, const char *value, gint64 offset)
+header_list_lookup (const GMimeHeaderList *headers, const char *name)
 {
 	GMimeHeader *header;
+	HeaderBlock *block;
+	guint id, i;
 	
-	header = g_slice_new (GMimeHeader);
-	header->name = g_strdup (name);
-	header->value = g_strdup (value);
-	/*header->offset = offset;*/
-	header->next = NULL;
-	header->prev = NULL;
+	id = header_name_id (name);
+	
+	if (headers->count > HEADER_INDEX_THRESHOLD) {
+		if (headers->index == NULL)
+			header_list_index_build ((GMimeHeaderList *) headers);
+		
+		return header_list_index_lookup (headers, name, g_mime_strcase_hash (name), id)->header;
+	}
+	
+	for (block = headers->head; block; block = block->next) {
+		for (i = block->first; i < block->last; i++) {
+			header = block->headers + i;
+			
+			if (header_name_equal (header, name, id))
+				return header;
+		}
+	}
+	
+	return NULL;
+}
+
+static GMimeHeader *
+header_list_append (GMimeHeaderList *headers, const char *name, const char *value)
+{
+	HeaderBlock *block = headers->tail;
+	GMimeHeader *header;
+	guint size;
+	
+	if (block == NULL || block->last == block->size) {
+		size = block ? MIN (block->size * 2, HEADER_BLOCK_MAX) : HEADER_BLOCK_MIN;
+		
+		block = header_block_new (size);
+		block->first = block->last = 0;
+		block->size = size;
+		block->next = NULL;
+		block->prev = headers->tail;
+		
+		if (headers->tail)
+			headers->tail->next = block;
+		else
+			headers->head = block;
+		
+		headers->tail = block;
+	}
+	
+	header = block->headers + block->last++;
+	g_mime_header_init (header, name, value);
+	header->block = block;
+	headers->count++;
+	
+	header_list_index_append (headers, header);
 	
 	return header;
 }
 
+static GMimeHeader *
+header_list_prepend (GMimeHeaderList *headers, const char *name, const char *value)
+{
+	HeaderBlock *block = headers->head;
+	GMimeHeader *header;
+	
+	if (block == NULL || block->first == 0) {
+		block = header_block_new (HEADER_BLOCK_MIN);
+		block->first = block->last = HEADER_BLOCK_MIN;
+		block->size = HEADER_BLOCK_MIN;
+		block->next = headers->head;
+		block->prev = NULL;
+		
+		if (headers->head)
+			headers->head->prev = block;
+		else
+			headers->tail = block;
+		
+		headers->head = block;
+	}
+	
+	header = block->headers + --block->first;
+	g_mime_header_init (header, name, value);
+	header->block = block;
+	headers->count++;
+	
+	/* the new header comes before any other with the same name */
+	header_list_index_clear (headers);
+	
+	return header;
+}
 
-/**
- * g_mime_header_free:
- * @header: a #GMimeHeader
- *
- * Frees a single #GMimeHeader node.
- **/
-static void
-g_mime_header_free (GMimeHeader *header)
+/* removes @header and returns whatever header now follows it (or NULL) */
+static GMimeHeader *
+header_list_remove (GMimeHeaderList *headers, GMimeHeader *header)
 {
-	g_free (header->name);
-	g_free (header->value);
+	HeaderBlock *block = header->block;
+	GMimeHeader *next;
+	guint i;
+	
+	i = header - block->headers;
+	
+	g_mime_header_clear (header);
+	headers->count--;
+	
+	memmove (block->headers + i, block->headers + i + 1, (block->last - i - 1) * sizeof (GMimeHeader));
+	block->last--;
+	
+	if (i < block->last) {
+		next = block->headers + i;
+	} else if (block->next) {
+		next = block->next->headers + block->next->first;
+	} else {
+		next = NULL;
+	}
+	
+	if (block->first == block->last) {
+		if (block->prev)
+			block->prev->next = block->next;
+		else
+			headers->head = block->next;
+		
+		if (block->next)
+			block->next->prev = block->prev;
+		else
+			headers->tail = block->prev;
+		
+		g_free (block);
+	}
+	
+	header_list_index_clear (headers);
+	headers->version++;
 	
-	g_slice_free (GMimeHeader, header);
+	return next;
 }
 
 
@@ -241,10 +594,7 @@ g_mime_header_iter_is_valid (GMimeHeaderIter *iter)
 	if (!iter->hdrlist || iter->version != iter->hdrlist->version)
 		return FALSE;
 	
-	if (!iter->cursor || !iter->cursor->next)
-		return FALSE;
-	
-	return TRUE;
+	return iter->cursor != NULL;
 }
 
 
@@ -264,11 +614,9 @@ g_mime_header_iter_first (GMimeHeaderIter *iter)
 	g_return_val_if_fail (iter != NULL, FALSE);
 	
 	/* make sure we can actually do as requested */
-	if (!iter->hdrlist || list_is_empty (&iter->hdrlist->list))
+	if (!iter->hdrlist || !(first = header_list_first (iter->hdrlist)))
 		return FALSE;
 	
-	first = (GMimeHeader *) iter->hdrlist->list.head;
-	
 	iter->version = iter->hdrlist->version;
 	iter->cursor = first;
 	
@@ -292,11 +640,9 @@ g_mime_header_iter_last (GMimeHeaderIter *iter)
 	g_return_val_if_fail (iter != NULL, FALSE);
 	
 	/* make sure we can actually do as requested */
-	if (!iter->hdrlist || list_is_empty (&iter->hdrlist->list))
+	if (!iter->hdrlist || !(last = header_list_last (iter->hdrlist)))
 		return FALSE;
 	
-	last = (GMimeHeader *) iter->hdrlist->list.tailpred;
-	
 	iter->version = iter->hdrlist->version;
 	iter->cursor = last;
 	
@@ -324,8 +670,7 @@ g_mime_header_iter_next (GMimeHeaderIter *iter)
 		return FALSE;
 	
 	/* make sure next item is valid */
-	next = iter->cursor->next;
-	if (!next->next)
+	if (!(next = header_list_next (iter->hdrlist, iter->cursor)))
 		return FALSE;
 	
 	iter->cursor = next;
@@ -354,8 +699,7 @@ g_mime_header_iter_prev (GMimeHeaderIter *iter)
 		return FALSE;
 	
 	/* make sure prev item is valid */
-	prev = iter->cursor->prev;
-	if (!prev || !prev->prev)
+	if (!(prev = header_list_prev (iter->hdrlist, iter->cursor)))
 		return FALSE;
 	
 	iter->cursor = prev;
@@ -473,43 +817,17 @@ g_mime_header_iter_get_value (GMimeHeaderIter *iter)
 gboolean
 g_mime_header_iter_remove (GMimeHeaderIter *iter)
 {
-	GMimeHeader *cursor, *header, *next;
 	GMimeHeaderList *hdrlist;
+	GMimeHeader *next;
 	
 	g_return_val_if_fail (iter != NULL, FALSE);
 	
 	if (!g_mime_header_iter_is_valid (iter))
 		return FALSE;
 	
-	/* save iter state */
-	hdrlist = iter->hdrlist;
-	cursor = iter->cursor;
-	next = cursor->next;
-	
-	if (!(header = g_hash_table_lookup (hdrlist->hash, cursor->name)))
-		return FALSE;
-	
-	if (cursor == header) {
-		/* update the header lookup table */
-		GMimeHeader *node = next;
-		
-		g_hash_table_remove (hdrlist->hash, cursor->name);
-		
-		while (node->next) {
-			if (!g_ascii_strcasecmp (node->name, cursor->name)) {
-				/* enter this node into the lookup table */
-				g_hash_table_insert (hdrlist->hash, node->name, node);
-				break;
-			}
-			
-			node = node->next;
-		}
-	}
-	
 	/* remove/free the header */
-	list_unlink ((ListNode *) cursor);
-	g_mime_header_free (cursor);
-	hdrlist->version++;
+	hdrlist = iter->hdrlist;
+	next = header_list_remove (hdrlist, iter->cursor);
 	
 	/* update iter state */
 	iter->version = hdrlist->version;
@@ -532,20 +850,46 @@ g_mime_header_list_new (void)
 	GMimeHeaderList *headers;
 	
 	headers = g_slice_new (GMimeHeaderList);
-	headers->writers = g_hash_table_new_full (g_mime_strcase_hash,
-						  g_mime_strcase_equal,
-						  g_free, NULL);
-	headers->hash = g_hash_table_new (g_mime_strcase_hash,
-					  g_mime_strcase_equal);
-	list_init (&headers->list);
 	headers->changed = g_mime_event_new (headers);
+	headers->writers = NULL;
 	headers->stream = NULL;
 	headers->version = 0;
 	
+	headers->head = NULL;
+	headers->tail = NULL;
+	headers->count = 0;
+	
+	headers->index = NULL;
+	headers->index_size = 0;
+	headers->index_used = 0;
+	
 	return headers;
 }
 
 
+static void
+header_list_free_blocks (GMimeHeaderList *headers)
+{
+	HeaderBlock *block, *next;
+	guint i;
+	
+	block = headers->head;
+	while (block) {
+		next = block->next;
+		
+		for (i = block->first; i < block->last; i++)
+			g_mime_header_clear (block->headers + i);
+		
+		g_free (block);
+		block = next;
+	}
+	
+	headers->head = NULL;
+	headers->tail = NULL;
+	headers->count = 0;
+}
+
+
 /**
  * g_mime_header_list_destroy:
  * @headers: a #GMimeHeaderList
@@ -555,20 +899,14 @@ g_mime_header_list_new (void)
 void
 g_mime_header_list_destroy (GMimeHeaderList *headers)
 {
-	GMimeHeader *header, *next;
-	
 	if (!headers)
 		return;
 	
-	header = (GMimeHeader *) headers->list.head;
-	while (header->next) {
-		next = header->next;
-		g_mime_header_free (header);
-		header = next;
-	}
+	header_list_free_blocks (headers);
+	header_list_index_clear (headers);
 	
-	g_hash_table_destroy (headers->writers);
-	g_hash_table_destroy (headers->hash);
+	if (headers->writers)
+		g_hash_table_destroy (headers->writers);
 	
 	if (headers->stream)
 		g_object_unref (headers->stream);
@@ -588,19 +926,11 @@ g_mime_header_list_destroy (GMimeHeaderList *headers)
 void
 g_mime_header_list_clear (GMimeHeaderList *headers)
 {
-	GMimeHeader *header, *next;
-	
 	g_return_if_fail (headers != NULL);
 	
-	header = (GMimeHeader *) headers->list.head;
-	while (header->next) {
-		next = header->next;
-		g_mime_header_free (header);
-		header = next;
-	}
-	
-	g_hash_table_remove_all (headers->hash);
-	list_init (&headers->list);
+	header_list_free_blocks (headers);
+	header_list_index_clear (headers);
+	headers->version++;
 	
 	g_mime_header_list_set_stream (headers, NULL);
 }
@@ -618,15 +948,10 @@ g_mime_header_list_clear (GMimeHeaderList *headers)
 gboolean
 g_mime_header_list_contains (const GMimeHeaderList *headers, const char *name)
 {
-	const GMimeHeader *header;
-	
 	g_return_val_if_fail (headers != NULL, FALSE);
 	g_return_val_if_fail (name != NULL, FALSE);
 	
-	if (!(header = g_hash_table_lookup (headers->hash, name)))
-		return FALSE;
-	
-	return TRUE;
+	return header_list_lookup (headers, name) != NULL;
 }
 
 
@@ -646,14 +971,10 @@ g_mime_header_list_contains (const GMimeHeaderList *headers, const char *name)
 void
 g_mime_header_list_prepend (GMimeHeaderList *headers, const char *name, const char *value)
 {
-	GMimeHeader *header;
-	
 	g_return_if_fail (headers != NULL);
 	g_return_if_fail (name != NULL);
 	
-	header = g_mime_header_new (name, value, -1);
-	list_prepend (&headers->list, (ListNode *) header);
-	g_hash_table_replace (headers->hash, header->name, header);
+	header_list_prepend (headers, name, value);
 	
 	g_mime_header_list_set_stream (headers, NULL);
 }
@@ -675,16 +996,10 @@ g_mime_header_list_prepend (GMimeHeaderList *headers, const char *name, const ch
 void
 g_mime_header_list_append (GMimeHeaderList *headers, const char *name, const char *value)
 {
-	GMimeHeader *header;
-	
 	g_return_if_fail (headers != NULL);
 	g_return_if_fail (name != NULL);
 	
-	header = g_mime_header_new (name, value, -1);
-	list_append (&headers->list, (ListNode *) header);
-	
-	if (!g_hash_table_lookup (headers->hash, name))
-		g_hash_table_insert (headers->hash, header->name, header);
+	header_list_append (headers, name, value);
 	
 	g_mime_header_list_set_stream (headers, NULL);
 }
@@ -710,7 +1025,7 @@ g_mime_header_list_get (const GMimeHeaderList *headers, const char *name)
 	g_return_val_if_fail (headers != NULL, NULL);
 	g_return_val_if_fail (name != NULL, NULL);
 	
-	if (!(header = g_hash_table_lookup (headers->hash, name)))
+	if (!(header = header_list_lookup (headers, name)))
 		return NULL;
 	
 	return header->value;
@@ -738,32 +1053,27 @@ g_mime_header_list_get (const GMimeHeaderList *headers, const char *name)
 void
 g_mime_header_list_set (GMimeHeaderList *headers, const char *name, const char *value)
 {
-	GMimeHeader *header, *next;
+	GMimeHeader *header;
+	guint id;
 	
 	g_return_if_fail (headers != NULL);
 	g_return_if_fail (name != NULL);
 	
-	if ((header = g_hash_table_lookup (headers->hash, name))) {
+	if ((header = header_list_lookup (headers, name))) {
 		g_free (header->value);
 		header->value = g_strdup (value);
 		
-		header = header->next;
-		while (header->next) {
-			next = header->next;
-			
-			if (!g_ascii_strcasecmp (header->name, name)) {
-				/* remove/free the header */
-				list_unlink ((ListNode *) header);
-				g_mime_header_free (header);
-				headers->version++;
-			}
-			
-			header = next;
+		/* remove/free any further instances */
+		id = header_name_id (name);
+		header = header_list_next (headers, header);
+		while (header) {
+			if (header_name_equal (header, name, id))
+				header = header_list_remove (headers, header);
+			else
+				header = header_list_next (headers, header);
 		}
 	} else {
-		header = g_mime_header_new (name, value, -1);
-		list_append (&headers->list, (ListNode *) header);
-		g_hash_table_insert (headers->hash, header->name, header);
+		header_list_append (headers, name, value);
 	}
 	
 	g_mime_header_list_set_stream (headers, NULL);
@@ -783,32 +1093,16 @@ g_mime_header_list_set (GMimeHeaderList *headers, const char *name, const char *
 gboolean
 g_mime_header_list_remove (GMimeHeaderList *headers, const char *name)
 {
-	GMimeHeader *header, *node;
+	GMimeHeader *header;
 	
 	g_return_val_if_fail (headers != NULL, FALSE);
 	g_return_val_if_fail (name != NULL, FALSE);
 	
-	if (!(header = g_hash_table_lookup (headers->hash, name)))
+	if (!(header = header_list_lookup (headers, name)))
 		return FALSE;
 	
-	/* look for another header with the same name... */
-	node = header->next;
-	while (node->next) {
-		if (!g_ascii_strcasecmp (node->name, name)) {
-			/* enter this node into the lookup table */
-			g_hash_table_replace (headers->hash, node->name, node);
-			break;
-		}
-		
-		node = node->next;
-	}
-	
-	/* invalidate all our outstanding iterators matching @header */
-	headers->version++;
-	
-	/* remove/free the header */
-	list_unlink ((ListNode *) header);
-	g_mime_header_free (header);
+	/* remove/free the header (invalidating all outstanding iterators) */
+	header_list_remove (headers, header);
 	
 	g_mime_header_list_set_stream (headers, NULL);
 	
@@ -833,8 +1127,7 @@ g_mime_header_list_get_iter (GMimeHeaderList *headers, GMimeHeaderIter *iter)
 	
 	g_return_val_if_fail (headers != NULL, FALSE);
 	
-	cursor = (GMimeHeader *) headers->list.head;
-	if (!cursor->next)
+	if (!(cursor = header_list_first (headers)))
 		return FALSE;
 	
 	iter->version = headers->version;
@@ -857,15 +1150,17 @@ void
 g_mime_header_list_foreach (const GMimeHeaderList *headers, GMimeHeaderForeachFunc func, gpointer user_data)
 {
 	const GMimeHeader *header;
+	const HeaderBlock *block;
+	guint i;
 	
 	g_return_if_fail (headers != NULL);
 	g_return_if_fail (func != NULL);
 	
-	header = (const GMimeHeader *) headers->list.head;
-	
-	while (header->next) {
-		func (header->name, header->value, user_data);
-		header = header->next;
+	for (block = headers->head; block; block = block->next) {
+		for (i = block->first; i < block->last; i++) {
+			header = block->headers + i;
+			func (header->name, header->value, user_data);
+		}
 	}
 }
 
@@ -883,6 +1178,21 @@ default_writer (GMimeStream *stream, const char *name, const char *value)
 	return nwritten;
 }
 
+/* writes out the header lines queued up in @vector and frees them */
+static ssize_t
+write_header_vector (GMimeStream *stream, GMimeStreamIOVector *vector, size_t n)
+{
+	ssize_t nwritten;
+	size_t i;
+	
+	nwritten = g_mime_stream_writev (stream, vector, n);
+	
+	for (i = 0; i < n; i++)
+		g_free (vector[i].data);
+	
+	return nwritten;
+}
+
 
 /**
  * g_mime_header_list_write_to_stream:
@@ -896,10 +1206,14 @@ default_writer (GMimeStream *stream, const char *name, const char *value)
 ssize_t
 g_mime_header_list_write_to_stream (const GMimeHeaderList *headers, GMimeStream *stream)
 {
+	GMimeStreamIOVector vector[HEADER_IOV_MAX];
 	ssize_t nwritten, total = 0;
+	const GMimeHeader *header;
+	const HeaderBlock *block;
 	GMimeHeaderWriter writer;
 	GHashTable *writers;
-	GMimeHeader *header;
+	size_t n = 0;
+	guint i;
 	
 	g_return_val_if_fail (headers != NULL, -1);
 	g_return_val_if_fail (stream != NULL, -1);
@@ -909,21 +1223,52 @@ g_mime_header_list_write_to_stream (const GMimeHeaderList *headers, GMimeStream
 		return g_mime_stream_write_to_stream (headers->stream, stream);
 	}
 	
-	header = (GMimeHeader *) headers->list.head;
 	writers = headers->writers;
 	
-	while (header->next) {
-		if (header->value) {
-			if (!(writer = g_hash_table_lookup (writers, header->name)))
+	for (block = headers->head; block; block = block->next) {
+		for (i = block->first; i < block->last; i++) {
+			header = block->headers + i;
+			
+			if (!header->value)
+				continue;
+			
+			if (!writers || !(writer = g_hash_table_lookup (writers, header->name)))
 				writer = default_writer;
 			
-			if ((nwritten = writer (stream, header->name, header->value)) == -1)
-				return -1;
+			if (writer == default_writer) {
+				/* the default format doesn't need the stream, so
+				 * queue the line up and write the lot at once */
+				vector[n].data = g_mime_utils_header_printf ("%s: %s\n", header->name, header->value);
+				vector[n].len = strlen (vector[n].data);
+				
+				if (++n < HEADER_IOV_MAX)
+					continue;
+			}
+			
+			if (n > 0) {
+				nwritten = write_header_vector (stream, vector, n);
+				n = 0;
+				
+				if (nwritten == -1)
+					return -1;
+				
+				total += nwritten;
+			}
 			
-			total += nwritten;
+			if (writer != default_writer) {
+				if ((nwritten = writer (stream, header->name, header->value)) == -1)
+					return -1;
+				
+				total += nwritten;
+			}
 		}
+	}
+	
+	if (n > 0) {
+		if ((nwritten = write_header_vector (stream, vector, n)) == -1)
+			return -1;
 		
-		header = header->next;
+		total += nwritten;
 	}
 	
 	return total;
@@ -982,11 +1327,18 @@ g_mime_header_list_to_string (const GMimeHeaderList *headers)
 void
 g_mime_header_list_register_writer (GMimeHeaderList *headers, const char *name, GMimeHeaderWriter writer)
 {
-	gpointer okey, oval;
-	
 	g_return_if_fail (headers != NULL);
 	g_return_if_fail (name != NULL);
 	
+	if (!headers->writers) {
+		if (!writer)
+			return;
+		
+		headers->writers = g_hash_table_new_full (g_mime_strcase_hash,
+							  g_mime_strcase_equal,
+							  g_free, NULL);
+	}
+	
 	g_hash_table_remove (headers->writers, name);
 	
 	if (writer)
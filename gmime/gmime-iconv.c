@@ -55,11 +55,24 @@
  *
  * 2. To use the appropriate system charset alias for the MIME charset
  * names given as arguments.
+ *
+ * Descriptors are cached at two levels. Each thread keeps a small
+ * pool of its own idle descriptors (see
+ * g_mime_iconv_set_thread_cache_size()) which it can reuse without
+ * taking any locks, and falls back to a cache shared by all threads
+ * when its own pool has nothing suitable. Descriptors that fall out
+ * of a thread's pool are handed back to the shared cache.
+ *
+ * A descriptor may be closed by a different thread than the one that
+ * opened it.
  **/
 
 
 #define ICONV_CACHE_SIZE   (16)
 
+/* default number of idle descriptors each thread holds on to */
+#define ICONV_THREAD_CACHE_SIZE (16)
+
 typedef struct {
 	CacheNode node;
 	guint32 refcount : 31;
@@ -67,10 +80,41 @@ typedef struct {
 	iconv_t cd;
 } IconvCacheNode;
 
+typedef struct {
+	char *key;
+	iconv_t cd;
+} IconvThreadEntry;
+
+typedef struct {
+	GArray *idle;        /* IconvThreadEntry, most recently used first */
+	GArray *lent;        /* IconvThreadEntry, currently open */
+	GSList *returned;    /* closed by other threads; needs the cache lock */
+	gint generation;
+	gint hits;
+	gint misses;
+} IconvThreadCache;
+
+
+static void iconv_thread_cache_free (gpointer user_data);
 
 static Cache *iconv_cache = NULL;
 static GHashTable *iconv_open_hash = NULL;
 
+/* maps descriptors belonging to a thread's cache to that cache, or to
+ * NULL if the thread has since exited */
+static GHashTable *iconv_thread_owned = NULL;
+static GSList *iconv_thread_caches = NULL;
+static GPrivate iconv_thread_cache = G_PRIVATE_INIT (iconv_thread_cache_free);
+static gint iconv_thread_cache_size = ICONV_THREAD_CACHE_SIZE;
+static gint iconv_generation = 0;
+
+/* stats: shared ones are protected by the cache lock, and the thread
+ * totals only include threads that have exited */
+static guint64 thread_hits = 0;
+static guint64 thread_misses = 0;
+static guint64 shared_hits = 0;
+static guint64 shared_misses = 0;
+
 #ifdef GMIME_ICONV_DEBUG
 static int cache_misses = 0;
 static int shutdown = 0;
@@ -90,6 +134,21 @@ extern void _g_mime_iconv_cache_lock (void);
 #endif /* G_THREADS_ENABLED */
 
 
+/* resets the conversion state of a descriptor that is being reused */
+static void
+iconv_reset (iconv_t cd)
+{
+	/* Apparently iconv on Solaris <= 7 segfaults if you pass in
+	 * NULL for anything but inbuf; work around that. (NULL outbuf
+	 * or NULL *outbuf is allowed by Unix98.)
+	 */
+	size_t inleft = 0, outleft = 0;
+	char *outbuf = NULL;
+	
+	iconv (cd, NULL, &inleft, &outbuf, &outleft);
+}
+
+
 /* caller *must* hold the iconv_cache_lock to call any of the following functions */
 
 
@@ -133,7 +192,9 @@ iconv_cache_node_free (CacheNode *node)
 	}
 #endif
 	
-	iconv_close (inode->cd);
+	/* the descriptor may have been handed over to a thread cache */
+	if (inode->cd != (iconv_t) -1)
+		iconv_close (inode->cd);
 }
 
 
@@ -171,6 +232,201 @@ iconv_open_node_free (gpointer key, gpointer value, gpointer user_data)
 }
 
 
+static void
+iconv_thread_owned_free (gpointer key, gpointer value, gpointer user_data)
+{
+	if (value == NULL)
+		iconv_close ((iconv_t) key);
+}
+
+
+/* gives a descriptor that a thread no longer wants to the shared
+ * cache, unless the shared cache already has one for @key */
+static void
+iconv_cache_give (const char *key, iconv_t cd)
+{
+	IconvCacheNode *node;
+	
+	if (cache_node_lookup (iconv_cache, key, FALSE) != NULL) {
+		iconv_close (cd);
+		return;
+	}
+	
+	node = iconv_cache_node_new (key, cd);
+	node->refcount = 0;
+	node->used = FALSE;
+}
+
+static int
+iconv_thread_entry_find (GArray *array, const char *key, iconv_t cd)
+{
+	IconvThreadEntry *entry;
+	guint i;
+	
+	for (i = 0; i < array->len; i++) {
+		entry = &g_array_index (array, IconvThreadEntry, i);
+		
+		if (key ? !strcmp (entry->key, key) : entry->cd == cd)
+			return i;
+	}
+	
+	return -1;
+}
+
+/* moves a descriptor that has been closed into the front of the idle
+ * list, and returns any that no longer fit to the shared cache */
+static void
+iconv_thread_cache_release (IconvThreadCache *tc, guint index, gboolean locked)
+{
+	IconvThreadEntry entry;
+	guint size;
+	
+	entry = g_array_index (tc->lent, IconvThreadEntry, index);
+	g_array_remove_index_fast (tc->lent, index);
+	g_array_prepend_val (tc->idle, entry);
+	
+	size = (guint) g_atomic_int_get (&iconv_thread_cache_size);
+	if (tc->idle->len <= size)
+		return;
+	
+	if (!locked)
+		ICONV_CACHE_LOCK ();
+	
+	while (tc->idle->len > size) {
+		entry = g_array_index (tc->idle, IconvThreadEntry, tc->idle->len - 1);
+		g_array_set_size (tc->idle, tc->idle->len - 1);
+		
+		g_hash_table_remove (iconv_thread_owned, entry.cd);
+		iconv_cache_give (entry.key, entry.cd);
+		g_free (entry.key);
+	}
+	
+	if (!locked)
+		ICONV_CACHE_UNLOCK ();
+}
+
+/* picks up the descriptors that other threads have closed on our
+ * behalf; caller must hold the cache lock */
+static void
+iconv_thread_cache_collect (IconvThreadCache *tc)
+{
+	GSList *node;
+	int index;
+	
+	for (node = tc->returned; node; node = node->next) {
+		if ((index = iconv_thread_entry_find (tc->lent, NULL, node->data)) != -1)
+			iconv_thread_cache_release (tc, index, TRUE);
+	}
+	
+	g_slist_free (tc->returned);
+	tc->returned = NULL;
+}
+
+/* closes everything a thread cache holds and detaches it; caller must
+ * hold the cache lock (or be shutting down) */
+static void
+iconv_thread_cache_clear (IconvThreadCache *tc, gboolean close_lent)
+{
+	IconvThreadEntry *entry;
+	guint i;
+	
+	/* returned descriptors are still in the lent list */
+	g_slist_free (tc->returned);
+	tc->returned = NULL;
+	
+	for (i = 0; i < tc->idle->len; i++) {
+		entry = &g_array_index (tc->idle, IconvThreadEntry, i);
+		iconv_close (entry->cd);
+		g_free (entry->key);
+	}
+	
+	for (i = 0; i < tc->lent->len; i++) {
+		entry = &g_array_index (tc->lent, IconvThreadEntry, i);
+		if (close_lent)
+			iconv_close (entry->cd);
+		g_free (entry->key);
+	}
+	
+	g_array_set_size (tc->idle, 0);
+	g_array_set_size (tc->lent, 0);
+	
+	thread_hits += tc->hits;
+	thread_misses += tc->misses;
+	tc->hits = tc->misses = 0;
+	tc->generation = -1;
+}
+
+static void
+iconv_thread_cache_free (gpointer user_data)
+{
+	IconvThreadCache *tc = user_data;
+	IconvThreadEntry *entry;
+	guint i;
+	
+	ICONV_CACHE_LOCK ();
+	
+	if (tc->generation == iconv_generation && iconv_cache != NULL) {
+		iconv_thread_cache_collect (tc);
+		
+		/* idle descriptors go back to the shared cache... */
+		for (i = 0; i < tc->idle->len; i++) {
+			entry = &g_array_index (tc->idle, IconvThreadEntry, i);
+			g_hash_table_remove (iconv_thread_owned, entry->cd);
+			iconv_cache_give (entry->key, entry->cd);
+			g_free (entry->key);
+		}
+		
+		g_array_set_size (tc->idle, 0);
+		
+		/* ...and whoever still has one of ours open will close it */
+		for (i = 0; i < tc->lent->len; i++) {
+			entry = &g_array_index (tc->lent, IconvThreadEntry, i);
+			g_hash_table_insert (iconv_thread_owned, entry->cd, NULL);
+		}
+		
+		iconv_thread_cache_clear (tc, FALSE);
+		iconv_thread_caches = g_slist_remove (iconv_thread_caches, tc);
+	}
+	
+	ICONV_CACHE_UNLOCK ();
+	
+	g_array_free (tc->idle, TRUE);
+	g_array_free (tc->lent, TRUE);
+	g_free (tc);
+}
+
+/* gets the calling thread's cache, creating (or re-attaching) it if
+ * @create is %TRUE */
+static IconvThreadCache *
+iconv_thread_cache_get (gboolean create)
+{
+	IconvThreadCache *tc;
+	
+	tc = g_private_get (&iconv_thread_cache);
+	
+	if (tc && tc->generation == g_atomic_int_get (&iconv_generation))
+		return tc;
+	
+	if (!create)
+		return NULL;
+	
+	if (tc == NULL) {
+		tc = g_new0 (IconvThreadCache, 1);
+		tc->idle = g_array_new (FALSE, FALSE, sizeof (IconvThreadEntry));
+		tc->lent = g_array_new (FALSE, FALSE, sizeof (IconvThreadEntry));
+		tc->generation = -1;
+		g_private_set (&iconv_thread_cache, tc);
+	}
+	
+	ICONV_CACHE_LOCK ();
+	tc->generation = iconv_generation;
+	iconv_thread_caches = g_slist_prepend (iconv_thread_caches, tc);
+	ICONV_CACHE_UNLOCK ();
+	
+	return tc;
+}
+
+
 /**
  * g_mime_iconv_shutdown:
  *
@@ -194,6 +450,22 @@ g_mime_iconv_shutdown (void)
 	g_hash_table_destroy (iconv_open_hash);
 	iconv_open_hash = NULL;
 	
+	/* detach all of the thread caches; each thread frees its own
+	 * when it exits or re-attaches it if GMime is initialized again */
+	while (iconv_thread_caches) {
+		iconv_thread_cache_clear (iconv_thread_caches->data, TRUE);
+		iconv_thread_caches = g_slist_delete_link (iconv_thread_caches, iconv_thread_caches);
+	}
+	
+	/* close the descriptors whose threads have exited */
+	g_hash_table_foreach (iconv_thread_owned, iconv_thread_owned_free, NULL);
+	g_hash_table_destroy (iconv_thread_owned);
+	iconv_thread_owned = NULL;
+	g_atomic_int_inc (&iconv_generation);
+	
+	thread_hits = thread_misses = 0;
+	shared_hits = shared_misses = 0;
+	
 	cache_free (iconv_cache);
 	iconv_cache = NULL;
 }
@@ -216,6 +488,7 @@ g_mime_iconv_init (void)
 	g_mime_charset_map_init ();
 	
 	iconv_open_hash = g_hash_table_new (g_direct_hash, g_direct_equal);
+	iconv_thread_owned = g_hash_table_new (g_direct_hash, g_direct_equal);
 	iconv_cache = cache_new (iconv_cache_node_expire, iconv_cache_node_free,
 				 sizeof (IconvCacheNode), ICONV_CACHE_SIZE);
 }
@@ -240,7 +513,10 @@ g_mime_iconv_init (void)
 iconv_t
 g_mime_iconv_open (const char *to, const char *from)
 {
+	IconvThreadCache *tc = NULL;
+	IconvThreadEntry entry;
 	IconvCacheNode *node;
+	int index;
 	iconv_t cd;
 	char *key;
 	
@@ -257,25 +533,64 @@ g_mime_iconv_open (const char *to, const char *from)
 	key = g_alloca (strlen (from) + strlen (to) + 2);
 	sprintf (key, "%s:%s", from, to);
 	
+	if (g_atomic_int_get (&iconv_thread_cache_size) > 0 && (tc = iconv_thread_cache_get (TRUE))) {
+		if ((index = iconv_thread_entry_find (tc->idle, key, NULL)) != -1) {
+			entry = g_array_index (tc->idle, IconvThreadEntry, index);
+			g_array_remove_index (tc->idle, index);
+			g_array_append_val (tc->lent, entry);
+			g_atomic_int_inc (&tc->hits);
+			
+			iconv_reset (entry.cd);
+			
+			return entry.cd;
+		}
+		
+		g_atomic_int_inc (&tc->misses);
+	}
+	
 	ICONV_CACHE_LOCK ();
 	
+	if (tc != NULL) {
+		iconv_thread_cache_collect (tc);
+		
+		/* fall back to the shared cache, taking its descriptor over
+		 * if nobody else is using it */
+		node = (IconvCacheNode *) cache_node_lookup (iconv_cache, key, FALSE);
+		if (node && !node->used && node->refcount == 0) {
+			cd = node->cd;
+			node->cd = (iconv_t) -1;
+			cache_node_expire ((CacheNode *) node);
+			iconv_reset (cd);
+			shared_hits++;
+		} else {
+			if ((cd = iconv_open (to, from)) == (iconv_t) -1)
+				goto exception;
+			
+			shared_misses++;
+		}
+		
+		entry.key = g_strdup (key);
+		entry.cd = cd;
+		g_array_append_val (tc->lent, entry);
+		g_hash_table_insert (iconv_thread_owned, cd, tc);
+		
+		ICONV_CACHE_UNLOCK ();
+		
+		return cd;
+	}
+	
 	if ((node = (IconvCacheNode *) cache_node_lookup (iconv_cache, key, TRUE))) {
 		if (node->used) {
 			if ((cd = iconv_open (to, from)) == (iconv_t) -1)
 				goto exception;
-		} else {
-			/* Apparently iconv on Solaris <= 7 segfaults if you pass in
-			 * NULL for anything but inbuf; work around that. (NULL outbuf
-			 * or NULL *outbuf is allowed by Unix98.)
-			 */
-			size_t inleft = 0, outleft = 0;
-			char *outbuf = NULL;
 			
+			shared_misses++;
+		} else {
 			cd = node->cd;
 			node->used = TRUE;
 			
-			/* reset the descriptor */
-			iconv (cd, NULL, &inleft, &outbuf, &outleft);
+			iconv_reset (cd);
+			shared_hits++;
 		}
 		
 		node->refcount++;
@@ -284,6 +599,7 @@ g_mime_iconv_open (const char *to, const char *from)
 			goto exception;
 		
 		node = iconv_cache_node_new (key, cd);
+		shared_misses++;
 	}
 	
 	g_hash_table_insert (iconv_open_hash, cd, ((CacheNode *) node)->key);
@@ -322,15 +638,33 @@ g_mime_iconv_open (const char *to, const char *from)
 int
 g_mime_iconv_close (iconv_t cd)
 {
+	IconvThreadCache *tc, *owner;
 	IconvCacheNode *node;
 	const char *key;
+	int index;
 	
 	if (cd == (iconv_t) -1)
 		return 0;
 	
+	if ((tc = iconv_thread_cache_get (FALSE)) != NULL) {
+		if ((index = iconv_thread_entry_find (tc->lent, NULL, cd)) != -1) {
+			iconv_thread_cache_release (tc, index, FALSE);
+			return 0;
+		}
+	}
+	
 	ICONV_CACHE_LOCK ();
 	
-	if ((key = g_hash_table_lookup (iconv_open_hash, cd))) {
+	if (g_hash_table_lookup_extended (iconv_thread_owned, cd, NULL, (gpointer *) &owner)) {
+		if (owner != NULL) {
+			/* opened by another thread, which will take it back */
+			owner->returned = g_slist_prepend (owner->returned, cd);
+		} else {
+			/* the thread that opened it has exited */
+			g_hash_table_remove (iconv_thread_owned, cd);
+			iconv_close (cd);
+		}
+	} else if ((key = g_hash_table_lookup (iconv_open_hash, cd))) {
 		g_hash_table_remove (iconv_open_hash, cd);
 		
 		node = (IconvCacheNode *) cache_node_lookup (iconv_cache, key, FALSE);
@@ -359,3 +693,72 @@ g_mime_iconv_close (iconv_t cd)
 	
 	return 0;
 }
+
+
+/**
+ * g_mime_iconv_set_thread_cache_size:
+ * @size: the number of descriptors
+ *
+ * Sets the maximum number of idle conversion descriptors that each
+ * thread keeps for its own use. Threads that convert between many
+ * different charsets may benefit from a larger value (see
+ * g_mime_iconv_get_cache_stats()). A @size of %0 disables the
+ * per-thread caches so that all descriptors come from the shared
+ * cache.
+ *
+ * The default is 16.
+ **/
+void
+g_mime_iconv_set_thread_cache_size (guint size)
+{
+	g_atomic_int_set (&iconv_thread_cache_size, (gint) MIN (size, G_MAXINT));
+}
+
+
+/**
+ * g_mime_iconv_get_thread_cache_size:
+ *
+ * Gets the maximum number of idle conversion descriptors that each
+ * thread keeps for its own use.
+ *
+ * Returns: the number of descriptors.
+ **/
+guint
+g_mime_iconv_get_thread_cache_size (void)
+{
+	return (guint) g_atomic_int_get (&iconv_thread_cache_size);
+}
+
+
+/**
+ * g_mime_iconv_get_cache_stats:
+ * @stats: (out): a #GMimeIconvCacheStats
+ *
+ * Gets the number of times g_mime_iconv_open() has found a descriptor
+ * in a thread's cache or in the shared cache, and the number of times
+ * it has not, since g_mime_iconv_init().
+ **/
+void
+g_mime_iconv_get_cache_stats (GMimeIconvCacheStats *stats)
+{
+	IconvThreadCache *tc;
+	GSList *node;
+	
+	g_return_if_fail (stats != NULL);
+	
+	ICONV_CACHE_LOCK ();
+	
+	stats->thread_hits = thread_hits;
+	stats->thread_misses = thread_misses;
+	stats->shared_hits = shared_hits;
+	stats->shared_misses = shared_misses;
+	
+	for (node = iconv_thread_caches; node; node = node->next) {
+		tc = node->data;
+		
+		stats->thread_hits += (guint) g_atomic_int_get (&tc->hits);
+		stats->thread_misses += (guint) g_atomic_int_get (&tc->misses);
+	}
+	
+	ICONV_CACHE_UNLOCK ();
+}
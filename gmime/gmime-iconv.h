@@ -27,9 +27,31 @@
 
 G_BEGIN_DECLS
 
+/**
+ * GMimeIconvCacheStats:
+ * @thread_hits: descriptors reused from the calling thread's own cache
+ * @thread_misses: descriptors that were not in the calling thread's cache
+ * @shared_hits: descriptors reused from the shared cache
+ * @shared_misses: descriptors that had to be opened with iconv_open()
+ *
+ * Statistics about the iconv descriptor caches, as returned by
+ * g_mime_iconv_get_cache_stats().
+ **/
+typedef struct {
+	guint64 thread_hits;
+	guint64 thread_misses;
+	guint64 shared_hits;
+	guint64 shared_misses;
+} GMimeIconvCacheStats;
+
 void g_mime_iconv_init (void);
 void g_mime_iconv_shutdown (void);
 
+void g_mime_iconv_set_thread_cache_size (guint size);
+guint g_mime_iconv_get_thread_cache_size (void);
+
+void g_mime_iconv_get_cache_stats (GMimeIconvCacheStats *stats);
+
 iconv_t g_mime_iconv_open (const char *to, const char *from);
 
 
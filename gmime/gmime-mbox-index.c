@@ -0,0 +1,510 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*  GMime
+ *  Copyright (C) 2000-2014 Jeffrey Stedfast
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "gmime-mbox-index.h"
+#include "gmime-stream-fs.h"
+#include "gmime-error.h"
+
+#define d(x)
+
+
+/**
+ * SECTION: gmime-mbox-index
+ * @title: GMimeMboxIndex
+ * @short_description: An on-disk index of the messages in an mbox
+ * @see_also: #GMimeParser
+ *
+ * A #GMimeMboxIndex records where each message in an mbox begins and
+ * where its headers and body are, along with the size and
+ * modification time of the mbox at the time that it was indexed. An
+ * index can be saved to disk and loaded again so that the mbox does
+ * not have to be parsed in order to find message N, and it can be
+ * brought up to date by only parsing the new messages when the mbox
+ * has been appended to.
+ *
+ * The index file consists of a 40 byte header followed by one 40
+ * byte record per message. All values are stored little-endian:
+ *
+ * magic ("GMIMEIDX", 8 bytes), format version (32 bits), reserved (32
+ * bits), mbox size (64 bits), mbox modification time (64 bits) and
+ * message count (64 bits); then, for each message, its from-offset,
+ * headers-begin, headers-end, body-begin and body-end offsets (64
+ * bits each).
+ **/
+
+
+#define MBOX_INDEX_MAGIC "GMIMEIDX"
+#define MBOX_INDEX_MAGIC_LEN 8
+#define MBOX_INDEX_VERSION 1
+#define MBOX_INDEX_HEADER_LEN 40
+#define MBOX_INDEX_ENTRY_LEN 40
+
+struct _GMimeMboxIndex {
+	gint64 size;
+	gint64 mtime;
+	GArray *entries;
+};
+
+
+/**
+ * g_mime_mbox_index_new:
+ *
+ * Creates a new, empty, #GMimeMboxIndex. Use g_mime_mbox_index_update()
+ * to index an mbox.
+ *
+ * Returns: a new mbox index.
+ **/
+GMimeMboxIndex *
+g_mime_mbox_index_new (void)
+{
+	GMimeMboxIndex *index;
+	
+	index = g_slice_new (GMimeMboxIndex);
+	index->entries = g_array_new (FALSE, FALSE, sizeof (GMimeMboxIndexEntry));
+	index->size = -1;
+	index->mtime = -1;
+	
+	return index;
+}
+
+
+/**
+ * g_mime_mbox_index_destroy:
+ * @index: a #GMimeMboxIndex
+ *
+ * Destroy the mbox index.
+ **/
+void
+g_mime_mbox_index_destroy (GMimeMboxIndex *index)
+{
+	g_return_if_fail (index != NULL);
+	
+	g_array_free (index->entries, TRUE);
+	g_slice_free (GMimeMboxIndex, index);
+}
+
+
+static gint64
+decode_int64 (const unsigned char *inptr)
+{
+	guint64 v = 0;
+	int i;
+	
+	for (i = 7; i >= 0; i--)
+		v = (v << 8) | inptr[i];
+	
+	return (gint64) v;
+}
+
+static void
+encode_int64 (GByteArray *buffer, gint64 value)
+{
+	guint64 v = (guint64) value;
+	unsigned char buf[8];
+	int i;
+	
+	for (i = 0; i < 8; i++) {
+		buf[i] = v & 0xff;
+		v >>= 8;
+	}
+	
+	g_byte_array_append (buffer, buf, 8);
+}
+
+
+/**
+ * g_mime_mbox_index_load:
+ * @filename: the path of the index file
+ * @err: a #GError
+ *
+ * Loads an mbox index that was previously saved with
+ * g_mime_mbox_index_save().
+ *
+ * Note: the index may no longer match the mbox; see
+ * g_mime_mbox_index_is_valid() and g_mime_mbox_index_update().
+ *
+ * Returns: the mbox index or %NULL on error.
+ **/
+GMimeMboxIndex *
+g_mime_mbox_index_load (const char *filename, GError **err)
+{
+	GMimeMboxIndexEntry entry;
+	GMimeMboxIndex *index;
+	unsigned char *inptr;
+	guint64 count, i;
+	char *buf;
+	gsize len;
+	
+	g_return_val_if_fail (filename != NULL, NULL);
+	
+	if (!g_file_get_contents (filename, &buf, &len, err))
+		return NULL;
+	
+	inptr = (unsigned char *) buf;
+	
+	if (len < MBOX_INDEX_HEADER_LEN || memcmp (inptr, MBOX_INDEX_MAGIC, MBOX_INDEX_MAGIC_LEN) != 0) {
+		g_set_error (err, GMIME_ERROR, GMIME_ERROR_PARSE_ERROR,
+			     "`%s' is not an mbox index", filename);
+		g_free (buf);
+		return NULL;
+	}
+	
+	if ((decode_int64 (inptr + 8) & 0xffffffff) != MBOX_INDEX_VERSION) {
+		g_set_error (err, GMIME_ERROR, GMIME_ERROR_NOT_SUPPORTED,
+			     "Unsupported mbox index version in `%s'", filename);
+		g_free (buf);
+		return NULL;
+	}
+	
+	count = (guint64) decode_int64 (inptr + 32);
+	
+	if (count > (len - MBOX_INDEX_HEADER_LEN) / MBOX_INDEX_ENTRY_LEN ||
+	    len != MBOX_INDEX_HEADER_LEN + count * MBOX_INDEX_ENTRY_LEN) {
+		g_set_error (err, GMIME_ERROR, GMIME_ERROR_PARSE_ERROR,
+			     "Truncated mbox index `%s'", filename);
+		g_free (buf);
+		return NULL;
+	}
+	
+	index = g_mime_mbox_index_new ();
+	index->size = decode_int64 (inptr + 16);
+	index->mtime = decode_int64 (inptr + 24);
+	
+	inptr += MBOX_INDEX_HEADER_LEN;
+	for (i = 0; i < count; i++) {
+		entry.from_offset = decode_int64 (inptr);
+		entry.headers_begin = decode_int64 (inptr + 8);
+		entry.headers_end = decode_int64 (inptr + 16);
+		entry.body_begin = decode_int64 (inptr + 24);
+		entry.body_end = decode_int64 (inptr + 32);
+		g_array_append_val (index->entries, entry);
+		inptr += MBOX_INDEX_ENTRY_LEN;
+	}
+	
+	g_free (buf);
+	
+	return index;
+}
+
+
+/**
+ * g_mime_mbox_index_save:
+ * @index: a #GMimeMboxIndex
+ * @filename: the path of the index file
+ * @err: a #GError
+ *
+ * Saves @index to @filename. The file is replaced atomically, so a
+ * reader will never see a partially written index.
+ *
+ * Returns: %TRUE on success or %FALSE on error.
+ **/
+gboolean
+g_mime_mbox_index_save (GMimeMboxIndex *index, const char *filename, GError **err)
+{
+	GMimeMboxIndexEntry *entry;
+	GByteArray *buffer;
+	gboolean saved;
+	guint i;
+	
+	g_return_val_if_fail (index != NULL, FALSE);
+	g_return_val_if_fail (filename != NULL, FALSE);
+	
+	buffer = g_byte_array_sized_new (MBOX_INDEX_HEADER_LEN + index->entries->len * MBOX_INDEX_ENTRY_LEN);
+	
+	g_byte_array_append (buffer, (unsigned char *) MBOX_INDEX_MAGIC, MBOX_INDEX_MAGIC_LEN);
+	encode_int64 (buffer, MBOX_INDEX_VERSION);
+	encode_int64 (buffer, index->size);
+	encode_int64 (buffer, index->mtime);
+	encode_int64 (buffer, index->entries->len);
+	
+	for (i = 0; i < index->entries->len; i++) {
+		entry = &g_array_index (index->entries, GMimeMboxIndexEntry, i);
+		encode_int64 (buffer, entry->from_offset);
+		encode_int64 (buffer, entry->headers_begin);
+		encode_int64 (buffer, entry->headers_end);
+		encode_int64 (buffer, entry->body_begin);
+		encode_int64 (buffer, entry->body_end);
+	}
+	
+	saved = g_file_set_contents (filename, (char *) buffer->data, buffer->len, err);
+	g_byte_array_free (buffer, TRUE);
+	
+	return saved;
+}
+
+
+/* the body begins after the blank line that ends the headers, if any */
+static gint64
+mbox_index_body_begin (GMimeStream *stream, gint64 headers_end, gint64 body_end)
+{
+	GMimeStream *substream;
+	ssize_t n = 0;
+	char buf[2];
+	
+	if (headers_end < body_end) {
+		substream = g_mime_stream_substream (stream, headers_end, MIN (headers_end + 2, body_end));
+		n = g_mime_stream_read (substream, buf, 2);
+		g_object_unref (substream);
+	}
+	
+	if (n >= 1 && buf[0] == '\n')
+		return headers_end + 1;
+	
+	if (n == 2 && buf[0] == '\r' && buf[1] == '\n')
+		return headers_end + 2;
+	
+	return headers_end;
+}
+
+/* appends the messages from the current position of @stream to the index */
+static void
+mbox_index_scan (GMimeMboxIndex *index, GMimeStream *stream)
+{
+	GMimeMboxIndexEntry entry;
+	GMimeMessage *message;
+	GMimeParser *parser;
+	
+	parser = g_mime_parser_new_with_stream (stream);
+	g_mime_parser_set_headers_only (parser, TRUE);
+	g_mime_parser_set_scan_from (parser, TRUE);
+	
+	while (!g_mime_parser_eos (parser)) {
+		if (!(message = g_mime_parser_construct_message (parser)))
+			break;
+		
+		entry.from_offset = g_mime_parser_get_from_offset (parser);
+		entry.headers_begin = g_mime_parser_get_headers_begin (parser);
+		entry.headers_end = g_mime_parser_get_headers_end (parser);
+		entry.body_end = g_mime_parser_tell (parser);
+		entry.body_begin = mbox_index_body_begin (stream, entry.headers_end, entry.body_end);
+		g_array_append_val (index->entries, entry);
+		
+		g_object_unref (message);
+	}
+	
+	g_object_unref (parser);
+}
+
+/* checks that the last message that was indexed is still where it was */
+static gboolean
+mbox_index_can_append (GMimeMboxIndex *index, GMimeStream *stream, gint64 size)
+{
+	GMimeMboxIndexEntry *last;
+	char buf[5];
+	
+	if (index->entries->len == 0 || index->size < 0 || size < index->size)
+		return FALSE;
+	
+	last = &g_array_index (index->entries, GMimeMboxIndexEntry, index->entries->len - 1);
+	if (last->body_end != index->size)
+		return FALSE;
+	
+	if (g_mime_stream_seek (stream, last->from_offset, GMIME_STREAM_SEEK_SET) == -1)
+		return FALSE;
+	
+	return g_mime_stream_read (stream, buf, 5) == 5 && !strncmp (buf, "From ", 5);
+}
+
+
+/**
+ * g_mime_mbox_index_update:
+ * @index: a #GMimeMboxIndex
+ * @mbox: the path of the mbox
+ * @err: a #GError
+ *
+ * Brings @index up to date with @mbox.
+ *
+ * If @index is still valid for @mbox, nothing needs to be done. If
+ * @mbox has only grown since it was indexed, only the last message
+ * that was indexed (which may have been appended to) and whatever
+ * follows it is parsed. Otherwise, the whole mbox is indexed again.
+ *
+ * Returns: %TRUE on success or %FALSE on error.
+ **/
+gboolean
+g_mime_mbox_index_update (GMimeMboxIndex *index, const char *mbox, GError **err)
+{
+	GMimeMboxIndexEntry *last;
+	GMimeStream *stream;
+	gint64 offset = 0;
+	struct stat st;
+	int fd;
+	
+	g_return_val_if_fail (index != NULL, FALSE);
+	g_return_val_if_fail (mbox != NULL, FALSE);
+	
+	if ((fd = g_open (mbox, O_RDONLY, 0)) == -1 || fstat (fd, &st) == -1) {
+		g_set_error (err, GMIME_ERROR, errno, "Cannot open `%s': %s",
+			     mbox, g_strerror (errno));
+		if (fd != -1)
+			close (fd);
+		return FALSE;
+	}
+	
+	if (index->size == (gint64) st.st_size && index->mtime == (gint64) st.st_mtime) {
+		close (fd);
+		return TRUE;
+	}
+	
+	stream = g_mime_stream_fs_new (fd);
+	
+	if (mbox_index_can_append (index, stream, st.st_size)) {
+		/* the last message may have grown, so parse it again */
+		last = &g_array_index (index->entries, GMimeMboxIndexEntry, index->entries->len - 1);
+		offset = last->from_offset;
+		g_array_set_size (index->entries, index->entries->len - 1);
+	} else {
+		g_array_set_size (index->entries, 0);
+	}
+	
+	d(g_message ("indexing `%s' from offset %" G_GINT64_FORMAT, mbox, offset));
+	
+	if (g_mime_stream_seek (stream, offset, GMIME_STREAM_SEEK_SET) == -1) {
+		g_set_error (err, GMIME_ERROR, errno, "Cannot seek in `%s': %s",
+			     mbox, g_strerror (errno));
+		g_array_set_size (index->entries, 0);
+		g_object_unref (stream);
+		index->size = -1;
+		return FALSE;
+	}
+	
+	mbox_index_scan (index, stream);
+	g_object_unref (stream);
+	
+	index->size = st.st_size;
+	index->mtime = st.st_mtime;
+	
+	return TRUE;
+}
+
+
+/**
+ * g_mime_mbox_index_is_valid:
+ * @index: a #GMimeMboxIndex
+ * @mbox: the path of the mbox
+ *
+ * Checks that @mbox has the same size and modification time as it did
+ * when @index was last updated.
+ *
+ * Returns: %TRUE if @index is valid for @mbox or %FALSE otherwise.
+ **/
+gboolean
+g_mime_mbox_index_is_valid (GMimeMboxIndex *index, const char *mbox)
+{
+	GStatBuf st;
+	
+	g_return_val_if_fail (index != NULL, FALSE);
+	g_return_val_if_fail (mbox != NULL, FALSE);
+	
+	if (g_stat (mbox, &st) == -1)
+		return FALSE;
+	
+	return index->size == (gint64) st.st_size && index->mtime == (gint64) st.st_mtime;
+}
+
+
+/**
+ * g_mime_mbox_index_get_count:
+ * @index: a #GMimeMboxIndex
+ *
+ * Gets the number of messages in @index.
+ *
+ * Returns: the number of messages in @index.
+ **/
+guint
+g_mime_mbox_index_get_count (GMimeMboxIndex *index)
+{
+	g_return_val_if_fail (index != NULL, 0);
+	
+	return index->entries->len;
+}
+
+
+/**
+ * g_mime_mbox_index_get_entry:
+ * @index: a #GMimeMboxIndex
+ * @n: the index of the message
+ *
+ * Gets the location of message @n.
+ *
+ * Returns: the location of message @n or %NULL if @n is out of range.
+ **/
+const GMimeMboxIndexEntry *
+g_mime_mbox_index_get_entry (GMimeMboxIndex *index, guint n)
+{
+	g_return_val_if_fail (index != NULL, NULL);
+	
+	if (n >= index->entries->len)
+		return NULL;
+	
+	return &g_array_index (index->entries, GMimeMboxIndexEntry, n);
+}
+
+
+/**
+ * g_mime_mbox_index_seek:
+ * @index: a #GMimeMboxIndex
+ * @n: the index of the message
+ * @parser: a #GMimeParser
+ * @stream: the mbox stream
+ *
+ * Seeks @stream to the beginning of message @n and (re)initializes
+ * @parser with it, so that the next call to
+ * g_mime_parser_construct_message() returns message @n. @parser
+ * should be set to scan for From-lines.
+ *
+ * Returns: %TRUE on success or %FALSE on error.
+ **/
+gboolean
+g_mime_mbox_index_seek (GMimeMboxIndex *index, guint n, GMimeParser *parser, GMimeStream *stream)
+{
+	const GMimeMboxIndexEntry *entry;
+	
+	g_return_val_if_fail (index != NULL, FALSE);
+	g_return_val_if_fail (GMIME_IS_PARSER (parser), FALSE);
+	g_return_val_if_fail (GMIME_IS_STREAM (stream), FALSE);
+	
+	if (!(entry = g_mime_mbox_index_get_entry (index, n)))
+		return FALSE;
+	
+	if (g_mime_stream_seek (stream, entry->from_offset, GMIME_STREAM_SEEK_SET) == -1)
+		return FALSE;
+	
+	g_mime_parser_init_with_stream (parser, stream);
+	
+	return TRUE;
+}
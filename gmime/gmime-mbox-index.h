@@ -0,0 +1,76 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*  GMime
+ *  Copyright (C) 2000-2014 Jeffrey Stedfast
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301, USA.
+ */
+
+
+#ifndef __GMIME_MBOX_INDEX_H__
+#define __GMIME_MBOX_INDEX_H__
+
+#include <glib.h>
+#include <gmime/gmime-parser.h>
+#include <gmime/gmime-stream.h>
+
+G_BEGIN_DECLS
+
+/**
+ * GMimeMboxIndex:
+ *
+ * An index of the message offsets in an mbox.
+ **/
+typedef struct _GMimeMboxIndex GMimeMboxIndex;
+
+typedef struct _GMimeMboxIndexEntry GMimeMboxIndexEntry;
+
+/**
+ * GMimeMboxIndexEntry:
+ * @from_offset: the offset of the message's From-line
+ * @headers_begin: the offset of the start of the message headers
+ * @headers_end: the offset of the end of the message headers
+ * @body_begin: the offset of the start of the message body
+ * @body_end: the offset of the end of the message body, which is also
+ * where the next message begins
+ *
+ * The location of a single message in an mbox.
+ **/
+struct _GMimeMboxIndexEntry {
+	gint64 from_offset;
+	gint64 headers_begin;
+	gint64 headers_end;
+	gint64 body_begin;
+	gint64 body_end;
+};
+
+
+GMimeMboxIndex *g_mime_mbox_index_new (void);
+void g_mime_mbox_index_destroy (GMimeMboxIndex *index);
+
+GMimeMboxIndex *g_mime_mbox_index_load (const char *filename, GError **err);
+gboolean g_mime_mbox_index_save (GMimeMboxIndex *index, const char *filename, GError **err);
+
+gboolean g_mime_mbox_index_update (GMimeMboxIndex *index, const char *mbox, GError **err);
+gboolean g_mime_mbox_index_is_valid (GMimeMboxIndex *index, const char *mbox);
+
+guint g_mime_mbox_index_get_count (GMimeMboxIndex *index);
+const GMimeMboxIndexEntry *g_mime_mbox_index_get_entry (GMimeMboxIndex *index, guint n);
+
+gboolean g_mime_mbox_index_seek (GMimeMboxIndex *index, guint n, GMimeParser *parser, GMimeStream *stream);
+
+G_END_DECLS
+
+#endif /* __GMIME_MBOX_INDEX_H__ */
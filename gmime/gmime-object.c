@@ -29,6 +29,7 @@
 #include "gmime-common.h"
 #include "gmime-object.h"
 #include "gmime-stream-mem.h"
+#include "gmime-stream-gather.h"
 #include "gmime-events.h"
 #include "gmime-utils.h"
 
@@ -989,10 +990,25 @@ object_write_to_stream (GMimeObject *object, GMimeStream *stream)
 ssize_t
 g_mime_object_write_to_stream (GMimeObject *object, GMimeStream *stream)
 {
+	GMimeStream *gather;
+	ssize_t nwritten;
+	
 	g_return_val_if_fail (GMIME_IS_OBJECT (object), -1);
 	g_return_val_if_fail (GMIME_IS_STREAM (stream), -1);
 	
-	return GMIME_OBJECT_GET_CLASS (object)->write_to_stream (object, stream);
+	if (!g_mime_stream_gather_wanted (stream))
+		return GMIME_OBJECT_GET_CLASS (object)->write_to_stream (object, stream);
+	
+	/* collect the headers, boundaries and other small writes so
+	 * that they go out in a few vectored writes rather than a
+	 * system call apiece */
+	gather = g_mime_stream_gather_new (stream);
+	nwritten = GMIME_OBJECT_GET_CLASS (object)->write_to_stream (object, gather);
+	if (g_mime_stream_gather_commit (gather) == -1)
+		nwritten = -1;
+	g_object_unref (gather);
+	
+	return nwritten;
 }
 
 
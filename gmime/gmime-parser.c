@@ -23,20 +23,32 @@
 #include <config.h>
 #endif
 
+#include <glib/gstdio.h>
+
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <errno.h>
 
 #include "gmime-parser.h"
+#include "gmime-data-wrapper-private.h"
 
 #include "gmime-table-private.h"
 #include "gmime-message-part.h"
 #include "gmime-parse-utils.h"
+#include "gmime-stream-chunked.h"
+#include "gmime-stream-mmap.h"
+#include "gmime-stream-fs.h"
 #include "gmime-stream-mem.h"
 #include "gmime-multipart.h"
 #include "gmime-common.h"
+#include "gmime-simd.h"
 #include "gmime-part.h"
 
+#ifdef GMIME_X86_SIMD
+#include <immintrin.h>
+#endif
+
 #if GLIB_MAJOR_VERSION > 2 || (GLIB_MAJOR_VERSION == 2 && GLIB_MINOR_VERSION >= 14)
 #define HAVE_GLIB_REGEX
 #elif defined (HAVE_REGEX_H)
@@ -61,6 +73,11 @@
  * A #GMimeParser parses a stream into a #GMimeMessage or other
  * #GMimeObject and can also handle parsing MBox formatted streams
  * into multiple #GMimeMessage objects.
+ *
+ * Alternatively, input may be pushed into a #GMimeParser a chunk at a
+ * time with g_mime_parser_feed(), in which case the headers and
+ * content of each MIME part are reported through a set of
+ * #GMimeParserCallbacks instead.
  **/
 
 typedef struct _boundary_stack {
@@ -72,17 +89,36 @@ typedef struct _boundary_stack {
 	gint64 content_end;
 } BoundaryStack;
 
+/* the parts that the push parser is in the middle of */
+typedef struct _part_stack {
+	struct _part_stack *parent;
+	BoundaryStack *bounds;
+	int depth;
+	gboolean digest;
+	gboolean preface;
+} PartStack;
+
 typedef struct _header_raw {
 	struct _header_raw *next;
 	char *name, *value;
 	gint64 offset;
 } HeaderRaw;
 
+typedef struct _header_arena_block {
+	struct _header_arena_block *next;
+	size_t size;
+} HeaderArenaBlock;
+
+/* keeps the block data suitably aligned for a HeaderRaw */
+#define HEADER_ARENA_BLOCK_HEAD ((sizeof (HeaderArenaBlock) + 15) & ~((size_t) 15))
+
 typedef struct _content_type {
 	char *type, *subtype;
 	gboolean exists;
 } ContentType;
 
+typedef char * (* ScanBoundaryFunc) (char *inptr, char *inend, gboolean scan_from);
+
 extern void _g_mime_object_set_content_type (GMimeObject *object, GMimeContentType *content_type);
 
 static void g_mime_parser_class_init (GMimeParserClass *klass);
@@ -99,8 +135,9 @@ static GMimeObject *parser_construct_multipart (GMimeParser *parser, ContentType
 
 static GObjectClass *parent_class = NULL;
 
-/* size of read buffer */
+/* default and maximum size of the read buffer */
 #define SCAN_BUF 4096
+#define SCAN_BUF_MAX (16 * 1024 * 1024)
 
 /* headroom guaranteed to be before each read buffer */
 #define SCAN_HEAD 128
@@ -108,6 +145,8 @@ static GObjectClass *parent_class = NULL;
 /* conservative growth sizes */
 #define HEADER_INIT_SIZE 128
 #define HEADER_RAW_INIT_SIZE 1024
+#define HEADER_ARENA_BLOCK_SIZE 4096
+#define HEADER_ARENA_BLOCK_MAX (64 * 1024)
 
 
 enum {
@@ -126,8 +165,10 @@ struct _GMimeParserPrivate {
 	
 	gint64 offset;
 	
-	/* i/o buffers */
-	char realbuf[SCAN_HEAD + SCAN_BUF + 4];
+	/* i/o buffers (inptr and inend point into the stream's own
+	 * memory rather than realbuf when mapped is set) */
+	char *realbuf;
+	size_t bufsize;
 	char *inbuf;
 	char *inptr;
 	char *inend;
@@ -167,7 +208,12 @@ struct _GMimeParserPrivate {
 	
 	short int state;
 	
-	unsigned short int unused:10;
+	unsigned short int unused:5;
+	unsigned short int spill_failed:1;
+	unsigned short int content_stats:1;
+	unsigned short int events:1;
+	unsigned short int headers_only:1;
+	unsigned short int mapped:1;
 	unsigned short int midline:1;
 	unsigned short int seekable:1;
 	unsigned short int scan_from:1;
@@ -177,7 +223,41 @@ struct _GMimeParserPrivate {
 	
 	HeaderRaw *headers;
 	
+	/* storage for the headers list, released all at once */
+	HeaderArenaBlock *arena;
+	char *arenaptr;
+	size_t arenaleft;
+	
 	BoundaryStack *bounds;
+	
+	/* vectorized content scanner or NULL */
+	ScanBoundaryFunc scan_boundary;
+	
+	/* push mode state, see g_mime_parser_feed() */
+	GMimeParserCallbacks callbacks;
+	gpointer callback_data;
+	PartStack *parts;
+	char held[2];
+	size_t nheld;
+	
+	/* statistics about the content being scanned, or NULL */
+	GMimeFilterBest *best;
+	char best_held[2];
+	size_t best_nheld;
+	
+	/* where the content being scanned is saved or NULL, and the
+	 * run of scanned content not yet written to it */
+	GMimeStream *store;
+	const char *pending;
+	size_t npending;
+	
+	/* how much content of the current message may be kept in
+	 * memory (or -1), how much is, and the temporary file the rest
+	 * is spilled to */
+	gint64 memory_limit;
+	gint64 memory_used;
+	GMimeStream *spill;
+	gint64 spill_start;
 };
 
 static const char MBOX_BOUNDARY[6] = "From ";
@@ -248,23 +328,103 @@ header_raw_find (HeaderRaw *headers, const char *name, gint64 *offset)
 	return NULL;
 }
 
+static void *
+header_arena_alloc (struct _GMimeParserPrivate *priv, size_t size, size_t align)
+{
+	HeaderArenaBlock *block;
+	size_t pad, len;
+	char *ptr;
+	
+	pad = (align - ((size_t) priv->arenaptr & (align - 1))) & (align - 1);
+	
+	if (priv->arenaleft < size + pad) {
+		len = MAX (HEADER_ARENA_BLOCK_SIZE, HEADER_ARENA_BLOCK_HEAD + size);
+		block = g_malloc (len);
+		block->next = priv->arena;
+		block->size = len;
+		
+		priv->arena = block;
+		priv->arenaptr = ((char *) block) + HEADER_ARENA_BLOCK_HEAD;
+		priv->arenaleft = len - HEADER_ARENA_BLOCK_HEAD;
+		pad = 0;
+	}
+	
+	ptr = priv->arenaptr + pad;
+	priv->arenaptr = ptr + size;
+	priv->arenaleft -= size + pad;
+	
+	return ptr;
+}
+
+static char *
+header_arena_strndup (struct _GMimeParserPrivate *priv, const char *str, size_t n)
+{
+	char *dup;
+	
+	dup = header_arena_alloc (priv, n + 1, 1);
+	memcpy (dup, str, n);
+	dup[n] = '\0';
+	
+	return dup;
+}
+
 static void
-header_raw_clear (HeaderRaw **headers)
+header_arena_free (struct _GMimeParserPrivate *priv)
 {
-	HeaderRaw *header, *next;
+	HeaderArenaBlock *block, *next;
 	
-	header = *headers;
-	while (header) {
-		next = header->next;
-		g_free (header->name);
-		g_free (header->value);
+	block = priv->arena;
+	while (block) {
+		next = block->next;
+		g_free (block);
+		block = next;
+	}
+	
+	priv->arena = NULL;
+	priv->arenaptr = NULL;
+	priv->arenaleft = 0;
+}
+
+static void
+header_raw_clear (struct _GMimeParserPrivate *priv)
+{
+	HeaderArenaBlock *block;
+	size_t size = 0;
+	
+	priv->headers = NULL;
+	
+	if (!(block = priv->arena))
+		return;
+	
+	if (block->next) {
+		/* the last header block did not fit; replace the arena
+		 * with a single block big enough to hold it next time,
+		 * within reason */
+		while (block) {
+			size += block->size;
+			block = block->next;
+		}
+		
+		size = MIN (size, HEADER_ARENA_BLOCK_MAX);
+	} else if (block->size > HEADER_ARENA_BLOCK_SIZE &&
+		   (size_t) (priv->arenaptr - (char *) block) <= HEADER_ARENA_BLOCK_SIZE) {
+		/* the last header block would have fit in a block of the
+		 * default size, so give back what a bigger one needed */
+		size = HEADER_ARENA_BLOCK_SIZE;
+	}
+	
+	if (size > 0) {
+		header_arena_free (priv);
 		
-		g_slice_free (HeaderRaw, header);
+		block = g_malloc (size);
+		block->next = NULL;
+		block->size = size;
 		
-		header = next;
+		priv->arena = block;
 	}
 	
-	*headers = NULL;
+	priv->arenaptr = ((char *) block) + HEADER_ARENA_BLOCK_HEAD;
+	priv->arenaleft = block->size - HEADER_ARENA_BLOCK_HEAD;
 }
 
 GType
@@ -302,14 +462,26 @@ g_mime_parser_class_init (GMimeParserClass *klass)
 	object_class->finalize = g_mime_parser_finalize;
 }
 
+static ScanBoundaryFunc scan_boundary_func (void);
+
 static void
 g_mime_parser_init (GMimeParser *parser, GMimeParserClass *klass)
 {
 	parser->priv = g_new (struct _GMimeParserPrivate, 1);
+	parser->priv->realbuf = g_malloc (SCAN_HEAD + SCAN_BUF + 4);
+	parser->priv->bufsize = SCAN_BUF;
+	parser->priv->scan_boundary = scan_boundary_func ();
 	parser->priv->respect_content_length = FALSE;
 	parser->priv->persist_stream = TRUE;
+	parser->priv->headers_only = FALSE;
 	parser->priv->have_regex = FALSE;
 	parser->priv->scan_from = FALSE;
+	parser->priv->events = FALSE;
+	parser->priv->content_stats = FALSE;
+	parser->priv->memory_limit = -1;
+	
+	memset (&parser->priv->callbacks, 0, sizeof (GMimeParserCallbacks));
+	parser->priv->callback_data = NULL;
 	
 #if defined (HAVE_GLIB_REGEX)
 	parser->priv->regex = NULL;
@@ -333,12 +505,68 @@ g_mime_parser_finalize (GObject *object)
 		regfree (&parser->priv->regex);
 #endif
 	
+	g_free (parser->priv->realbuf);
 	g_free (parser->priv);
 	
 	G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
 
+/* Streams that keep their entire content in memory (GMimeStreamMmap
+ * and GMimeStreamMem) are scanned in place rather than being copied
+ * into realbuf 4k at a time. The window ends on the last '\n' of the
+ * stream so that *inend is already the sentinel that the scanners
+ * depend on (see optimization comment [1]) and we never have to write
+ * into the stream's memory. Whatever follows that '\n' is read into
+ * realbuf as usual once the window has been consumed. */
+static gboolean
+parser_map_stream (struct _GMimeParserPrivate *priv)
+{
+	GMimeStream *stream = priv->stream;
+	char *map, *inptr, *inend;
+	GByteArray *buffer;
+	gint64 end;
+	
+	if (G_OBJECT_TYPE (stream) == GMIME_TYPE_STREAM_MMAP) {
+		map = ((GMimeStreamMmap *) stream)->map;
+		end = ((GMimeStreamMmap *) stream)->maplen;
+	} else if (G_OBJECT_TYPE (stream) == GMIME_TYPE_STREAM_MEM) {
+		if (!(buffer = ((GMimeStreamMem *) stream)->buffer))
+			return FALSE;
+		
+		map = (char *) buffer->data;
+		end = buffer->len;
+	} else {
+		return FALSE;
+	}
+	
+	if (stream->bound_end != -1 && stream->bound_end < end)
+		end = stream->bound_end;
+	
+	if (map == NULL || stream->position >= end)
+		return FALSE;
+	
+	inptr = map + stream->position;
+	inend = map + end;
+	
+	while (inend > inptr && inend[-1] != '\n')
+		inend--;
+	
+	if (inend - inptr < 2)
+		return FALSE;
+	
+	inend--;
+	
+	if (g_mime_stream_seek (stream, inend - map, GMIME_STREAM_SEEK_SET) == -1)
+		return FALSE;
+	
+	priv->offset = inend - map;
+	priv->inptr = inptr;
+	priv->inend = inend;
+	
+	return TRUE;
+}
+
 static void
 parser_init (GMimeParser *parser, GMimeStream *stream)
 {
@@ -390,7 +618,27 @@ parser_init (GMimeParser *parser, GMimeStream *stream)
 	
 	priv->headers = NULL;
 	
+	priv->arena = NULL;
+	priv->arenaptr = NULL;
+	priv->arenaleft = 0;
+	
 	priv->bounds = NULL;
+	
+	priv->parts = NULL;
+	priv->nheld = 0;
+	
+	priv->best = NULL;
+	priv->best_nheld = 0;
+	
+	priv->store = NULL;
+	priv->pending = NULL;
+	priv->npending = 0;
+	
+	priv->memory_used = 0;
+	priv->spill_failed = FALSE;
+	priv->spill = NULL;
+	
+	priv->mapped = stream ? parser_map_stream (priv) : FALSE;
 }
 
 static void
@@ -406,10 +654,27 @@ parser_close (GMimeParser *parser)
 	g_free (priv->headerbuf);
 	g_free (priv->rawbuf);
 	
-	header_raw_clear (&priv->headers);
+	header_raw_clear (priv);
+	header_arena_free (priv);
 	
 	while (priv->bounds)
 		parser_pop_boundary (parser);
+	
+	while (priv->parts) {
+		PartStack *part = priv->parts;
+		
+		priv->parts = part->parent;
+		g_slice_free (PartStack, part);
+	}
+	
+	if (priv->best)
+		g_object_unref (priv->best);
+	
+	if (priv->store)
+		g_object_unref (priv->store);
+	
+	if (priv->spill)
+		g_object_unref (priv->spill);
 }
 
 
@@ -529,23 +794,21 @@ g_mime_parser_set_persist_stream (GMimeParser *parser, gboolean persist)
 	if (priv->persist_stream == persist)
 		return;
 	
-	if (persist) {
-		priv->persist_stream = TRUE;
-		
-		if (priv->seekable && !priv->rawbuf) {
-			priv->rawbuf = g_malloc (HEADER_RAW_INIT_SIZE);
-			priv->rawleft = HEADER_RAW_INIT_SIZE - 1;
-			priv->rawptr = priv->rawbuf;
-		}
-	} else {
-		priv->persist_stream = FALSE;
-		
+	priv->persist_stream = persist ? 1 : 0;
+	
+	/* the raw headers are only copied when they can't be gotten
+	 * back from the stream */
+	if (persist && priv->seekable) {
 		if (priv->rawbuf) {
 			g_free (priv->rawbuf);
 			priv->rawbuf = NULL;
 			priv->rawptr = NULL;
 			priv->rawleft = 0;
 		}
+	} else if (!priv->rawbuf) {
+		priv->rawbuf = g_malloc (HEADER_RAW_INIT_SIZE);
+		priv->rawleft = HEADER_RAW_INIT_SIZE - 1;
+		priv->rawptr = priv->rawbuf;
 	}
 }
 
@@ -628,6 +891,213 @@ g_mime_parser_set_respect_content_length (GMimeParser *parser, gboolean respect_
 }
 
 
+/**
+ * g_mime_parser_get_headers_only:
+ * @parser: a #GMimeParser context
+ *
+ * Gets whether or not @parser is set to only parse message headers.
+ *
+ * Returns: whether or not @parser is set to only parse message
+ * headers.
+ **/
+gboolean
+g_mime_parser_get_headers_only (GMimeParser *parser)
+{
+	g_return_val_if_fail (GMIME_IS_PARSER (parser), FALSE);
+	
+	return parser->priv->headers_only;
+}
+
+
+/**
+ * g_mime_parser_set_headers_only:
+ * @parser: a #GMimeParser context
+ * @headers_only: %TRUE if the parser should stop after the message headers or %FALSE otherwise.
+ *
+ * Sets whether or not g_mime_parser_construct_message() should stop
+ * once it has parsed the message headers. The returned message has a
+ * toplevel mime part with the message's Content-* headers but no
+ * content or subparts.
+ *
+ * When @parser is also set to scan for From-lines, the message body
+ * is skipped without being parsed or copied, by looking for nothing
+ * but the next From-line. If @parser respects Content-Length and the
+ * stream is seekable, a Content-Length header that points at the next
+ * From-line lets @parser seek straight past the body instead. This makes
+ * building a summary of an mbox proportional to the size of the
+ * message headers rather than to the size of the mbox.
+ *
+ * When @parser is not scanning for From-lines, it is left positioned
+ * at the start of the message content.
+ *
+ * By default, this feature is disabled.
+ **/
+void
+g_mime_parser_set_headers_only (GMimeParser *parser, gboolean headers_only)
+{
+	g_return_if_fail (GMIME_IS_PARSER (parser));
+	
+	parser->priv->headers_only = headers_only ? 1 : 0;
+}
+
+
+/**
+ * g_mime_parser_get_content_stats:
+ * @parser: a #GMimeParser context
+ *
+ * Gets whether or not @parser gathers statistics about the content of
+ * the mime parts it parses.
+ *
+ * Returns: whether or not @parser gathers content statistics.
+ **/
+gboolean
+g_mime_parser_get_content_stats (GMimeParser *parser)
+{
+	g_return_val_if_fail (GMIME_IS_PARSER (parser), FALSE);
+	
+	return parser->priv->content_stats;
+}
+
+
+/**
+ * g_mime_parser_set_content_stats:
+ * @parser: a #GMimeParser context
+ * @content_stats: %TRUE if the parser should gather content statistics or %FALSE otherwise.
+ *
+ * Sets whether or not @parser should keep track of the number of
+ * 8bit and nul bytes, the longest line and the presence of From-lines
+ * in the content of each mime part that has no transfer encoding as
+ * it scans it.
+ *
+ * g_mime_part_get_best_content_encoding() and g_mime_object_encode()
+ * then use these statistics rather than reading the content again.
+ *
+ * By default, this feature is disabled.
+ **/
+void
+g_mime_parser_set_content_stats (GMimeParser *parser, gboolean content_stats)
+{
+	g_return_if_fail (GMIME_IS_PARSER (parser));
+	
+	parser->priv->content_stats = content_stats ? 1 : 0;
+}
+
+
+/**
+ * g_mime_parser_get_memory_limit:
+ * @parser: a #GMimeParser context
+ *
+ * Gets how many bytes of the content of each message @parser may keep
+ * in memory.
+ *
+ * Returns: the memory limit, in bytes, or %-1 if there is none.
+ **/
+gint64
+g_mime_parser_get_memory_limit (GMimeParser *parser)
+{
+	g_return_val_if_fail (GMIME_IS_PARSER (parser), -1);
+	
+	return parser->priv->memory_limit;
+}
+
+
+/**
+ * g_mime_parser_set_memory_limit:
+ * @parser: a #GMimeParser context
+ * @limit: the memory limit, in bytes, or %-1 for none
+ *
+ * Sets how many bytes of the content of each message @parser may keep
+ * in memory when it cannot persist the stream it is parsing (see
+ * g_mime_parser_set_persist_stream()), as is the case with pipes and
+ * sockets.
+ *
+ * The content of a part that would take the content of its message
+ * kept in memory past @limit is written to an unlinked temporary file
+ * instead, and the part gets a #GMimeStreamFs substream of it. Each
+ * message gets its own file, which goes away once none of its parts
+ * need it any longer. If the file cannot be written, the content is
+ * kept in memory after all.
+ *
+ * By default, there is no limit.
+ **/
+void
+g_mime_parser_set_memory_limit (GMimeParser *parser, gint64 limit)
+{
+	g_return_if_fail (GMIME_IS_PARSER (parser));
+	
+	parser->priv->memory_limit = limit < 0 ? -1 : limit;
+}
+
+
+/**
+ * g_mime_parser_get_buffer_size:
+ * @parser: a #GMimeParser context
+ *
+ * Gets the size of the buffer that @parser reads its stream into.
+ *
+ * Returns: the size of the read buffer, in bytes.
+ **/
+size_t
+g_mime_parser_get_buffer_size (GMimeParser *parser)
+{
+	g_return_val_if_fail (GMIME_IS_PARSER (parser), 0);
+	
+	return parser->priv->bufsize;
+}
+
+
+/**
+ * g_mime_parser_set_buffer_size:
+ * @parser: a #GMimeParser context
+ * @size: the size of the read buffer, in bytes
+ *
+ * Sets the size of the buffer that @parser reads its stream into.
+ *
+ * Larger buffers mean fewer, larger reads from the underlying stream
+ * which can make a big difference when parsing large messages or
+ * mbox files from a #GMimeStreamFs. The size is clamped to between
+ * 4 KB (the default) and 16 MB.
+ *
+ * This may be changed at any time, even part way through parsing a
+ * stream. The buffer will never shrink below the amount of data that
+ * the @parser has read but not yet consumed.
+ **/
+void
+g_mime_parser_set_buffer_size (GMimeParser *parser, size_t size)
+{
+	struct _GMimeParserPrivate *priv;
+	size_t inlen = 0;
+	char *realbuf;
+	
+	g_return_if_fail (GMIME_IS_PARSER (parser));
+	
+	priv = parser->priv;
+	
+	/* if we are scanning a mapped stream, realbuf is empty */
+	if (!priv->mapped)
+		inlen = priv->inend - priv->inptr;
+	
+	size = CLAMP (size, SCAN_BUF, SCAN_BUF_MAX);
+	size = MAX (size, inlen);
+	
+	if (size == priv->bufsize)
+		return;
+	
+	realbuf = g_malloc (SCAN_HEAD + size + 4);
+	
+	if (!priv->mapped) {
+		memcpy (realbuf + SCAN_HEAD, priv->inptr, inlen);
+		priv->inptr = realbuf + SCAN_HEAD;
+		priv->inend = priv->inptr + inlen;
+	}
+	
+	g_free (priv->realbuf);
+	priv->inbuf = realbuf + SCAN_HEAD;
+	priv->realbuf = realbuf;
+	priv->bufsize = size;
+}
+
+
 /**
  * g_mime_parser_set_header_regex:
  * @parser: a #GMimeParser context
@@ -696,6 +1166,16 @@ parser_fill (GMimeParser *parser, size_t atleast)
 	if (inlen > atleast)
 		return inlen;
 	
+	if (priv->mapped) {
+		/* we've used up the mapped window, seek back to inptr and
+		 * read whatever is left into realbuf like any other stream */
+		priv->offset -= inlen;
+		g_mime_stream_seek (priv->stream, priv->offset, GMIME_STREAM_SEEK_SET);
+		inptr = inend = inbuf;
+		priv->mapped = FALSE;
+		inlen = 0;
+	}
+	
 	/* attempt to align 'inend' with realbuf + SCAN_HEAD */
 	if (inptr >= inbuf) {
 		inbuf -= inlen < SCAN_HEAD ? inlen : SCAN_HEAD;
@@ -716,7 +1196,7 @@ parser_fill (GMimeParser *parser, size_t atleast)
 	
 	priv->inptr = inptr;
 	priv->inend = inbuf;
-	inend = priv->realbuf + SCAN_HEAD + SCAN_BUF;
+	inend = priv->realbuf + SCAN_HEAD + priv->bufsize;
 	
 	if ((nread = g_mime_stream_read (priv->stream, inbuf, inend - inbuf)) > 0) {
 		priv->offset += nread;
@@ -746,6 +1226,10 @@ parser_offset (struct _GMimeParserPrivate *priv, const char *inptr)
  *
  * Gets the current stream offset from the parser's internal stream.
  *
+ * When @parser is being fed with g_mime_parser_feed(), this is the
+ * offset of the line currently being parsed, counting from the first
+ * byte that was ever fed to @parser.
+ *
  * Returns: the current stream offset from the parser's internal stream
  * or %-1 on error.
  **/
@@ -753,7 +1237,6 @@ gint64
 g_mime_parser_tell (GMimeParser *parser)
 {
 	g_return_val_if_fail (GMIME_IS_PARSER (parser), -1);
-	g_return_val_if_fail (GMIME_IS_STREAM (parser->priv->stream), -1);
 	
 	return parser_offset (parser->priv, NULL);
 }
@@ -804,7 +1287,8 @@ parser_step_from (GMimeParser *parser)
 		
 		inptr = priv->inptr;
 		inend = priv->inend;
-		*inend = '\n';
+		if (!priv->mapped)
+			*inend = '\n';
 		
 		while (inptr < inend) {
 			start = inptr;
@@ -926,6 +1410,7 @@ header_parse (GMimeParser *parser, HeaderRaw **tail)
 {
 	struct _GMimeParserPrivate *priv = parser->priv;
 	register char *inptr;
+	char *start, *end;
 	HeaderRaw *header;
 	
 	*priv->headerptr = '\0';
@@ -945,11 +1430,23 @@ header_parse (GMimeParser *parser, HeaderRaw **tail)
 		return;
 	}
 	
-	header = g_slice_new (HeaderRaw);
+	header = header_arena_alloc (priv, sizeof (HeaderRaw), G_MEM_ALIGN);
 	header->next = NULL;
 	
-	header->name = g_strndup (priv->headerbuf, (size_t) (inptr - priv->headerbuf));
-	header->value = g_mime_strdup_trim (inptr + 1);
+	header->name = header_arena_strndup (priv, priv->headerbuf, (size_t) (inptr - priv->headerbuf));
+	
+	/* trim the value the same way as g_mime_strdup_trim() */
+	inptr++;
+	while (is_lwsp (*inptr))
+		inptr++;
+	
+	start = end = inptr;
+	while (*inptr) {
+		if (!is_lwsp (*inptr++))
+			end = inptr;
+	}
+	
+	header->value = header_arena_strndup (priv, start, (size_t) (end - start));
 	
 	header->offset = priv->header_offset;
 	
@@ -1034,7 +1531,7 @@ parser_step_headers (GMimeParser *parser)
 	
 	priv->midline = FALSE;
 	raw_header_reset (priv);
-	header_raw_clear (&priv->headers);
+	header_raw_clear (priv);
 	tail = (HeaderRaw *) &priv->headers;
 	priv->headers_begin = parser_offset (priv, NULL);
 	priv->header_offset = priv->headers_begin;
@@ -1050,7 +1547,8 @@ parser_step_headers (GMimeParser *parser)
 		inptr = priv->inptr;
 		inend = priv->inend;
 		/* Note: see optimization comment [1] */
-		*inend = '\n';
+		if (!priv->mapped)
+			*inend = '\n';
 		
 		g_assert (inptr <= inend);
 		
@@ -1070,10 +1568,7 @@ parser_step_headers (GMimeParser *parser)
 			if (fieldname && !eoln) {
 				/* scan and validate the field name */
 				if (*inptr != ':') {
-					/* Note: see optimization comment [1] */
-					*inend = ':';
-					
-					while (*inptr != ':') {
+					while (inptr < inend && *inptr != ':') {
 						if (is_type (*inptr, IS_SPACE | IS_CTRL)) {
 							valid = FALSE;
 							break;
@@ -1088,9 +1583,6 @@ parser_step_headers (GMimeParser *parser)
 						priv->inptr = start;
 						goto refill;
 					}
-					
-					/* Note: see optimization comment [1] */
-					*inend = '\n';
 				} else {
 					valid = FALSE;
 				}
@@ -1240,7 +1732,7 @@ content_type_is_type (ContentType *content_type, const char *type, const char *s
 }
 
 static ContentType *
-parser_content_type (GMimeParser *parser, GMimeContentType *parent)
+parser_content_type (GMimeParser *parser, gboolean digest)
 {
 	struct _GMimeParserPrivate *priv = parser->priv;
 	ContentType *content_type;
@@ -1250,7 +1742,7 @@ parser_content_type (GMimeParser *parser, GMimeContentType *parent)
 	
 	if (!(value = header_raw_find (priv->headers, "Content-Type", NULL)) ||
 	    !g_mime_parse_content_type (&value, &content_type->type, &content_type->subtype)) {
-		if (parent != NULL && g_mime_content_type_is_type (parent, "multipart", "digest")) {
+		if (digest) {
 			content_type->type = g_strdup ("message");
 			content_type->subtype = g_strdup ("rfc822");
 		} else {
@@ -1275,7 +1767,8 @@ parser_skip_line (GMimeParser *parser)
 	do {
 		inptr = priv->inptr;
 		inend = priv->inend;
-		*inend = '\n';
+		if (!priv->mapped)
+			*inend = '\n';
 		
 		while (*inptr != '\n')
 			inptr++;
@@ -1355,54 +1848,219 @@ enum {
 	FOUND_END_BOUNDARY
 };
 
-#define content_save(content, start, len) G_STMT_START {                     \
-	if (content)                                                         \
-		g_byte_array_append (content, (unsigned char *) start, len); \
-} G_STMT_END
-
-#define possible_boundary(scan_from, start, len)                                      \
-                         ((scan_from && len >= 5 && !strncmp (start, "From ", 5)) ||  \
-			  (len >= 2 && (start[0] == '-' && start[1] == '-')))
-
-static gboolean
-is_boundary (const char *text, size_t len, const char *boundary, size_t boundary_len)
+/* Like the content handed to the callbacks, the content statistics
+ * have to hold back the last end-of-line in case it belongs to a
+ * boundary. */
+static void
+content_stats_step (GMimeParser *parser, const char *content, size_t len)
 {
-	const char *inptr = text + boundary_len;
-	const char *inend = text + len;
-	
-	if (boundary_len > len)
-		return FALSE;
-	
-	/* make sure that the text matches the boundary */
-	if (strncmp (text, boundary, boundary_len) != 0)
-		return FALSE;
-	
-	if (!strncmp (text, "From ", 5))
-		return TRUE;
+	struct _GMimeParserPrivate *priv = parser->priv;
+	size_t outlen, outprespace;
+	char *outbuf;
 	
-	/* the boundary may be optionally followed by linear whitespace */
-	while (inptr < inend) {
-		if (!is_lwsp (*inptr))
-			return FALSE;
+	if (len >= 2) {
+		if (priv->best_nheld > 0)
+			g_mime_filter_filter ((GMimeFilter *) priv->best, priv->best_held, priv->best_nheld, 0,
+					      &outbuf, &outlen, &outprespace);
 		
-		inptr++;
+		g_mime_filter_filter ((GMimeFilter *) priv->best, (char *) content, len - 2, 0,
+				      &outbuf, &outlen, &outprespace);
+		memcpy (priv->best_held, content + len - 2, 2);
+		priv->best_nheld = 2;
+	} else if (len == 1) {
+		if (priv->best_nheld == 2) {
+			g_mime_filter_filter ((GMimeFilter *) priv->best, priv->best_held, 1, 0,
+					      &outbuf, &outlen, &outprespace);
+			priv->best_held[0] = priv->best_held[1];
+			priv->best_nheld = 1;
+		}
+		
+		priv->best_held[priv->best_nheld++] = content[0];
 	}
-	
-	return TRUE;
 }
 
-static int
-check_boundary (struct _GMimeParserPrivate *priv, const char *start, size_t len)
+static GMimeFilterBest *
+content_stats_end (GMimeParser *parser, guint crlf)
 {
-	gint64 offset = parser_offset (priv, start);
+	struct _GMimeParserPrivate *priv = parser->priv;
+	GMimeFilterBest *best = priv->best;
+	size_t outlen, outprespace;
+	char *outbuf;
 	
-	if (len > 0 && start[len - 1] == '\r')
-		len--;
+	g_mime_filter_complete ((GMimeFilter *) best, priv->best_held,
+				priv->best_nheld > crlf ? priv->best_nheld - crlf : 0, 0,
+				&outbuf, &outlen, &outprespace);
 	
-	if (possible_boundary (priv->scan_from, start, len)) {
-		BoundaryStack *s;
-		
-		d(printf ("checking boundary '%.*s'\n", len, start));
+	priv->best_nheld = 0;
+	priv->best = NULL;
+	
+	return best;
+}
+
+static GMimeStream *
+content_spill_new (void)
+{
+	char *path;
+	int fd;
+	
+	if ((fd = g_file_open_tmp ("gmime-XXXXXX", &path, NULL)) == -1)
+		return NULL;
+	
+	/* only the streams of the parts need to get at it (Note: this
+	 * fails on win32, which cannot unlink a file that is open) */
+	g_unlink (path);
+	g_free (path);
+	
+	return g_mime_stream_fs_new (fd);
+}
+
+/* Moves the content saved so far to the spill file and saves the rest
+ * of it there too. */
+static void
+content_store_spill (GMimeParser *parser)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	
+	if (priv->spill == NULL && !(priv->spill = content_spill_new ())) {
+		priv->spill_failed = TRUE;
+		return;
+	}
+	
+	priv->spill_start = g_mime_stream_tell (priv->spill);
+	
+	g_mime_stream_reset (priv->store);
+	if (g_mime_stream_write_to_stream (priv->store, priv->spill) == -1) {
+		/* keep appending to what is in memory */
+		g_mime_stream_seek (priv->store, 0, GMIME_STREAM_SEEK_END);
+		g_mime_stream_seek (priv->spill, priv->spill_start, GMIME_STREAM_SEEK_SET);
+		priv->spill_failed = TRUE;
+		return;
+	}
+	
+	g_object_unref (priv->store);
+	priv->store = g_object_ref (priv->spill);
+}
+
+/* Moves the content saved in the spill file up to @end back to memory
+ * when the spill file cannot be written to any more, so that the rest
+ * of it gets kept in memory too. */
+static void
+content_store_unspill (GMimeParser *parser, gint64 end)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	GMimeStream *saved;
+	
+	g_object_unref (priv->store);
+	priv->store = g_mime_stream_chunked_new ();
+	priv->spill_failed = TRUE;
+	
+	saved = g_mime_stream_substream (priv->spill, priv->spill_start, end);
+	if (g_mime_stream_write_to_stream (saved, priv->store) == -1)
+		w(g_warning ("Failed to read back content from the spill file: %s",
+			     g_strerror (errno)));
+	g_object_unref (saved);
+	
+	g_mime_stream_seek (priv->spill, priv->spill_start, GMIME_STREAM_SEEK_SET);
+}
+
+/* The lines saved from one scan window follow each other in the read
+ * buffer, so they are written to the content store as one run once
+ * the window is done with (or something else comes in between). */
+static void
+content_store_flush (GMimeParser *parser)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	gint64 end;
+	
+	if (priv->npending > 0) {
+		if (priv->memory_limit != -1 && priv->store != priv->spill && !priv->spill_failed &&
+		    priv->memory_used + g_mime_stream_length (priv->store) + (gint64) priv->npending > priv->memory_limit)
+			content_store_spill (parser);
+		
+		if (priv->store == priv->spill) {
+			end = g_mime_stream_tell (priv->spill);
+			if (g_mime_stream_write (priv->spill, priv->pending, priv->npending) != (ssize_t) priv->npending) {
+				content_store_unspill (parser, end);
+				g_mime_stream_write (priv->store, priv->pending, priv->npending);
+			}
+		} else {
+			g_mime_stream_write (priv->store, priv->pending, priv->npending);
+		}
+	}
+	
+	priv->pending = NULL;
+	priv->npending = 0;
+}
+
+static void
+content_store (GMimeParser *parser, const char *content, size_t len)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	
+	if (priv->pending + priv->npending != content) {
+		content_store_flush (parser);
+		priv->pending = content;
+	}
+	
+	priv->npending += len;
+}
+
+#define content_save(parser, content, start, len) G_STMT_START {             \
+	if (parser->priv->best)                                              \
+		content_stats_step (parser, start, len);                     \
+	if (content)                                                         \
+		g_byte_array_append (content, (unsigned char *) start, len); \
+	else if (parser->priv->store)                                        \
+		content_store (parser, start, len);                          \
+	else if (parser->priv->events)                                       \
+		parser_emit_content (parser, start, len);                    \
+} G_STMT_END
+
+#define possible_boundary(scan_from, start, len)                                      \
+                         ((scan_from && len >= 5 && !strncmp (start, "From ", 5)) ||  \
+			  (len >= 2 && (start[0] == '-' && start[1] == '-')))
+
+#define possible_boundary_start(scan_from, c) ((c) == '-' || (scan_from && (c) == 'F'))
+
+static gboolean
+is_boundary (const char *text, size_t len, const char *boundary, size_t boundary_len)
+{
+	const char *inptr = text + boundary_len;
+	const char *inend = text + len;
+	
+	if (boundary_len > len)
+		return FALSE;
+	
+	/* make sure that the text matches the boundary */
+	if (strncmp (text, boundary, boundary_len) != 0)
+		return FALSE;
+	
+	if (!strncmp (text, "From ", 5))
+		return TRUE;
+	
+	/* the boundary may be optionally followed by linear whitespace */
+	while (inptr < inend) {
+		if (!is_lwsp (*inptr))
+			return FALSE;
+		
+		inptr++;
+	}
+	
+	return TRUE;
+}
+
+static int
+check_boundary (struct _GMimeParserPrivate *priv, const char *start, size_t len)
+{
+	gint64 offset = parser_offset (priv, start);
+	
+	if (len > 0 && start[len - 1] == '\r')
+		len--;
+	
+	if (possible_boundary (priv->scan_from, start, len)) {
+		BoundaryStack *s;
+		
+		d(printf ("checking boundary '%.*s'\n", len, start));
 		
 		s = priv->bounds;
 		while (s) {
@@ -1436,7 +2094,8 @@ found_immediate_boundary (struct _GMimeParserPrivate *priv, gboolean end)
 	char *inend = priv->inend;
 	
 	/* Note: see optimization comment [1] */
-	*inend = '\n';
+	if (!priv->mapped)
+		*inend = '\n';
 	while (*inptr != '\n')
 		inptr++;
 	
@@ -1451,8 +2110,167 @@ found_immediate_boundary (struct _GMimeParserPrivate *priv, gboolean end)
  * inend every trip through our inner while-loop. This cuts the number
  * of instructions down from ~7 to ~4, assuming the compiler does its
  * job correctly ;-)
+ *
+ * When the parser is scanning a mapped stream in place, '*inend' is
+ * the last '\n' in the stream and must not be written to, see
+ * parser_map_stream().
+ **/
+
+
+/* Scanning content one line at a time means a trip through
+ * check_boundary() for every line. Only lines beginning with '-' (or
+ * 'F' when scanning From-lines) can ever match, so the vectorized
+ * scanners below look for the end of a line and the first character
+ * of the following line at the same time, 16 or 32 bytes per
+ * iteration.
+ *
+ * They return a pointer to the first '\n' in [inptr, inend) that is
+ * followed by a possible boundary line, or inend if there is none.
+ *
+ * Note: see optimization comment [1]; *inend is always a readable
+ * '\n', which can never be followed by a boundary line of its own.
  **/
+#ifdef GMIME_X86_SIMD
+static char *
+scan_boundary_tail (char *inptr, char *inend, gboolean scan_from)
+{
+	while (inptr < inend) {
+		if (*inptr == '\n' && possible_boundary_start (scan_from, inptr[1]))
+			return inptr;
+		
+		inptr++;
+	}
+	
+	return inend;
+}
+
+GMIME_TARGET ("sse2") static char *
+scan_boundary_sse2 (char *inptr, char *inend, gboolean scan_from)
+{
+	const __m128i from = _mm_set1_epi8 (scan_from ? 'F' : '-');
+	const __m128i dash = _mm_set1_epi8 ('-');
+	const __m128i eoln = _mm_set1_epi8 ('\n');
+	__m128i cur, next, mask;
+	int bits;
+	
+	while (inend - inptr >= 16) {
+		cur = _mm_loadu_si128 ((const __m128i *) inptr);
+		next = _mm_loadu_si128 ((const __m128i *) (inptr + 1));
+		
+		mask = _mm_or_si128 (_mm_cmpeq_epi8 (next, dash), _mm_cmpeq_epi8 (next, from));
+		mask = _mm_and_si128 (_mm_cmpeq_epi8 (cur, eoln), mask);
+		
+		if ((bits = _mm_movemask_epi8 (mask)) != 0)
+			return inptr + __builtin_ctz (bits);
+		
+		inptr += 16;
+	}
+	
+	return scan_boundary_tail (inptr, inend, scan_from);
+}
+
+GMIME_TARGET ("avx2") static char *
+scan_boundary_avx2 (char *inptr, char *inend, gboolean scan_from)
+{
+	const __m256i from = _mm256_set1_epi8 (scan_from ? 'F' : '-');
+	const __m256i dash = _mm256_set1_epi8 ('-');
+	const __m256i eoln = _mm256_set1_epi8 ('\n');
+	__m256i cur, next, mask;
+	unsigned int bits;
+	
+	while (inend - inptr >= 32) {
+		cur = _mm256_loadu_si256 ((const __m256i *) inptr);
+		next = _mm256_loadu_si256 ((const __m256i *) (inptr + 1));
+		
+		mask = _mm256_or_si256 (_mm256_cmpeq_epi8 (next, dash), _mm256_cmpeq_epi8 (next, from));
+		mask = _mm256_and_si256 (_mm256_cmpeq_epi8 (cur, eoln), mask);
+		
+		if ((bits = (unsigned int) _mm256_movemask_epi8 (mask)) != 0)
+			return inptr + __builtin_ctz (bits);
+		
+		inptr += 32;
+	}
+	
+	return scan_boundary_sse2 (inptr, inend, scan_from);
+}
+#endif /* GMIME_X86_SIMD */
+
+static ScanBoundaryFunc
+scan_boundary_func (void)
+{
+#ifdef GMIME_X86_SIMD
+	if (g_mime_simd_has (GMIME_SIMD_AVX2))
+		return scan_boundary_avx2;
+	
+	if (g_mime_simd_has (GMIME_SIMD_SSE2))
+		return scan_boundary_sse2;
+#endif
+	
+	/* the word-at-a-time line scanner in parser_scan_content() */
+	return NULL;
+}
+
+/* The last end-of-line before a boundary belongs to the boundary, so
+ * when content is handed to the callbacks rather than saved, up to 2
+ * bytes of it are held back in priv->held until we know whether or
+ * not a boundary follows. */
+static void
+parser_emit (GMimeParser *parser, const char *content, size_t len)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	
+	if (len > 0 && priv->callbacks.content)
+		priv->callbacks.content (parser, content, len, priv->callback_data);
+}
+
+static void
+parser_emit_content (GMimeParser *parser, const char *content, size_t len)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	
+	if (len >= 2) {
+		parser_emit (parser, priv->held, priv->nheld);
+		parser_emit (parser, content, len - 2);
+		memcpy (priv->held, content + len - 2, 2);
+		priv->nheld = 2;
+	} else if (len == 1) {
+		if (priv->nheld == 2) {
+			parser_emit (parser, priv->held, 1);
+			priv->held[0] = priv->held[1];
+			priv->nheld = 1;
+		}
+		
+		priv->held[priv->nheld++] = content[0];
+	}
+}
+
+static void
+parser_emit_content_end (GMimeParser *parser, guint crlf)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	
+	if (priv->nheld > crlf)
+		parser_emit (parser, priv->held, priv->nheld - crlf);
+	
+	priv->nheld = 0;
+}
 
+static void
+parser_emit_headers (GMimeParser *parser)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	HeaderRaw *header;
+	
+	if (!priv->callbacks.header)
+		return;
+	
+	header = priv->headers;
+	while (header) {
+		priv->callbacks.header (parser, header->name, header->value,
+					header->offset, priv->callback_data);
+		header = header->next;
+	}
+}
 
 /* we add 2 for \r\n */
 #define MAX_BOUNDARY_LEN(bounds) (bounds ? bounds->boundarylenmax + 2 : 0)
@@ -1461,7 +2279,9 @@ static int
 parser_scan_content (GMimeParser *parser, GByteArray *content, guint *crlf)
 {
 	struct _GMimeParserPrivate *priv = parser->priv;
+	ScanBoundaryFunc scan_boundary = priv->scan_boundary;
 	char *aligned, *start, *inend;
+	gboolean continuation = FALSE;
 	register char *inptr;
 	register int *dword;
 	size_t nleft, len;
@@ -1482,6 +2302,10 @@ parser_scan_content (GMimeParser *parser, GByteArray *content, guint *crlf)
 	
 	do {
 	refill:
+		/* the read buffer is about to be moved */
+		if (priv->npending > 0)
+			content_store_flush (parser);
+		
 		nleft = priv->inend - inptr;
 		if (parser_fill (parser, atleast) <= 0) {
 			start = priv->inptr;
@@ -1492,7 +2316,8 @@ parser_scan_content (GMimeParser *parser, GByteArray *content, guint *crlf)
 		inptr = priv->inptr;
 		inend = priv->inend;
 		/* Note: see optimization comment [1] */
-		*inend = '\n';
+		if (!priv->mapped)
+			*inend = '\n';
 		
 		len = (size_t) (inend - inptr);
 		if (priv->midline && len == nleft)
@@ -1501,9 +2326,36 @@ parser_scan_content (GMimeParser *parser, GByteArray *content, guint *crlf)
 		priv->midline = FALSE;
 		
 		while (inptr < inend) {
-			aligned = (char *) (((long) (inptr + 3)) & ~3);
 			start = inptr;
 			
+			if (scan_boundary && (continuation || !possible_boundary_start (priv->scan_from, *inptr))) {
+				/* skip over every line that cannot be a boundary */
+				inptr = scan_boundary (inptr, inend, priv->scan_from);
+				
+				if (inptr < inend) {
+					inptr++;
+					content_save (parser, content, start, (size_t) (inptr - start));
+					continuation = FALSE;
+					continue;
+				}
+				
+				/* save the complete lines, the last line is partial */
+				while (inptr > start && inptr[-1] != '\n')
+					inptr--;
+				
+				if (inptr > start) {
+					content_save (parser, content, start, (size_t) (inptr - start));
+					continuation = FALSE;
+					
+					if (inptr == inend)
+						break;
+					
+					start = inptr;
+				}
+			}
+			
+			aligned = (char *) (((long) (inptr + 3)) & ~3);
+			
 			/* Note: see optimization comment [1] */
 			while (inptr < aligned && *inptr != '\n')
 				inptr++;
@@ -1511,12 +2363,28 @@ parser_scan_content (GMimeParser *parser, GByteArray *content, guint *crlf)
 			if (inptr == aligned) {
 				dword = (int *) inptr;
 				
-				do {
-					mask = *dword++ ^ 0x0A0A0A0A;
-					mask = ((mask - 0x01010101) & (~mask & 0x80808080));
-				} while (mask == 0);
+				if (priv->mapped) {
+					/* *inend is the last byte of the stream's memory,
+					 * so don't load a dword that would run past it */
+					while (inend - (char *) dword >= 3) {
+						mask = *dword ^ 0x0A0A0A0A;
+						mask = ((mask - 0x01010101) & (~mask & 0x80808080));
+						if (mask != 0)
+							break;
+						
+						dword++;
+					}
+					
+					inptr = (char *) dword;
+				} else {
+					do {
+						mask = *dword++ ^ 0x0A0A0A0A;
+						mask = ((mask - 0x01010101) & (~mask & 0x80808080));
+					} while (mask == 0);
+					
+					inptr = (char *) (dword - 1);
+				}
 				
-				inptr = (char *) (dword - 1);
 				while (*inptr != '\n')
 					inptr++;
 			}
@@ -1524,9 +2392,10 @@ parser_scan_content (GMimeParser *parser, GByteArray *content, guint *crlf)
 			len = (size_t) (inptr - start);
 			
 			if (inptr < inend) {
-				if ((found = check_boundary (priv, start, len)))
+				if (!continuation && (found = check_boundary (priv, start, len)))
 					goto boundary;
 				
+				continuation = FALSE;
 				inptr++;
 				len++;
 			} else {
@@ -1540,12 +2409,18 @@ parser_scan_content (GMimeParser *parser, GByteArray *content, guint *crlf)
 					goto refill;
 				}
 				
-				/* check for a boundary not ending in a \n (EOF) */
-				if ((found = check_boundary (priv, start, len)))
+				/* check for a boundary not ending in a \n (EOF)
+				 * unless this is the middle of a line that was
+				 * too long to fit in the buffer */
+				if (continuation)
+					found = FOUND_NOTHING;
+				else if ((found = check_boundary (priv, start, len)))
 					goto boundary;
+				
+				continuation = TRUE;
 			}
 			
-			content_save (content, start, len);
+			content_save (parser, content, start, len);
 		}
 		
 		priv->inptr = inptr;
@@ -1568,15 +2443,75 @@ parser_scan_content (GMimeParser *parser, GByteArray *content, guint *crlf)
 	return found;
 }
 
+/* a bogus Content-Length shouldn't make us allocate more than this,
+ * nor, when the length of the stream isn't known, more than this many
+ * read buffers */
+#define CONTENT_LENGTH_RESERVE_MAX (64 * 1024 * 1024)
+#define CONTENT_LENGTH_RESERVE_BUFS 16
+
+/* Starts counting the content kept in memory anew, and in a new spill
+ * file, for the next message. */
+static void
+parser_content_reset (GMimeParser *parser)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	
+	if (priv->spill) {
+		g_object_unref (priv->spill);
+		priv->spill = NULL;
+	}
+	
+	priv->spill_failed = FALSE;
+	priv->memory_used = 0;
+}
+
+/* Creates the stream the content of @mime_part gets saved to when it
+ * cannot be left in the stream being parsed. */
+static GMimeStream *
+parser_content_store_new (GMimeParser *parser, GMimePart *mime_part)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	gint64 offset, length, reserve;
+	unsigned long content_length;
+	const char *value;
+	GMimeStream *store;
+	char *endptr;
+	
+	store = g_mime_stream_chunked_new ();
+	
+	/* the Content-Length is only a hint, but saves growing the
+	 * store chunk by chunk when it is right */
+	if (!(value = g_mime_object_get_header ((GMimeObject *) mime_part, "Content-Length")))
+		return store;
+	
+	content_length = strtoul (value, &endptr, 10);
+	if (endptr == value || content_length == 0)
+		return store;
+	
+	/* there can't be more content than what is left of the stream */
+	if (priv->stream && (length = g_mime_stream_length (priv->stream)) != -1 &&
+	    (offset = parser_offset (priv, NULL)) != -1)
+		reserve = MAX (priv->stream->bound_start + length - offset, 0);
+	else
+		reserve = (gint64) priv->bufsize * CONTENT_LENGTH_RESERVE_BUFS;
+	
+	reserve = MIN (reserve, MIN ((gint64) content_length, CONTENT_LENGTH_RESERVE_MAX));
+	
+	if (priv->memory_limit == -1 || priv->memory_used + reserve <= priv->memory_limit)
+		g_mime_stream_chunked_reserve (store, (size_t) reserve);
+	
+	return store;
+}
+
 static void
 parser_scan_mime_part_content (GMimeParser *parser, GMimePart *mime_part, int *found)
 {
 	struct _GMimeParserPrivate *priv = parser->priv;
 	GMimeContentEncoding encoding;
-	GByteArray *content = NULL;
+	GMimeFilterBest *best = NULL;
 	GMimeDataWrapper *wrapper;
 	GMimeStream *stream;
-	gint64 start, end;
+	gint64 start = 0, end;
 	guint crlf;
 	
 	g_assert (priv->state >= GMIME_PARSER_STATE_HEADERS_END);
@@ -1584,80 +2519,137 @@ parser_scan_mime_part_content (GMimeParser *parser, GMimePart *mime_part, int *f
 	if (priv->persist_stream && priv->seekable)
 		start = parser_offset (priv, NULL);
 	else
-		content = g_byte_array_new ();
+		priv->store = parser_content_store_new (parser, mime_part);
+	
+	encoding = g_mime_part_get_content_encoding (mime_part);
+	
+	/* the statistics are only of use for content that is not
+	 * already transfer-encoded, which is also the only content
+	 * whose statistics don't need decoding it first */
+	if (priv->content_stats) {
+		switch (encoding) {
+		case GMIME_CONTENT_ENCODING_DEFAULT:
+		case GMIME_CONTENT_ENCODING_7BIT:
+		case GMIME_CONTENT_ENCODING_8BIT:
+		case GMIME_CONTENT_ENCODING_BINARY:
+			priv->best = (GMimeFilterBest *) g_mime_filter_best_new (GMIME_FILTER_BEST_ENCODING);
+			break;
+		default:
+			break;
+		}
+	}
+	
+	*found = parser_scan_content (parser, NULL, &crlf);
+	
+	if (priv->best)
+		best = content_stats_end (parser, crlf);
 	
-	*found = parser_scan_content (parser, content, &crlf);
-	if (*found != FOUND_EOS) {
+	if (priv->store)
+		content_store_flush (parser);
+	
+	if (priv->store && priv->store == priv->spill) {
+		/* last '\n' belongs to the boundary */
+		end = g_mime_stream_tell (priv->spill);
+		if (*found != FOUND_EOS)
+			end = MAX (end - crlf, priv->spill_start);
+		
+		stream = g_mime_stream_substream (priv->spill, priv->spill_start, end);
+		g_object_unref (priv->store);
+		priv->store = NULL;
+	} else if (priv->store) {
+		stream = priv->store;
+		priv->store = NULL;
+		
+		/* last '\n' belongs to the boundary, and whatever was
+		 * reserved for the content but not used is given back */
+		end = g_mime_stream_length (stream);
+		if (*found != FOUND_EOS)
+			end -= crlf;
+		
+		g_mime_stream_chunked_truncate (stream, end);
+		
+		priv->memory_used += g_mime_stream_length (stream);
+		g_mime_stream_reset (stream);
+	} else {
 		/* last '\n' belongs to the boundary */
-		if (priv->persist_stream && priv->seekable)
+		if (*found != FOUND_EOS)
 			end = parser_offset (priv, NULL) - crlf;
-		else if (content->len > crlf)
-			g_byte_array_set_size (content, content->len - crlf);
 		else
-			g_byte_array_set_size (content, 0);
-	} else if (priv->persist_stream && priv->seekable) {
-		end = parser_offset (priv, NULL);
+			end = parser_offset (priv, NULL);
+		
+		stream = g_mime_stream_substream (priv->stream, start, end);
 	}
 	
-	encoding = g_mime_part_get_content_encoding (mime_part);
+	wrapper = g_mime_data_wrapper_new_with_stream (stream, encoding);
 	
-	if (priv->persist_stream && priv->seekable)
-		stream = g_mime_stream_substream (priv->stream, start, end);
-	else
-		stream = g_mime_stream_mem_new_with_byte_array (content);
+	if (best != NULL) {
+		g_mime_data_wrapper_set_content_stats (wrapper, best);
+		g_object_unref (best);
+	}
 	
-	wrapper = g_mime_data_wrapper_new_with_stream (stream, encoding);
 	g_mime_part_set_content_object (mime_part, wrapper);
 	g_object_unref (wrapper);
 	g_object_unref (stream);
 }
 
-static void
-parser_scan_message_part (GMimeParser *parser, GMimeMessagePart *mpart, int *found)
+/* Check for the possibility of an empty message/rfc822 part. */
+static gboolean
+parser_scan_empty_message_part (GMimeParser *parser, int *found)
 {
 	struct _GMimeParserPrivate *priv = parser->priv;
-	ContentType *content_type;
-	GMimeMessage *message;
-	GMimeObject *object;
-	GMimeStream *stream;
-	HeaderRaw *header;
+	register char *inptr;
+	size_t atleast;
+	char *inend;
 	
-	g_assert (priv->state == GMIME_PARSER_STATE_CONTENT);
+	if (priv->bounds == NULL)
+		return FALSE;
 	
-	if (priv->bounds != NULL) {
-		/* Check for the possibility of an empty message/rfc822 part. */
-		register char *inptr;
-		size_t atleast;
-		char *inend;
-		
-		/* figure out minimum amount of data we need */
-		atleast = MAX (SCAN_HEAD, MAX_BOUNDARY_LEN (priv->bounds));
-		
-		if (parser_fill (parser, atleast) <= 0) {
-			*found = FOUND_EOS;
-			return;
-		}
-		
-		inptr = priv->inptr;
-		inend = priv->inend;
-		/* Note: see optimization comment [1] */
+	/* figure out minimum amount of data we need */
+	atleast = MAX (SCAN_HEAD, MAX_BOUNDARY_LEN (priv->bounds));
+	
+	if (parser_fill (parser, atleast) <= 0) {
+		*found = FOUND_EOS;
+		return TRUE;
+	}
+	
+	inptr = priv->inptr;
+	inend = priv->inend;
+	/* Note: see optimization comment [1] */
+	if (!priv->mapped)
 		*inend = '\n';
-		
-		while (*inptr != '\n')
-			inptr++;
-		
-		*found = check_boundary (priv, priv->inptr, inptr - priv->inptr);
-		switch (*found) {
-		case FOUND_END_BOUNDARY:
-			/* ignore "From " boundaries, boken mailers tend to include these lines... */
-			if (strncmp (priv->inptr, "From ", 5) != 0)
-				return;
-			break;
-		case FOUND_BOUNDARY:
-			return;
-		}
+	
+	while (*inptr != '\n')
+		inptr++;
+	
+	*found = check_boundary (priv, priv->inptr, inptr - priv->inptr);
+	switch (*found) {
+	case FOUND_END_BOUNDARY:
+		/* ignore "From " boundaries, boken mailers tend to include these lines... */
+		if (strncmp (priv->inptr, "From ", 5) != 0)
+			return TRUE;
+		break;
+	case FOUND_BOUNDARY:
+		return TRUE;
 	}
 	
+	return FALSE;
+}
+
+static void
+parser_scan_message_part (GMimeParser *parser, GMimeMessagePart *mpart, int *found)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	ContentType *content_type;
+	GMimeMessage *message;
+	GMimeObject *object;
+	GMimeStream *stream;
+	HeaderRaw *header;
+	
+	g_assert (priv->state == GMIME_PARSER_STATE_CONTENT);
+	
+	if (parser_scan_empty_message_part (parser, found))
+		return;
+	
 	/* get the headers */
 	priv->state = GMIME_PARSER_STATE_HEADERS;
 	if (parser_step (parser) == GMIME_PARSER_STATE_ERROR) {
@@ -1675,7 +2667,7 @@ parser_scan_message_part (GMimeParser *parser, GMimeMessagePart *mpart, int *fou
 		header = header->next;
 	}
 	
-	content_type = parser_content_type (parser, NULL);
+	content_type = parser_content_type (parser, FALSE);
 	if (content_type_is_type (content_type, "multipart", "*"))
 		object = parser_construct_multipart (parser, content_type, TRUE, found);
 	else
@@ -1693,7 +2685,7 @@ parser_scan_message_part (GMimeParser *parser, GMimeMessagePart *mpart, int *fou
 }
 
 static GMimeObject *
-parser_construct_leaf_part (GMimeParser *parser, ContentType *content_type, gboolean toplevel, int *found)
+parser_construct_object (GMimeParser *parser, ContentType *content_type, gboolean toplevel)
 {
 	struct _GMimeParserPrivate *priv = parser->priv;
 	GMimeObject *object;
@@ -1719,7 +2711,7 @@ parser_construct_leaf_part (GMimeParser *parser, ContentType *content_type, gboo
 		header = header->next;
 	}
 	
-	header_raw_clear (&priv->headers);
+	header_raw_clear (priv);
 	
 	/* set the raw header stream on the header-list */
 	if (priv->persist_stream && priv->seekable)
@@ -1732,6 +2724,17 @@ parser_construct_leaf_part (GMimeParser *parser, ContentType *content_type, gboo
 	
 	raw_header_reset (priv);
 	
+	return object;
+}
+
+static GMimeObject *
+parser_construct_leaf_part (GMimeParser *parser, ContentType *content_type, gboolean toplevel, int *found)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	GMimeObject *object;
+	
+	object = parser_construct_object (parser, content_type, toplevel);
+	
 	if (priv->state == GMIME_PARSER_STATE_HEADERS_END) {
 		/* skip empty line after headers */
 		if (parser_step (parser) == GMIME_PARSER_STATE_ERROR) {
@@ -1811,8 +2814,11 @@ parser_scan_multipart_subparts (GMimeParser *parser, GMimeMultipart *multipart)
 	struct _GMimeParserPrivate *priv = parser->priv;
 	ContentType *content_type;
 	GMimeObject *subpart;
+	gboolean digest;
 	int found;
 	
+	digest = g_mime_content_type_is_type (((GMimeObject *) multipart)->content_type, "multipart", "digest");
+	
 	do {
 		/* skip over the boundary marker */
 		if (parser_skip_line (parser) == -1) {
@@ -1832,7 +2838,7 @@ parser_scan_multipart_subparts (GMimeParser *parser, GMimeMultipart *multipart)
 			break;
 		}
 		
-		content_type = parser_content_type (parser, ((GMimeObject *) multipart)->content_type);
+		content_type = parser_content_type (parser, digest);
 		if (content_type_is_type (content_type, "multipart", "*"))
 			subpart = parser_construct_multipart (parser, content_type, FALSE, &found);
 		else
@@ -1853,33 +2859,8 @@ parser_construct_multipart (GMimeParser *parser, ContentType *content_type, gboo
 	GMimeMultipart *multipart;
 	const char *boundary;
 	GMimeObject *object;
-	GMimeStream *stream;
-	HeaderRaw *header;
-	
-	g_assert (priv->state >= GMIME_PARSER_STATE_HEADERS_END);
-	
-	object = g_mime_object_new_type (content_type->type, content_type->subtype);
-	
-	header = priv->headers;
-	while (header) {
-		if (!toplevel || !g_ascii_strncasecmp (header->name, "Content-", 8))
-			g_mime_object_append_header (object, header->name, header->value);
-		header = header->next;
-	}
-	
-	header_raw_clear (&priv->headers);
-	
-	/* set the raw header stream on the header-list */
-	if (priv->persist_stream && priv->seekable)
-		stream = g_mime_stream_substream (priv->stream, priv->headers_begin, priv->headers_end);
-	else
-		stream = g_mime_stream_mem_new_with_buffer (priv->rawbuf, priv->rawptr - priv->rawbuf);
-	
-	g_mime_header_list_set_stream (object->headers, stream);
-	g_object_unref (stream);
-	
-	raw_header_reset (priv);
 	
+	object = parser_construct_object (parser, content_type, toplevel);
 	multipart = (GMimeMultipart *) object;
 	
 	if (priv->state == GMIME_PARSER_STATE_HEADERS_END) {
@@ -1924,6 +2905,8 @@ parser_construct_part (GMimeParser *parser)
 	GMimeObject *object;
 	int found;
 	
+	parser_content_reset (parser);
+	
 	/* get the headers */
 	priv->state = GMIME_PARSER_STATE_HEADERS;
 	while (priv->state < GMIME_PARSER_STATE_HEADERS_END) {
@@ -1931,7 +2914,7 @@ parser_construct_part (GMimeParser *parser)
 			return NULL;
 	}
 	
-	content_type = parser_content_type (parser, NULL);
+	content_type = parser_content_type (parser, FALSE);
 	if (content_type_is_type (content_type, "multipart", "*"))
 		object = parser_construct_multipart (parser, content_type, TRUE, &found);
 	else
@@ -1961,6 +2944,176 @@ g_mime_parser_construct_part (GMimeParser *parser)
 }
 
 
+/* Headers-only mode
+ *
+ * Once the message headers have been parsed, the body is skipped by
+ * looking for nothing but the next From-line. A Content-Length that
+ * is respected lets us seek over the body of a seekable stream
+ * instead of reading it. */
+
+static gboolean
+parser_skip_to (GMimeParser *parser, gint64 offset)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	gint64 length;
+	
+	if (priv->offset == -1)
+		return FALSE;
+	
+	if (offset >= parser_offset (priv, NULL) && offset <= priv->offset) {
+		priv->inptr = priv->inend - (priv->offset - offset);
+		return TRUE;
+	}
+	
+	if (priv->seekable) {
+		/* never seek past the end, a GMimeStreamMem would grow */
+		if ((length = g_mime_stream_length (priv->stream)) == -1 ||
+		    offset > priv->stream->bound_start + length)
+			return FALSE;
+		
+		if (g_mime_stream_seek (priv->stream, offset, GMIME_STREAM_SEEK_SET) == -1)
+			return FALSE;
+		
+		priv->inptr = priv->inend = priv->inbuf;
+		priv->offset = offset;
+		
+		priv->mapped = parser_map_stream (priv);
+		
+		return TRUE;
+	}
+	
+	if (offset < priv->offset)
+		return FALSE;
+	
+	while (priv->offset < offset) {
+		priv->inptr = priv->inend;
+		if (parser_fill (parser, 0) <= 0)
+			return FALSE;
+	}
+	
+	priv->inptr = priv->inend - (priv->offset - offset);
+	
+	return TRUE;
+}
+
+/* leaves priv->inptr at the start of the next From-line or at the end
+ * of the stream; @bol is whether priv->inptr is at the start of a line */
+static void
+parser_skip_to_from (GMimeParser *parser, gboolean bol)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	ScanBoundaryFunc scan_boundary = priv->scan_boundary;
+	register char *inptr;
+	size_t left = 0;
+	char *inend;
+	
+	do {
+		if (parser_fill (parser, MAX (SCAN_HEAD, left)) <= (ssize_t) left) {
+			/* EOF reached */
+			priv->inptr = priv->inend;
+			return;
+		}
+		
+		inptr = priv->inptr;
+		inend = priv->inend;
+		if (!priv->mapped)
+			*inend = '\n';
+		
+		while (inptr < inend) {
+			if (bol) {
+				if (inend - inptr < 5)
+					break;
+				
+				if (!strncmp (inptr, "From ", 5)) {
+					priv->inptr = inptr;
+					return;
+				}
+				
+				bol = FALSE;
+			}
+			
+			if (scan_boundary) {
+				/* only stops on a '\n' that might start a From-line */
+				if ((inptr = scan_boundary (inptr, inend, TRUE)) == inend) {
+					/* the scanner can't see past inend */
+					bol = inend[-1] == '\n';
+					break;
+				}
+			} else {
+				while (*inptr != '\n')
+					inptr++;
+				
+				if (inptr == inend)
+					break;
+			}
+			
+			inptr++;
+			bol = TRUE;
+		}
+		
+		left = inend - inptr;
+		priv->inptr = inptr;
+	} while (1);
+}
+
+/* Content-Length counts the bytes following the blank line after the
+ * headers, so content_end is the offset of the last byte of content.
+ * The Content-Length is only trusted if nothing but line endings
+ * separate it from the next From-line (or the end of the stream). */
+static gboolean
+parser_skip_content_length (GMimeParser *parser, gint64 content_end)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	register char *inptr;
+	char *start, *inend;
+	
+	if (!parser_skip_to (parser, content_end))
+		return FALSE;
+	
+	if (parser_fill (parser, SCAN_HEAD) <= 0)
+		return FALSE;
+	
+	start = inptr = priv->inptr;
+	inend = priv->inend;
+	
+	while (inptr < inend && inptr - start < 4 && (*inptr == '\r' || *inptr == '\n'))
+		inptr++;
+	
+	if (inptr == start || inptr[-1] != '\n')
+		return FALSE;
+	
+	if (inend - inptr >= 5 && !strncmp (inptr, "From ", 5)) {
+		priv->inptr = inptr;
+		return TRUE;
+	}
+	
+	if (inptr == inend && !priv->mapped && g_mime_stream_eos (priv->stream)) {
+		priv->inptr = inptr;
+		return TRUE;
+	}
+	
+	return FALSE;
+}
+
+static void
+parser_skip_message (GMimeParser *parser)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	gint64 content_end = priv->bounds->content_end;
+	gint64 offset = parser_offset (priv, NULL);
+	
+	if (priv->seekable && content_end > offset) {
+		if (parser_skip_content_length (parser, content_end))
+			return;
+		
+		/* bogus Content-Length, look for the From-line instead */
+		if (!parser_skip_to (parser, offset))
+			return;
+	}
+	
+	parser_skip_to_from (parser, TRUE);
+}
+
 static GMimeMessage *
 parser_construct_message (GMimeParser *parser)
 {
@@ -1974,6 +3127,8 @@ parser_construct_message (GMimeParser *parser)
 	char *endptr;
 	int found;
 	
+	parser_content_reset (parser);
+	
 	/* scan the from-line if we are parsing an mbox */
 	while (priv->state != GMIME_PARSER_STATE_MESSAGE_HEADERS) {
 		if (parser_step (parser) == GMIME_PARSER_STATE_ERROR)
@@ -2006,8 +3161,12 @@ parser_construct_message (GMimeParser *parser)
 			priv->bounds->content_end = parser_offset (priv, NULL) + content_length;
 	}
 	
-	content_type = parser_content_type (parser, NULL);
-	if (content_type_is_type (content_type, "multipart", "*"))
+	content_type = parser_content_type (parser, FALSE);
+	if (priv->headers_only) {
+		object = parser_construct_object (parser, content_type, TRUE);
+		if (priv->scan_from)
+			parser_skip_message (parser);
+	} else if (content_type_is_type (content_type, "multipart", "*"))
 		object = parser_construct_multipart (parser, content_type, TRUE, &found);
 	else
 		object = parser_construct_leaf_part (parser, content_type, TRUE, &found);
@@ -2045,92 +3204,1322 @@ g_mime_parser_construct_message (GMimeParser *parser)
 }
 
 
-/**
- * g_mime_parser_get_from:
- * @parser: a #GMimeParser context
- *
- * Gets the mbox-style From-line of the most recently parsed message
- * (gotten from g_mime_parser_construct_message()).
+/* Parallel mbox parsing
  *
- * Returns: the mbox-style From-line of the most recently parsed
- * message or %NULL on error.
- **/
-char *
-g_mime_parser_get_from (GMimeParser *parser)
-{
+ * g_mime_parser_construct_messages() cuts the rest of an mbox into
+ * chunks at From-lines that follow a blank line. Unless Content-Length
+ * headers are respected, such a From-line always starts a new message:
+ * it can't be part of a header block and the content scanner treats
+ * every From-line as the end of the message. When they are respected,
+ * a From-line may just as well be part of the content, so the mbox is
+ * parsed as a whole instead. Each chunk is parsed by a parser of its
+ * own on a worker thread and the messages are handed to the caller in
+ * the order in which they appear in the mbox. */
+
+#define MBOX_CHUNK_MIN (256 * 1024)
+
+typedef struct {
+	GMimeMessage *message;
+	char *from;
+	gint64 from_offset;
+	gint64 headers_begin;
+	gint64 headers_end;
+} MboxMessage;
+
+typedef struct {
+	gint64 start;
+	gint64 end;
+	gint64 failed;  /* where a message could not be parsed, or -1 */
+	GPtrArray *messages;
+	gboolean done;
+} MboxChunk;
+
+typedef struct {
 	struct _GMimeParserPrivate *priv;
+	GMimeStream *stream;
+	gboolean in_memory;
+	GMutex lock;
+	GCond cond;
+} MboxContext;
+
+/* finds the first From-line after @offset that follows a blank line
+ * and returns its offset or %-1 if there is none */
+static gint64
+mbox_find_split (GMimeStream *stream, gint64 offset)
+{
+	char buf[4096], *inptr, *inend;
+	gint64 pos = offset - 2;
+	size_t n = 0;
+	ssize_t nread;
 	
-	g_return_val_if_fail (GMIME_IS_PARSER (parser), NULL);
+	if (g_mime_stream_seek (stream, pos, GMIME_STREAM_SEEK_SET) == -1)
+		return -1;
 	
-	priv = parser->priv;
-	if (!priv->scan_from)
-		return NULL;
+	do {
+		if ((nread = g_mime_stream_read (stream, buf + n, sizeof (buf) - n)) <= 0)
+			return -1;
+		
+		if ((n += nread) < 8)
+			continue;
+		
+		inptr = buf + 2;
+		inend = buf + n - 6;
+		
+		while (inptr < inend && (inptr = memchr (inptr, '\n', inend - inptr))) {
+			if (!strncmp (inptr + 1, "From ", 5) &&
+			    (inptr[-1] == '\n' || (inptr[-1] == '\r' && inptr[-2] == '\n')))
+				return pos + (inptr - buf) + 1;
+			
+			inptr++;
+		}
+		
+		/* keep enough to match a From-line split across reads */
+		memmove (buf, buf + n - 8, 8);
+		pos += n - 8;
+		n = 8;
+	} while (1);
+}
+
+/* parser_scan_content() treats the end of the line before a boundary
+ * as part of the boundary, and decides whether that is 1 or 2 bytes
+ * by looking at how the boundary line itself ends. The chunk before
+ * @split has to end in the same place for its last message to come
+ * out the same as it would have if the mbox was parsed as a whole. */
+static gint64
+mbox_split_eoln (GMimeStream *stream, gint64 split)
+{
+	char buf[4096], *eoln;
+	ssize_t nread;
+	char last = 0;
 	
-	if (priv->from_line->len)
-		return g_strndup ((char *) priv->from_line->data, priv->from_line->len);
+	if (g_mime_stream_seek (stream, split, GMIME_STREAM_SEEK_SET) == -1)
+		return split - 1;
 	
-	return NULL;
+	while ((nread = g_mime_stream_read (stream, buf, sizeof (buf))) > 0) {
+		if ((eoln = memchr (buf, '\n', nread))) {
+			if (eoln > buf)
+				last = eoln[-1];
+			
+			return last == '\r' ? split - 2 : split - 1;
+		}
+		
+		last = buf[nread - 1];
+	}
+	
+	return split - 1;
 }
 
-
-/**
- * g_mime_parser_get_from_offset:
- * @parser: a #GMimeParser context
+static void
+mbox_parse_chunk (gpointer data, gpointer user_data)
+{
+	MboxContext *ctx = user_data;
+	MboxChunk *chunk = data;
+	GMimeStream *stream, *substream;
+	struct _GMimeParserPrivate *priv;
+	GMimeMessage *message;
+	GMimeParser *parser;
+	MboxMessage *mbox;
+	gint64 base = 0;
+	
+	if (ctx->in_memory) {
+		stream = g_mime_stream_substream (ctx->stream, chunk->start, chunk->end);
+	} else {
+		/* streams like GMimeStreamFs share their file position
+		 * with all of their substreams, so they are read one
+		 * chunk at a time and the chunk is parsed from memory */
+		stream = g_mime_stream_mem_new ();
+		
+		g_mutex_lock (&ctx->lock);
+		substream = g_mime_stream_substream (ctx->stream, chunk->start, chunk->end);
+		g_mime_stream_write_to_stream (substream, stream);
+		g_object_unref (substream);
+		g_mutex_unlock (&ctx->lock);
+		
+		g_mime_stream_reset (stream);
+		base = chunk->start;
+	}
+	
+	parser = g_mime_parser_new_with_stream (stream);
+	g_mime_parser_set_buffer_size (parser, ctx->priv->bufsize);
+	
+	g_mime_parser_set_persist_stream (parser, ctx->in_memory && ctx->priv->persist_stream);
+	
+	priv = parser->priv;
+	priv->headers_only = ctx->priv->headers_only;
+	priv->content_stats = ctx->priv->content_stats;
+	priv->memory_limit = ctx->priv->memory_limit;
+	priv->scan_from = TRUE;
+	
+	while (!g_mime_parser_eos (parser)) {
+		if (!(message = parser_construct_message (parser))) {
+			chunk->failed = base + g_mime_parser_tell (parser);
+			break;
+		}
+		
+		mbox = g_slice_new (MboxMessage);
+		mbox->message = message;
+		mbox->from = g_strndup ((char *) priv->from_line->data, priv->from_line->len);
+		mbox->from_offset = base + priv->from_offset;
+		mbox->headers_begin = base + priv->message_headers_begin;
+		mbox->headers_end = base + priv->message_headers_end;
+		g_ptr_array_add (chunk->messages, mbox);
+	}
+	
+	g_object_unref (parser);
+	g_object_unref (stream);
+	
+	g_mutex_lock (&ctx->lock);
+	chunk->done = TRUE;
+	g_cond_broadcast (&ctx->cond);
+	g_mutex_unlock (&ctx->lock);
+}
+
+static void
+mbox_chunk_free (MboxChunk *chunk)
+{
+	MboxMessage *mbox;
+	guint i;
+	
+	for (i = 0; i < chunk->messages->len; i++) {
+		mbox = chunk->messages->pdata[i];
+		g_object_unref (mbox->message);
+		g_free (mbox->from);
+		g_slice_free (MboxMessage, mbox);
+	}
+	
+	g_ptr_array_free (chunk->messages, TRUE);
+	g_slice_free (MboxChunk, chunk);
+}
+
+static int
+parser_construct_messages (GMimeParser *parser, GMimeParserMessageFunc func, gpointer user_data)
+{
+	GMimeMessage *message;
+	int n = 0;
+	
+	while (!g_mime_parser_eos (parser)) {
+		if (!(message = parser_construct_message (parser)))
+			break;
+		
+		func (parser, message, user_data);
+		g_object_unref (message);
+		n++;
+	}
+	
+	return n;
+}
+
+
+/**
+ * g_mime_parser_construct_messages:
+ * @parser: a #GMimeParser context
+ * @nthreads: the number of threads to use, or 0 for one per processor
+ * @func: (scope call): the function to call for each message
+ * @user_data: user data for @func
+ *
+ * Constructs all of the remaining messages in the mbox that @parser
+ * is reading from and calls @func with each of them in the order in
+ * which they appear in the mbox. @parser must be set to scan for
+ * From-lines.
+ *
+ * If the stream is seekable and large enough to be worth it, the mbox
+ * is split at From-lines into chunks that are parsed by up to
+ * @nthreads threads at once; @func is always called on the calling
+ * thread. Streams that keep their content in memory
+ * (#GMimeStreamMmap and #GMimeStreamMem) are parsed in place. Any
+ * other stream is read one chunk at a time and the chunks are parsed
+ * as if @parser was not set to persist the stream, so that the
+ * threads never share a file position.
+ *
+ * An mbox is never split if @parser is set to respect Content-Length
+ * headers (see g_mime_parser_set_respect_content_length()), since a
+ * From-line within the content of a message cannot be told apart
+ * without parsing everything before it.
+ *
+ * The header regex callback set with g_mime_parser_set_header_regex()
+ * is not invoked for messages parsed by the threads.
+ *
+ * As when the mbox is not split, a message that cannot be parsed ends
+ * the mbox: @func is not called for any of the messages after it, and
+ * @parser is left where it gave up on that message.
+ *
+ * Returns: the number of messages constructed or %-1 on error.
+ **/
+int
+g_mime_parser_construct_messages (GMimeParser *parser, guint nthreads, GMimeParserMessageFunc func, gpointer user_data)
+{
+	struct _GMimeParserPrivate *priv;
+	gint64 start, end, size, split;
+	gint64 failed = -1;
+	MboxChunk *chunk;
+	MboxMessage *mbox;
+	GThreadPool *pool;
+	GPtrArray *chunks;
+	MboxContext ctx;
+	guint window, i, j;
+	int n = 0;
+	
+	g_return_val_if_fail (GMIME_IS_PARSER (parser), -1);
+	g_return_val_if_fail (func != NULL, -1);
+	
+	priv = parser->priv;
+	
+	g_return_val_if_fail (priv->scan_from, -1);
+	
+	if (nthreads == 0)
+		nthreads = g_get_num_processors ();
+	
+	if (nthreads < 2 || !priv->seekable || priv->respect_content_length ||
+	    priv->state > GMIME_PARSER_STATE_FROM ||
+	    (start = parser_offset (priv, NULL)) == -1 ||
+	    (size = g_mime_stream_length (priv->stream)) == -1)
+		return parser_construct_messages (parser, func, user_data);
+	
+	end = priv->stream->bound_start + size;
+	size = MAX ((end - start) / (nthreads * 4), MBOX_CHUNK_MIN);
+	
+	if (end - start < 2 * MBOX_CHUNK_MIN)
+		return parser_construct_messages (parser, func, user_data);
+	
+	chunks = g_ptr_array_new ();
+	
+	while (start < end) {
+		chunk = g_slice_new (MboxChunk);
+		chunk->messages = g_ptr_array_new ();
+		chunk->done = FALSE;
+		chunk->failed = -1;
+		chunk->start = start;
+		
+		if (start + size < end && (split = mbox_find_split (priv->stream, start + size)) != -1) {
+			chunk->end = mbox_split_eoln (priv->stream, split);
+			start = split;
+		} else {
+			chunk->end = end;
+			start = end;
+		}
+		
+		g_ptr_array_add (chunks, chunk);
+	}
+	
+	ctx.priv = priv;
+	ctx.stream = priv->stream;
+	ctx.in_memory = G_OBJECT_TYPE (priv->stream) == GMIME_TYPE_STREAM_MMAP ||
+		G_OBJECT_TYPE (priv->stream) == GMIME_TYPE_STREAM_MEM;
+	g_mutex_init (&ctx.lock);
+	g_cond_init (&ctx.cond);
+	
+	pool = g_thread_pool_new (mbox_parse_chunk, &ctx, nthreads, FALSE, NULL);
+	
+	/* only parse a few chunks ahead of the caller so that we don't
+	 * end up holding on to the entire mbox worth of messages */
+	window = nthreads * 2;
+	for (i = 0; i < chunks->len && i < window; i++)
+		g_thread_pool_push (pool, chunks->pdata[i], NULL);
+	
+	for (i = 0; i < chunks->len && failed == -1; i++) {
+		chunk = chunks->pdata[i];
+		
+		g_mutex_lock (&ctx.lock);
+		while (!chunk->done)
+			g_cond_wait (&ctx.cond, &ctx.lock);
+		g_mutex_unlock (&ctx.lock);
+		
+		failed = chunk->failed;
+		
+		if (i + window < chunks->len && failed == -1)
+			g_thread_pool_push (pool, chunks->pdata[i + window], NULL);
+		
+		for (j = 0; j < chunk->messages->len; j++) {
+			mbox = chunk->messages->pdata[j];
+			
+			g_byte_array_set_size (priv->from_line, 0);
+			g_byte_array_append (priv->from_line, (unsigned char *) mbox->from, strlen (mbox->from));
+			priv->from_offset = mbox->from_offset;
+			priv->message_headers_begin = mbox->headers_begin;
+			priv->message_headers_end = mbox->headers_end;
+			
+			func (parser, mbox->message, user_data);
+			n++;
+		}
+		
+		mbox_chunk_free (chunk);
+	}
+	
+	/* after a message that could not be parsed, the chunks that
+	 * haven't been started are dropped and the rest thrown away */
+	g_thread_pool_free (pool, failed != -1, TRUE);
+	for ( ; i < chunks->len; i++)
+		mbox_chunk_free (chunks->pdata[i]);
+	
+	g_ptr_array_free (chunks, TRUE);
+	g_cond_clear (&ctx.cond);
+	g_mutex_clear (&ctx.lock);
+	
+	/* leave @parser at the end of the stream, or where it would
+	 * have given up if the mbox had not been split */
+	if (failed != -1)
+		end = failed;
+	
+	g_mime_stream_seek (priv->stream, end, GMIME_STREAM_SEEK_SET);
+	priv->inptr = priv->inend = priv->inbuf;
+	priv->state = GMIME_PARSER_STATE_FROM;
+	priv->mapped = FALSE;
+	priv->offset = end;
+	
+	parser_fill (parser, 0);
+	
+	return n;
+}
+
+
+/* Event mode
+ *
+ * g_mime_parser_parse_message() and g_mime_parser_parse_part() walk
+ * the stream exactly like the parser_construct_*() functions do but
+ * report what they find through the parser's callbacks rather than
+ * building GMimeObjects. Content is passed to the callbacks straight
+ * out of the read buffer by parser_scan_content(). */
+
+static const char *
+content_type_boundary (const char *value, GMimeParam **params)
+{
+	const char *boundary = NULL;
+	GMimeParam *param;
+	char *type, *subtype;
+	
+	*params = NULL;
+	
+	if (value == NULL || !g_mime_parse_content_type (&value, &type, &subtype))
+		return NULL;
+	
+	g_free (subtype);
+	g_free (type);
+	
+	while (*value && *value != ';')
+		value++;
+	
+	if (*value++ != ';' || *value == '\0')
+		return NULL;
+	
+	/* same as GMimeContentType: the last boundary parameter wins */
+	param = *params = g_mime_param_new_from_string (value);
+	while (param != NULL) {
+		if (!g_ascii_strcasecmp (param->name, "boundary"))
+			boundary = param->value;
+		
+		param = param->next;
+	}
+	
+	return boundary;
+}
+
+static void parser_emit_part (GMimeParser *parser, ContentType *content_type, int depth, int *found);
+
+static void
+parser_emit_start (GMimeParser *parser, int depth)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	
+	if (priv->callbacks.start_part)
+		priv->callbacks.start_part (parser, depth, priv->callback_data);
+}
+
+static int
+parser_emit_face (GMimeParser *parser)
+{
+	guint crlf;
+	int found;
+	
+	found = parser_scan_content (parser, NULL, &crlf);
+	parser_emit_content_end (parser, crlf);
+	
+	return found;
+}
+
+static int
+parser_emit_subparts (GMimeParser *parser, int depth, gboolean digest)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	ContentType *content_type;
+	int found;
+	
+	do {
+		/* skip over the boundary marker */
+		if (parser_skip_line (parser) == -1) {
+			found = FOUND_EOS;
+			break;
+		}
+		
+		/* get the headers */
+		priv->state = GMIME_PARSER_STATE_HEADERS;
+		if (parser_step (parser) == GMIME_PARSER_STATE_ERROR) {
+			found = FOUND_EOS;
+			break;
+		}
+		
+		if (priv->state == GMIME_PARSER_STATE_COMPLETE && priv->headers == NULL) {
+			found = FOUND_END_BOUNDARY;
+			break;
+		}
+		
+		parser_emit_start (parser, depth);
+		content_type = parser_content_type (parser, digest);
+		parser_emit_part (parser, content_type, depth, &found);
+		content_type_destroy (content_type);
+	} while (found == FOUND_BOUNDARY && found_immediate_boundary (priv, FALSE));
+	
+	return found;
+}
+
+static void
+parser_emit_multipart (GMimeParser *parser, const char *boundary, gboolean digest, int depth, int *found)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	
+	if (boundary) {
+		parser_push_boundary (parser, boundary);
+		
+		*found = parser_emit_face (parser);
+		
+		if (*found == FOUND_BOUNDARY)
+			*found = parser_emit_subparts (parser, depth + 1, digest);
+		
+		if (*found == FOUND_END_BOUNDARY && found_immediate_boundary (priv, TRUE)) {
+			/* eat end boundary */
+			parser_skip_line (parser);
+			parser_pop_boundary (parser);
+			*found = parser_emit_face (parser);
+		} else {
+			parser_pop_boundary (parser);
+		}
+	} else {
+		w(g_warning ("multipart without boundary encountered"));
+		/* this will scan everything into the preface */
+		*found = parser_emit_face (parser);
+	}
+}
+
+static void
+parser_emit_message_part (GMimeParser *parser, int depth, int *found)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	ContentType *content_type;
+	
+	if (parser_scan_empty_message_part (parser, found))
+		return;
+	
+	/* get the headers */
+	priv->state = GMIME_PARSER_STATE_HEADERS;
+	if (parser_step (parser) == GMIME_PARSER_STATE_ERROR) {
+		*found = FOUND_EOS;
+		return;
+	}
+	
+	parser_emit_start (parser, depth + 1);
+	content_type = parser_content_type (parser, FALSE);
+	parser_emit_part (parser, content_type, depth + 1, found);
+	content_type_destroy (content_type);
+}
+
+static void
+parser_emit_part (GMimeParser *parser, ContentType *content_type, int depth, int *found)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	char *boundary = NULL;
+	GMimeParam *params;
+	guint crlf;
+	
+	g_assert (priv->state >= GMIME_PARSER_STATE_HEADERS_END);
+	
+	parser_emit_headers (parser);
+	
+	if (priv->callbacks.end_headers)
+		priv->callbacks.end_headers (parser, content_type->type, content_type->subtype,
+					     priv->callback_data);
+	
+	if (content_type_is_type (content_type, "multipart", "*")) {
+		boundary = g_strdup (content_type_boundary (header_raw_find (priv->headers, "Content-Type", NULL), &params));
+		g_mime_param_destroy (params);
+	}
+	
+	header_raw_clear (priv);
+	raw_header_reset (priv);
+	
+	if (priv->state == GMIME_PARSER_STATE_HEADERS_END) {
+		/* skip empty line after headers */
+		if (parser_step (parser) == GMIME_PARSER_STATE_ERROR) {
+			*found = FOUND_EOS;
+			goto done;
+		}
+	}
+	
+	if (content_type_is_type (content_type, "multipart", "*")) {
+		parser_emit_multipart (parser, boundary, content_type_is_type (content_type, "multipart", "digest"),
+				       depth, found);
+	} else if (content_type_is_type (content_type, "message", "rfc822") ||
+		   content_type_is_type (content_type, "message", "rfc2822") ||
+		   content_type_is_type (content_type, "message", "news")) {
+		parser_emit_message_part (parser, depth, found);
+	} else {
+		*found = parser_scan_content (parser, NULL, &crlf);
+		parser_emit_content_end (parser, crlf);
+	}
+	
+ done:
+	
+	if (priv->callbacks.end_part)
+		priv->callbacks.end_part (parser, priv->callback_data);
+	
+	g_free (boundary);
+}
+
+
+/**
+ * g_mime_parser_parse_part:
+ * @parser: a #GMimeParser context
+ *
+ * Parses a MIME part from @parser's stream in the same way as
+ * g_mime_parser_construct_part(), except that rather than
+ * constructing a #GMimeObject, the headers and content of the part
+ * (and of each of its subparts) are reported through the callbacks
+ * set with g_mime_parser_set_callbacks().
+ *
+ * No #GObject is created for any of the parts, which makes this much
+ * cheaper than g_mime_parser_construct_part() when only the headers
+ * and the structure of a part are of interest.
+ *
+ * Returns: %TRUE on success or %FALSE on fail.
+ **/
+gboolean
+g_mime_parser_parse_part (GMimeParser *parser)
+{
+	struct _GMimeParserPrivate *priv;
+	ContentType *content_type;
+	int found;
+	
+	g_return_val_if_fail (GMIME_IS_PARSER (parser), FALSE);
+	
+	priv = parser->priv;
+	
+	/* get the headers */
+	priv->state = GMIME_PARSER_STATE_HEADERS;
+	while (priv->state < GMIME_PARSER_STATE_HEADERS_END) {
+		if (parser_step (parser) == GMIME_PARSER_STATE_ERROR)
+			return FALSE;
+	}
+	
+	priv->events = TRUE;
+	
+	parser_emit_start (parser, 0);
+	content_type = parser_content_type (parser, FALSE);
+	parser_emit_part (parser, content_type, 0, &found);
+	content_type_destroy (content_type);
+	
+	priv->events = FALSE;
+	
+	return TRUE;
+}
+
+
+/**
+ * g_mime_parser_parse_message:
+ * @parser: a #GMimeParser context
+ *
+ * Parses the next message from @parser's stream in the same way as
+ * g_mime_parser_construct_message(), except that rather than
+ * constructing a #GMimeMessage, the message headers and each of its
+ * MIME parts are reported through the callbacks set with
+ * g_mime_parser_set_callbacks(). The toplevel MIME part of the message
+ * shares its header block with the message itself, so it has a depth
+ * of 0.
+ *
+ * Like with g_mime_parser_construct_message(), an mbox may be parsed
+ * one message at a time until g_mime_parser_eos() returns %TRUE.
+ *
+ * Returns: %TRUE on success or %FALSE on fail.
+ **/
+gboolean
+g_mime_parser_parse_message (GMimeParser *parser)
+{
+	struct _GMimeParserPrivate *priv;
+	unsigned long content_length = ULONG_MAX;
+	ContentType *content_type;
+	HeaderRaw *header;
+	char *endptr;
+	int found;
+	
+	g_return_val_if_fail (GMIME_IS_PARSER (parser), FALSE);
+	
+	priv = parser->priv;
+	
+	/* scan the from-line if we are parsing an mbox */
+	while (priv->state != GMIME_PARSER_STATE_MESSAGE_HEADERS) {
+		if (parser_step (parser) == GMIME_PARSER_STATE_ERROR)
+			return FALSE;
+	}
+	
+	/* parse the headers */
+	while (priv->state < GMIME_PARSER_STATE_HEADERS_END) {
+		if (parser_step (parser) == GMIME_PARSER_STATE_ERROR)
+			return FALSE;
+	}
+	
+	if (priv->respect_content_length) {
+		header = priv->headers;
+		while (header) {
+			if (!g_ascii_strcasecmp (header->name, "Content-Length")) {
+				content_length = strtoul (header->value, &endptr, 10);
+				if (endptr == header->value)
+					content_length = ULONG_MAX;
+			}
+			
+			header = header->next;
+		}
+	}
+	
+	if (priv->scan_from) {
+		parser_push_boundary (parser, MBOX_BOUNDARY);
+		if (priv->respect_content_length && content_length < ULONG_MAX)
+			priv->bounds->content_end = parser_offset (priv, NULL) + content_length;
+	}
+	
+	priv->events = TRUE;
+	
+	parser_emit_start (parser, 0);
+	content_type = parser_content_type (parser, FALSE);
+	parser_emit_part (parser, content_type, 0, &found);
+	content_type_destroy (content_type);
+	
+	priv->events = FALSE;
+	
+	if (priv->scan_from) {
+		priv->state = GMIME_PARSER_STATE_FROM;
+		parser_pop_boundary (parser);
+	}
+	
+	return TRUE;
+}
+
+
+/**
+ * g_mime_parser_get_from:
+ * @parser: a #GMimeParser context
+ *
+ * Gets the mbox-style From-line of the most recently parsed message
+ * (gotten from g_mime_parser_construct_message()).
+ *
+ * Returns: the mbox-style From-line of the most recently parsed
+ * message or %NULL on error.
+ **/
+char *
+g_mime_parser_get_from (GMimeParser *parser)
+{
+	struct _GMimeParserPrivate *priv;
+	
+	g_return_val_if_fail (GMIME_IS_PARSER (parser), NULL);
+	
+	priv = parser->priv;
+	if (!priv->scan_from)
+		return NULL;
+	
+	if (priv->from_line->len)
+		return g_strndup ((char *) priv->from_line->data, priv->from_line->len);
+	
+	return NULL;
+}
+
+
+/**
+ * g_mime_parser_get_from_offset:
+ * @parser: a #GMimeParser context
  *
  * Gets the offset of the most recently parsed mbox-style From-line
  * (gotten from g_mime_parser_construct_message()).
  *
- * Returns: the offset of the most recently parsed mbox-style From-line
- * or %-1 on error.
+ * Returns: the offset of the most recently parsed mbox-style From-line
+ * or %-1 on error.
+ **/
+gint64
+g_mime_parser_get_from_offset (GMimeParser *parser)
+{
+	struct _GMimeParserPrivate *priv;
+	
+	g_return_val_if_fail (GMIME_IS_PARSER (parser), -1);
+	
+	priv = parser->priv;
+	if (!priv->scan_from)
+		return -1;
+	
+	return priv->from_offset;
+}
+
+
+/**
+ * g_mime_parser_get_headers_begin:
+ * @parser: a #GMimeParser context
+ *
+ * Gets the stream offset of the beginning of the headers of the most
+ * recently parsed message.
+ *
+ * Returns: the offset of the beginning of the headers of the most
+ * recently parsed message or %-1 on error.
+ **/
+gint64
+g_mime_parser_get_headers_begin (GMimeParser *parser)
+{
+	g_return_val_if_fail (GMIME_IS_PARSER (parser), -1);
+	
+	return parser->priv->message_headers_begin;
+}
+
+
+/**
+ * g_mime_parser_get_headers_end:
+ * @parser: a #GMimeParser context
+ *
+ * Gets the stream offset of the end of the headers of the most
+ * recently parsed message.
+ *
+ * Returns: the offset of the end of the headers of the most recently
+ * parsed message or %-1 on error.
+ **/
+gint64
+g_mime_parser_get_headers_end (GMimeParser *parser)
+{
+	g_return_val_if_fail (GMIME_IS_PARSER (parser), -1);
+	
+	return parser->priv->message_headers_end;
+}
+
+
+/* Push mode
+ *
+ * g_mime_parser_feed() must never block waiting for more input the
+ * way parser_fill() does, so rather than recursing through the
+ * parser_construct_*() functions, the push parser is a line-at-a-time
+ * state machine which keeps the parts that it is in the middle of on
+ * an explicit PartStack. The BoundaryStack, the header scanner and
+ * check_boundary() are shared with the pull parser.
+ *
+ * Complete lines are scanned directly out of the buffer that was
+ * passed to g_mime_parser_feed(). Only a trailing partial line gets
+ * copied into realbuf, to be completed by the next call, which means
+ * that memory use is bounded by the buffer size plus the largest
+ * header block no matter how large the message is. */
+
+static void
+parser_push_part (GMimeParser *parser)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	PartStack *part;
+	
+	part = g_slice_new (PartStack);
+	part->depth = priv->parts ? priv->parts->depth + 1 : 0;
+	part->parent = priv->parts;
+	part->preface = FALSE;
+	part->digest = FALSE;
+	part->bounds = NULL;
+	priv->parts = part;
+	
+	header_raw_clear (priv);
+	priv->headers_begin = -1;
+	priv->headers_end = -1;
+	
+	priv->state = GMIME_PARSER_STATE_HEADERS;
+	
+	if (priv->callbacks.start_part)
+		priv->callbacks.start_part (parser, part->depth, priv->callback_data);
+}
+
+static void
+parser_pop_part (GMimeParser *parser)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	PartStack *part = priv->parts;
+	
+	if (part->bounds)
+		parser_pop_boundary (parser);
+	
+	priv->parts = part->parent;
+	g_slice_free (PartStack, part);
+	
+	if (priv->callbacks.end_part)
+		priv->callbacks.end_part (parser, priv->callback_data);
+}
+
+static void
+parser_push_message (GMimeParser *parser, const char *from, size_t len)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	
+	if (priv->scan_from) {
+		g_byte_array_set_size (priv->from_line, 0);
+		g_byte_array_append (priv->from_line, (unsigned char *) from, len);
+		priv->from_offset = parser_offset (priv, from);
+		
+		if (priv->bounds == NULL)
+			parser_push_boundary (parser, MBOX_BOUNDARY);
+	}
+	
+	priv->message_headers_begin = -1;
+	priv->message_headers_end = -1;
+	
+	parser_push_part (parser);
+	
+	priv->state = GMIME_PARSER_STATE_MESSAGE_HEADERS;
+}
+
+static void
+parser_push_headers_end (GMimeParser *parser, const char *start)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	PartStack *part = priv->parts;
+	ContentType *content_type;
+	const char *boundary;
+	GMimeParam *params;
+	HeaderRaw *tail;
+	
+	if (priv->headerptr > priv->headerbuf) {
+		tail = (HeaderRaw *) &priv->headers;
+		while (tail->next)
+			tail = tail->next;
+		
+		header_parse (parser, &tail);
+	}
+	
+	if (priv->headers_begin == -1)
+		priv->headers_begin = parser_offset (priv, start);
+	priv->headers_end = parser_offset (priv, start);
+	
+	if (priv->message_headers_begin == -1) {
+		priv->message_headers_begin = priv->headers_begin;
+		priv->message_headers_end = priv->headers_end;
+	}
+	
+	content_type = parser_content_type (parser, part->parent && part->parent->digest);
+	
+	parser_emit_headers (parser);
+	
+	if (priv->callbacks.end_headers)
+		priv->callbacks.end_headers (parser, content_type->type, content_type->subtype,
+					     priv->callback_data);
+	
+	priv->state = GMIME_PARSER_STATE_CONTENT;
+	
+	if (content_type_is_type (content_type, "multipart", "*")) {
+		part->digest = content_type_is_type (content_type, "multipart", "digest");
+		
+		boundary = content_type_boundary (header_raw_find (priv->headers, "Content-Type", NULL), &params);
+		if (boundary) {
+			parser_push_boundary (parser, boundary);
+			part->bounds = priv->bounds;
+			part->preface = TRUE;
+		} else {
+			w(g_warning ("multipart without boundary encountered"));
+			/* this will scan everything into the preface */
+		}
+		
+		g_mime_param_destroy (params);
+	} else if (content_type_is_type (content_type, "message", "rfc822") ||
+		   content_type_is_type (content_type, "message", "rfc2822") ||
+		   content_type_is_type (content_type, "message", "news")) {
+		/* the message itself begins with the next line */
+		priv->state = GMIME_PARSER_STATE_HEADERS_END;
+	}
+	
+	content_type_destroy (content_type);
+	header_raw_clear (priv);
+}
+
+/* returns %FALSE if the line turned out to be the start of the content */
+static gboolean
+parser_push_header (GMimeParser *parser, const char *start, size_t len, gboolean complete)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	const char *inptr, *inend = start + len;
+	gboolean valid = TRUE;
+	HeaderRaw *tail;
+	
+	if (priv->headers_begin == -1)
+		priv->headers_begin = parser_offset (priv, start);
+	
+	if (complete && inend > start && inend[-1] == '\r')
+		inend--;
+	
+	if (priv->midline) {
+		/* the rest of a header line that was too long to buffer */
+		header_append (priv, start, (size_t) (inend - start));
+		return TRUE;
+	}
+	
+	if (priv->headerptr > priv->headerbuf) {
+		/* check for a folded header */
+		if (*start == ' ' || *start == '\t') {
+			header_append (priv, start, (size_t) (inend - start));
+			return TRUE;
+		}
+		
+		tail = (HeaderRaw *) &priv->headers;
+		while (tail->next)
+			tail = tail->next;
+		
+		header_parse (parser, &tail);
+	}
+	
+	/* check to see if we've reached the end of the headers */
+	if (complete && inend == start) {
+		parser_push_headers_end (parser, start);
+		return TRUE;
+	}
+	
+	/* scan and validate the field name */
+	inptr = start;
+	while (inptr < inend && *inptr != ':') {
+		if (is_type (*inptr, IS_SPACE | IS_CTRL)) {
+			valid = FALSE;
+			break;
+		}
+		
+		inptr++;
+	}
+	
+	if (inptr == start || inptr == inend)
+		valid = FALSE;
+	
+	if (!valid) {
+		if (priv->scan_from && (inptr - start) == 4 && !strncmp (start, "From ", 5)) {
+			/* let the content scanner treat it as a boundary */
+			parser_push_headers_end (parser, start);
+			return FALSE;
+		}
+		
+		if (priv->headers != NULL) {
+			if (priv->state == GMIME_PARSER_STATE_MESSAGE_HEADERS ?
+			    has_message_headers (priv->headers) : has_content_headers (priv->headers)) {
+				/* probably the start of the content,
+				 * a broken mailer didn't terminate the
+				 * headers with an empty line. *sigh* */
+				parser_push_headers_end (parser, start);
+				return FALSE;
+			}
+		}
+	}
+	
+	priv->header_offset = parser_offset (priv, start);
+	header_append (priv, start, (size_t) (inend - start));
+	
+	return TRUE;
+}
+
+static void
+parser_push_boundary_line (GMimeParser *parser, const char *start, size_t len, gboolean complete)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	BoundaryStack *s;
+	PartStack *part;
+	size_t n = len;
+	
+	/* last '\n' belongs to the boundary */
+	if (n > 0 && start[n - 1] == '\r') {
+		parser_emit_content_end (parser, 2);
+		n--;
+	} else {
+		parser_emit_content_end (parser, 1);
+	}
+	
+	part = priv->parts;
+	if (part->preface) {
+		part->preface = FALSE;
+		
+		/* like parser_construct_multipart(), the first subpart
+		 * starts at the first boundary after the preface, even
+		 * if the boundary belongs to one of our parents */
+		if (check_boundary (priv, start, len) == FOUND_BOUNDARY) {
+			if (complete)
+				parser_push_part (parser);
+			return;
+		}
+	}
+	
+	/* find the multipart that the boundary belongs to, ending
+	 * any parts that are missing their end boundary */
+	while ((part = priv->parts) != NULL) {
+		if ((s = part->bounds) != NULL) {
+			if (is_boundary (start, n, s->boundary, s->boundarylenfinal)) {
+				/* whatever follows is the postface */
+				parser_pop_boundary (parser);
+				part->bounds = NULL;
+				priv->state = GMIME_PARSER_STATE_CONTENT;
+				return;
+			}
+			
+			if (is_boundary (start, n, s->boundary, s->boundarylen)) {
+				if (complete)
+					parser_push_part (parser);
+				else
+					priv->state = GMIME_PARSER_STATE_CONTENT;
+				return;
+			}
+		}
+		
+		parser_pop_part (parser);
+	}
+	
+	/* must be a From-line; on to the next message */
+	parser_push_message (parser, start, len);
+}
+
+/* returns %FALSE if the line needs to be scanned again in the new state */
+static gboolean
+parser_push_line (GMimeParser *parser, const char *start, size_t len, gboolean complete)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	int found;
+	
+	switch (priv->state) {
+	case GMIME_PARSER_STATE_INIT:
+		if (priv->scan_from) {
+			priv->state = GMIME_PARSER_STATE_FROM;
+			return FALSE;
+		}
+		
+		parser_push_message (parser, NULL, 0);
+		return FALSE;
+	case GMIME_PARSER_STATE_FROM:
+		if (!priv->midline && len >= 5 && !strncmp (start, "From ", 5))
+			parser_push_message (parser, start, len);
+		return TRUE;
+	case GMIME_PARSER_STATE_MESSAGE_HEADERS:
+	case GMIME_PARSER_STATE_HEADERS:
+		return parser_push_header (parser, start, len, complete);
+	case GMIME_PARSER_STATE_HEADERS_END:
+		/* Check for the possibility of an empty message/rfc822 part. */
+		if (priv->bounds != NULL) {
+			found = check_boundary (priv, start, len);
+			
+			/* ignore "From " boundaries, boken mailers tend to include these lines... */
+			if (found == FOUND_BOUNDARY ||
+			    (found == FOUND_END_BOUNDARY && strncmp (start, "From ", 5) != 0)) {
+				parser_push_boundary_line (parser, start, len, complete);
+				return TRUE;
+			}
+		}
+		
+		parser_push_part (parser);
+		return FALSE;
+	case GMIME_PARSER_STATE_CONTENT:
+		/* parser_push_lines() only passes us boundaries */
+		parser_push_boundary_line (parser, start, len, complete);
+		return TRUE;
+	default:
+		g_assert_not_reached ();
+		return TRUE;
+	}
+}
+
+static void
+parser_push_lines (GMimeParser *parser, gboolean eof)
+{
+	struct _GMimeParserPrivate *priv = parser->priv;
+	char *start, *eoln, *run = NULL;
+	gboolean complete;
+	size_t len;
+	
+	while (priv->inptr < priv->inend) {
+		start = priv->inptr;
+		
+		if ((eoln = memchr (start, '\n', priv->inend - start))) {
+			complete = TRUE;
+		} else if (eof || (size_t) (priv->inend - start) >= priv->bufsize) {
+			/* the last line of the input or a line that is
+			 * too long to buffer, take what we have */
+			eoln = priv->inend;
+			complete = FALSE;
+		} else {
+			/* wait for the rest of the line */
+			break;
+		}
+		
+		len = (size_t) (eoln - start);
+		
+		if (priv->state == GMIME_PARSER_STATE_CONTENT) {
+			/* the tail of a line that was too long to buffer
+			 * can never be a boundary */
+			if (priv->midline || !possible_boundary_start (priv->scan_from, *start) ||
+			    check_boundary (priv, start, len) == FOUND_NOTHING) {
+				if (run == NULL)
+					run = start;
+				
+				priv->inptr = complete ? eoln + 1 : eoln;
+				priv->midline = !complete;
+				continue;
+			}
+			
+			if (run != NULL) {
+				parser_emit_content (parser, run, (size_t) (start - run));
+				run = NULL;
+			}
+		}
+		
+		if (parser_push_line (parser, start, len, complete)) {
+			priv->inptr = complete ? eoln + 1 : eoln;
+			priv->midline = !complete;
+		}
+	}
+	
+	if (run != NULL)
+		parser_emit_content (parser, run, (size_t) (priv->inptr - run));
+}
+
+
+/**
+ * g_mime_parser_set_callbacks:
+ * @parser: a #GMimeParser context
+ * @callbacks: a #GMimeParserCallbacks or %NULL
+ * @user_data: user data to pass to each of the callbacks
+ *
+ * Sets the callbacks that @parser invokes as it parses input passed
+ * to g_mime_parser_feed() or parses its stream with
+ * g_mime_parser_parse_message() and g_mime_parser_parse_part(). The
+ * @callbacks structure is copied.
  **/
-gint64
-g_mime_parser_get_from_offset (GMimeParser *parser)
+void
+g_mime_parser_set_callbacks (GMimeParser *parser, const GMimeParserCallbacks *callbacks, gpointer user_data)
 {
 	struct _GMimeParserPrivate *priv;
 	
-	g_return_val_if_fail (GMIME_IS_PARSER (parser), -1);
+	g_return_if_fail (GMIME_IS_PARSER (parser));
 	
 	priv = parser->priv;
-	if (!priv->scan_from)
-		return -1;
 	
-	return priv->from_offset;
+	if (callbacks != NULL)
+		memcpy (&priv->callbacks, callbacks, sizeof (GMimeParserCallbacks));
+	else
+		memset (&priv->callbacks, 0, sizeof (GMimeParserCallbacks));
+	
+	priv->callback_data = user_data;
 }
 
 
 /**
- * g_mime_parser_get_headers_begin:
+ * g_mime_parser_feed:
  * @parser: a #GMimeParser context
+ * @buffer: the next chunk of input
+ * @len: the length of @buffer
  *
- * Gets the stream offset of the beginning of the headers of the most
- * recently parsed message.
+ * Feeds the next chunk of a message (or of an mbox, if @parser has
+ * been set to scan From-lines) to a @parser that was created with
+ * g_mime_parser_new() rather than with a stream.
  *
- * Returns: the offset of the beginning of the headers of the most
- * recently parsed message or %-1 on error.
+ * Instead of constructing #GMimeObjects, @parser invokes the
+ * callbacks set with g_mime_parser_set_callbacks() as each header and
+ * MIME part is parsed, so @buffer may be of any size and messages of
+ * any size can be parsed without ever holding more than the largest
+ * header block in memory. Content is passed on as soon as it is known
+ * not to be part of a boundary; lines are only held back until they
+ * are complete (or fill the parser's buffer, see
+ * g_mime_parser_set_buffer_size()).
+ *
+ * Call g_mime_parser_feed_end() once all of the input has been fed.
+ *
+ * Note: Content-Length headers are not respected in push mode.
  **/
-gint64
-g_mime_parser_get_headers_begin (GMimeParser *parser)
+void
+g_mime_parser_feed (GMimeParser *parser, const char *buffer, size_t len)
 {
-	g_return_val_if_fail (GMIME_IS_PARSER (parser), -1);
+	struct _GMimeParserPrivate *priv;
+	const char *eoln;
+	size_t n;
 	
-	return parser->priv->message_headers_begin;
+	g_return_if_fail (GMIME_IS_PARSER (parser));
+	g_return_if_fail (parser->priv->stream == NULL);
+	g_return_if_fail (buffer != NULL || len == 0);
+	
+	priv = parser->priv;
+	
+	if (priv->offset == -1)
+		priv->offset = 0;
+	
+	if (priv->inptr < priv->inend) {
+		/* complete the partial line left over from last time */
+		n = MIN (len, priv->bufsize - (size_t) (priv->inend - priv->inptr));
+		if ((eoln = memchr (buffer, '\n', n)))
+			n = (size_t) (eoln - buffer) + 1;
+		
+		memcpy (priv->inend, buffer, n);
+		priv->inend += n;
+		priv->offset += n;
+		buffer += n;
+		len -= n;
+		
+		parser_push_lines (parser, FALSE);
+		
+		if (priv->inptr < priv->inend) {
+			/* still incomplete, so we've used up all of buffer */
+			n = (size_t) (priv->inend - priv->inptr);
+			memmove (priv->inbuf, priv->inptr, n);
+			priv->inptr = priv->inbuf;
+			priv->inend = priv->inbuf + n;
+			return;
+		}
+	}
+	
+	/* scan the rest in place; we never write to it */
+	priv->inptr = (char *) buffer;
+	priv->inend = (char *) buffer + len;
+	priv->offset += len;
+	
+	parser_push_lines (parser, FALSE);
+	
+	/* save the trailing partial line */
+	n = (size_t) (priv->inend - priv->inptr);
+	memcpy (priv->inbuf, priv->inptr, n);
+	priv->inptr = priv->inbuf;
+	priv->inend = priv->inbuf + n;
 }
 
 
 /**
- * g_mime_parser_get_headers_end:
+ * g_mime_parser_feed_end:
  * @parser: a #GMimeParser context
  *
- * Gets the stream offset of the end of the headers of the most
- * recently parsed message.
+ * Tells @parser that all of the input has been fed to it with
+ * g_mime_parser_feed(). Whatever is left of the current message is
+ * parsed and each of the MIME parts that are still open get ended.
  *
- * Returns: the offset of the end of the headers of the most recently
- * parsed message or %-1 on error.
+ * The @parser is then ready to be fed the next message.
  **/
-gint64
-g_mime_parser_get_headers_end (GMimeParser *parser)
+void
+g_mime_parser_feed_end (GMimeParser *parser)
 {
-	g_return_val_if_fail (GMIME_IS_PARSER (parser), -1);
+	struct _GMimeParserPrivate *priv;
 	
-	return parser->priv->message_headers_end;
+	g_return_if_fail (GMIME_IS_PARSER (parser));
+	g_return_if_fail (parser->priv->stream == NULL);
+	
+	priv = parser->priv;
+	
+	parser_push_lines (parser, TRUE);
+	
+	switch (priv->state) {
+	case GMIME_PARSER_STATE_MESSAGE_HEADERS:
+	case GMIME_PARSER_STATE_HEADERS:
+		parser_push_headers_end (parser, priv->inptr);
+		break;
+	case GMIME_PARSER_STATE_CONTENT:
+		parser_emit_content_end (parser, 0);
+		break;
+	}
+	
+	while (priv->parts)
+		parser_pop_part (parser);
+	
+	while (priv->bounds)
+		parser_pop_boundary (parser);
+	
+	priv->state = GMIME_PARSER_STATE_INIT;
+	priv->inptr = priv->inbuf;
+	priv->inend = priv->inbuf;
+	priv->midline = FALSE;
+	priv->nheld = 0;
 }
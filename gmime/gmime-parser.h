@@ -42,6 +42,7 @@ G_BEGIN_DECLS
 
 typedef struct _GMimeParser GMimeParser;
 typedef struct _GMimeParserClass GMimeParserClass;
+typedef struct _GMimeParserCallbacks GMimeParserCallbacks;
 
 
 /**
@@ -79,6 +80,52 @@ typedef void (* GMimeParserHeaderRegexFunc) (GMimeParser *parser, const char *he
 					     gpointer user_data);
 
 
+/**
+ * GMimeParserMessageFunc:
+ * @parser: The #GMimeParser object.
+ * @message: The #GMimeMessage that was constructed.
+ * @user_data: The user-supplied callback data.
+ *
+ * Function signature for the callback to
+ * g_mime_parser_construct_messages(). While the callback runs,
+ * g_mime_parser_get_from(), g_mime_parser_get_from_offset(),
+ * g_mime_parser_get_headers_begin() and
+ * g_mime_parser_get_headers_end() describe @message.
+ **/
+typedef void (* GMimeParserMessageFunc) (GMimeParser *parser, GMimeMessage *message,
+					 gpointer user_data);
+
+
+/**
+ * GMimeParserCallbacks:
+ * @start_part: Called when a new MIME part begins, before any of its
+ * headers. @depth is 0 for a toplevel message, the subparts of a
+ * multipart and the message contained in a message/rfc822 part are
+ * one level deeper than their parent.
+ * @header: Called for each header of the current MIME part.
+ * @end_headers: Called once all of the headers of the current MIME
+ * part have been parsed, with the part's effective Content-Type.
+ * @content: Called with each chunk of the current MIME part's content
+ * (or the preface and postface of a multipart). The content is passed
+ * on exactly as it appears in the input, still transfer-encoded.
+ * @end_part: Called when the current MIME part ends.
+ *
+ * The set of callbacks used by g_mime_parser_feed(),
+ * g_mime_parser_parse_message() and g_mime_parser_parse_part(). Any
+ * of the callbacks may be %NULL.
+ **/
+struct _GMimeParserCallbacks {
+	void (* start_part)  (GMimeParser *parser, int depth, gpointer user_data);
+	void (* header)      (GMimeParser *parser, const char *header, const char *value,
+			      gint64 offset, gpointer user_data);
+	void (* end_headers) (GMimeParser *parser, const char *type, const char *subtype,
+			      gpointer user_data);
+	void (* content)     (GMimeParser *parser, const char *content, size_t len,
+			      gpointer user_data);
+	void (* end_part)    (GMimeParser *parser, gpointer user_data);
+};
+
+
 GType g_mime_parser_get_type (void);
 
 GMimeParser *g_mime_parser_new (void);
@@ -95,14 +142,40 @@ void g_mime_parser_set_scan_from (GMimeParser *parser, gboolean scan_from);
 gboolean g_mime_parser_get_respect_content_length (GMimeParser *parser);
 void g_mime_parser_set_respect_content_length (GMimeParser *parser, gboolean respect_content_length);
 
+gboolean g_mime_parser_get_headers_only (GMimeParser *parser);
+void g_mime_parser_set_headers_only (GMimeParser *parser, gboolean headers_only);
+
+gboolean g_mime_parser_get_content_stats (GMimeParser *parser);
+void g_mime_parser_set_content_stats (GMimeParser *parser, gboolean content_stats);
+
+gint64 g_mime_parser_get_memory_limit (GMimeParser *parser);
+void g_mime_parser_set_memory_limit (GMimeParser *parser, gint64 limit);
+
+size_t g_mime_parser_get_buffer_size (GMimeParser *parser);
+void g_mime_parser_set_buffer_size (GMimeParser *parser, size_t size);
+
 void g_mime_parser_set_header_regex (GMimeParser *parser, const char *regex,
 				     GMimeParserHeaderRegexFunc header_cb,
 				     gpointer user_data);
 
+void g_mime_parser_set_callbacks (GMimeParser *parser, const GMimeParserCallbacks *callbacks,
+				  gpointer user_data);
+
+void g_mime_parser_feed (GMimeParser *parser, const char *buffer, size_t len);
+void g_mime_parser_feed_end (GMimeParser *parser);
+
 GMimeObject *g_mime_parser_construct_part (GMimeParser *parser);
 
 GMimeMessage *g_mime_parser_construct_message (GMimeParser *parser);
 
+int g_mime_parser_construct_messages (GMimeParser *parser, guint nthreads,
+				      GMimeParserMessageFunc func,
+				      gpointer user_data);
+
+gboolean g_mime_parser_parse_part (GMimeParser *parser);
+
+gboolean g_mime_parser_parse_message (GMimeParser *parser);
+
 gint64 g_mime_parser_tell (GMimeParser *parser);
 
 gboolean g_mime_parser_eos (GMimeParser *parser);
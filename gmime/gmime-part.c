@@ -37,6 +37,7 @@
 #include "gmime-filter-best.h"
 #include "gmime-filter-crlf.h"
 #include "gmime-filter-md5.h"
+#include "gmime-data-wrapper-private.h"
 #include "gmime-table-private.h"
 
 #define d(x)
@@ -386,8 +387,9 @@ mime_part_encode (GMimeObject *object, GMimeEncodingConstraint constraint)
 {
 	GMimePart *part = (GMimePart *) object;
 	GMimeContentEncoding encoding;
-	GMimeStream *stream, *null;
-	GMimeFilter *filter;
+	
+	if (part->content == NULL)
+		return;
 	
 	switch (part->encoding) {
 	case GMIME_CONTENT_ENCODING_DEFAULT:
@@ -414,19 +416,8 @@ mime_part_encode (GMimeObject *object, GMimeEncodingConstraint constraint)
 		return;
 	}
 	
-	filter = g_mime_filter_best_new (GMIME_FILTER_BEST_ENCODING);
-	
-	null = g_mime_stream_null_new ();
-	stream = g_mime_stream_filter_new (null);
-	g_mime_stream_filter_add ((GMimeStreamFilter *) stream, filter);
-	g_object_unref (null);
-	
-	g_mime_object_write_to_stream (object, stream);
-	g_object_unref (stream);
-	
-	encoding = g_mime_filter_best_encoding ((GMimeFilterBest *) filter, constraint);
+	encoding = g_mime_part_get_best_content_encoding (part, constraint);
 	g_mime_part_set_content_encoding (part, encoding);
-	g_object_unref (filter);
 }
 
 
@@ -773,6 +764,10 @@ g_mime_part_get_content_encoding (GMimePart *mime_part)
  * Calculates the most efficient content encoding for the @mime_part
  * given the @constraint.
  *
+ * If the content was parsed by a #GMimeParser that gathered content
+ * statistics (see g_mime_parser_set_content_stats()), those are used
+ * instead of reading the content again.
+ *
  * Returns: the best content encoding for the specified mime part.
  **/
 GMimeContentEncoding
@@ -785,6 +780,9 @@ g_mime_part_get_best_content_encoding (GMimePart *mime_part, GMimeEncodingConstr
 	
 	g_return_val_if_fail (GMIME_IS_PART (mime_part), GMIME_CONTENT_ENCODING_DEFAULT);
 	
+	if (mime_part->content && (best = g_mime_data_wrapper_get_content_stats (mime_part->content)))
+		return g_mime_filter_best_encoding (best, constraint);
+	
 	stream = g_mime_stream_null_new ();
 	filtered = g_mime_stream_filter_new (stream);
 	g_object_unref (stream);
@@ -0,0 +1,111 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*  GMime
+ *  Copyright (C) 2000-2014 Jeffrey Stedfast
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gmime-simd.h"
+
+#ifdef GMIME_X86_SIMD
+#include <cpuid.h>
+#endif
+
+#define d(x)
+
+static guint32 features = GMIME_SIMD_NONE;
+
+static struct {
+	const char *name;
+	guint32 mask;
+} simd_levels[] = {
+	{ "none",   GMIME_SIMD_NONE },
+	{ "sse2",   GMIME_SIMD_SSE2 },
+	{ "ssse3",  GMIME_SIMD_SSE2 | GMIME_SIMD_SSSE3 },
+	{ "sse4.1", GMIME_SIMD_SSE2 | GMIME_SIMD_SSSE3 | GMIME_SIMD_SSE4_1 | GMIME_SIMD_PCLMUL },
+	{ "avx2",   GMIME_SIMD_SSE2 | GMIME_SIMD_SSSE3 | GMIME_SIMD_SSE4_1 | GMIME_SIMD_PCLMUL | GMIME_SIMD_AVX2 },
+};
+
+
+/**
+ * g_mime_simd_init:
+ *
+ * Probes the cpu for the vector instruction sets that GMime has
+ * kernels for.
+ *
+ * The GMIME_SIMD environment variable may be set to one of "none",
+ * "sse2", "ssse3", "sse4.1" or "avx2" in order to cap the instruction
+ * set that will be used. This is mostly useful for benchmarking and
+ * for testing the portable code paths.
+ **/
+void
+g_mime_simd_init (void)
+{
+#ifdef GMIME_X86_SIMD
+	unsigned int eax, ebx, ecx, edx;
+#endif
+	const char *env;
+	guint i;
+	
+	features = GMIME_SIMD_NONE;
+	
+#ifdef GMIME_X86_SIMD
+	__builtin_cpu_init ();
+	
+	if (__builtin_cpu_supports ("sse2"))
+		features |= GMIME_SIMD_SSE2;
+	if (__builtin_cpu_supports ("ssse3"))
+		features |= GMIME_SIMD_SSSE3;
+	if (__builtin_cpu_supports ("sse4.1"))
+		features |= GMIME_SIMD_SSE4_1;
+	if (__builtin_cpu_supports ("avx2"))
+		features |= GMIME_SIMD_AVX2;
+	
+	/* __builtin_cpu_supports() has no "pclmul" key, so ask cpuid */
+	if (__get_cpuid (1, &eax, &ebx, &ecx, &edx) && (ecx & bit_PCLMUL))
+		features |= GMIME_SIMD_PCLMUL;
+#endif /* GMIME_X86_SIMD */
+	
+	if ((env = g_getenv ("GMIME_SIMD")) != NULL) {
+		for (i = 0; i < G_N_ELEMENTS (simd_levels); i++) {
+			if (!g_ascii_strcasecmp (env, simd_levels[i].name)) {
+				features &= simd_levels[i].mask;
+				break;
+			}
+		}
+	}
+	
+	d(g_message ("simd features: 0x%x", features));
+}
+
+
+/**
+ * g_mime_simd_get_features:
+ *
+ * Gets the set of vector instruction sets that may be used.
+ *
+ * Returns: a bitmask of #GMimeSimdFeatures.
+ **/
+guint32
+g_mime_simd_get_features (void)
+{
+	return features;
+}
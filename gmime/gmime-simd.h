@@ -0,0 +1,54 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*  GMime
+ *  Copyright (C) 2000-2014 Jeffrey Stedfast
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301, USA.
+ */
+
+
+#ifndef __GMIME_SIMD_H__
+#define __GMIME_SIMD_H__
+
+#include <glib.h>
+
+/* x86 kernels are compiled with per-function target attributes so
+ * that the library itself can still be built for the baseline ISA;
+ * which kernel actually gets used is decided at runtime. */
+#if defined (HAVE_X86_SIMD) && (defined (__x86_64__) || defined (__i386__))
+#define GMIME_X86_SIMD 1
+#define GMIME_TARGET(isa) __attribute__((target (isa)))
+#endif
+
+G_BEGIN_DECLS
+
+typedef enum {
+	GMIME_SIMD_NONE   = 0,
+	GMIME_SIMD_SSE2   = 1 << 0,
+	GMIME_SIMD_SSSE3  = 1 << 1,
+	GMIME_SIMD_SSE4_1 = 1 << 2,
+	GMIME_SIMD_AVX2   = 1 << 3,
+	GMIME_SIMD_PCLMUL = 1 << 4
+} GMimeSimdFeatures;
+
+G_GNUC_INTERNAL void g_mime_simd_init (void);
+
+G_GNUC_INTERNAL guint32 g_mime_simd_get_features (void);
+
+#define g_mime_simd_has(feature) ((g_mime_simd_get_features () & (feature)) == (feature))
+
+G_END_DECLS
+
+#endif /* __GMIME_SIMD_H__ */
@@ -0,0 +1,545 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*  GMime
+ *  Copyright (C) 2000-2014 Jeffrey Stedfast
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <errno.h>
+
+#include "gmime-stream-base64.h"
+#include "gmime-encodings.h"
+
+
+/**
+ * SECTION: gmime-stream-base64
+ * @title: GMimeStreamBase64
+ * @short_description: A seekable base64 decoding stream
+ * @see_also: #GMimeStreamFilter
+ *
+ * A read-only #GMimeStream of the decoded content of a base64 encoded
+ * stream.
+ *
+ * Unlike a #GMimeStreamFilter with a base64 decoder, which can only
+ * be read from start to end, a #GMimeStreamBase64 may be seeked. As
+ * the content gets decoded, it keeps a sparse index of the offsets in
+ * the source stream that decoding can be resumed from, so that reading
+ * from the middle of the content only means decoding from the closest
+ * one before it rather than from the very start. This makes it
+ * suitable for serving byte ranges of an attachment.
+ **/
+
+
+#define BLOCK_SIZE 8192
+
+/* decoded bytes between entries of the index */
+#define CHECKPOINT_INTERVAL (64 * 1024)
+
+typedef struct {
+	gint64 decoded;  /* offset in the decoded content */
+	gint64 encoded;  /* matching offset in the source stream */
+} Checkpoint;
+
+struct _GMimeStreamBase64Private {
+	GArray *index;          /* checkpoints, by offset */
+	gint64 length;          /* decoded length or -1 if not known yet */
+	
+	/* decoder state */
+	gint64 encoded;         /* source offset of the next byte to read */
+	guint32 save;
+	int state;
+	gboolean eos;
+	
+	unsigned char inbuf[BLOCK_SIZE];
+	size_t inlen;           /* bytes held back for the next block */
+	
+	unsigned char outbuf[(BLOCK_SIZE / 4) * 3 + 3];
+	size_t outlen;
+	gint64 outoff;          /* decoded offset of outbuf[0] */
+};
+
+static void g_mime_stream_base64_class_init (GMimeStreamBase64Class *klass);
+static void g_mime_stream_base64_init (GMimeStreamBase64 *stream, GMimeStreamBase64Class *klass);
+static void g_mime_stream_base64_finalize (GObject *object);
+
+static ssize_t stream_read (GMimeStream *stream, char *buf, size_t len);
+static ssize_t stream_write (GMimeStream *stream, const char *buf, size_t len);
+static int stream_flush (GMimeStream *stream);
+static int stream_close (GMimeStream *stream);
+static gboolean stream_eos (GMimeStream *stream);
+static int stream_reset (GMimeStream *stream);
+static gint64 stream_seek (GMimeStream *stream, gint64 offset, GMimeSeekWhence whence);
+static gint64 stream_tell (GMimeStream *stream);
+static gint64 stream_length (GMimeStream *stream);
+static GMimeStream *stream_substream (GMimeStream *stream, gint64 start, gint64 end);
+
+
+static GMimeStreamClass *parent_class = NULL;
+
+
+GType
+g_mime_stream_base64_get_type (void)
+{
+	static GType type = 0;
+	
+	if (!type) {
+		static const GTypeInfo info = {
+			sizeof (GMimeStreamBase64Class),
+			NULL, /* base_class_init */
+			NULL, /* base_class_finalize */
+			(GClassInitFunc) g_mime_stream_base64_class_init,
+			NULL, /* class_finalize */
+			NULL, /* class_data */
+			sizeof (GMimeStreamBase64),
+			0,    /* n_preallocs */
+			(GInstanceInitFunc) g_mime_stream_base64_init,
+		};
+		
+		type = g_type_register_static (GMIME_TYPE_STREAM, "GMimeStreamBase64", &info, 0);
+	}
+	
+	return type;
+}
+
+
+static void
+g_mime_stream_base64_class_init (GMimeStreamBase64Class *klass)
+{
+	GMimeStreamClass *stream_class = GMIME_STREAM_CLASS (klass);
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	
+	parent_class = g_type_class_ref (GMIME_TYPE_STREAM);
+	
+	object_class->finalize = g_mime_stream_base64_finalize;
+	
+	stream_class->read = stream_read;
+	stream_class->write = stream_write;
+	stream_class->flush = stream_flush;
+	stream_class->close = stream_close;
+	stream_class->eos = stream_eos;
+	stream_class->reset = stream_reset;
+	stream_class->seek = stream_seek;
+	stream_class->tell = stream_tell;
+	stream_class->length = stream_length;
+	stream_class->substream = stream_substream;
+}
+
+static void
+g_mime_stream_base64_init (GMimeStreamBase64 *stream, GMimeStreamBase64Class *klass)
+{
+	stream->source = NULL;
+	stream->priv = g_new (struct _GMimeStreamBase64Private, 1);
+	stream->priv->index = g_array_new (FALSE, FALSE, sizeof (Checkpoint));
+	stream->priv->length = -1;
+	stream->priv->encoded = 0;
+	stream->priv->save = 0;
+	stream->priv->state = 0;
+	stream->priv->eos = FALSE;
+	stream->priv->inlen = 0;
+	stream->priv->outlen = 0;
+	stream->priv->outoff = 0;
+}
+
+static void
+g_mime_stream_base64_finalize (GObject *object)
+{
+	GMimeStreamBase64 *stream = (GMimeStreamBase64 *) object;
+	
+	if (stream->source)
+		g_object_unref (stream->source);
+	
+	g_array_free (stream->priv->index, TRUE);
+	g_free (stream->priv);
+	
+	G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+
+/* finds the last checkpoint at or before @offset */
+static Checkpoint *
+checkpoint_find (struct _GMimeStreamBase64Private *priv, gint64 offset)
+{
+	guint lo = 0, hi = priv->index->len;
+	Checkpoint *checkpoint;
+	guint i;
+	
+	while (hi - lo > 1) {
+		i = lo + (hi - lo) / 2;
+		checkpoint = &g_array_index (priv->index, Checkpoint, i);
+		
+		if (checkpoint->decoded <= offset)
+			lo = i;
+		else
+			hi = i;
+	}
+	
+	return &g_array_index (priv->index, Checkpoint, lo);
+}
+
+static void
+base64_restart (struct _GMimeStreamBase64Private *priv, Checkpoint *checkpoint)
+{
+	priv->encoded = checkpoint->encoded;
+	priv->save = 0;
+	priv->state = 0;
+	priv->eos = FALSE;
+	priv->inlen = 0;
+	priv->outlen = 0;
+	priv->outoff = checkpoint->decoded;
+}
+
+#define is_base64(c) (((c) >= 'A' && (c) <= 'Z') || ((c) >= 'a' && (c) <= 'z') || \
+		      ((c) >= '0' && (c) <= '9') || (c) == '+' || (c) == '/')
+
+/* The decoder drops a byte of output for each '=' among the last two
+ * base64 characters of every block it is given, so only the last
+ * block may end near one. This way, the content decodes the same no
+ * matter which checkpoint decoding started from. */
+static size_t
+base64_safe_len (const unsigned char *inbuf, size_t inlen)
+{
+	size_t i = inlen;
+	int n = 0;
+	
+	while (i > 0 && n < 2) {
+		i--;
+		
+		if (inbuf[i] == '=') {
+			inlen = i;
+			n = 0;
+		} else if (is_base64 (inbuf[i])) {
+			n++;
+		}
+	}
+	
+	return inlen;
+}
+
+/* decodes the next block of the source */
+static int
+base64_fill (GMimeStreamBase64 *stream)
+{
+	struct _GMimeStreamBase64Private *priv = stream->priv;
+	GMimeStream *source = stream->source;
+	Checkpoint checkpoint, *last;
+	ssize_t nread = 0;
+	size_t inlen, len;
+	gboolean eos;
+	
+	if (source->position != priv->encoded &&
+	    g_mime_stream_seek (source, priv->encoded, GMIME_STREAM_SEEK_SET) == -1)
+		return -1;
+	
+	if (!(eos = g_mime_stream_eos (source))) {
+		nread = g_mime_stream_read (source, (char *) priv->inbuf + priv->inlen, BLOCK_SIZE - priv->inlen);
+		if (nread == -1)
+			return -1;
+		
+		eos = nread == 0;
+	}
+	
+	priv->encoded += nread;
+	inlen = priv->inlen + nread;
+	
+	len = eos ? inlen : base64_safe_len (priv->inbuf, inlen);
+	
+	/* a block of nothing but padding */
+	if (len == 0 && inlen == BLOCK_SIZE)
+		len = inlen;
+	
+	priv->outoff += priv->outlen;
+	priv->outlen = g_mime_encoding_base64_decode_step (priv->inbuf, len, priv->outbuf, &priv->state, &priv->save);
+	
+	priv->inlen = inlen - len;
+	memmove (priv->inbuf, priv->inbuf + len, priv->inlen);
+	
+	if (eos) {
+		priv->length = priv->outoff + priv->outlen;
+		priv->eos = TRUE;
+		return 0;
+	}
+	
+	/* decoding can only be resumed in between 4-byte groups */
+	last = &g_array_index (priv->index, Checkpoint, priv->index->len - 1);
+	if (priv->state == 0 && priv->outoff + (gint64) priv->outlen - last->decoded >= CHECKPOINT_INTERVAL) {
+		checkpoint.decoded = priv->outoff + priv->outlen;
+		checkpoint.encoded = priv->encoded - priv->inlen;
+		g_array_append_val (priv->index, checkpoint);
+	}
+	
+	return 0;
+}
+
+/* Gets the decoded content at @offset into the output buffer and
+ * returns how much of it there is from @offset on, 0 if @offset is
+ * past the end or -1 on error. */
+static ssize_t
+base64_locate (GMimeStreamBase64 *stream, gint64 offset)
+{
+	struct _GMimeStreamBase64Private *priv = stream->priv;
+	Checkpoint *checkpoint;
+	
+	checkpoint = checkpoint_find (priv, offset);
+	
+	/* go back, or skip ahead rather than decode what's in between */
+	if (offset < priv->outoff || checkpoint->decoded > priv->outoff + (gint64) priv->outlen)
+		base64_restart (priv, checkpoint);
+	
+	while (offset >= priv->outoff + (gint64) priv->outlen) {
+		if (priv->eos)
+			return 0;
+		
+		if (base64_fill (stream) == -1)
+			return -1;
+	}
+	
+	return (ssize_t) (priv->outoff + priv->outlen - offset);
+}
+
+static gint64
+base64_length (GMimeStreamBase64 *stream)
+{
+	if (stream->priv->length == -1 && base64_locate (stream, G_MAXINT64) == -1)
+		return -1;
+	
+	return stream->priv->length;
+}
+
+static ssize_t
+stream_read (GMimeStream *stream, char *buf, size_t len)
+{
+	GMimeStreamBase64 *b64 = (GMimeStreamBase64 *) stream;
+	struct _GMimeStreamBase64Private *priv = b64->priv;
+	size_t nread = 0;
+	ssize_t n;
+	
+	if (b64->source == NULL) {
+		errno = EBADF;
+		return -1;
+	}
+	
+	if (stream->bound_end != -1) {
+		if (stream->position > stream->bound_end) {
+			errno = EINVAL;
+			return -1;
+		}
+		
+		len = (size_t) MIN (stream->bound_end - stream->position, (gint64) len);
+	}
+	
+	while (nread < len) {
+		if ((n = base64_locate (b64, stream->position)) <= 0) {
+			if (n == -1 && nread == 0)
+				return -1;
+			
+			break;
+		}
+		
+		n = MIN ((size_t) n, len - nread);
+		memcpy (buf + nread, priv->outbuf + (stream->position - priv->outoff), n);
+		stream->position += n;
+		nread += n;
+	}
+	
+	return nread;
+}
+
+static ssize_t
+stream_write (GMimeStream *stream, const char *buf, size_t len)
+{
+	/* read-only */
+	errno = EBADF;
+	
+	return -1;
+}
+
+static int
+stream_flush (GMimeStream *stream)
+{
+	GMimeStreamBase64 *b64 = (GMimeStreamBase64 *) stream;
+	
+	if (b64->source == NULL) {
+		errno = EBADF;
+		return -1;
+	}
+	
+	return 0;
+}
+
+static int
+stream_close (GMimeStream *stream)
+{
+	GMimeStreamBase64 *b64 = (GMimeStreamBase64 *) stream;
+	
+	if (b64->source) {
+		g_object_unref (b64->source);
+		b64->source = NULL;
+	}
+	
+	return 0;
+}
+
+static gboolean
+stream_eos (GMimeStream *stream)
+{
+	GMimeStreamBase64 *b64 = (GMimeStreamBase64 *) stream;
+	
+	if (b64->source == NULL)
+		return TRUE;
+	
+	if (stream->bound_end != -1 && stream->position >= stream->bound_end)
+		return TRUE;
+	
+	return base64_locate (b64, stream->position) <= 0;
+}
+
+static int
+stream_reset (GMimeStream *stream)
+{
+	GMimeStreamBase64 *b64 = (GMimeStreamBase64 *) stream;
+	
+	if (b64->source == NULL) {
+		errno = EBADF;
+		return -1;
+	}
+	
+	return 0;
+}
+
+static gint64
+stream_seek (GMimeStream *stream, gint64 offset, GMimeSeekWhence whence)
+{
+	GMimeStreamBase64 *b64 = (GMimeStreamBase64 *) stream;
+	gint64 real = stream->position;
+	gint64 length;
+	
+	if (b64->source == NULL) {
+		errno = EBADF;
+		return -1;
+	}
+	
+	switch (whence) {
+	case GMIME_STREAM_SEEK_SET:
+		real = offset;
+		break;
+	case GMIME_STREAM_SEEK_CUR:
+		real = stream->position + offset;
+		break;
+	case GMIME_STREAM_SEEK_END:
+		if (stream->bound_end == -1) {
+			if ((length = base64_length (b64)) == -1)
+				return -1;
+			
+			real = length + offset;
+		} else {
+			real = stream->bound_end + offset;
+		}
+		break;
+	}
+	
+	if (real < stream->bound_start || (stream->bound_end != -1 && real > stream->bound_end)) {
+		errno = EINVAL;
+		return -1;
+	}
+	
+	/* the decoder catches up on the next read */
+	stream->position = real;
+	
+	return real;
+}
+
+static gint64
+stream_tell (GMimeStream *stream)
+{
+	return stream->position;
+}
+
+static gint64
+stream_length (GMimeStream *stream)
+{
+	GMimeStreamBase64 *b64 = (GMimeStreamBase64 *) stream;
+	gint64 length;
+	
+	if (b64->source == NULL) {
+		errno = EBADF;
+		return -1;
+	}
+	
+	if (stream->bound_end != -1)
+		return stream->bound_end - stream->bound_start;
+	
+	if ((length = base64_length (b64)) == -1)
+		return -1;
+	
+	return length - stream->bound_start;
+}
+
+/* decodes @source from @offset on */
+static GMimeStream *
+stream_base64_new (GMimeStream *source, gint64 offset, gint64 start, gint64 end)
+{
+	GMimeStreamBase64 *b64;
+	Checkpoint checkpoint;
+	
+	b64 = g_object_newv (GMIME_TYPE_STREAM_BASE64, 0, NULL);
+	g_mime_stream_construct ((GMimeStream *) b64, start, end);
+	
+	/* a substream of its own, so that nothing else moves it */
+	b64->source = g_mime_stream_substream (source, offset, source->bound_end);
+	
+	checkpoint.decoded = 0;
+	checkpoint.encoded = offset;
+	g_array_append_val (b64->priv->index, checkpoint);
+	base64_restart (b64->priv, &checkpoint);
+	
+	return (GMimeStream *) b64;
+}
+
+static GMimeStream *
+stream_substream (GMimeStream *stream, gint64 start, gint64 end)
+{
+	GMimeStreamBase64 *b64 = (GMimeStreamBase64 *) stream;
+	
+	if (b64->source == NULL) {
+		errno = EBADF;
+		return NULL;
+	}
+	
+	return stream_base64_new (b64->source, b64->source->bound_start, start, end);
+}
+
+/**
+ * g_mime_stream_base64_new:
+ * @source: a base64 encoded source stream
+ *
+ * Creates a new #GMimeStreamBase64 of the decoded content of @source,
+ * from its current position on. @source should be seekable.
+ *
+ * Returns: a seekable stream of the decoded content of @source.
+ **/
+GMimeStream *
+g_mime_stream_base64_new (GMimeStream *source)
+{
+	g_return_val_if_fail (GMIME_IS_STREAM (source), NULL);
+	
+	return stream_base64_new (source, source->position, 0, -1);
+}
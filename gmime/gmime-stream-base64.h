@@ -0,0 +1,68 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*  GMime
+ *  Copyright (C) 2000-2014 Jeffrey Stedfast
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301, USA.
+ */
+
+
+#ifndef __GMIME_STREAM_BASE64_H__
+#define __GMIME_STREAM_BASE64_H__
+
+#include <gmime/gmime-stream.h>
+
+G_BEGIN_DECLS
+
+#define GMIME_TYPE_STREAM_BASE64            (g_mime_stream_base64_get_type ())
+#define GMIME_STREAM_BASE64(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), GMIME_TYPE_STREAM_BASE64, GMimeStreamBase64))
+#define GMIME_STREAM_BASE64_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), GMIME_TYPE_STREAM_BASE64, GMimeStreamBase64Class))
+#define GMIME_IS_STREAM_BASE64(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GMIME_TYPE_STREAM_BASE64))
+#define GMIME_IS_STREAM_BASE64_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), GMIME_TYPE_STREAM_BASE64))
+#define GMIME_STREAM_BASE64_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj), GMIME_TYPE_STREAM_BASE64, GMimeStreamBase64Class))
+
+typedef struct _GMimeStreamBase64 GMimeStreamBase64;
+typedef struct _GMimeStreamBase64Class GMimeStreamBase64Class;
+
+/**
+ * GMimeStreamBase64:
+ * @parent_object: parent #GMimeStream
+ * @priv: private state data
+ * @source: the base64 encoded source stream
+ *
+ * A read-only #GMimeStream of the decoded content of a base64 encoded
+ * stream which may be seeked.
+ **/
+struct _GMimeStreamBase64 {
+	GMimeStream parent_object;
+	
+	struct _GMimeStreamBase64Private *priv;
+	
+	GMimeStream *source;
+};
+
+struct _GMimeStreamBase64Class {
+	GMimeStreamClass parent_class;
+	
+};
+
+
+GType g_mime_stream_base64_get_type (void);
+
+GMimeStream *g_mime_stream_base64_new (GMimeStream *source);
+
+G_END_DECLS
+
+#endif /* __GMIME_STREAM_BASE64_H__ */
@@ -0,0 +1,548 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*  GMime
+ *  Copyright (C) 2000-2014 Jeffrey Stedfast
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <errno.h>
+
+#include "gmime-stream-chunked.h"
+
+
+/* new chunks are as large as everything before them, within these
+ * limits, so that small streams don't waste much memory and large
+ * ones don't need too many chunks */
+#define CHUNK_SIZE_MIN 256
+#define CHUNK_SIZE_MAX (1024 * 1024)
+
+typedef struct {
+	gint64 offset;  /* stream offset of data[0] */
+	size_t len;
+	size_t size;
+	char data[1];
+} Chunk;
+
+static void g_mime_stream_chunked_class_init (GMimeStreamChunkedClass *klass);
+static void g_mime_stream_chunked_init (GMimeStreamChunked *stream, GMimeStreamChunkedClass *klass);
+static void g_mime_stream_chunked_finalize (GObject *object);
+
+static ssize_t stream_read (GMimeStream *stream, char *buf, size_t len);
+static ssize_t stream_write (GMimeStream *stream, const char *buf, size_t len);
+static int stream_flush (GMimeStream *stream);
+static int stream_close (GMimeStream *stream);
+static gboolean stream_eos (GMimeStream *stream);
+static int stream_reset (GMimeStream *stream);
+static gint64 stream_seek (GMimeStream *stream, gint64 offset, GMimeSeekWhence whence);
+static gint64 stream_tell (GMimeStream *stream);
+static gint64 stream_length (GMimeStream *stream);
+static GMimeStream *stream_substream (GMimeStream *stream, gint64 start, gint64 end);
+
+
+static GMimeStreamClass *parent_class = NULL;
+
+
+GType
+g_mime_stream_chunked_get_type (void)
+{
+	static GType type = 0;
+	
+	if (!type) {
+		static const GTypeInfo info = {
+			sizeof (GMimeStreamChunkedClass),
+			NULL, /* base_class_init */
+			NULL, /* base_class_finalize */
+			(GClassInitFunc) g_mime_stream_chunked_class_init,
+			NULL, /* class_finalize */
+			NULL, /* class_data */
+			sizeof (GMimeStreamChunked),
+			0,    /* n_preallocs */
+			(GInstanceInitFunc) g_mime_stream_chunked_init,
+		};
+		
+		type = g_type_register_static (GMIME_TYPE_STREAM, "GMimeStreamChunked", &info, 0);
+	}
+	
+	return type;
+}
+
+
+static void
+g_mime_stream_chunked_class_init (GMimeStreamChunkedClass *klass)
+{
+	GMimeStreamClass *stream_class = GMIME_STREAM_CLASS (klass);
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	
+	parent_class = g_type_class_ref (GMIME_TYPE_STREAM);
+	
+	object_class->finalize = g_mime_stream_chunked_finalize;
+	
+	stream_class->read = stream_read;
+	stream_class->write = stream_write;
+	stream_class->flush = stream_flush;
+	stream_class->close = stream_close;
+	stream_class->eos = stream_eos;
+	stream_class->reset = stream_reset;
+	stream_class->seek = stream_seek;
+	stream_class->tell = stream_tell;
+	stream_class->length = stream_length;
+	stream_class->substream = stream_substream;
+}
+
+static void
+g_mime_stream_chunked_init (GMimeStreamChunked *stream, GMimeStreamChunkedClass *klass)
+{
+	stream->owner = NULL;
+	stream->chunks = NULL;
+	stream->length = 0;
+	stream->current = 0;
+}
+
+static void
+chunks_free (GPtrArray *chunks)
+{
+	guint i;
+	
+	for (i = 0; i < chunks->len; i++)
+		g_free (chunks->pdata[i]);
+	
+	g_ptr_array_free (chunks, TRUE);
+}
+
+static void
+g_mime_stream_chunked_finalize (GObject *object)
+{
+	GMimeStreamChunked *chunked = (GMimeStreamChunked *) object;
+	
+	if (chunked->owner && chunked->owner != chunked)
+		g_object_unref (chunked->owner);
+	
+	if (chunked->chunks)
+		chunks_free (chunked->chunks);
+	
+	G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+
+static Chunk *
+chunk_new (gint64 offset, size_t size)
+{
+	Chunk *chunk;
+	
+	chunk = g_malloc (G_STRUCT_OFFSET (Chunk, data) + size);
+	chunk->offset = offset;
+	chunk->size = size;
+	chunk->len = 0;
+	
+	return chunk;
+}
+
+/* gets the stream holding the chunks, or NULL if it has been closed */
+static GMimeStreamChunked *
+chunked_store (GMimeStream *stream)
+{
+	GMimeStreamChunked *owner = ((GMimeStreamChunked *) stream)->owner;
+	
+	if (owner == NULL || owner->chunks == NULL) {
+		errno = EBADF;
+		return NULL;
+	}
+	
+	return owner;
+}
+
+/* finds the chunk holding @offset, which must be within the data */
+static Chunk *
+chunked_find (GMimeStreamChunked *store, gint64 offset)
+{
+	guint lo = 0, hi = store->chunks->len;
+	Chunk *chunk;
+	guint i;
+	
+	/* streams are mostly read and written from start to end */
+	for (i = store->current; i < store->current + 2 && i < hi; i++) {
+		chunk = store->chunks->pdata[i];
+		if (offset >= chunk->offset && offset < chunk->offset + (gint64) chunk->len)
+			goto found;
+	}
+	
+	while (lo < hi) {
+		i = lo + (hi - lo) / 2;
+		chunk = store->chunks->pdata[i];
+		
+		if (offset < chunk->offset)
+			hi = i;
+		else if (offset >= chunk->offset + (gint64) chunk->len)
+			lo = i + 1;
+		else
+			goto found;
+	}
+	
+	g_assert_not_reached ();
+	
+ found:
+	store->current = i;
+	
+	return chunk;
+}
+
+/* appends @len bytes of @buf, or of zeros if @buf is NULL */
+static void
+chunked_append (GMimeStreamChunked *store, const char *buf, size_t len)
+{
+	Chunk *chunk = NULL;
+	size_t n;
+	
+	if (store->chunks->len > 0)
+		chunk = store->chunks->pdata[store->chunks->len - 1];
+	
+	while (len > 0) {
+		if (chunk == NULL || chunk->len == chunk->size) {
+			n = (size_t) CLAMP (store->length, CHUNK_SIZE_MIN, CHUNK_SIZE_MAX);
+			chunk = chunk_new (store->length, n);
+			g_ptr_array_add (store->chunks, chunk);
+		}
+		
+		n = MIN (len, chunk->size - chunk->len);
+		if (buf != NULL) {
+			memcpy (chunk->data + chunk->len, buf, n);
+			buf += n;
+		} else {
+			memset (chunk->data + chunk->len, 0, n);
+		}
+		
+		store->length += n;
+		chunk->len += n;
+		len -= n;
+	}
+}
+
+static ssize_t
+stream_read (GMimeStream *stream, char *buf, size_t len)
+{
+	GMimeStreamChunked *store;
+	gint64 bound_end;
+	ssize_t nread;
+	Chunk *chunk;
+	size_t n;
+	
+	if (!(store = chunked_store (stream)))
+		return -1;
+	
+	bound_end = stream->bound_end != -1 ? stream->bound_end : store->length;
+	
+	if (stream->position > bound_end) {
+		errno = EINVAL;
+		return -1;
+	}
+	
+	/* a substream's bounds may go past the end of the data */
+	bound_end = MIN (bound_end, store->length);
+	if (stream->position >= bound_end)
+		return 0;
+	
+	nread = (ssize_t) MIN (bound_end - stream->position, (gint64) len);
+	
+	for (len = nread; len > 0; len -= n) {
+		chunk = chunked_find (store, stream->position);
+		n = MIN (len, (size_t) (chunk->offset + chunk->len - stream->position));
+		memcpy (buf, chunk->data + (stream->position - chunk->offset), n);
+		stream->position += n;
+		buf += n;
+	}
+	
+	return nread;
+}
+
+static ssize_t
+stream_write (GMimeStream *stream, const char *buf, size_t len)
+{
+	GMimeStreamChunked *store;
+	ssize_t nwritten;
+	Chunk *chunk;
+	size_t n;
+	
+	if (!(store = chunked_store (stream)))
+		return -1;
+	
+	if (stream->bound_end != -1) {
+		if (stream->position > stream->bound_end) {
+			errno = EINVAL;
+			return -1;
+		}
+		
+		len = (size_t) MIN (stream->bound_end - stream->position, (gint64) len);
+	}
+	
+	nwritten = len;
+	
+	if (stream->position > store->length)
+		chunked_append (store, NULL, (size_t) (stream->position - store->length));
+	
+	/* overwrite what is already there... */
+	while (len > 0 && stream->position < store->length) {
+		chunk = chunked_find (store, stream->position);
+		n = MIN (len, (size_t) (chunk->offset + chunk->len - stream->position));
+		memcpy (chunk->data + (stream->position - chunk->offset), buf, n);
+		stream->position += n;
+		buf += n;
+		len -= n;
+	}
+	
+	/* ...and append the rest */
+	chunked_append (store, buf, len);
+	stream->position += len;
+	
+	return nwritten;
+}
+
+static int
+stream_flush (GMimeStream *stream)
+{
+	if (!chunked_store (stream))
+		return -1;
+	
+	return 0;
+}
+
+static int
+stream_close (GMimeStream *stream)
+{
+	GMimeStreamChunked *chunked = (GMimeStreamChunked *) stream;
+	
+	if (chunked->owner && chunked->owner != chunked)
+		g_object_unref (chunked->owner);
+	
+	if (chunked->chunks)
+		chunks_free (chunked->chunks);
+	
+	chunked->chunks = NULL;
+	chunked->owner = NULL;
+	
+	return 0;
+}
+
+static gboolean
+stream_eos (GMimeStream *stream)
+{
+	GMimeStreamChunked *store;
+	
+	if (!(store = chunked_store (stream)))
+		return TRUE;
+	
+	if (stream->bound_end != -1 && stream->bound_end < store->length)
+		return stream->position >= stream->bound_end;
+	
+	return stream->position >= store->length;
+}
+
+static int
+stream_reset (GMimeStream *stream)
+{
+	if (!chunked_store (stream))
+		return -1;
+	
+	return 0;
+}
+
+static gint64
+stream_seek (GMimeStream *stream, gint64 offset, GMimeSeekWhence whence)
+{
+	gint64 bound_end, real = stream->position;
+	GMimeStreamChunked *store;
+	
+	if (!(store = chunked_store (stream)))
+		return -1;
+	
+	bound_end = stream->bound_end != -1 ? stream->bound_end : store->length;
+	
+	switch (whence) {
+	case GMIME_STREAM_SEEK_SET:
+		real = offset;
+		break;
+	case GMIME_STREAM_SEEK_END:
+		real = offset + bound_end;
+		break;
+	case GMIME_STREAM_SEEK_CUR:
+		real = stream->position + offset;
+		break;
+	}
+	
+	if (real < stream->bound_start) {
+		errno = EINVAL;
+		return -1;
+	}
+	
+	if (stream->bound_end != -1 && real > bound_end) {
+		errno = EINVAL;
+		return -1;
+	}
+	
+	/* like GMimeStreamMem, grow when seeking past the end */
+	if (real > store->length)
+		chunked_append (store, NULL, (size_t) (real - store->length));
+	
+	stream->position = real;
+	
+	return stream->position;
+}
+
+static gint64
+stream_tell (GMimeStream *stream)
+{
+	if (!chunked_store (stream))
+		return -1;
+	
+	return stream->position;
+}
+
+static gint64
+stream_length (GMimeStream *stream)
+{
+	GMimeStreamChunked *store;
+	gint64 bound_end;
+	
+	if (!(store = chunked_store (stream)))
+		return -1;
+	
+	bound_end = stream->bound_end != -1 ? stream->bound_end : store->length;
+	
+	return bound_end - stream->bound_start;
+}
+
+static GMimeStream *
+stream_substream (GMimeStream *stream, gint64 start, gint64 end)
+{
+	GMimeStreamChunked *chunked;
+	
+	chunked = g_object_newv (GMIME_TYPE_STREAM_CHUNKED, 0, NULL);
+	g_mime_stream_construct ((GMimeStream *) chunked, start, end);
+	
+	/* keep the chunks alive for as long as the substream needs them */
+	if ((chunked->owner = ((GMimeStreamChunked *) stream)->owner))
+		g_object_ref (chunked->owner);
+	
+	return (GMimeStream *) chunked;
+}
+
+
+/**
+ * g_mime_stream_chunked_new:
+ *
+ * Creates a new, empty #GMimeStreamChunked.
+ *
+ * Returns: a new chunked memory stream.
+ **/
+GMimeStream *
+g_mime_stream_chunked_new (void)
+{
+	GMimeStreamChunked *chunked;
+	
+	chunked = g_object_newv (GMIME_TYPE_STREAM_CHUNKED, 0, NULL);
+	g_mime_stream_construct ((GMimeStream *) chunked, 0, -1);
+	chunked->chunks = g_ptr_array_new ();
+	chunked->owner = chunked;
+	
+	return (GMimeStream *) chunked;
+}
+
+
+/**
+ * g_mime_stream_chunked_reserve:
+ * @stream: a #GMimeStreamChunked
+ * @size: number of bytes
+ *
+ * Makes room for @size more bytes to be appended to @stream in a
+ * single chunk, for when the caller knows roughly how much data is
+ * coming.
+ **/
+void
+g_mime_stream_chunked_reserve (GMimeStream *stream, size_t size)
+{
+	GMimeStreamChunked *store;
+	Chunk *chunk;
+	guint last;
+	
+	if (!(store = chunked_store (stream)) || size == 0)
+		return;
+	
+	if (store->chunks->len == 0) {
+		g_ptr_array_add (store->chunks, chunk_new (store->length, size));
+		return;
+	}
+	
+	last = store->chunks->len - 1;
+	chunk = store->chunks->pdata[last];
+	
+	if (chunk->size - chunk->len < size) {
+		/* the last chunk is the only one that may move */
+		chunk = g_realloc (chunk, G_STRUCT_OFFSET (Chunk, data) + chunk->len + size);
+		chunk->size = chunk->len + size;
+		store->chunks->pdata[last] = chunk;
+	}
+}
+
+
+/**
+ * g_mime_stream_chunked_truncate:
+ * @stream: a #GMimeStreamChunked
+ * @length: new length
+ *
+ * Discards the data of @stream past @length, if any, along with the
+ * room that was reserved past it.
+ **/
+void
+g_mime_stream_chunked_truncate (GMimeStream *stream, gint64 length)
+{
+	GMimeStreamChunked *store;
+	Chunk *chunk;
+	guint last;
+	
+	if (!(store = chunked_store (stream)) || length > store->length)
+		return;
+	
+	length = MAX (length, 0);
+	
+	while (store->chunks->len > 0) {
+		chunk = store->chunks->pdata[store->chunks->len - 1];
+		if (chunk->offset < length || (chunk->offset == 0 && store->chunks->len == 1))
+			break;
+		
+		g_ptr_array_remove_index (store->chunks, store->chunks->len - 1);
+		g_free (chunk);
+	}
+	
+	if (store->chunks->len > 0) {
+		last = store->chunks->len - 1;
+		chunk = store->chunks->pdata[last];
+		chunk->len = (size_t) (length - chunk->offset);
+		
+		if (chunk->size > MAX (chunk->len, 1)) {
+			chunk = g_realloc (chunk, G_STRUCT_OFFSET (Chunk, data) + MAX (chunk->len, 1));
+			chunk->size = MAX (chunk->len, 1);
+			store->chunks->pdata[last] = chunk;
+		}
+	}
+	
+	store->length = length;
+	store->current = 0;
+}
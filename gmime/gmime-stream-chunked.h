@@ -0,0 +1,67 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*  GMime
+ *  Copyright (C) 2000-2014 Jeffrey Stedfast
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301, USA.
+ */
+
+
+#ifndef __GMIME_STREAM_CHUNKED_H__
+#define __GMIME_STREAM_CHUNKED_H__
+
+#include <glib.h>
+#include <gmime/gmime-stream.h>
+
+G_BEGIN_DECLS
+
+#define GMIME_TYPE_STREAM_CHUNKED            (g_mime_stream_chunked_get_type ())
+#define GMIME_STREAM_CHUNKED(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), GMIME_TYPE_STREAM_CHUNKED, GMimeStreamChunked))
+#define GMIME_IS_STREAM_CHUNKED(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GMIME_TYPE_STREAM_CHUNKED))
+
+typedef struct _GMimeStreamChunked GMimeStreamChunked;
+typedef struct _GMimeStreamChunkedClass GMimeStreamChunkedClass;
+
+/* A memory stream that keeps its data in a list of separately
+ * allocated chunks rather than in one buffer, so that it never has to
+ * move what it already holds in order to grow. The parser saves the
+ * content of the parts it cannot leave in the stream being parsed in
+ * one. Substreams share the chunks of the stream that owns them. */
+struct _GMimeStreamChunked {
+	GMimeStream parent_object;
+
+	GMimeStreamChunked *owner;  /* the stream holding the chunks, or NULL once closed */
+	GPtrArray *chunks;
+	gint64 length;
+	guint current;              /* the chunk last read or written */
+};
+
+struct _GMimeStreamChunkedClass {
+	GMimeStreamClass parent_class;
+
+};
+
+
+G_GNUC_INTERNAL GType g_mime_stream_chunked_get_type (void);
+
+G_GNUC_INTERNAL GMimeStream *g_mime_stream_chunked_new (void);
+
+G_GNUC_INTERNAL void g_mime_stream_chunked_reserve (GMimeStream *stream, size_t size);
+
+G_GNUC_INTERNAL void g_mime_stream_chunked_truncate (GMimeStream *stream, gint64 length);
+
+G_END_DECLS
+
+#endif /* __GMIME_STREAM_CHUNKED_H__ */
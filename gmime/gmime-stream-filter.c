@@ -26,6 +26,7 @@
 #include <string.h>
 
 #include "gmime-stream-filter.h"
+#include "gmime-filter-private.h"
 
 
 /**
@@ -45,7 +46,7 @@
 
 
 #define READ_PAD (64)		/* bytes padded before buffer */
-#define READ_SIZE (4096)
+#define READ_SIZE (4096)	/* default chunk size */
 
 #define _PRIVATE(o) (((GMimeStreamFilter *)(o))->priv)
 
@@ -60,13 +61,16 @@ struct _GMimeStreamFilterPrivate {
 	int filterid;		/* next filter id */
 	
 	char *realbuffer;	/* buffer - READ_PAD */
-	char *buffer;		/* READ_SIZE bytes */
+	char *buffer;		/* buflen bytes */
+	size_t buflen;
+	size_t chunksize;	/* buflen to use for the next read */
 	
 	char *filtered;		/* the filtered data */
 	size_t filteredlen;
 	
 	int last_was_read:1;	/* was the last op read or write? */
 	int flushed:1;          /* have the filters been flushed? */
+	int passthrough:1;	/* may reads go straight into the caller's buffer? */
 };
 
 static void g_mime_stream_filter_class_init (GMimeStreamFilterClass *klass);
@@ -144,9 +148,12 @@ g_mime_stream_filter_init (GMimeStreamFilter *stream, GMimeStreamFilterClass *kl
 	stream->priv->filterid = 0;
 	stream->priv->realbuffer = g_malloc (READ_SIZE + READ_PAD);
 	stream->priv->buffer = stream->priv->realbuffer + READ_PAD;
+	stream->priv->buflen = READ_SIZE;
+	stream->priv->chunksize = READ_SIZE;
 	stream->priv->last_was_read = TRUE;
 	stream->priv->filteredlen = 0;
 	stream->priv->flushed = FALSE;
+	stream->priv->passthrough = TRUE;
 }
 
 static void
@@ -174,33 +181,87 @@ g_mime_stream_filter_finalize (GObject *object)
 }
 
 
+/* runs the buffer through each of the filters, letting the ones that
+ * can work in place do so as long as the buffer is ours to modify */
+static void
+filter_chain (struct _filter *f, gboolean complete, gboolean writable,
+	      char **buffer, size_t *len, size_t *presize)
+{
+	while (f != NULL) {
+		if (complete)
+			writable = g_mime_filter_complete_writable (f->filter, *buffer, *len, *presize,
+								    buffer, len, presize, writable);
+		else
+			writable = g_mime_filter_filter_writable (f->filter, *buffer, *len, *presize,
+								  buffer, len, presize, writable);
+		
+		f = f->next;
+	}
+}
+
 static ssize_t
 stream_read (GMimeStream *stream, char *buf, size_t n)
 {
 	GMimeStreamFilter *filter = (GMimeStreamFilter *) stream;
 	struct _GMimeStreamFilterPrivate *priv = filter->priv;
-	struct _filter *f;
+	size_t presize, len;
 	ssize_t nread;
+	char *buffer;
 	
 	priv->last_was_read = TRUE;
 	
 	if (priv->filteredlen <= 0) {
-		size_t presize = READ_PAD;
+		presize = READ_PAD;
+		
+		if (priv->buflen != priv->chunksize) {
+			g_free (priv->realbuffer);
+			priv->realbuffer = g_malloc (priv->chunksize + READ_PAD);
+			priv->buffer = priv->realbuffer + READ_PAD;
+			priv->buflen = priv->chunksize;
+		}
+		
+		if (priv->passthrough && n >= priv->chunksize) {
+			/* read straight into the caller's buffer: if the filters
+			 * all work in place, the data never has to be copied */
+			if ((nread = g_mime_stream_read (filter->source, buf, n)) > 0) {
+				priv->flushed = FALSE;
+				buffer = buf;
+				len = nread;
+				presize = 0;
+				
+				filter_chain (priv->filters, FALSE, TRUE, &buffer, &len, &presize);
+				
+				if (buffer == buf)
+					return len;
+				
+				/* one of the filters needed its own output buffer,
+				 * so stop trying to save a copy */
+				priv->passthrough = FALSE;
+				
+				if (buffer > buf && buffer < buf + n) {
+					memmove (buf, buffer, len);
+					return len;
+				}
+				
+				nread = MIN (n, len);
+				memcpy (buf, buffer, nread);
+				priv->filtered = buffer + nread;
+				priv->filteredlen = len - nread;
+				
+				return nread;
+			}
+		} else {
+			nread = g_mime_stream_read (filter->source, priv->buffer, priv->buflen);
+		}
 		
-		nread = g_mime_stream_read (filter->source, priv->buffer, READ_SIZE);
 		if (nread <= 0) {
 			/* this is somewhat untested */
 			if (g_mime_stream_eos (filter->source) && !priv->flushed) {
 				priv->filtered = priv->buffer;
 				priv->filteredlen = 0;
-				f = priv->filters;
 				
-				while (f != NULL) {
-					g_mime_filter_complete (f->filter, priv->filtered, priv->filteredlen,
-								presize, &priv->filtered, &priv->filteredlen,
-								&presize);
-					f = f->next;
-				}
+				filter_chain (priv->filters, TRUE, TRUE, &priv->filtered,
+					      &priv->filteredlen, &presize);
 				
 				nread = priv->filteredlen;
 				priv->flushed = TRUE;
@@ -212,14 +273,9 @@ stream_read (GMimeStream *stream, char *buf, size_t n)
 			priv->filtered = priv->buffer;
 			priv->filteredlen = nread;
 			priv->flushed = FALSE;
-			f = priv->filters;
 			
-			while (f != NULL) {
-				g_mime_filter_filter (f->filter, priv->filtered, priv->filteredlen, presize,
-						      &priv->filtered, &priv->filteredlen, &presize);
-				
-				f = f->next;
-			}
+			filter_chain (priv->filters, FALSE, TRUE, &priv->filtered,
+				      &priv->filteredlen, &presize);
 		}
 	}
 	
@@ -238,19 +294,14 @@ stream_write (GMimeStream *stream, const char *buf, size_t n)
 	struct _GMimeStreamFilterPrivate *priv = filter->priv;
 	char *buffer = (char *) buf;
 	ssize_t nwritten = n;
-	struct _filter *f;
 	size_t presize;
 	
 	priv->last_was_read = FALSE;
 	priv->flushed = FALSE;
 	
-	f = priv->filters;
+	/* the caller's buffer is not ours to modify */
 	presize = 0;
-	while (f != NULL) {
-		g_mime_filter_filter (f->filter, buffer, n, presize, &buffer, &n, &presize);
-		
-		f = f->next;
-	}
+	filter_chain (priv->filters, FALSE, FALSE, &buffer, &n, &presize);
 	
 	if (g_mime_stream_write (filter->source, buffer, n) == -1)
 		return -1;
@@ -265,7 +316,6 @@ stream_flush (GMimeStream *stream)
 	GMimeStreamFilter *filter = (GMimeStreamFilter *) stream;
 	struct _GMimeStreamFilterPrivate *priv = filter->priv;
 	size_t presize, len;
-	struct _filter *f;
 	char *buffer;
 	
 	if (priv->last_was_read) {
@@ -276,13 +326,8 @@ stream_flush (GMimeStream *stream)
 	buffer = "";
 	len = 0;
 	presize = 0;
-	f = priv->filters;
 	
-	while (f != NULL) {
-		g_mime_filter_complete (f->filter, buffer, len, presize, &buffer, &len, &presize);
-		
-		f = f->next;
-	}
+	filter_chain (priv->filters, TRUE, FALSE, &buffer, &len, &presize);
 	
 	if (len > 0 && g_mime_stream_write (filter->source, buffer, len) == -1)
 		return -1;
@@ -329,6 +374,7 @@ stream_reset (GMimeStream *stream)
 	
 	priv->filteredlen = 0;
 	priv->flushed = FALSE;
+	priv->passthrough = TRUE;
 	
 	/* and reset filters */
 	f = priv->filters;
@@ -392,6 +438,8 @@ stream_substream (GMimeStream *stream, gint64 start, gint64 end)
 		sub->priv->filterid = filter->priv->filterid;
 	}
 	
+	sub->priv->chunksize = filter->priv->chunksize;
+	
 	g_mime_stream_construct (GMIME_STREAM (filter), start, end);
 	
 	return GMIME_STREAM (sub);
@@ -496,4 +544,45 @@ g_mime_stream_filter_remove (GMimeStreamFilter *stream, int id)
 		}
 		f = f->next;
 	}
+	
+	/* the remaining filters may all work in place */
+	priv->passthrough = TRUE;
+}
+
+
+/**
+ * g_mime_stream_filter_set_chunk_size:
+ * @stream: a #GMimeStreamFilter
+ * @size: chunk size
+ *
+ * Sets the number of bytes that @stream reads from its source stream
+ * at a time when it cannot read straight into the caller's buffer
+ * (the default is 4096). Larger chunks mean fewer calls into the
+ * filters, at the cost of a larger buffer.
+ **/
+void
+g_mime_stream_filter_set_chunk_size (GMimeStreamFilter *stream, size_t size)
+{
+	g_return_if_fail (GMIME_IS_STREAM_FILTER (stream));
+	g_return_if_fail (size > 0);
+	
+	stream->priv->chunksize = size;
+}
+
+
+/**
+ * g_mime_stream_filter_get_chunk_size:
+ * @stream: a #GMimeStreamFilter
+ *
+ * Gets the number of bytes that @stream reads from its source stream
+ * at a time.
+ *
+ * Returns: the chunk size.
+ **/
+size_t
+g_mime_stream_filter_get_chunk_size (GMimeStreamFilter *stream)
+{
+	g_return_val_if_fail (GMIME_IS_STREAM_FILTER (stream), 0);
+	
+	return stream->priv->chunksize;
 }
@@ -66,6 +66,9 @@ GMimeStream *g_mime_stream_filter_new (GMimeStream *stream);
 int g_mime_stream_filter_add (GMimeStreamFilter *stream, GMimeFilter *filter);
 void g_mime_stream_filter_remove (GMimeStreamFilter *stream, int id);
 
+void g_mime_stream_filter_set_chunk_size (GMimeStreamFilter *stream, size_t size);
+size_t g_mime_stream_filter_get_chunk_size (GMimeStreamFilter *stream);
+
 G_END_DECLS
 
 #endif /* __GMIME_STREAM_FILTER_H__ */
@@ -32,7 +32,31 @@
 #include <fcntl.h>
 #include <errno.h>
 
+#ifdef HAVE_WRITEV
+#include <sys/uio.h>
+#include <string.h>
+#include <limits.h>
+#endif
+
 #include "gmime-stream-fs.h"
+#include "gmime-stream-private.h"
+
+#if defined (HAVE_PREAD) && defined (HAVE_PWRITE)
+/* reads and writes never depend on the fd's file offset */
+#define HAVE_POSITIONED_IO 1
+#endif
+
+#if defined (HAVE_WRITEV) && (defined (HAVE_PWRITEV) || !defined (HAVE_POSITIONED_IO))
+/* writev() can be used without giving up on positioned I/O */
+#define HAVE_VECTORED_IO 1
+
+/* maximum number of iovecs passed to a single writev() */
+#if defined (IOV_MAX) && IOV_MAX < 64
+#define FS_IOV_MAX IOV_MAX
+#else
+#define FS_IOV_MAX 64
+#endif
+#endif
 
 #ifndef HAVE_FSYNC
 #ifdef G_OS_WIN32
@@ -53,6 +77,23 @@ static int fsync (int fd) { return 0; }
  *
  * A simple #GMimeStream implementation that sits on top of the
  * low-level UNIX file descriptor based I/O layer.
+ *
+ * Where the system provides pread() and pwrite(), a #GMimeStreamFs
+ * reads and writes at its own position without ever moving the file
+ * offset of the underlying descriptor. This means that any number of
+ * substreams created with g_mime_stream_substream() on the same file
+ * descriptor, such as one for each message of an mbox, may be read
+ * concurrently from different threads, as long as each individual
+ * stream is only used by one thread at a time. The file offset of a
+ * descriptor that the stream does not own (see
+ * g_mime_stream_fs_set_owner()) is still moved to where the stream
+ * stopped after each write, and when the stream is closed or
+ * destroyed, so that other users of the descriptor carry on from
+ * there.
+ *
+ * Where the system provides writev() (and pwritev(), if positioned
+ * I/O is in use), g_mime_stream_writev() writes the whole vector with
+ * a single system call rather than one per block.
  **/
 
 
@@ -70,11 +111,106 @@ static gint64 stream_seek (GMimeStream *stream, gint64 offset, GMimeSeekWhence w
 static gint64 stream_tell (GMimeStream *stream);
 static gint64 stream_length (GMimeStream *stream);
 static GMimeStream *stream_substream (GMimeStream *stream, gint64 start, gint64 end);
+#ifdef HAVE_VECTORED_IO
+static ssize_t stream_writev (GMimeStream *stream, GMimeStreamIOVector *vector, size_t count);
+#endif
 
 
 static GMimeStreamClass *parent_class = NULL;
 
 
+/* reads from @fd at @offset, falling back to a plain read() for
+ * descriptors that cannot seek, such as pipes and ttys */
+static ssize_t
+fs_read (int fd, char *buf, size_t len, gint64 offset)
+{
+	ssize_t nread;
+	
+#ifdef HAVE_PREAD
+	do {
+		nread = pread (fd, buf, len, (off_t) offset);
+	} while (nread == -1 && errno == EINTR);
+	
+	if (nread != -1 || errno != ESPIPE)
+		return nread;
+#else
+	/* make sure we are at the right position */
+	lseek (fd, (off_t) offset, SEEK_SET);
+#endif
+	
+	do {
+		nread = read (fd, buf, len);
+	} while (nread == -1 && errno == EINTR);
+	
+	return nread;
+}
+
+static ssize_t
+fs_write (int fd, const char *buf, size_t len, gint64 offset)
+{
+	ssize_t n;
+	
+#ifdef HAVE_PWRITE
+	do {
+		n = pwrite (fd, buf, len, (off_t) offset);
+	} while (n == -1 && (errno == EINTR || errno == EAGAIN));
+	
+	if (n != -1 || errno != ESPIPE)
+		return n;
+#else
+	/* make sure we are at the right position */
+	lseek (fd, (off_t) offset, SEEK_SET);
+#endif
+	
+	do {
+		n = write (fd, buf, len);
+	} while (n == -1 && (errno == EINTR || errno == EAGAIN));
+	
+	return n;
+}
+
+#ifdef HAVE_POSITIONED_IO
+/* Positioned I/O leaves the file offset of the fd alone. A stream
+ * that doesn't own its fd moves it to where the stream stopped, so
+ * that whoever else uses the fd carries on from there, as they could
+ * when the stream lseek()'d before each read and write. */
+static void
+fs_sync_offset (GMimeStreamFs *fs)
+{
+	if (!fs->owner && fs->fd != -1)
+		lseek (fs->fd, (off_t) ((GMimeStream *) fs)->position, SEEK_SET);
+}
+#else
+#define fs_sync_offset(fs)
+#endif
+
+#ifdef HAVE_VECTORED_IO
+static ssize_t
+fs_writev (int fd, const struct iovec *iov, int count, gint64 offset)
+{
+	ssize_t n;
+	
+#ifdef HAVE_PWRITEV
+	do {
+		n = pwritev (fd, iov, count, (off_t) offset);
+	} while (n == -1 && (errno == EINTR || errno == EAGAIN));
+	
+	if (n != -1 || errno != ESPIPE)
+		return n;
+#else
+	/* make sure we are at the right position */
+	lseek (fd, (off_t) offset, SEEK_SET);
+#endif
+	
+	do {
+		n = writev (fd, iov, count);
+	} while (n == -1 && (errno == EINTR || errno == EAGAIN));
+	
+	return n;
+}
+#endif /* HAVE_VECTORED_IO */
+
+
 GType
 g_mime_stream_fs_get_type (void)
 {
@@ -137,6 +273,8 @@ g_mime_stream_fs_finalize (GObject *object)
 	
 	if (stream->owner && stream->fd != -1)
 		close (stream->fd);
+	else
+		fs_sync_offset (stream);
 	
 	G_OBJECT_CLASS (parent_class)->finalize (object);
 }
@@ -160,12 +298,7 @@ stream_read (GMimeStream *stream, char *buf, size_t len)
 	if (stream->bound_end != -1)
 		len = (size_t) MIN (stream->bound_end - stream->position, (gint64) len);
 	
-	/* make sure we are at the right position */
-	lseek (fs->fd, (off_t) stream->position, SEEK_SET);
-	
-	do {
-		nread = read (fs->fd, buf, len);
-	} while (nread == -1 && errno == EINTR);
+	nread = fs_read (fs->fd, buf, len, stream->position);
 	
 	if (nread > 0) {
 		stream->position += nread;
@@ -196,13 +329,8 @@ stream_write (GMimeStream *stream, const char *buf, size_t len)
 	if (stream->bound_end != -1)
 		len = (size_t) MIN (stream->bound_end - stream->position, (gint64) len);
 	
-	/* make sure we are at the right position */
-	lseek (fs->fd, (off_t) stream->position, SEEK_SET);
-	
 	do {
-		do {
-			n = write (fs->fd, buf + nwritten, len - nwritten);
-		} while (n == -1 && (errno == EINTR || errno == EAGAIN));
+		n = fs_write (fs->fd, buf + nwritten, len - nwritten, stream->position + nwritten);
 		
 		if (n > 0)
 			nwritten += n;
@@ -213,6 +341,7 @@ stream_write (GMimeStream *stream, const char *buf, size_t len)
 	
 	if (nwritten > 0) {
 		stream->position += nwritten;
+		fs_sync_offset (fs);
 	} else if (n == -1) {
 		/* error and nothing written */
 		return -1;
@@ -221,6 +350,86 @@ stream_write (GMimeStream *stream, const char *buf, size_t len)
 	return nwritten;
 }
 
+#ifdef HAVE_VECTORED_IO
+static ssize_t
+stream_writev (GMimeStream *stream, GMimeStreamIOVector *vector, size_t count)
+{
+	GMimeStreamFs *fs = (GMimeStreamFs *) stream;
+	struct iovec iov[FS_IOV_MAX];
+	size_t i = 0, total = 0;
+	size_t nwritten, len;
+	int n_iov;
+	ssize_t n;
+	
+	if (fs->fd == -1) {
+		errno = EBADF;
+		return -1;
+	}
+	
+	if (stream->bound_end != -1) {
+		for (len = 0; i < count; i++)
+			len += vector[i].len;
+		
+		/* let the block-at-a-time writer deal with truncation */
+		if (stream->position + (gint64) len > stream->bound_end)
+			return g_mime_stream_write_blocks (stream, vector, count);
+		
+		i = 0;
+	}
+	
+	while (i < count) {
+		/* gather up as many blocks as will fit into a single writev() */
+		for (n_iov = 0, len = 0; i < count && n_iov < FS_IOV_MAX; i++) {
+			if (vector[i].len == 0)
+				continue;
+			
+			iov[n_iov].iov_base = vector[i].data;
+			iov[n_iov].iov_len = vector[i].len;
+			len += vector[i].len;
+			n_iov++;
+		}
+		
+		nwritten = 0;
+		
+		while (nwritten < len) {
+			if ((n = fs_writev (fs->fd, iov, n_iov, stream->position)) == -1) {
+				if (errno == EFBIG || errno == ENOSPC)
+					fs->eos = TRUE;
+				
+				/* error and nothing written */
+				if (total + nwritten == 0)
+					return -1;
+				
+				fs_sync_offset (fs);
+				
+				return total + nwritten;
+			}
+			
+			stream->position += n;
+			nwritten += n;
+			
+			if (nwritten == len)
+				break;
+			
+			/* short write: skip past the blocks that made it out */
+			while ((size_t) n >= iov[0].iov_len) {
+				n -= iov[0].iov_len;
+				memmove (iov, iov + 1, sizeof (struct iovec) * --n_iov);
+			}
+			
+			iov[0].iov_base = (char *) iov[0].iov_base + n;
+			iov[0].iov_len -= n;
+		}
+		
+		total += nwritten;
+	}
+	
+	fs_sync_offset (fs);
+	
+	return total;
+}
+#endif /* HAVE_VECTORED_IO */
+
 static int
 stream_flush (GMimeStream *stream)
 {
@@ -243,6 +452,8 @@ stream_close (GMimeStream *stream)
 	if (fs->fd == -1)
 		return 0;
 	
+	fs_sync_offset (fs);
+	
 	do {
 		if ((rv = close (fs->fd)) == 0)
 			fs->fd = -1;
@@ -277,11 +488,10 @@ stream_reset (GMimeStream *stream)
 		return 0;
 	}
 	
-	/* FIXME: if stream_read/write is always going to lseek to
-	 * make sure fd's seek position matches our own, we could just
-	 * set stream->position = stream->bound_start and be done. */
+#ifndef HAVE_POSITIONED_IO
 	if (lseek (fs->fd, (off_t) stream->bound_start, SEEK_SET) == -1)
 		return -1;
+#endif
 	
 	fs->eos = FALSE;
 	
@@ -344,8 +554,15 @@ stream_seek (GMimeStream *stream, gint64 offset, GMimeSeekWhence whence)
 		return -1;
 	}
 	
+#ifdef HAVE_POSITIONED_IO
+	/* reads and writes go to stream->position by themselves, so
+	 * only make sure that the fd can seek at all */
+	if (lseek (fs->fd, (off_t) 0, SEEK_CUR) == -1)
+		return -1;
+#else
 	if ((real = lseek (fs->fd, (off_t) real, SEEK_SET)) == -1)
 		return -1;
+#endif
 	
 	/* reset eos if appropriate */
 	if ((stream->bound_end != -1 && real < stream->bound_end) ||
@@ -526,3 +743,27 @@ g_mime_stream_fs_set_owner (GMimeStreamFs *stream, gboolean owner)
 	
 	stream->owner = owner;
 }
+
+
+/* Checks whether @stream is a GMimeStreamFs that can write a whole
+ * vector at once. Subclasses may write differently, so they don't
+ * count. */
+gboolean
+g_mime_stream_fs_can_writev (GMimeStream *stream)
+{
+#ifdef HAVE_VECTORED_IO
+	return G_OBJECT_TYPE (stream) == GMIME_TYPE_STREAM_FS;
+#else
+	return FALSE;
+#endif
+}
+
+ssize_t
+g_mime_stream_fs_writev (GMimeStream *stream, GMimeStreamIOVector *vector, size_t count)
+{
+#ifdef HAVE_VECTORED_IO
+	return stream_writev (stream, vector, count);
+#else
+	return g_mime_stream_write_blocks (stream, vector, count);
+#endif
+}
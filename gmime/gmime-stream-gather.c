@@ -0,0 +1,250 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*  GMime
+ *  Copyright (C) 2000-2014 Jeffrey Stedfast
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include "gmime-stream-gather.h"
+#include "gmime-stream-private.h"
+
+
+/* size of the buffer that small writes are collected in */
+#define GATHER_BUFFER_SIZE (64 * 1024)
+
+/* writes at least this large are never copied */
+#define GATHER_COPY_MAX (GATHER_BUFFER_SIZE / 4)
+
+
+static void g_mime_stream_gather_class_init (GMimeStreamGatherClass *klass);
+static void g_mime_stream_gather_init (GMimeStreamGather *stream, GMimeStreamGatherClass *klass);
+static void g_mime_stream_gather_finalize (GObject *object);
+
+static ssize_t stream_write (GMimeStream *stream, const char *buf, size_t len);
+static int stream_flush (GMimeStream *stream);
+static int stream_close (GMimeStream *stream);
+
+
+static GMimeStreamClass *parent_class = NULL;
+
+
+GType
+g_mime_stream_gather_get_type (void)
+{
+	static GType type = 0;
+	
+	if (!type) {
+		static const GTypeInfo info = {
+			sizeof (GMimeStreamGatherClass),
+			NULL, /* base_class_init */
+			NULL, /* base_class_finalize */
+			(GClassInitFunc) g_mime_stream_gather_class_init,
+			NULL, /* class_finalize */
+			NULL, /* class_data */
+			sizeof (GMimeStreamGather),
+			0,    /* n_preallocs */
+			(GInstanceInitFunc) g_mime_stream_gather_init,
+		};
+		
+		type = g_type_register_static (GMIME_TYPE_STREAM, "GMimeStreamGather", &info, 0);
+	}
+	
+	return type;
+}
+
+
+static void
+g_mime_stream_gather_class_init (GMimeStreamGatherClass *klass)
+{
+	GMimeStreamClass *stream_class = GMIME_STREAM_CLASS (klass);
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	
+	parent_class = g_type_class_ref (GMIME_TYPE_STREAM);
+	
+	object_class->finalize = g_mime_stream_gather_finalize;
+	
+	stream_class->write = stream_write;
+	stream_class->flush = stream_flush;
+	stream_class->close = stream_close;
+}
+
+static void
+g_mime_stream_gather_init (GMimeStreamGather *stream, GMimeStreamGatherClass *klass)
+{
+	stream->source = NULL;
+	stream->buffer = NULL;
+	stream->buflen = 0;
+	stream->flush = FALSE;
+}
+
+static void
+g_mime_stream_gather_finalize (GObject *object)
+{
+	GMimeStreamGather *gather = (GMimeStreamGather *) object;
+	
+	if (gather->source)
+		g_object_unref (gather->source);
+	
+	g_free (gather->buffer);
+	
+	G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static ssize_t
+stream_write (GMimeStream *stream, const char *buf, size_t len)
+{
+	GMimeStreamGather *gather = (GMimeStreamGather *) stream;
+	GMimeStreamIOVector vector[2];
+	size_t buflen;
+	ssize_t n;
+	
+	if (len < GATHER_COPY_MAX && gather->buflen + len <= GATHER_BUFFER_SIZE) {
+		if (gather->buffer == NULL)
+			gather->buffer = g_malloc (GATHER_BUFFER_SIZE);
+		
+		memcpy (gather->buffer + gather->buflen, buf, len);
+		gather->buflen += len;
+	} else {
+		/* send what we've collected along with this block */
+		vector[0].data = gather->buffer;
+		vector[0].len = gather->buflen;
+		vector[1].data = (char *) buf;
+		vector[1].len = len;
+		
+		n = g_mime_stream_writev (gather->source, vector, 2);
+		buflen = gather->buflen;
+		gather->buflen = 0;
+		
+		/* what was collected has already been reported as
+		 * written, so it all has to have made it out, along
+		 * with some of this block */
+		if (n == -1 || (size_t) n <= buflen)
+			return -1;
+		
+		len = n - buflen;
+	}
+	
+	stream->position += len;
+	
+	return len;
+}
+
+static int
+stream_flush (GMimeStream *stream)
+{
+	GMimeStreamGather *gather = (GMimeStreamGather *) stream;
+	
+	/* the serializers flush their filter chains after each part,
+	 * which would otherwise defeat the point; everything is
+	 * written out and flushed by g_mime_stream_gather_commit()
+	 * instead */
+	gather->flush = TRUE;
+	
+	return 0;
+}
+
+static int
+stream_close (GMimeStream *stream)
+{
+	return g_mime_stream_gather_commit (stream);
+}
+
+
+/**
+ * g_mime_stream_gather_wanted:
+ * @stream: a #GMimeStream
+ *
+ * Checks whether it is worth gathering up writes to @stream, which is
+ * the case for streams that g_mime_stream_writev() can write a whole
+ * vector to at once.
+ *
+ * Returns: %TRUE if writes to @stream should go through a
+ * #GMimeStreamGather or %FALSE otherwise.
+ **/
+gboolean
+g_mime_stream_gather_wanted (GMimeStream *stream)
+{
+	return g_mime_stream_fs_can_writev (stream);
+}
+
+
+/**
+ * g_mime_stream_gather_new:
+ * @source: source stream
+ *
+ * Creates a new #GMimeStreamGather which collects writes destined
+ * for @source.
+ *
+ * Returns: a gather stream.
+ **/
+GMimeStream *
+g_mime_stream_gather_new (GMimeStream *source)
+{
+	GMimeStreamGather *gather;
+	
+	gather = g_object_newv (GMIME_TYPE_STREAM_GATHER, 0, NULL);
+	g_mime_stream_construct ((GMimeStream *) gather, 0, -1);
+	gather->source = source;
+	g_object_ref (source);
+	
+	return (GMimeStream *) gather;
+}
+
+
+/**
+ * g_mime_stream_gather_commit:
+ * @stream: a #GMimeStreamGather
+ *
+ * Writes out anything still held by @stream to its source stream,
+ * and flushes the source if @stream has been flushed since the last
+ * commit.
+ *
+ * Returns: %0 on success or %-1 on fail.
+ **/
+int
+g_mime_stream_gather_commit (GMimeStream *stream)
+{
+	GMimeStreamGather *gather = (GMimeStreamGather *) stream;
+	size_t nwritten = 0;
+	ssize_t n;
+	
+	while (nwritten < gather->buflen) {
+		if ((n = g_mime_stream_write (gather->source, gather->buffer + nwritten,
+					      gather->buflen - nwritten)) == -1) {
+			gather->buflen = 0;
+			return -1;
+		}
+		
+		nwritten += n;
+	}
+	
+	gather->buflen = 0;
+	
+	/* like the serializers, don't treat a failed flush as an error */
+	if (gather->flush) {
+		g_mime_stream_flush (gather->source);
+		gather->flush = FALSE;
+	}
+	
+	return 0;
+}
@@ -0,0 +1,66 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*  GMime
+ *  Copyright (C) 2000-2014 Jeffrey Stedfast
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301, USA.
+ */
+
+
+#ifndef __GMIME_STREAM_GATHER_H__
+#define __GMIME_STREAM_GATHER_H__
+
+#include <glib.h>
+#include <gmime/gmime-stream.h>
+
+G_BEGIN_DECLS
+
+#define GMIME_TYPE_STREAM_GATHER            (g_mime_stream_gather_get_type ())
+#define GMIME_STREAM_GATHER(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), GMIME_TYPE_STREAM_GATHER, GMimeStreamGather))
+#define GMIME_IS_STREAM_GATHER(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GMIME_TYPE_STREAM_GATHER))
+
+typedef struct _GMimeStreamGather GMimeStreamGather;
+typedef struct _GMimeStreamGatherClass GMimeStreamGatherClass;
+
+/* A write-only stream that collects the many small writes made by
+ * the serializers (headers, boundaries, short lines of content) and
+ * hands them to its source stream together with the next large
+ * write, as a single g_mime_stream_writev(). */
+struct _GMimeStreamGather {
+	GMimeStream parent_object;
+	
+	GMimeStream *source;
+	char *buffer;
+	size_t buflen;
+	gboolean flush;
+};
+
+struct _GMimeStreamGatherClass {
+	GMimeStreamClass parent_class;
+	
+};
+
+
+G_GNUC_INTERNAL GType g_mime_stream_gather_get_type (void);
+
+G_GNUC_INTERNAL gboolean g_mime_stream_gather_wanted (GMimeStream *stream);
+
+G_GNUC_INTERNAL GMimeStream *g_mime_stream_gather_new (GMimeStream *source);
+
+G_GNUC_INTERNAL int g_mime_stream_gather_commit (GMimeStream *stream);
+
+G_END_DECLS
+
+#endif /* __GMIME_STREAM_GATHER_H__ */
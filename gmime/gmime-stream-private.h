@@ -0,0 +1,41 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*  GMime
+ *  Copyright (C) 2000-2014 Jeffrey Stedfast
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301, USA.
+ */
+
+
+#ifndef __GMIME_STREAM_PRIVATE_H__
+#define __GMIME_STREAM_PRIVATE_H__
+
+#include <gmime/gmime-stream.h>
+
+G_BEGIN_DECLS
+
+/* GMimeStreamClass can't gain a vectored write method without
+ * breaking the ABI, so g_mime_stream_writev() picks out the streams
+ * that have one by their type. */
+G_GNUC_INTERNAL gboolean g_mime_stream_fs_can_writev (GMimeStream *stream);
+
+G_GNUC_INTERNAL ssize_t g_mime_stream_fs_writev (GMimeStream *stream, GMimeStreamIOVector *vector, size_t count);
+
+/* what every other stream does: write the blocks one at a time */
+G_GNUC_INTERNAL ssize_t g_mime_stream_write_blocks (GMimeStream *stream, GMimeStreamIOVector *vector, size_t count);
+
+G_END_DECLS
+
+#endif /* __GMIME_STREAM_PRIVATE_H__ */
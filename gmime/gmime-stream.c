@@ -23,9 +23,43 @@
 #include <config.h>
 #endif
 
+#define _GNU_SOURCE
+
 #include <string.h>
 
 #include "gmime-stream.h"
+#include "gmime-stream-private.h"
+
+#if defined (HAVE_COPY_FILE_RANGE) || (defined (HAVE_SENDFILE) && defined (HAVE_SYS_SENDFILE_H)) || defined (HAVE_SPLICE)
+#define HAVE_KERNEL_COPY 1
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
+#include "gmime-stream-fs.h"
+#include "gmime-stream-pipe.h"
+#include "gmime-stream-gather.h"
+
+/* the most that is handed to the kernel in one call */
+#define KERNEL_COPY_MAX (64 * 1024 * 1024)
+
+/* anything smaller than this is better off being gathered up
+ * with the headers and boundaries around it */
+#define KERNEL_COPY_MIN (64 * 1024)
+
+/* copy_file_range() takes loff_t offsets on Linux, where off_t may
+ * only be 32 bits wide, but off_t offsets elsewhere (FreeBSD) */
+#ifdef __linux__
+typedef loff_t copy_off_t;
+#else
+typedef off_t copy_off_t;
+#endif
+#endif
 
 #define d(x)
 
@@ -528,6 +562,120 @@ g_mime_stream_printf (GMimeStream *stream, const char *fmt, ...)
 }
 
 
+#ifdef HAVE_KERNEL_COPY
+static gboolean
+fd_is_seekable (int fd)
+{
+	return lseek (fd, (off_t) 0, SEEK_CUR) != (off_t) -1;
+}
+
+/* copies from a #GMimeStreamFs to a #GMimeStreamFs or #GMimeStreamPipe
+ * using copy_file_range(), sendfile() or splice(), updating the
+ * positions of both streams as it goes. Stops as soon as the kernel
+ * refuses, leaving the rest to the caller, and returns the number of
+ * bytes copied. */
+static ssize_t
+kernel_copy (GMimeStream *src, GMimeStream *dest)
+{
+	gboolean in_seekable, positioned;
+	GMimeStream *target = dest;
+	int in_fd, out_fd;
+	ssize_t total = 0;
+	ssize_t n = 0;
+	size_t len;
+	
+	if (!GMIME_IS_STREAM_FS (src) || (in_fd = GMIME_STREAM_FS (src)->fd) == -1)
+		return 0;
+	
+	if (GMIME_IS_STREAM_GATHER (dest)) {
+		/* small copies stay in the gather buffer */
+		if (src->bound_end != -1 && src->bound_end - src->position < KERNEL_COPY_MIN)
+			return 0;
+		
+		target = GMIME_STREAM_GATHER (dest)->source;
+	}
+	
+	if (GMIME_IS_STREAM_FS (target))
+		out_fd = GMIME_STREAM_FS (target)->fd;
+	else if (GMIME_IS_STREAM_PIPE (target))
+		out_fd = GMIME_STREAM_PIPE (target)->fd;
+	else
+		return 0;
+	
+	if (out_fd == -1 || target->bound_end != -1)
+		return 0;
+	
+	if (target != dest && g_mime_stream_gather_commit (dest) == -1)
+		return 0;
+	
+	/* seekable destinations are written at the stream position
+	 * (like GMimeStreamFs does), everything else is appended to */
+	positioned = GMIME_IS_STREAM_FS (target) && fd_is_seekable (out_fd);
+	in_seekable = fd_is_seekable (in_fd);
+	
+	do {
+		if (src->bound_end != -1)
+			len = (size_t) MIN (src->bound_end - src->position, KERNEL_COPY_MAX);
+		else
+			len = KERNEL_COPY_MAX;
+		
+		if (len == 0)
+			break;
+		
+		if (in_seekable && positioned) {
+#ifdef HAVE_COPY_FILE_RANGE
+			copy_off_t in_off = src->position;
+			copy_off_t out_off = target->position;
+			
+			do {
+				n = copy_file_range (in_fd, &in_off, out_fd, &out_off, len, 0);
+			} while (n == -1 && errno == EINTR);
+#else
+			n = -1;
+#endif
+		} else if (in_seekable) {
+#if defined (HAVE_SENDFILE) && defined (HAVE_SYS_SENDFILE_H)
+			off_t in_off = (off_t) src->position;
+			
+			do {
+				n = sendfile (out_fd, in_fd, &in_off, len);
+			} while (n == -1 && errno == EINTR);
+#else
+			n = -1;
+#endif
+		} else {
+#ifdef HAVE_SPLICE
+			/* only works if the source is a pipe */
+			loff_t out_off = target->position;
+			
+			do {
+				n = splice (in_fd, NULL, out_fd, positioned ? &out_off : NULL, len, SPLICE_F_MOVE);
+			} while (n == -1 && errno == EINTR);
+#else
+			n = -1;
+#endif
+		}
+		
+		if (n > 0) {
+			src->position += n;
+			target->position += n;
+			total += n;
+		}
+	} while (n > 0);
+	
+	/* like its writes, leave a fd that isn't the stream's own where
+	 * the stream stopped */
+	if (positioned && total > 0 && !GMIME_STREAM_FS (target)->owner)
+		lseek (out_fd, (off_t) target->position, SEEK_SET);
+	
+	if (target != dest)
+		dest->position += total;
+	
+	return total;
+}
+#endif /* HAVE_KERNEL_COPY */
+
+
 /**
  * g_mime_stream_write_to_stream:
  * @src: source stream
@@ -535,6 +683,11 @@ g_mime_stream_printf (GMimeStream *stream, const char *fmt, ...)
  *
  * Attempts to write the source stream to the destination stream.
  *
+ * When @src is a #GMimeStreamFs and @dest is a #GMimeStreamFs or
+ * #GMimeStreamPipe, the data is copied by the kernel (using
+ * copy_file_range(), sendfile() or splice(), where available) without
+ * ever being read into memory.
+ *
  * Returns: the number of bytes written or %-1 on fail.
  **/
 ssize_t
@@ -546,6 +699,12 @@ g_mime_stream_write_to_stream (GMimeStream *src, GMimeStream *dest)
 	g_return_val_if_fail (GMIME_IS_STREAM (src), -1);
 	g_return_val_if_fail (GMIME_IS_STREAM (dest), -1);
 	
+#ifdef HAVE_KERNEL_COPY
+	/* copy what we can without it passing through user space, and
+	 * leave whatever the kernel couldn't do to the loop below */
+	total = kernel_copy (src, dest);
+#endif
+	
 	while (!g_mime_stream_eos (src)) {
 		if ((nread = g_mime_stream_read (src, buf, sizeof (buf))) < 0)
 			return -1;
@@ -569,24 +728,12 @@ g_mime_stream_write_to_stream (GMimeStream *src, GMimeStream *dest)
 }
 
 
-/**
- * g_mime_stream_writev:
- * @stream: a #GMimeStream
- * @vector: a #GMimeStreamIOVector
- * @count: number of vector elements
- *
- * Writes at most @count blocks described by @vector to @stream.
- *
- * Returns: the number of bytes written or %-1 on fail.
- **/
 ssize_t
-g_mime_stream_writev (GMimeStream *stream, GMimeStreamIOVector *vector, size_t count)
+g_mime_stream_write_blocks (GMimeStream *stream, GMimeStreamIOVector *vector, size_t count)
 {
 	ssize_t total = 0;
 	size_t i;
 	
-	g_return_val_if_fail (GMIME_IS_STREAM (stream), -1);
-	
 	for (i = 0; i < count; i++) {
 		char *buffer = vector[i].data;
 		size_t nwritten = 0;
@@ -605,3 +752,30 @@ g_mime_stream_writev (GMimeStream *stream, GMimeStreamIOVector *vector, size_t c
 	
 	return total;
 }
+
+
+/**
+ * g_mime_stream_writev:
+ * @stream: a #GMimeStream
+ * @vector: a #GMimeStreamIOVector
+ * @count: number of vector elements
+ *
+ * Writes at most @count blocks described by @vector to @stream.
+ *
+ * Streams that sit on top of a file descriptor, such as
+ * #GMimeStreamFs, write the whole vector with as few system calls
+ * as possible (using writev() where available) rather than one per
+ * block.
+ *
+ * Returns: the number of bytes written or %-1 on fail.
+ **/
+ssize_t
+g_mime_stream_writev (GMimeStream *stream, GMimeStreamIOVector *vector, size_t count)
+{
+	g_return_val_if_fail (GMIME_IS_STREAM (stream), -1);
+	
+	if (g_mime_stream_fs_can_writev (stream))
+		return g_mime_stream_fs_writev (stream, vector, count);
+	
+	return g_mime_stream_write_blocks (stream, vector, count);
+}
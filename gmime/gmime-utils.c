@@ -57,6 +57,7 @@
 #include "gmime-charset.h"
 #include "gmime-iconv.h"
 #include "gmime-iconv-utils.h"
+#include "gmime-charset-table.h"
 
 #ifdef ENABLE_WARNINGS
 #define w(x) x
@@ -1296,6 +1297,7 @@ g_mime_utils_best_encoding (const unsigned char *text, size_t len)
 /**
  * charset_convert:
  * @cd: iconv converter
+ * @table: built-in conversion table to use instead of @cd, or %NULL
  * @inbuf: input text buffer to convert
  * @inleft: length of the input buffer
  * @outp: pointer to output buffer
@@ -1303,7 +1305,7 @@ g_mime_utils_best_encoding (const unsigned char *text, size_t len)
  * @ninval: the number of invalid bytes in @inbuf
  *
  * Converts the input buffer from one charset to another using the
- * @cd. On completion, @outp will point to the output buffer
+ * @cd (or @table). On completion, @outp will point to the output buffer
  * containing the converted text (nul-terminated), @outlenp will be
  * the size of the @outp buffer (note: not the strlen() of @outp) and
  * @ninval will contain the number of bytes which could not be
@@ -1319,7 +1321,7 @@ g_mime_utils_best_encoding (const unsigned char *text, size_t len)
  * Returns: the string length of the output buffer.
  **/
 static size_t
-charset_convert (iconv_t cd, const char *inbuf, size_t inleft, char **outp, size_t *outlenp, size_t *ninval)
+charset_convert (iconv_t cd, const guint16 *table, const char *inbuf, size_t inleft, char **outp, size_t *outlenp, size_t *ninval)
 {
 	size_t outlen, outleft, rc, n = 0;
 	char *outbuf, *out;
@@ -1333,7 +1335,11 @@ charset_convert (iconv_t cd, const char *inbuf, size_t inleft, char **outp, size
 	}
 	
 	do {
-		rc = iconv (cd, (char **) &inbuf, &inleft, &outbuf, &outleft);
+		if (table != NULL)
+			rc = g_mime_charset_table_convert (table, &inbuf, &inleft, &outbuf, &outleft);
+		else
+			rc = iconv (cd, (char **) &inbuf, &inleft, &outbuf, &outleft);
+		
 		if (rc == (size_t) -1) {
 			if (errno == EINVAL) {
 				/* incomplete sequence at the end of the input buffer */
@@ -1373,7 +1379,7 @@ charset_convert (iconv_t cd, const char *inbuf, size_t inleft, char **outp, size
 		}
 	} while (inleft > 0);
 	
-	while (iconv (cd, NULL, NULL, &outbuf, &outleft) == (size_t) -1) {
+	while (table == NULL && iconv (cd, NULL, NULL, &outbuf, &outleft) == (size_t) -1) {
 		if (errno != E2BIG)
 			break;
 		
@@ -1393,6 +1399,29 @@ charset_convert (iconv_t cd, const char *inbuf, size_t inleft, char **outp, size
 	return (outbuf - out);
 }
 
+/* converts @inbuf from @charset to UTF-8 using charset_convert(),
+ * with a built-in table rather than iconv if there is one; returns
+ * (size_t) -1 if there is no way to convert from @charset */
+static size_t
+charset_convert_to_utf8 (const char *charset, const char *inbuf, size_t inleft, char **outp, size_t *outlenp, size_t *ninval)
+{
+	const guint16 *table;
+	size_t outlen;
+	iconv_t cd;
+	
+	if ((table = g_mime_charset_table_lookup ("UTF-8", charset)) != NULL)
+		return charset_convert ((iconv_t) -1, table, inbuf, inleft, outp, outlenp, ninval);
+	
+	if ((cd = g_mime_iconv_open ("UTF-8", charset)) == (iconv_t) -1)
+		return (size_t) -1;
+	
+	outlen = charset_convert (cd, NULL, inbuf, inleft, outp, outlenp, ninval);
+	
+	g_mime_iconv_close (cd);
+	
+	return outlen;
+}
+
 
 #define USER_CHARSETS_INCLUDE_UTF8    (1 << 0)
 #define USER_CHARSETS_INCLUDE_LOCALE  (1 << 1)
@@ -1419,7 +1448,6 @@ g_mime_utils_decode_8bit (const char *text, size_t len)
 	const char **charsets, **user_charsets, *locale, *best;
 	size_t outleft, outlen, min, ninval;
 	unsigned int included = 0;
-	iconv_t cd;
 	char *out;
 	int i = 0;
 	
@@ -1483,13 +1511,9 @@ g_mime_utils_decode_8bit (const char *text, size_t len)
 	out = g_malloc (outleft + 1);
 	
 	for (i = 0; charsets[i]; i++) {
-		if ((cd = g_mime_iconv_open ("UTF-8", charsets[i])) == (iconv_t) -1)
+		if ((outlen = charset_convert_to_utf8 (charsets[i], text, len, &out, &outleft, &ninval)) == (size_t) -1)
 			continue;
 		
-		outlen = charset_convert (cd, text, len, &out, &outleft, &ninval);
-		
-		g_mime_iconv_close (cd);
-		
 		if (ninval == 0)
 			return g_realloc (out, outlen + 1);
 		
@@ -1503,7 +1527,7 @@ g_mime_utils_decode_8bit (const char *text, size_t len)
 	 * try to find the one that fit the best and use that to convert what we can,
 	 * replacing any byte we can't convert with a '?' */
 	
-	if ((cd = g_mime_iconv_open ("UTF-8", best)) == (iconv_t) -1) {
+	if ((outlen = charset_convert_to_utf8 (best, text, len, &out, &outleft, &ninval)) == (size_t) -1) {
 		/* this shouldn't happen... but if we are here, then
 		 * it did...  the only thing we can do at this point
 		 * is replace the 8bit garbage and pray */
@@ -1525,10 +1549,6 @@ g_mime_utils_decode_8bit (const char *text, size_t len)
 		return g_realloc (out, (size_t) (outbuf - out));
 	}
 	
-	outlen = charset_convert (cd, text, len, &out, &outleft, &ninval);
-	
-	g_mime_iconv_close (cd);
-	
 	return g_realloc (out, outlen + 1);
 }
 
@@ -2045,7 +2065,6 @@ rfc2047_decode_tokens (rfc2047_token *tokens, size_t buflen)
 	GString *decoded;
 	char encoding;
 	guint32 save;
-	iconv_t cd;
 	int state;
 	char *str;
 	
@@ -2104,30 +2123,30 @@ rfc2047_decode_tokens (rfc2047_token *tokens, size_t buflen)
 				}
 				
 				g_string_append_len (decoded, (char *) outptr, outlen);
-			} else if ((cd = g_mime_iconv_open ("UTF-8", charset)) == (iconv_t) -1) {
-				w(g_warning ("Cannot convert from %s to UTF-8, header display may "
-					     "be corrupt: %s", charset[0] ? charset : "unspecified charset",
-					     g_strerror (errno)));
-				
-				str = g_mime_utils_decode_8bit ((char *) outptr, outlen);
-				g_string_append (decoded, str);
-				g_free (str);
 			} else {
 				str = g_malloc (outlen + 1);
 				len = outlen;
 				
-				len = charset_convert (cd, (char *) outptr, outlen, &str, &len, &ninval);
-				g_mime_iconv_close (cd);
-				
-				g_string_append_len (decoded, str, len);
-				g_free (str);
-				
+				if ((len = charset_convert_to_utf8 (charset, (char *) outptr, outlen, &str, &len, &ninval)) == (size_t) -1) {
+					w(g_warning ("Cannot convert from %s to UTF-8, header display may "
+						     "be corrupt: %s", charset[0] ? charset : "unspecified charset",
+						     g_strerror (errno)));
+					
+					g_free (str);
+					str = g_mime_utils_decode_8bit ((char *) outptr, outlen);
+					g_string_append (decoded, str);
+					g_free (str);
+				} else {
+					g_string_append_len (decoded, str, len);
+					g_free (str);
+					
 #if w(!)0
-				if (ninval > 0) {
-					g_warning ("Failed to completely convert \"%.*s\" to UTF-8, display may be "
-						   "corrupt: %s", outlen, (char *) outptr, g_strerror (errno));
-				}
+					if (ninval > 0) {
+						g_warning ("Failed to completely convert \"%.*s\" to UTF-8, display may be "
+							   "corrupt: %s", outlen, (char *) outptr, g_strerror (errno));
+					}
 #endif
+				}
 			}
 		} else if (token->is_8bit) {
 			/* *sigh* I hate broken mailers... */
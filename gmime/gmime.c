@@ -52,6 +52,8 @@ extern gboolean _g_mime_use_only_user_charsets (void);
 extern void g_mime_iconv_utils_shutdown (void);
 extern void g_mime_iconv_utils_init (void);
 
+extern void g_mime_simd_init (void);
+
 extern void _g_mime_iconv_cache_unlock (void);
 extern void _g_mime_iconv_cache_lock (void);
 extern void _g_mime_iconv_utils_unlock (void);
@@ -142,6 +144,7 @@ g_mime_init (guint32 flags)
 	g_mime_charset_map_init ();
 	g_mime_iconv_utils_init ();
 	g_mime_iconv_init ();
+	g_mime_simd_init ();
 	
 #ifdef ENABLE_SMIME
 	/* gpgme_check_version() initializes GpgMe */
@@ -178,6 +181,7 @@ g_mime_init (guint32 flags)
 	g_mime_filter_yenc_get_type ();
 	
 	g_mime_stream_get_type ();
+	g_mime_stream_base64_get_type ();
 	g_mime_stream_buffer_get_type ();
 	g_mime_stream_cat_get_type ();
 	g_mime_stream_file_get_type ();
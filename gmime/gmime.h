@@ -44,8 +44,10 @@
 #include <gmime/internet-address.h>
 #include <gmime/gmime-encodings.h>
 #include <gmime/gmime-parser.h>
+#include <gmime/gmime-mbox-index.h>
 #include <gmime/gmime-utils.h>
 #include <gmime/gmime-stream.h>
+#include <gmime/gmime-stream-base64.h>
 #include <gmime/gmime-stream-buffer.h>
 #include <gmime/gmime-stream-cat.h>
 #include <gmime/gmime-stream-file.h>
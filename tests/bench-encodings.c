@@ -0,0 +1,271 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*  GMime
+ *  Copyright (C) 2000-2014 Jeffrey Stedfast
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gmime/gmime.h>
+
+#define ENABLE_ZENTIMER
+#include "zentimer.h"
+
+/* Content encoding throughput benchmark.
+ *
+ * Usage: bench-encodings [-n iterations] [-s size]
+ *
+ * A buffer of random bytes (or of html-like text, for
+ * quoted-printable) is encoded and the result decoded again with
+ * g_mime_encoding_step() or the yEnc step functions, feeding them
+ * the same block size that GMimeStreamFilter uses. Each run is
+ * repeated for every value of GMIME_SIMD so that the vectorized
+ * kernels can be compared to the portable loops. Throughput is
+ * reported in GB/s of decoded data. */
+
+#define BLOCK_SIZE 4096
+
+static const char *simd_levels[] = { "none", "sse2", "sse4.1", "avx2" };
+
+static guint32 seed = 1;
+
+static guint32
+random_next (void)
+{
+	seed = seed * 1103515245 + 12345;
+	
+	return seed >> 16;
+}
+
+static GByteArray *
+random_data (size_t size)
+{
+	GByteArray *data;
+	size_t i;
+	
+	data = g_byte_array_sized_new (size);
+	g_byte_array_set_size (data, size);
+	for (i = 0; i < size; i++)
+		data->data[i] = random_next ();
+	
+	return data;
+}
+
+/* something like the html that makes up most quoted-printable mail:
+ * words of markup and text on lines of varying length, with the odd
+ * '=' and 8-bit character thrown in */
+static GByteArray *
+text_data (size_t size)
+{
+	static const char *words[] = {
+		"<p>", "</p>", "<div class=\"body\">", "</div>", "<br>", "the", "quick",
+		"brown", "fox", "jumps", "over", "lazy", "dog", "caf\xc3\xa9", "&nbsp;"
+	};
+	const char *word;
+	GByteArray *data;
+	size_t linelen;
+	
+	data = g_byte_array_sized_new (size + 64);
+	
+	while (data->len < size) {
+		linelen = 40 + random_next () % 160;
+		while (linelen > 0 && data->len < size) {
+			word = words[random_next () % G_N_ELEMENTS (words)];
+			g_byte_array_append (data, (const guint8 *) word, strlen (word));
+			g_byte_array_append (data, (const guint8 *) " ", 1);
+			linelen -= MIN (linelen, strlen (word) + 1);
+		}
+		
+		g_byte_array_append (data, (const guint8 *) "\n", 1);
+	}
+	
+	g_byte_array_set_size (data, size);
+	
+	return data;
+}
+
+static size_t
+run_step (GMimeEncoding *state, const unsigned char *inbuf, size_t inlen, unsigned char *outbuf)
+{
+	unsigned char *outptr = outbuf;
+	size_t i, n;
+	
+	for (i = 0; i < inlen; i += n) {
+		n = MIN (BLOCK_SIZE, inlen - i);
+		outptr += g_mime_encoding_step (state, (const char *) inbuf + i, n, (char *) outptr);
+	}
+	
+	outptr += g_mime_encoding_flush (state, NULL, 0, (char *) outptr);
+	
+	return outptr - outbuf;
+}
+
+static void
+bench_codec (GMimeContentEncoding encoding, GByteArray *input, guint iterations)
+{
+	unsigned char *encoded, *decoded;
+	size_t enclen = 0, declen = 0;
+	GMimeEncoding state;
+	double seconds, gb;
+	guint i, j;
+	
+	gb = ((double) input->len * iterations) / (1024.0 * 1024.0 * 1024.0);
+	
+	g_mime_encoding_init_encode (&state, encoding);
+	encoded = g_malloc (g_mime_encoding_outlen (&state, input->len) + BLOCK_SIZE);
+	decoded = g_malloc (input->len + BLOCK_SIZE);
+	
+	for (i = 0; i < G_N_ELEMENTS (simd_levels); i++) {
+		g_setenv ("GMIME_SIMD", simd_levels[i], TRUE);
+		g_mime_init (0);
+		
+		ZenTimerStart (NULL);
+		for (j = 0; j < iterations; j++) {
+			g_mime_encoding_init_encode (&state, encoding);
+			enclen = run_step (&state, input->data, input->len, encoded);
+		}
+		ZenTimerStop (NULL);
+		
+		seconds = ZenTimerElapsed (NULL, NULL);
+		printf ("%-16s encode simd %-6s %10.2f MB %8.3f s %8.2f GB/s\n",
+			g_mime_content_encoding_to_string (encoding), simd_levels[i],
+			gb * 1024.0, seconds, gb / seconds);
+		
+		ZenTimerStart (NULL);
+		for (j = 0; j < iterations; j++) {
+			g_mime_encoding_init_decode (&state, encoding);
+			declen = run_step (&state, encoded, enclen, decoded);
+		}
+		ZenTimerStop (NULL);
+		
+		seconds = ZenTimerElapsed (NULL, NULL);
+		printf ("%-16s decode simd %-6s %10.2f MB %8.3f s %8.2f GB/s\n",
+			g_mime_content_encoding_to_string (encoding), simd_levels[i],
+			gb * 1024.0, seconds, gb / seconds);
+		
+		if (declen != input->len || memcmp (decoded, input->data, declen) != 0)
+			fprintf (stderr, "%s: simd level %s does not round-trip\n",
+				 g_mime_content_encoding_to_string (encoding), simd_levels[i]);
+		
+		g_mime_shutdown ();
+	}
+	
+	g_unsetenv ("GMIME_SIMD");
+	
+	g_free (encoded);
+	g_free (decoded);
+}
+
+static void
+bench_yenc (GByteArray *input, guint iterations)
+{
+	guint32 pcrc, crc, expected = 0;
+	unsigned char *encoded, *decoded;
+	size_t i, n, enclen = 0, declen = 0;
+	double seconds, gb;
+	guint j, k;
+	int state;
+	
+	gb = ((double) input->len * iterations) / (1024.0 * 1024.0 * 1024.0);
+	
+	encoded = g_malloc ((input->len + 2) * 2 + 62 + BLOCK_SIZE);
+	decoded = g_malloc (input->len + 3 + BLOCK_SIZE);
+	
+	for (k = 0; k < G_N_ELEMENTS (simd_levels); k++) {
+		g_setenv ("GMIME_SIMD", simd_levels[k], TRUE);
+		g_mime_init (0);
+		
+		ZenTimerStart (NULL);
+		for (j = 0; j < iterations; j++) {
+			state = GMIME_YENCODE_STATE_INIT;
+			pcrc = crc = GMIME_YENCODE_CRC_INIT;
+			
+			for (i = 0, enclen = 0; i < input->len; i += n) {
+				n = MIN (BLOCK_SIZE, input->len - i);
+				enclen += g_mime_yencode_step (input->data + i, n, encoded + enclen, &state, &pcrc, &crc);
+			}
+			
+			enclen += g_mime_yencode_close (NULL, 0, encoded + enclen, &state, &pcrc, &crc);
+		}
+		ZenTimerStop (NULL);
+		
+		seconds = ZenTimerElapsed (NULL, NULL);
+		printf ("%-16s encode simd %-6s %10.2f MB %8.3f s %8.2f GB/s\n",
+			"yEnc", simd_levels[k], gb * 1024.0, seconds, gb / seconds);
+		
+		if (k == 0)
+			expected = crc;
+		
+		ZenTimerStart (NULL);
+		for (j = 0; j < iterations; j++) {
+			state = GMIME_YDECODE_STATE_INIT;
+			pcrc = crc = GMIME_YENCODE_CRC_INIT;
+			
+			for (i = 0, declen = 0; i < enclen; i += n) {
+				n = MIN (BLOCK_SIZE, enclen - i);
+				declen += g_mime_ydecode_step (encoded + i, n, decoded + declen, &state, &pcrc, &crc);
+			}
+		}
+		ZenTimerStop (NULL);
+		
+		seconds = ZenTimerElapsed (NULL, NULL);
+		printf ("%-16s decode simd %-6s %10.2f MB %8.3f s %8.2f GB/s\n",
+			"yEnc", simd_levels[k], gb * 1024.0, seconds, gb / seconds);
+		
+		if (declen != input->len || memcmp (decoded, input->data, declen) != 0 || crc != expected)
+			fprintf (stderr, "yEnc: simd level %s does not round-trip\n", simd_levels[k]);
+		
+		g_mime_shutdown ();
+	}
+	
+	g_unsetenv ("GMIME_SIMD");
+	
+	g_free (encoded);
+	g_free (decoded);
+}
+
+int main (int argc, char **argv)
+{
+	size_t size = 16 * 1024 * 1024;
+	guint iterations = 10;
+	GByteArray *input;
+	int i;
+	
+	for (i = 1; i < argc; i++) {
+		if (!strcmp (argv[i], "-n") && i + 1 < argc)
+			iterations = strtoul (argv[++i], NULL, 10);
+		else if (!strcmp (argv[i], "-s") && i + 1 < argc)
+			size = strtoul (argv[++i], NULL, 10);
+	}
+	
+	input = random_data (size);
+	bench_codec (GMIME_CONTENT_ENCODING_BASE64, input, iterations);
+	bench_yenc (input, iterations);
+	g_byte_array_free (input, TRUE);
+	
+	input = text_data (size);
+	bench_codec (GMIME_CONTENT_ENCODING_QUOTEDPRINTABLE, input, iterations);
+	g_byte_array_free (input, TRUE);
+	
+	return 0;
+}
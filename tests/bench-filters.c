@@ -0,0 +1,297 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*  GMime
+ *  Copyright (C) 2000-2014 Jeffrey Stedfast
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gmime/gmime.h>
+
+#define ENABLE_ZENTIMER
+#include "zentimer.h"
+
+/* GMimeStreamFilter throughput benchmark.
+ *
+ * Usage: bench-filters [-n iterations] [-s size]
+ *
+ * Some latin1 text with CRLF line endings (base64 or quoted-printable
+ * encoded, for the chains that start by decoding it) is pushed
+ * through the filter chains that are commonly used to display or
+ * save a message part. Each chain is run both ways: by writing the
+ * input to a filter stream on top of a null stream, and by reading
+ * from a filter stream on top of a memory stream into a 64k buffer
+ * (which lets the filters that can work in place do so), using a
+ * couple of chunk sizes. The decode, charset and CRLF steps are also
+ * timed done in one pass by g_mime_data_wrapper_write_text_to_stream().
+ * Throughput is reported in MB/s of input. */
+
+#define READ_BUFFER_SIZE (64 * 1024)
+
+static size_t chunk_sizes[] = { 4096, 65536 };
+
+enum {
+	CHAIN_CRLF,
+	CHAIN_MD5_BEST_CRLF,
+	CHAIN_BASE64_CHARSET_CRLF,
+	CHAIN_QP_CHARSET_CRLF_HTML
+};
+
+static struct {
+	const char *name;
+	GMimeContentEncoding encoding;
+} chains[] = {
+	{ "crlf",                     GMIME_CONTENT_ENCODING_DEFAULT         },
+	{ "md5|best|crlf",            GMIME_CONTENT_ENCODING_DEFAULT         },
+	{ "base64|charset|crlf",      GMIME_CONTENT_ENCODING_BASE64          },
+	{ "qp|charset|crlf|html",     GMIME_CONTENT_ENCODING_QUOTEDPRINTABLE },
+};
+
+static guint32 seed = 1;
+
+static guint32
+random_next (void)
+{
+	seed = seed * 1103515245 + 12345;
+	
+	return seed >> 16;
+}
+
+static GByteArray *
+text_data (size_t size)
+{
+	static const char *words[] = {
+		"the", "quick", "brown", "fox", "jumps", "over", "the", "lazy",
+		"dog", "caf\xe9", "na\xefve", "<b>", "&", "=", "r\xe9sum\xe9"
+	};
+	const char *word;
+	GByteArray *data;
+	size_t linelen;
+	
+	data = g_byte_array_sized_new (size + 64);
+	
+	while (data->len < size) {
+		linelen = 20 + random_next () % 56;
+		while (linelen > 0 && data->len < size) {
+			word = words[random_next () % G_N_ELEMENTS (words)];
+			g_byte_array_append (data, (const guint8 *) word, strlen (word));
+			g_byte_array_append (data, (const guint8 *) " ", 1);
+			linelen -= MIN (linelen, strlen (word) + 1);
+		}
+		
+		g_byte_array_append (data, (const guint8 *) "\r\n", 2);
+	}
+	
+	return data;
+}
+
+static GByteArray *
+encode_data (GByteArray *input, GMimeContentEncoding encoding)
+{
+	GMimeStream *stream, *filtered;
+	GMimeFilter *filter;
+	GByteArray *output;
+	
+	output = g_byte_array_new ();
+	stream = g_mime_stream_mem_new_with_byte_array (output);
+	g_mime_stream_mem_set_owner ((GMimeStreamMem *) stream, FALSE);
+	
+	filtered = g_mime_stream_filter_new (stream);
+	filter = g_mime_filter_basic_new (encoding, TRUE);
+	g_mime_stream_filter_add ((GMimeStreamFilter *) filtered, filter);
+	g_object_unref (filter);
+	
+	g_mime_stream_write (filtered, (const char *) input->data, input->len);
+	g_mime_stream_flush (filtered);
+	
+	g_object_unref (filtered);
+	g_object_unref (stream);
+	
+	return output;
+}
+
+static GMimeStream *
+chain_new (GMimeStream *source, int chain, size_t chunksize)
+{
+	GMimeFilter *filters[4];
+	GMimeStream *stream;
+	int i, n = 0;
+	
+	switch (chain) {
+	case CHAIN_CRLF:
+		filters[n++] = g_mime_filter_crlf_new (FALSE, FALSE);
+		break;
+	case CHAIN_MD5_BEST_CRLF:
+		filters[n++] = g_mime_filter_md5_new ();
+		filters[n++] = g_mime_filter_best_new (GMIME_FILTER_BEST_CHARSET | GMIME_FILTER_BEST_ENCODING);
+		filters[n++] = g_mime_filter_crlf_new (FALSE, FALSE);
+		break;
+	case CHAIN_BASE64_CHARSET_CRLF:
+		filters[n++] = g_mime_filter_basic_new (GMIME_CONTENT_ENCODING_BASE64, FALSE);
+		filters[n++] = g_mime_filter_charset_new ("iso-8859-1", "utf-8");
+		filters[n++] = g_mime_filter_crlf_new (FALSE, FALSE);
+		break;
+	case CHAIN_QP_CHARSET_CRLF_HTML:
+		filters[n++] = g_mime_filter_basic_new (GMIME_CONTENT_ENCODING_QUOTEDPRINTABLE, FALSE);
+		filters[n++] = g_mime_filter_charset_new ("iso-8859-1", "utf-8");
+		filters[n++] = g_mime_filter_crlf_new (FALSE, FALSE);
+		filters[n++] = g_mime_filter_html_new (GMIME_FILTER_HTML_CONVERT_NL, 0);
+		break;
+	}
+	
+	stream = g_mime_stream_filter_new (source);
+	g_mime_stream_filter_set_chunk_size ((GMimeStreamFilter *) stream, chunksize);
+	
+	for (i = 0; i < n; i++) {
+		g_mime_stream_filter_add ((GMimeStreamFilter *) stream, filters[i]);
+		g_object_unref (filters[i]);
+	}
+	
+	return stream;
+}
+
+static void
+bench_chain (GByteArray *text, int chain, guint iterations)
+{
+	GMimeStream *source, *stream, *null;
+	gint64 written = 0, nread = 0;
+	double seconds, mb;
+	GByteArray *input;
+	char *buf;
+	ssize_t n;
+	guint i, j;
+	
+	if (chains[chain].encoding != GMIME_CONTENT_ENCODING_DEFAULT)
+		input = encode_data (text, chains[chain].encoding);
+	else
+		input = text;
+	
+	mb = ((double) input->len * iterations) / (1024.0 * 1024.0);
+	buf = g_malloc (READ_BUFFER_SIZE);
+	
+	for (i = 0; i < G_N_ELEMENTS (chunk_sizes); i++) {
+		ZenTimerStart (NULL);
+		for (j = 0; j < iterations; j++) {
+			null = g_mime_stream_null_new ();
+			stream = chain_new (null, chain, chunk_sizes[i]);
+			g_mime_stream_write (stream, (const char *) input->data, input->len);
+			g_mime_stream_flush (stream);
+			written = ((GMimeStreamNull *) null)->written;
+			g_object_unref (stream);
+			g_object_unref (null);
+		}
+		ZenTimerStop (NULL);
+		
+		seconds = ZenTimerElapsed (NULL, NULL);
+		printf ("%-22s write chunk %6u %10.2f MB %8.3f s %8.2f MB/s\n",
+			chains[chain].name, (unsigned int) chunk_sizes[i],
+			mb, seconds, mb / seconds);
+		
+		ZenTimerStart (NULL);
+		for (j = 0; j < iterations; j++) {
+			source = g_mime_stream_mem_new_with_buffer ((const char *) input->data, input->len);
+			stream = chain_new (source, chain, chunk_sizes[i]);
+			nread = 0;
+			while ((n = g_mime_stream_read (stream, buf, READ_BUFFER_SIZE)) > 0)
+				nread += n;
+			g_object_unref (stream);
+			g_object_unref (source);
+		}
+		ZenTimerStop (NULL);
+		
+		seconds = ZenTimerElapsed (NULL, NULL);
+		printf ("%-22s read  chunk %6u %10.2f MB %8.3f s %8.2f MB/s\n",
+			chains[chain].name, (unsigned int) chunk_sizes[i],
+			mb, seconds, mb / seconds);
+		
+		if (nread != written)
+			fprintf (stderr, "%s: read %" G_GINT64_FORMAT " bytes but wrote %" G_GINT64_FORMAT "\n",
+				 chains[chain].name, nread, written);
+	}
+	
+	if (input != text)
+		g_byte_array_free (input, TRUE);
+	
+	g_free (buf);
+}
+
+static void
+bench_text (GByteArray *text, GMimeContentEncoding encoding, guint iterations)
+{
+	GMimeStream *source, *null;
+	GMimeDataWrapper *wrapper;
+	double seconds, mb;
+	GByteArray *input;
+	guint i;
+	
+	input = encode_data (text, encoding);
+	mb = ((double) input->len * iterations) / (1024.0 * 1024.0);
+	
+	source = g_mime_stream_mem_new_with_buffer ((const char *) input->data, input->len);
+	wrapper = g_mime_data_wrapper_new_with_stream (source, encoding);
+	g_object_unref (source);
+	
+	ZenTimerStart (NULL);
+	for (i = 0; i < iterations; i++) {
+		null = g_mime_stream_null_new ();
+		g_mime_data_wrapper_write_text_to_stream (wrapper, null, "iso-8859-1");
+		g_object_unref (null);
+	}
+	ZenTimerStop (NULL);
+	
+	seconds = ZenTimerElapsed (NULL, NULL);
+	printf ("%-22s fused             %10.2f MB %8.3f s %8.2f MB/s\n",
+		encoding == GMIME_CONTENT_ENCODING_BASE64 ? "base64|charset|crlf" : "qp|charset|crlf",
+		mb, seconds, mb / seconds);
+	
+	g_object_unref (wrapper);
+	g_byte_array_free (input, TRUE);
+}
+
+int main (int argc, char **argv)
+{
+	size_t size = 16 * 1024 * 1024;
+	guint iterations = 10;
+	GByteArray *text;
+	int i;
+	
+	for (i = 1; i < argc; i++) {
+		if (!strcmp (argv[i], "-n") && i + 1 < argc)
+			iterations = strtoul (argv[++i], NULL, 10);
+		else if (!strcmp (argv[i], "-s") && i + 1 < argc)
+			size = strtoul (argv[++i], NULL, 10);
+	}
+	
+	g_mime_init (0);
+	
+	text = text_data (size);
+	for (i = 0; i < (int) G_N_ELEMENTS (chains); i++)
+		bench_chain (text, i, iterations);
+	bench_text (text, GMIME_CONTENT_ENCODING_BASE64, iterations);
+	bench_text (text, GMIME_CONTENT_ENCODING_QUOTEDPRINTABLE, iterations);
+	g_byte_array_free (text, TRUE);
+	
+	g_mime_shutdown ();
+	
+	return 0;
+}
@@ -0,0 +1,391 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*  GMime
+ *  Copyright (C) 2000-2014 Jeffrey Stedfast
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <gmime/gmime.h>
+
+#define ENABLE_ZENTIMER
+#include "zentimer.h"
+
+/* Parser throughput benchmark.
+ *
+ * Usage: bench-parser [-n iterations] [mbox]
+ *
+ * Without an mbox, a synthetic one full of base64 attachments and
+ * plain text bodies is generated. The whole input is kept in memory
+ * so that only the parser is measured. Each run is repeated for every
+ * value of GMIME_SIMD so that the vectorized content scanner can be
+ * compared to the portable line-at-a-time loop.
+ *
+ * The mbox is then written to a temporary file and parsed from a
+ * GMimeStreamFs with a range of parser buffer sizes, reporting the
+ * number of read() syscalls (on systems that have /proc/self/io)
+ * along with the throughput.
+ *
+ * Finally, building the object tree is compared to reporting the
+ * same parse through callbacks with g_mime_parser_parse_message() and
+ * to only parsing the message headers.
+ *
+ * Last of all, g_mime_parser_construct_messages() is run with an
+ * increasing number of threads. */
+
+static const char *simd_levels[] = { "none", "sse2", "avx2" };
+
+static const size_t buffer_sizes[] = {
+	4096, 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024
+};
+
+static GString *
+generate_mbox (guint nmessages)
+{
+	static const char base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	guint32 seed = 1;
+	GString *mbox;
+	guint i, j, k;
+	
+	mbox = g_string_new ("");
+	
+	for (i = 0; i < nmessages; i++) {
+		g_string_append_printf (mbox, "From bench@example.com Mon Jan  1 00:00:%02u 2001\n", i % 60);
+		g_string_append_printf (mbox, "From: Bench <bench@example.com>\n"
+					"To: Parser <parser@example.com>\n"
+					"Subject: message %u\n"
+					"Message-Id: <%u@example.com>\n"
+					"MIME-Version: 1.0\n"
+					"Content-Type: multipart/mixed; boundary=\"=-boundary-%u\"\n\n"
+					"This is a multi-part message in MIME format.\n\n", i, i, i);
+		
+		g_string_append_printf (mbox, "--=-boundary-%u\n"
+					"Content-Type: text/plain; charset=us-ascii\n\n", i);
+		
+		for (j = 0; j < 64; j++)
+			g_string_append (mbox, "The quick brown fox jumps over the lazy dog, again and again and again.\n");
+		
+		g_string_append_printf (mbox, "\n--=-boundary-%u\n"
+					"Content-Type: application/octet-stream\n"
+					"Content-Transfer-Encoding: base64\n\n", i);
+		
+		for (j = 0; j < 1024; j++) {
+			for (k = 0; k < 76; k++) {
+				seed = seed * 1103515245 + 12345;
+				g_string_append_c (mbox, base64[(seed >> 16) & 63]);
+			}
+			
+			g_string_append_c (mbox, '\n');
+		}
+		
+		g_string_append_printf (mbox, "\n--=-boundary-%u--\n\n", i);
+	}
+	
+	return mbox;
+}
+
+static GString *
+load_mbox (const char *path)
+{
+	GString *mbox;
+	char *buf;
+	gsize len;
+	
+	if (!g_file_get_contents (path, &buf, &len, NULL))
+		return NULL;
+	
+	mbox = g_string_new_len (buf, len);
+	g_free (buf);
+	
+	return mbox;
+}
+
+static guint64
+read_syscalls (void)
+{
+	guint64 syscr = 0;
+	char *buf, *p;
+	
+	if (!g_file_get_contents ("/proc/self/io", &buf, NULL, NULL))
+		return 0;
+	
+	if ((p = strstr (buf, "syscr: ")))
+		syscr = g_ascii_strtoull (p + 7, NULL, 10);
+	
+	g_free (buf);
+	
+	return syscr;
+}
+
+static guint
+parse_mbox (GMimeStream *stream, size_t bufsize, gboolean headers_only)
+{
+	GMimeMessage *message;
+	GMimeParser *parser;
+	guint n = 0;
+	
+	g_mime_stream_reset (stream);
+	parser = g_mime_parser_new_with_stream (stream);
+	g_mime_parser_set_buffer_size (parser, bufsize);
+	g_mime_parser_set_headers_only (parser, headers_only);
+	g_mime_parser_set_scan_from (parser, TRUE);
+	
+	while (!g_mime_parser_eos (parser)) {
+		if (!(message = g_mime_parser_construct_message (parser)))
+			break;
+		
+		g_object_unref (message);
+		n++;
+	}
+	
+	g_object_unref (parser);
+	
+	return n;
+}
+
+static guint
+parse_mbox_events (GMimeStream *stream)
+{
+	GMimeParserCallbacks callbacks = { NULL, };
+	GMimeParser *parser;
+	guint n = 0;
+	
+	g_mime_stream_reset (stream);
+	parser = g_mime_parser_new_with_stream (stream);
+	g_mime_parser_set_callbacks (parser, &callbacks, NULL);
+	g_mime_parser_set_scan_from (parser, TRUE);
+	
+	while (!g_mime_parser_eos (parser)) {
+		if (!g_mime_parser_parse_message (parser))
+			break;
+		
+		n++;
+	}
+	
+	g_object_unref (parser);
+	
+	return n;
+}
+
+static void
+count_message (GMimeParser *parser, GMimeMessage *message, gpointer user_data)
+{
+	(*((guint *) user_data))++;
+}
+
+static guint
+parse_mbox_threads (GMimeStream *stream, guint nthreads)
+{
+	GMimeParser *parser;
+	guint n = 0;
+	
+	g_mime_stream_reset (stream);
+	parser = g_mime_parser_new_with_stream (stream);
+	g_mime_parser_set_scan_from (parser, TRUE);
+	
+	g_mime_parser_construct_messages (parser, nthreads, count_message, &n);
+	
+	g_object_unref (parser);
+	
+	return n;
+}
+
+static void
+bench_simd (GByteArray *array, guint iterations)
+{
+	GMimeStream *stream;
+	double seconds, mb;
+	guint i, j, n;
+	
+	mb = ((double) array->len * iterations) / (1024.0 * 1024.0);
+	
+	for (i = 0; i < G_N_ELEMENTS (simd_levels); i++) {
+		g_setenv ("GMIME_SIMD", simd_levels[i], TRUE);
+		g_mime_init (0);
+		
+		stream = g_mime_stream_mem_new_with_byte_array (array);
+		g_mime_stream_mem_set_owner ((GMimeStreamMem *) stream, FALSE);
+		
+		ZenTimerStart (NULL);
+		for (j = 0, n = 0; j < iterations; j++)
+			n += parse_mbox (stream, 4096, FALSE);
+		ZenTimerStop (NULL);
+		
+		g_object_unref (stream);
+		
+		seconds = ZenTimerElapsed (NULL, NULL);
+		printf ("simd %-6s %8u messages %10.2f MB %8.3f s %10.2f MB/s\n",
+			simd_levels[i], n, mb, seconds, mb / seconds);
+		
+		g_mime_shutdown ();
+	}
+	
+	g_unsetenv ("GMIME_SIMD");
+}
+
+static void
+bench_buffer_size (GByteArray *array, guint iterations)
+{
+	GMimeStream *stream;
+	double seconds, mb;
+	guint64 syscr;
+	char *path;
+	guint i, j;
+	int fd;
+	
+	if ((fd = g_file_open_tmp ("bench-parser.XXXXXX", &path, NULL)) == -1)
+		return;
+	
+	if (write (fd, array->data, array->len) != (ssize_t) array->len) {
+		close (fd);
+		goto exit;
+	}
+	
+	lseek (fd, 0, SEEK_SET);
+	mb = ((double) array->len * iterations) / (1024.0 * 1024.0);
+	stream = g_mime_stream_fs_new (fd);
+	g_mime_init (0);
+	
+	for (i = 0; i < G_N_ELEMENTS (buffer_sizes); i++) {
+		syscr = read_syscalls ();
+		
+		ZenTimerStart (NULL);
+		for (j = 0; j < iterations; j++)
+			parse_mbox (stream, buffer_sizes[i], FALSE);
+		ZenTimerStop (NULL);
+		
+		syscr = read_syscalls () - syscr;
+		seconds = ZenTimerElapsed (NULL, NULL);
+		printf ("buffer %8zu %10" G_GUINT64_FORMAT " reads %10.2f MB %8.3f s %10.2f MB/s\n",
+			buffer_sizes[i], syscr / iterations, mb, seconds, mb / seconds);
+	}
+	
+	g_mime_shutdown ();
+	g_object_unref (stream);
+	
+ exit:
+	unlink (path);
+	g_free (path);
+}
+
+static void
+bench_events (GByteArray *array, guint iterations)
+{
+	static const char *modes[] = { "construct", "events", "headers-only" };
+	GMimeStream *stream;
+	double seconds, mb;
+	guint i, n, mode;
+	
+	mb = ((double) array->len * iterations) / (1024.0 * 1024.0);
+	g_mime_init (0);
+	
+	stream = g_mime_stream_mem_new_with_byte_array (array);
+	g_mime_stream_mem_set_owner ((GMimeStreamMem *) stream, FALSE);
+	
+	for (mode = 0; mode < G_N_ELEMENTS (modes); mode++) {
+		ZenTimerStart (NULL);
+		for (i = 0, n = 0; i < iterations; i++) {
+			if (mode == 1)
+				n += parse_mbox_events (stream);
+			else
+				n += parse_mbox (stream, 4096, mode == 2);
+		}
+		ZenTimerStop (NULL);
+		
+		seconds = ZenTimerElapsed (NULL, NULL);
+		printf ("%-12s %8u messages %10.2f MB %8.3f s %10.2f MB/s\n",
+			modes[mode], n, mb, seconds, mb / seconds);
+	}
+	
+	g_object_unref (stream);
+	g_mime_shutdown ();
+}
+
+static void
+bench_threads (GByteArray *array, guint iterations)
+{
+	GMimeStream *stream;
+	double seconds, mb;
+	guint i, n, nthreads, max;
+	
+	mb = ((double) array->len * iterations) / (1024.0 * 1024.0);
+	max = MIN (g_get_num_processors (), 8);
+	g_mime_init (0);
+	
+	stream = g_mime_stream_mem_new_with_byte_array (array);
+	g_mime_stream_mem_set_owner ((GMimeStreamMem *) stream, FALSE);
+	
+	for (nthreads = 1; nthreads <= max; nthreads *= 2) {
+		ZenTimerStart (NULL);
+		for (i = 0, n = 0; i < iterations; i++)
+			n += parse_mbox_threads (stream, nthreads);
+		ZenTimerStop (NULL);
+		
+		seconds = ZenTimerElapsed (NULL, NULL);
+		printf ("threads %4u %8u messages %10.2f MB %8.3f s %10.2f MB/s\n",
+			nthreads, n, mb, seconds, mb / seconds);
+	}
+	
+	g_object_unref (stream);
+	g_mime_shutdown ();
+}
+
+int main (int argc, char **argv)
+{
+	const char *path = NULL;
+	guint iterations = 10;
+	GByteArray *array;
+	GString *mbox;
+	guint i;
+	
+	for (i = 1; i < argc; i++) {
+		if (!strcmp (argv[i], "-n") && i + 1 < argc)
+			iterations = strtoul (argv[++i], NULL, 10);
+		else
+			path = argv[i];
+	}
+	
+	if (path != NULL) {
+		if (!(mbox = load_mbox (path))) {
+			fprintf (stderr, "failed to load %s\n", path);
+			return EXIT_FAILURE;
+		}
+	} else {
+		mbox = generate_mbox (256);
+	}
+	
+	array = g_byte_array_sized_new (mbox->len);
+	g_byte_array_append (array, (guint8 *) mbox->str, mbox->len);
+	g_string_free (mbox, TRUE);
+	
+	bench_simd (array, iterations);
+	bench_buffer_size (array, iterations);
+	bench_events (array, iterations);
+	bench_threads (array, iterations);
+	
+	g_byte_array_free (array, TRUE);
+	
+	return 0;
+}
@@ -0,0 +1,757 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*  GMime
+ *  Copyright (C) 2000-2014 Jeffrey Stedfast
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <gmime/gmime.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "testsuite.h"
+
+extern int verbose;
+
+#define d(x)
+#define v(x) if (verbose > 3) x
+
+/* The vectorized codecs must produce exactly what the portable ones
+ * do, so every case is run once for each value of GMIME_SIMD and the
+ * results are compared to those of "none". */
+static const char *simd_levels[] = { "none", "sse2", "ssse3", "sse4.1", "avx2" };
+
+static const size_t lengths[] = { 0, 1, 2, 3, 4, 11, 12, 13, 16, 47, 48, 57, 58, 100, 1000, 4093, 65543 };
+
+static const size_t chunks[] = { 1, 3, 7, 57, 77, 4096, G_MAXSIZE };
+
+static guint32 seed = 1;
+
+static guint32
+random_next (void)
+{
+	seed = seed * 1103515245 + 12345;
+	
+	return seed >> 16;
+}
+
+static GByteArray *
+random_data (size_t len)
+{
+	GByteArray *data;
+	size_t i;
+	
+	data = g_byte_array_sized_new (len);
+	for (i = 0; i < len; i++) {
+		unsigned char c = random_next () & 0xff;
+		g_byte_array_append (data, &c, 1);
+	}
+	
+	return data;
+}
+
+/* text with a mix of long and short lines, trailing whitespace, '='
+ * and 8-bit characters, all of which quoted-printable has to escape */
+static GByteArray *
+text_data (size_t len)
+{
+	static const char specials[] = " \t =.\x80\xc3\xa9";
+	GByteArray *data;
+	guint32 linelen, i, r;
+	unsigned char c;
+	
+	data = g_byte_array_sized_new (len);
+	while (data->len < len) {
+		linelen = random_next () % 160;
+		for (i = 0; i < linelen && data->len < len; i++) {
+			r = random_next () % 100;
+			if (r < 80)
+				c = 'a' + (r % 26);
+			else
+				c = specials[r % (sizeof (specials) - 1)];
+			g_byte_array_append (data, &c, 1);
+		}
+		
+		if (data->len < len)
+			g_byte_array_append (data, (unsigned char *) "\n", 1);
+	}
+	
+	return data;
+}
+
+/* mangles encoded text the way transports and broken mailers do */
+static GByteArray *
+dirty_data (GByteArray *clean)
+{
+	static const char noise[] = " \t\r=*!~\x80\xff";
+	GByteArray *dirty;
+	unsigned char c;
+	size_t i;
+	
+	dirty = g_byte_array_sized_new (clean->len * 2);
+	for (i = 0; i < clean->len; i++) {
+		if (clean->data[i] == '\n')
+			g_byte_array_append (dirty, (unsigned char *) "\r", 1);
+		
+		g_byte_array_append (dirty, clean->data + i, 1);
+		
+		if ((random_next () % 61) == 0) {
+			c = noise[random_next () % (sizeof (noise) - 1)];
+			g_byte_array_append (dirty, &c, 1);
+		}
+	}
+	
+	return dirty;
+}
+
+static GByteArray *
+encoding_step_chunked (GMimeEncoding *state, GByteArray *input, size_t chunk)
+{
+	GByteArray *output;
+	size_t i, n, len;
+	
+	output = g_byte_array_new ();
+	
+	for (i = 0; i < input->len; i += n) {
+		n = MIN (chunk, input->len - i);
+		len = output->len;
+		
+		g_byte_array_set_size (output, len + g_mime_encoding_outlen (state, n));
+		len += g_mime_encoding_step (state, (const char *) input->data + i, n, (char *) output->data + len);
+		g_byte_array_set_size (output, len);
+	}
+	
+	len = output->len;
+	g_byte_array_set_size (output, len + g_mime_encoding_outlen (state, 0) + 8);
+	len += g_mime_encoding_flush (state, NULL, 0, (char *) output->data + len);
+	g_byte_array_set_size (output, len);
+	
+	return output;
+}
+
+static GByteArray *
+encode_chunked (GMimeContentEncoding encoding, GByteArray *input, size_t chunk)
+{
+	GMimeEncoding state;
+	
+	g_mime_encoding_init_encode (&state, encoding);
+	
+	return encoding_step_chunked (&state, input, chunk);
+}
+
+static GByteArray *
+decode_chunked (GMimeContentEncoding encoding, GByteArray *input, size_t chunk)
+{
+	GMimeEncoding state;
+	
+	g_mime_encoding_init_decode (&state, encoding);
+	
+	return encoding_step_chunked (&state, input, chunk);
+}
+
+static gboolean
+byte_arrays_equal (GByteArray *a, GByteArray *b)
+{
+	return a->len == b->len && (a->len == 0 || memcmp (a->data, b->data, a->len) == 0);
+}
+
+/* runs every case for the current simd level, appending the results */
+typedef GByteArray * (* DataFunc) (size_t len);
+typedef void (* RunFunc) (GMimeContentEncoding encoding, DataFunc generate, GPtrArray *results);
+
+static void
+run_codec (GMimeContentEncoding encoding, DataFunc generate, GPtrArray *results)
+{
+	GByteArray *input, *encoded, *dirty, *output;
+	guint i, j;
+	
+	seed = 1;
+	
+	for (i = 0; i < G_N_ELEMENTS (lengths); i++) {
+		input = generate (lengths[i]);
+		encoded = encode_chunked (encoding, input, G_MAXSIZE);
+		dirty = dirty_data (encoded);
+		
+		for (j = 0; j < G_N_ELEMENTS (chunks); j++) {
+			output = encode_chunked (encoding, input, chunks[j]);
+			if (!byte_arrays_equal (output, encoded))
+				throw (exception_new ("encoding %u bytes in chunks of %u bytes is inconsistent",
+						      (guint) lengths[i], (guint) MIN (chunks[j], G_MAXUINT)));
+			g_ptr_array_add (results, output);
+			
+			/* padding split across steps is not always recognized,
+			 * so only a decode in one step must round-trip */
+			output = decode_chunked (encoding, encoded, chunks[j]);
+			if (chunks[j] == G_MAXSIZE && !byte_arrays_equal (output, input))
+				throw (exception_new ("decoding %u bytes does not round-trip", (guint) lengths[i]));
+			g_ptr_array_add (results, output);
+			
+			g_ptr_array_add (results, decode_chunked (encoding, dirty, chunks[j]));
+		}
+		
+		g_byte_array_free (encoded, TRUE);
+		g_byte_array_free (dirty, TRUE);
+		g_byte_array_free (input, TRUE);
+	}
+}
+
+/* the textbook bit-at-a-time crc32, to check the table-driven and
+ * carry-less multiplication versions in gmime-filter-yenc.c against */
+static guint32
+crc32_update (guint32 crc, const unsigned char *inbuf, size_t inlen)
+{
+	size_t i;
+	int bit;
+	
+	for (i = 0; i < inlen; i++) {
+		crc ^= inbuf[i];
+		for (bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+	
+	return crc;
+}
+
+static void
+append_crc (GByteArray *output, guint32 crc)
+{
+	guint8 bytes[4] = { crc >> 24, crc >> 16, crc >> 8, crc };
+	
+	g_byte_array_append (output, bytes, 4);
+}
+
+/* yencodes @input as two parts, @split bytes into the input */
+static GByteArray *
+yencode_chunked (GByteArray *input, size_t split, size_t chunk, guint32 *pcrc, guint32 *crc)
+{
+	size_t i, n, len, end;
+	GByteArray *output;
+	int state, part;
+	
+	output = g_byte_array_new ();
+	*pcrc = *crc = GMIME_YENCODE_CRC_INIT;
+	
+	for (part = 0, i = 0; part < 2 && i < input->len; part++) {
+		state = GMIME_YENCODE_STATE_INIT;
+		*pcrc = GMIME_YENCODE_CRC_INIT;
+		end = part == 0 ? split : input->len;
+		
+		for ( ; i < end; i += n) {
+			n = MIN (chunk, end - i);
+			len = output->len;
+			
+			g_byte_array_set_size (output, len + (n + 2) * 2 + 62);
+			len += g_mime_yencode_step (input->data + i, n, output->data + len, &state, pcrc, crc);
+			g_byte_array_set_size (output, len);
+		}
+		
+		len = output->len;
+		g_byte_array_set_size (output, len + 64);
+		len += g_mime_yencode_close (NULL, 0, output->data + len, &state, pcrc, crc);
+		g_byte_array_set_size (output, len);
+	}
+	
+	return output;
+}
+
+static GByteArray *
+ydecode_chunked (GByteArray *input, size_t chunk, guint32 *pcrc, guint32 *crc)
+{
+	GByteArray *output;
+	size_t i, n, len;
+	int state;
+	
+	output = g_byte_array_new ();
+	state = GMIME_YDECODE_STATE_INIT;
+	*pcrc = *crc = GMIME_YENCODE_CRC_INIT;
+	
+	for (i = 0; i < input->len; i += n) {
+		n = MIN (chunk, input->len - i);
+		len = output->len;
+		
+		g_byte_array_set_size (output, len + n + 3);
+		len += g_mime_ydecode_step (input->data + i, n, output->data + len, &state, pcrc, crc);
+		g_byte_array_set_size (output, len);
+	}
+	
+	return output;
+}
+
+static void
+run_yenc (GMimeContentEncoding encoding, DataFunc generate, GPtrArray *results)
+{
+	GByteArray *input, *encoded, *dirty, *output;
+	guint32 pcrc, crc, expected;
+	size_t split;
+	guint i, j;
+	
+	seed = 1;
+	
+	for (i = 0; i < G_N_ELEMENTS (lengths); i++) {
+		input = generate (lengths[i]);
+		split = input->len / 3;
+		encoded = yencode_chunked (input, input->len, G_MAXSIZE, &pcrc, &crc);
+		dirty = dirty_data (encoded);
+		
+		expected = crc32_update (~0, input->data, input->len);
+		if (crc != expected || pcrc != expected)
+			throw (exception_new ("crc of %u bytes is %08x instead of %08x",
+					      (guint) lengths[i], ~crc, ~expected));
+		
+		for (j = 0; j < G_N_ELEMENTS (chunks); j++) {
+			output = yencode_chunked (input, split, chunks[j], &pcrc, &crc);
+			if (pcrc != crc32_update (~0, input->data + split, input->len - split) || crc != expected)
+				throw (exception_new ("part crcs of %u bytes in chunks of %u bytes are wrong",
+						      (guint) lengths[i], (guint) MIN (chunks[j], G_MAXUINT)));
+			g_ptr_array_add (results, output);
+			
+			output = yencode_chunked (input, input->len, chunks[j], &pcrc, &crc);
+			if (!byte_arrays_equal (output, encoded))
+				throw (exception_new ("yencoding %u bytes in chunks of %u bytes is inconsistent",
+						      (guint) lengths[i], (guint) MIN (chunks[j], G_MAXUINT)));
+			g_byte_array_free (output, TRUE);
+			
+			output = ydecode_chunked (encoded, chunks[j], &pcrc, &crc);
+			if (!byte_arrays_equal (output, input) || crc != expected || pcrc != expected)
+				throw (exception_new ("ydecoding %u bytes in chunks of %u bytes does not round-trip",
+						      (guint) lengths[i], (guint) MIN (chunks[j], G_MAXUINT)));
+			g_ptr_array_add (results, output);
+			
+			output = ydecode_chunked (dirty, chunks[j], &pcrc, &crc);
+			append_crc (output, pcrc);
+			append_crc (output, crc);
+			g_ptr_array_add (results, output);
+		}
+		
+		g_byte_array_free (encoded, TRUE);
+		g_byte_array_free (dirty, TRUE);
+		g_byte_array_free (input, TRUE);
+	}
+}
+
+static void
+free_results (GPtrArray *results)
+{
+	guint i;
+	
+	for (i = 0; i < results->len; i++)
+		g_byte_array_free (results->pdata[i], TRUE);
+	
+	g_ptr_array_free (results, TRUE);
+}
+
+static void
+test_codec (RunFunc run, GMimeContentEncoding encoding, DataFunc generate)
+{
+	GPtrArray *expected, *results;
+	guint i, j;
+	
+	expected = g_ptr_array_new ();
+	
+	for (i = 0; i < G_N_ELEMENTS (simd_levels); i++) {
+		g_setenv ("GMIME_SIMD", simd_levels[i], TRUE);
+		g_mime_init (0);
+		
+		results = i == 0 ? expected : g_ptr_array_new ();
+		
+		testsuite_check ("simd level %s", simd_levels[i]);
+		try {
+			run (encoding, generate, results);
+			
+			if (results != expected) {
+				if (results->len != expected->len)
+					throw (exception_new ("ran %u cases instead of %u", results->len, expected->len));
+				
+				for (j = 0; j < results->len; j++) {
+					if (!byte_arrays_equal (results->pdata[j], expected->pdata[j]))
+						throw (exception_new ("case %u does not match the portable code", j));
+				}
+			}
+			
+			testsuite_check_passed ();
+		} catch (ex) {
+			testsuite_check_failed ("simd level %s: %s", simd_levels[i], ex->message);
+		} finally;
+		
+		if (results != expected)
+			free_results (results);
+		
+		g_mime_shutdown ();
+	}
+	
+	free_results (expected);
+	
+	g_unsetenv ("GMIME_SIMD");
+}
+
+/* text for the best filter: lines that start with "From ", nul bytes,
+ * every US-ASCII character, UTF-8 from each plane and some that is
+ * not UTF-8 at all */
+static GByteArray *
+best_data (size_t len)
+{
+	static const char *units[] = {
+		"From ", "Fro", "\n", "\r\n", "\n\nFrom ", "the", "quick", " ",
+		"{|}~\x7f", "\xc3\xa9", "\xd0\xb6", "\xe3\x81\x82", "\xf0\x9f\x98\x80",
+		"\xe9", "\xc3", "\x80"
+	};
+	GByteArray *data;
+	unsigned char c;
+	guint32 r;
+	
+	data = g_byte_array_sized_new (len);
+	while (data->len < len) {
+		r = random_next () % 100;
+		if (r < 40) {
+			/* long runs of plain text for the vector loops */
+			for (r = random_next () % 80; r > 0; r--) {
+				c = ' ' + random_next () % 95;
+				g_byte_array_append (data, &c, 1);
+			}
+		} else if (r < 42) {
+			g_byte_array_append (data, (const unsigned char *) "\0", 1);
+		} else {
+			const char *unit = units[r % G_N_ELEMENTS (units)];
+			
+			g_byte_array_append (data, (const unsigned char *) unit, strlen (unit));
+		}
+	}
+	
+	g_byte_array_set_size (data, len);
+	
+	return data;
+}
+
+/* the byte-at-a-time statistics that GMimeFilterBest has always
+ * gathered, which the vectorized version must match */
+typedef struct {
+	unsigned int count0, count8, total, maxline, linelen;
+	gboolean hadfrom, startline, midline;
+	unsigned char frombuf[6];
+	unsigned int fromlen;
+} BestStats;
+
+static void
+best_stats_step (BestStats *best, const unsigned char *inbuf, size_t inlen)
+{
+	const unsigned char *inptr = inbuf, *inend = inbuf + inlen;
+	unsigned char c;
+	size_t left;
+	
+	best->total += inlen;
+	
+	while (inptr < inend) {
+		c = 0;
+		
+		if (best->midline) {
+			while (inptr < inend && (c = *inptr++) != '\n') {
+				if (c == 0)
+					best->count0++;
+				else if (c & 0x80)
+					best->count8++;
+				
+				if (best->fromlen > 0 && best->fromlen < 5)
+					best->frombuf[best->fromlen++] = c & 0xff;
+				
+				best->linelen++;
+			}
+			
+			if (c == '\n') {
+				best->maxline = MAX (best->maxline, best->linelen);
+				best->startline = TRUE;
+				best->midline = FALSE;
+				best->linelen = 0;
+			}
+		}
+		
+		if (best->fromlen == 5 && !strcmp ((char *) best->frombuf, "From "))
+			best->hadfrom = TRUE;
+		
+		best->fromlen = 0;
+		
+		left = inend - inptr;
+		
+		if (best->startline && !best->hadfrom && left > 0) {
+			if (left < 5) {
+				if (!strncmp ((char *) inptr, "From ", left)) {
+					memcpy (best->frombuf, inptr, left);
+					best->frombuf[left] = '\0';
+					best->fromlen = left;
+					break;
+				}
+			} else {
+				if (!strncmp ((char *) inptr, "From ", 5)) {
+					best->hadfrom = TRUE;
+					inptr += 5;
+				}
+			}
+		}
+		
+		best->startline = FALSE;
+		best->midline = TRUE;
+	}
+}
+
+static void
+run_best (GMimeContentEncoding encoding, DataFunc generate, GPtrArray *results)
+{
+	GMimeEncodingConstraint constraint;
+	size_t i, n, outlen, outprespace;
+	GMimeFilterBest *best;
+	const char *charset;
+	GByteArray *input, *output;
+	BestStats expected;
+	unsigned int stats[7];
+	char *outbuf;
+	guint j, k;
+	
+	seed = 1;
+	
+	for (j = 0; j < G_N_ELEMENTS (lengths); j++) {
+		input = generate (lengths[j]);
+		
+		for (k = 0; k < G_N_ELEMENTS (chunks); k++) {
+			best = (GMimeFilterBest *) g_mime_filter_best_new (GMIME_FILTER_BEST_CHARSET | GMIME_FILTER_BEST_ENCODING);
+			memset (&expected, 0, sizeof (expected));
+			expected.startline = TRUE;
+			
+			for (i = 0; i < input->len; i += n) {
+				n = MIN (chunks[k], input->len - i);
+				g_mime_filter_filter ((GMimeFilter *) best, (char *) input->data + i, n, 0,
+						      &outbuf, &outlen, &outprespace);
+				best_stats_step (&expected, input->data + i, n);
+			}
+			
+			g_mime_filter_complete ((GMimeFilter *) best, NULL, 0, 0, &outbuf, &outlen, &outprespace);
+			expected.maxline = MAX (expected.maxline, expected.linelen);
+			
+			if (best->count0 != expected.count0 || best->count8 != expected.count8 ||
+			    best->total != expected.total || best->maxline != expected.maxline ||
+			    best->hadfrom != expected.hadfrom) {
+				g_object_unref (best);
+				g_byte_array_free (input, TRUE);
+				throw (exception_new ("statistics of %u bytes in chunks of %u bytes are wrong",
+						      (guint) lengths[j], (guint) MIN (chunks[k], G_MAXUINT)));
+			}
+			
+			/* the charset statistics are checked against the
+			 * portable code only */
+			stats[0] = best->count0;
+			stats[1] = best->count8;
+			stats[2] = best->total;
+			stats[3] = best->maxline;
+			stats[4] = best->hadfrom;
+			stats[5] = best->charset.mask;
+			stats[6] = best->charset.level;
+			
+			output = g_byte_array_new ();
+			g_byte_array_append (output, (unsigned char *) stats, sizeof (stats));
+			
+			charset = g_mime_filter_best_charset (best);
+			g_byte_array_append (output, (unsigned char *) charset, strlen (charset) + 1);
+			
+			for (constraint = GMIME_ENCODING_CONSTRAINT_7BIT; constraint <= GMIME_ENCODING_CONSTRAINT_BINARY; constraint++) {
+				encoding = g_mime_filter_best_encoding (best, constraint);
+				g_byte_array_append (output, (unsigned char *) &encoding, sizeof (encoding));
+			}
+			
+			g_ptr_array_add (results, output);
+			g_object_unref (best);
+		}
+		
+		g_byte_array_free (input, TRUE);
+	}
+}
+
+/* text in @charset: line endings of all kinds, and some bytes that
+ * the charset converters have to drop */
+static struct {
+	const char *charset;
+	const char *units[8];
+} text_charsets[] = {
+	{ NULL,           { "a", "b", "\r\n", "\r", "\n", "\xc3\xa9", NULL } },
+	{ "utf-8",        { "a", "b", "\r\n", "\r", "\n", "\xc3\xa9", NULL } },
+	{ "iso-8859-1",   { "a", "b", "\r\n", "\r", "\n", "\xe9", "\x80", NULL } },
+	{ "koi8-r",       { "a", "b", "\r\n", "\r", "\n", "\xc1", "\xff", NULL } },
+	{ "us-ascii",     { "a", "b", "\r\n", "\r", "\n", "\xe9", NULL } },
+	{ "windows-1252", { "a", "b", "\r\n", "\r", "\n", "\x81", "\x80", NULL } },
+	{ "shift_jis",    { "a", "\r\n", "\r", "\n", "\x82\xa0", "\x88\x9f", "\x82", NULL } },
+	{ "x-bogus",      { "a", "b", "\r\n", "\r", "\n", "\xe9", NULL } },
+};
+
+static GByteArray *
+charset_text_data (int which, size_t len)
+{
+	const char **units = text_charsets[which].units;
+	GByteArray *data;
+	size_t n;
+	
+	for (n = 0; units[n] != NULL; n++)
+		;
+	
+	data = g_byte_array_sized_new (len);
+	while (data->len < len) {
+		const char *unit = units[random_next () % n];
+		
+		g_byte_array_append (data, (const unsigned char *) unit, strlen (unit));
+	}
+	
+	return data;
+}
+
+/* what writing through the decoding filters produces */
+static GByteArray *
+filter_text (GByteArray *encoded, GMimeContentEncoding encoding, const char *charset)
+{
+	GMimeStream *stream, *filtered;
+	GMimeFilter *filter;
+	GByteArray *output;
+	
+	output = g_byte_array_new ();
+	stream = g_mime_stream_mem_new_with_byte_array (output);
+	g_mime_stream_mem_set_owner ((GMimeStreamMem *) stream, FALSE);
+	filtered = g_mime_stream_filter_new (stream);
+	
+	if (encoding != GMIME_CONTENT_ENCODING_8BIT) {
+		filter = g_mime_filter_basic_new (encoding, FALSE);
+		g_mime_stream_filter_add ((GMimeStreamFilter *) filtered, filter);
+		g_object_unref (filter);
+	}
+	
+	if (charset && g_ascii_strcasecmp (charset, "utf-8") != 0 &&
+	    (filter = g_mime_filter_charset_new (charset, "utf-8"))) {
+		g_mime_stream_filter_add ((GMimeStreamFilter *) filtered, filter);
+		g_object_unref (filter);
+	}
+	
+	filter = g_mime_filter_crlf_new (FALSE, FALSE);
+	g_mime_stream_filter_add ((GMimeStreamFilter *) filtered, filter);
+	g_object_unref (filter);
+	
+	if (encoded->len > 0)
+		g_mime_stream_write (filtered, (const char *) encoded->data, encoded->len);
+	g_mime_stream_flush (filtered);
+	
+	g_object_unref (filtered);
+	g_object_unref (stream);
+	
+	return output;
+}
+
+static void
+test_text_decoding (void)
+{
+	static const size_t text_lengths[] = { 0, 1, 2, 4095, 4097, 50000 };
+	static const GMimeContentEncoding encodings[] = {
+		GMIME_CONTENT_ENCODING_8BIT,
+		GMIME_CONTENT_ENCODING_BASE64,
+		GMIME_CONTENT_ENCODING_QUOTEDPRINTABLE
+	};
+	GByteArray *input, *encoded, *expected, *output;
+	GMimeStream *content, *stream;
+	GMimeDataWrapper *wrapper;
+	const char *charset;
+	ssize_t written;
+	guint i, j, k;
+	
+	g_mime_init (0);
+	
+	for (i = 0; i < G_N_ELEMENTS (text_charsets); i++) {
+		charset = text_charsets[i].charset;
+		
+		for (j = 0; j < G_N_ELEMENTS (encodings); j++) {
+			testsuite_check ("%s text, %s", charset ? charset : "unlabelled",
+					 g_mime_content_encoding_to_string (encodings[j]));
+			try {
+				for (k = 0; k < G_N_ELEMENTS (text_lengths); k++) {
+					input = charset_text_data (i, text_lengths[k]);
+					if (encodings[j] != GMIME_CONTENT_ENCODING_8BIT) {
+						encoded = encode_chunked (encodings[j], input, G_MAXSIZE);
+						g_byte_array_free (input, TRUE);
+					} else {
+						encoded = input;
+					}
+					
+					expected = filter_text (encoded, encodings[j], charset);
+					
+					content = g_mime_stream_mem_new_with_buffer ((const char *) encoded->data, encoded->len);
+					wrapper = g_mime_data_wrapper_new_with_stream (content, encodings[j]);
+					g_object_unref (content);
+					
+					output = g_byte_array_new ();
+					stream = g_mime_stream_mem_new_with_byte_array (output);
+					g_mime_stream_mem_set_owner ((GMimeStreamMem *) stream, FALSE);
+					written = g_mime_data_wrapper_write_text_to_stream (wrapper, stream, charset);
+					g_object_unref (wrapper);
+					g_object_unref (stream);
+					
+					g_byte_array_free (encoded, TRUE);
+					
+					if (written != (ssize_t) output->len || !byte_arrays_equal (output, expected)) {
+						g_byte_array_free (expected, TRUE);
+						g_byte_array_free (output, TRUE);
+						throw (exception_new ("%u bytes of text do not match the filters",
+								      (guint) text_lengths[k]));
+					}
+					
+					g_byte_array_free (expected, TRUE);
+					g_byte_array_free (output, TRUE);
+				}
+				
+				testsuite_check_passed ();
+			} catch (ex) {
+				testsuite_check_failed ("%s text, %s: %s", charset ? charset : "unlabelled",
+							g_mime_content_encoding_to_string (encodings[j]), ex->message);
+			} finally;
+		}
+	}
+	
+	g_mime_shutdown ();
+}
+
+int main (int argc, char **argv)
+{
+	testsuite_init (argc, argv);
+	
+	testsuite_start ("base64");
+	test_codec (run_codec, GMIME_CONTENT_ENCODING_BASE64, random_data);
+	testsuite_end ();
+	
+	testsuite_start ("quoted-printable");
+	test_codec (run_codec, GMIME_CONTENT_ENCODING_QUOTEDPRINTABLE, text_data);
+	testsuite_end ();
+	
+	testsuite_start ("yEnc");
+	test_codec (run_yenc, GMIME_CONTENT_ENCODING_DEFAULT, random_data);
+	testsuite_end ();
+	
+	testsuite_start ("best encoding and charset");
+	test_codec (run_best, GMIME_CONTENT_ENCODING_DEFAULT, best_data);
+	test_codec (run_best, GMIME_CONTENT_ENCODING_DEFAULT, random_data);
+	testsuite_end ();
+	
+	testsuite_start ("text decoding");
+	test_text_decoding ();
+	testsuite_end ();
+	
+	return testsuite_exit ();
+}
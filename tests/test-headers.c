@@ -360,6 +360,143 @@ test_iter_remove (void)
 	g_mime_header_list_destroy (list);
 }
 
+static void
+count_header (const char *name, const char *value, gpointer user_data)
+{
+	guint *count = user_data;
+	
+	if (!g_ascii_strcasecmp (name, "Received"))
+		(*count)++;
+}
+
+static void
+test_large_list (void)
+{
+	const char *name, *value;
+	GMimeHeaderList *list;
+	GMimeHeaderIter iter;
+	char buf[64];
+	guint count;
+	int i;
+	
+	list = g_mime_header_list_new ();
+	for (i = 0; i < 100; i++) {
+		sprintf (buf, "received header #%d", i);
+		g_mime_header_list_append (list, "Received", buf);
+		sprintf (buf, "X-Custom-%d", i);
+		g_mime_header_list_append (list, buf, "custom");
+	}
+	
+	g_mime_header_list_append (list, "SUBJECT", "hey, check this out");
+	
+	testsuite_check ("header lookups");
+	try {
+		if (!(value = g_mime_header_list_get (list, "received")) ||
+		    strcmp ("received header #0", value) != 0)
+			throw (exception_new ("unexpected Received header"));
+		
+		if (!(value = g_mime_header_list_get (list, "Subject")) ||
+		    strcmp ("hey, check this out", value) != 0)
+			throw (exception_new ("unexpected Subject header"));
+		
+		if (!g_mime_header_list_contains (list, "x-custom-99") ||
+		    g_mime_header_list_contains (list, "X-Custom-100"))
+			throw (exception_new ("unexpected X-Custom headers"));
+		
+		g_mime_header_list_prepend (list, "Received", "prepended");
+		if (!(value = g_mime_header_list_get (list, "Received")) ||
+		    strcmp ("prepended", value) != 0)
+			throw (exception_new ("unexpected Received header after prepend"));
+		
+		if (!g_mime_header_list_remove (list, "X-CUSTOM-50") ||
+		    g_mime_header_list_contains (list, "X-Custom-50"))
+			throw (exception_new ("X-Custom-50 was not removed"));
+		
+		testsuite_check_passed ();
+	} catch (ex) {
+		testsuite_check_failed ("header lookups: %s", ex->message);
+	} finally;
+	
+	testsuite_check ("appending while iterating");
+	try {
+		g_mime_header_list_get_iter (list, &iter);
+		g_mime_header_list_append (list, "X-Appended", "appended");
+		
+		if (!g_mime_header_iter_is_valid (&iter))
+			throw (exception_new ("append invalidated iter"));
+		
+		while (g_mime_header_iter_next (&iter))
+			;
+		
+		name = g_mime_header_iter_get_name (&iter);
+		if (!name || strcmp ("X-Appended", name) != 0)
+			throw (exception_new ("iter did not reach the appended header"));
+		
+		testsuite_check_passed ();
+	} catch (ex) {
+		testsuite_check_failed ("appending while iterating: %s", ex->message);
+	} finally;
+	
+	testsuite_check ("iterating across blocks");
+	try {
+		/* 200 custom and Received headers, the prepended and
+		 * appended ones and the Subject, less X-Custom-50 */
+		count = 0;
+		if (g_mime_header_list_get_iter (list, &iter)) {
+			do {
+				count++;
+			} while (g_mime_header_iter_next (&iter));
+		}
+		
+		if (count != 202)
+			throw (exception_new ("iterated forward over %u headers", count));
+		
+		count = 1;
+		while (g_mime_header_iter_prev (&iter))
+			count++;
+		
+		if (count != 202)
+			throw (exception_new ("iterated back over %u headers", count));
+		
+		value = g_mime_header_iter_get_value (&iter);
+		if (!value || strcmp ("prepended", value) != 0)
+			throw (exception_new ("iter did not go back to the first header"));
+		
+		testsuite_check_passed ();
+	} catch (ex) {
+		testsuite_check_failed ("iterating across blocks: %s", ex->message);
+	} finally;
+	
+	testsuite_check ("replacing repeated headers");
+	try {
+		g_mime_header_list_get_iter (list, &iter);
+		g_mime_header_list_set (list, "received", "only");
+		
+		if (g_mime_header_iter_is_valid (&iter))
+			throw (exception_new ("set did not invalidate iter"));
+		
+		count = 0;
+		g_mime_header_list_foreach (list, count_header, &count);
+		if (count != 1)
+			throw (exception_new ("%u Received headers left", count));
+		
+		if (!(value = g_mime_header_list_get (list, "Received")) ||
+		    strcmp ("only", value) != 0)
+			throw (exception_new ("unexpected Received header"));
+		
+		if (!g_mime_header_list_get_iter (list, &iter) ||
+		    !(name = g_mime_header_iter_get_name (&iter)) ||
+		    strcmp ("Received", name) != 0)
+			throw (exception_new ("Received is no longer the first header"));
+		
+		testsuite_check_passed ();
+	} catch (ex) {
+		testsuite_check_failed ("replacing repeated headers: %s", ex->message);
+	} finally;
+	
+	g_mime_header_list_destroy (list);
+}
+
 static void
 test_header_sync (void)
 {
@@ -551,6 +688,10 @@ int main (int argc, char **argv)
 	test_iter_remove ();
 	testsuite_end ();
 	
+	testsuite_start ("large header lists");
+	test_large_list ();
+	testsuite_end ();
+	
 	testsuite_start ("header synchronization");
 	test_header_sync ();
 	testsuite_end ();
@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 #include <gmime/gmime.h>
 
@@ -204,9 +205,306 @@ test_utils (void)
 	testsuite_end ();
 }
 
+static gboolean
+round_trip (int i, GAsyncQueue *unclosed)
+{
+	char *utf8, *native;
+	gboolean match;
+	iconv_t cd;
+	
+	if ((cd = g_mime_iconv_open ("UTF-8", tests[i].charset)) == (iconv_t) -1)
+		return FALSE;
+	
+	utf8 = g_mime_iconv_strdup (cd, tests[i].text);
+	
+	/* leave some of them for another thread to close */
+	if (unclosed != NULL)
+		g_async_queue_push (unclosed, cd);
+	else
+		g_mime_iconv_close (cd);
+	
+	if (utf8 == NULL)
+		return FALSE;
+	
+	if ((cd = g_mime_iconv_open (tests[i].charset, "UTF-8")) == (iconv_t) -1) {
+		g_free (utf8);
+		return FALSE;
+	}
+	
+	native = g_mime_iconv_strdup (cd, utf8);
+	g_mime_iconv_close (cd);
+	g_free (utf8);
+	
+	match = native != NULL && !strcmp (native, tests[i].text);
+	g_free (native);
+	
+	return match;
+}
+
+#define CACHE_THREADS 8
+#define CACHE_JOBS 32
+#define CACHE_ROUNDS 200
+
+typedef struct {
+	int id;
+	gboolean ok;
+} CacheJob;
+
+static void
+cache_worker (gpointer data, gpointer user_data)
+{
+	GAsyncQueue *unclosed = user_data;
+	CacheJob *job = data;
+	int i;
+	
+	job->ok = TRUE;
+	
+	for (i = 0; i < CACHE_ROUNDS && job->ok; i++)
+		job->ok = round_trip ((job->id * 7 + i) % G_N_ELEMENTS (tests), i % 16 == 0 ? unclosed : NULL);
+}
+
+static void
+run_cache_jobs (GAsyncQueue *unclosed)
+{
+	CacheJob jobs[CACHE_JOBS];
+	GThreadPool *pool;
+	int i;
+	
+	pool = g_thread_pool_new (cache_worker, unclosed, CACHE_THREADS, FALSE, NULL);
+	for (i = 0; i < CACHE_JOBS; i++) {
+		jobs[i].id = i;
+		g_thread_pool_push (pool, &jobs[i], NULL);
+	}
+	g_thread_pool_free (pool, FALSE, TRUE);
+	
+	for (i = 0; i < CACHE_JOBS; i++) {
+		if (!jobs[i].ok)
+			throw (exception_new ("job %d failed to convert", i));
+	}
+}
+
+static void
+test_thread_cache (void)
+{
+	GMimeIconvCacheStats before, after;
+	GAsyncQueue *unclosed;
+	iconv_t cd;
+	int i;
+	
+	testsuite_start ("iconv descriptor cache");
+	
+	testsuite_check ("reuse within a thread");
+	try {
+		g_mime_iconv_set_thread_cache_size (4);
+		g_mime_iconv_get_cache_stats (&before);
+		
+		for (i = 0; i < 10; i++) {
+			if (!round_trip (i % 2, NULL))
+				throw (exception_new ("round trip %d failed", i));
+		}
+		
+		g_mime_iconv_get_cache_stats (&after);
+		
+		if (after.thread_hits - before.thread_hits < 16)
+			throw (exception_new ("only %u of 20 opens were cache hits",
+					      (guint) (after.thread_hits - before.thread_hits)));
+		
+		testsuite_check_passed ();
+	} catch (ex) {
+		testsuite_check_failed ("reuse within a thread failed: %s", ex->message);
+	} finally;
+	
+	testsuite_check ("thread cache disabled");
+	try {
+		g_mime_iconv_set_thread_cache_size (0);
+		g_mime_iconv_get_cache_stats (&before);
+		
+		for (i = 0; i < 10; i++) {
+			if (!round_trip (i % 2, NULL))
+				throw (exception_new ("round trip %d failed", i));
+		}
+		
+		g_mime_iconv_get_cache_stats (&after);
+		
+		if (after.thread_hits != before.thread_hits || after.thread_misses != before.thread_misses)
+			throw (exception_new ("the thread cache was used"));
+		
+		if (after.shared_hits - before.shared_hits < 16)
+			throw (exception_new ("only %u of 20 opens were shared cache hits",
+					      (guint) (after.shared_hits - before.shared_hits)));
+		
+		testsuite_check_passed ();
+	} catch (ex) {
+		testsuite_check_failed ("thread cache disabled failed: %s", ex->message);
+	} finally;
+	
+	/* small enough that the threads keep evicting descriptors */
+	g_mime_iconv_set_thread_cache_size (4);
+	unclosed = g_async_queue_new ();
+	
+	testsuite_check ("concurrent use");
+	try {
+		run_cache_jobs (unclosed);
+		
+		/* close the other threads' descriptors from here... */
+		while ((cd = g_async_queue_try_pop (unclosed)))
+			g_mime_iconv_close (cd);
+		
+		/* ...and make sure they come back in working order */
+		run_cache_jobs (NULL);
+		
+		testsuite_check_passed ();
+	} catch (ex) {
+		testsuite_check_failed ("concurrent use failed: %s", ex->message);
+	} finally;
+	
+	g_async_queue_unref (unclosed);
+	
+	testsuite_end ();
+}
+
+/* the charsets that are converted to UTF-8 with built-in tables, as
+ * well as a few of their aliases and a couple that aren't */
+static const char *table_charsets[] = {
+	"us-ascii", "ascii", "iso-8859-1", "latin1", "iso-8859-2", "iso-8859-4",
+	"iso-8859-5", "iso-8859-6", "iso-8859-7", "iso-8859-8", "iso-8859-9",
+	"iso-8859-13", "iso-8859-15", "koi8-r", "koi8-u", "windows-1250", "cp1251",
+	"windows-1252", "windows-1253", "windows-1254", "windows-1255",
+	"windows-1256", "windows-1257", "windows-1258", "utf-8"
+};
+
+/* converts @in to UTF-8 with the system iconv, dropping (or
+ * replacing with '?') the bytes it can't convert */
+static GByteArray *
+iconv_reference (const char *charset, const unsigned char *in, size_t inlen, gboolean replace)
+{
+	size_t inleft = inlen, outleft;
+	char *inbuf = (char *) in;
+	GByteArray *array;
+	char buf[4096];
+	char *outbuf;
+	iconv_t cd;
+	size_t rc;
+	
+	if ((cd = iconv_open ("UTF-8", g_mime_charset_iconv_name (charset))) == (iconv_t) -1)
+		return NULL;
+	
+	array = g_byte_array_new ();
+	
+	do {
+		outbuf = buf;
+		outleft = sizeof (buf);
+		rc = iconv (cd, &inbuf, &inleft, &outbuf, &outleft);
+		g_byte_array_append (array, (unsigned char *) buf, outbuf - buf);
+		
+		if (rc == (size_t) -1 && errno == EILSEQ) {
+			if (replace)
+				g_byte_array_append (array, (unsigned char *) "?", 1);
+			
+			inleft--;
+			inbuf++;
+		}
+	} while (inleft > 0);
+	
+	outbuf = buf;
+	outleft = sizeof (buf);
+	iconv (cd, NULL, NULL, &outbuf, &outleft);
+	g_byte_array_append (array, (unsigned char *) buf, outbuf - buf);
+	iconv_close (cd);
+	
+	return array;
+}
+
+static void
+test_charset_tables (void)
+{
+	GMimeStream *stream, *fstream;
+	GByteArray *input, *expected;
+	GByteArray *output;
+	GMimeFilter *filter;
+	char *encoded, *header, *decoded;
+	unsigned char c;
+	guint i, j;
+	
+	/* every 8bit character, both on its own and after runs of
+	 * US-ASCII long enough for the vectorized copy */
+	input = g_byte_array_new ();
+	for (i = 0x20; i < 0x100; i++) {
+		c = i;
+		for (j = 0; j < i % 40; j++)
+			g_byte_array_append (input, (unsigned char *) "abcdefghij" + j % 10, 1);
+		g_byte_array_append (input, &c, 1);
+	}
+	
+	testsuite_start ("built-in charset tables");
+	
+	for (i = 0; i < G_N_ELEMENTS (table_charsets); i++) {
+		testsuite_check ("%s", table_charsets[i]);
+		
+		output = NULL;
+		expected = NULL;
+		decoded = NULL;
+		
+		try {
+			/* GMimeFilterCharset drops what it can't convert */
+			if (!(expected = iconv_reference (table_charsets[i], input->data, input->len, FALSE)))
+				throw (exception_new ("iconv can't convert from %s", table_charsets[i]));
+			
+			if (!(filter = g_mime_filter_charset_new (table_charsets[i], "UTF-8")))
+				throw (exception_new ("could not create the charset filter"));
+			
+			output = g_byte_array_new ();
+			stream = g_mime_stream_mem_new_with_byte_array (output);
+			g_mime_stream_mem_set_owner ((GMimeStreamMem *) stream, FALSE);
+			fstream = g_mime_stream_filter_new (stream);
+			g_mime_stream_filter_add ((GMimeStreamFilter *) fstream, filter);
+			g_object_unref (filter);
+			
+			for (j = 0; j < input->len; j += 1000)
+				g_mime_stream_write (fstream, (char *) input->data + j, MIN (1000, input->len - j));
+			g_mime_stream_flush (fstream);
+			g_object_unref (fstream);
+			g_object_unref (stream);
+			
+			if (output->len != expected->len || memcmp (output->data, expected->data, output->len) != 0)
+				throw (exception_new ("the charset filter output differs from iconv's"));
+			
+			g_byte_array_free (expected, TRUE);
+			expected = NULL;
+			
+			/* rfc2047 decoding replaces what it can't convert with '?' */
+			expected = iconv_reference (table_charsets[i], input->data, input->len, TRUE);
+			g_byte_array_append (expected, (unsigned char *) "", 1);
+			
+			encoded = g_base64_encode (input->data, input->len);
+			header = g_strdup_printf ("=?%s?b?%s?=", table_charsets[i], encoded);
+			decoded = g_mime_utils_header_decode_text (header);
+			g_free (encoded);
+			g_free (header);
+			
+			if (strcmp (decoded, (char *) expected->data) != 0)
+				throw (exception_new ("the decoded header differs from iconv's conversion"));
+			
+			testsuite_check_passed ();
+		} catch (ex) {
+			testsuite_check_failed ("%s failed: %s", table_charsets[i], ex->message);
+		} finally;
+		
+		if (output != NULL)
+			g_byte_array_free (output, TRUE);
+		if (expected != NULL)
+			g_byte_array_free (expected, TRUE);
+		g_free (decoded);
+	}
+	
+	testsuite_end ();
+	
+	g_byte_array_free (input, TRUE);
+}
+
 int main (int argc, char **argv)
 {
-	g_mime_iconv_init ();
+	g_mime_init (0);
 	
 	testsuite_init (argc, argv);
 	
@@ -218,8 +516,10 @@ int main (int argc, char **argv)
 #endif
 	
 	test_utils ();
+	test_thread_cache ();
+	test_charset_tables ();
 	
-	g_mime_iconv_shutdown ();
+	g_mime_shutdown ();
 	
 	return testsuite_exit ();
 }
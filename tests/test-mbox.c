@@ -27,6 +27,13 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#include <signal.h>
+#endif
 #include <unistd.h>
 #include <fcntl.h>
 #include <time.h>
@@ -137,6 +144,175 @@ test_parser (GMimeParser *parser, GMimeStream *mbox, GMimeStream *summary)
 	}
 }
 
+typedef struct {
+	GMimeStream *summary;
+	GMimeStream *structure;
+	gint64 message_begin;
+	char *exev;
+	int depth;
+} EventContext;
+
+static void
+event_start_part (GMimeParser *parser, int depth, gpointer user_data)
+{
+	EventContext *ctx = user_data;
+	
+	if (depth == 0) {
+		ctx->message_begin = g_mime_parser_get_from_offset (parser);
+		ctx->structure = g_mime_stream_mem_new ();
+	}
+	
+	ctx->depth = depth;
+}
+
+static void
+event_header (GMimeParser *parser, const char *header, const char *value, gint64 offset, gpointer user_data)
+{
+	EventContext *ctx = user_data;
+	
+	if (ctx->depth == 0 && !ctx->exev && !g_ascii_strcasecmp (header, "X-Evolution"))
+		ctx->exev = g_strdup (value);
+}
+
+static void
+event_end_headers (GMimeParser *parser, const char *type, const char *subtype, gpointer user_data)
+{
+	EventContext *ctx = user_data;
+	
+	print_depth (ctx->structure, ctx->depth);
+	g_mime_stream_printf (ctx->structure, "Content-Type: %s/%s\n", type, subtype);
+}
+
+static void
+event_end_part (GMimeParser *parser, gpointer user_data)
+{
+	EventContext *ctx = user_data;
+	char *from;
+	
+	if (ctx->depth-- > 0)
+		return;
+	
+	/* same summary as test_parser(), but without any GMimeObjects */
+	g_mime_stream_printf (ctx->summary, "message offsets: %" G_GINT64_FORMAT ", %" G_GINT64_FORMAT "\n",
+			      ctx->message_begin, g_mime_parser_tell (parser));
+	g_mime_stream_printf (ctx->summary, "header offsets: %" G_GINT64_FORMAT ", %" G_GINT64_FORMAT "\n",
+			      g_mime_parser_get_headers_begin (parser),
+			      g_mime_parser_get_headers_end (parser));
+	
+	from = g_mime_parser_get_from (parser);
+	g_mime_stream_printf (ctx->summary, "%s\n", from);
+	g_mime_stream_printf (ctx->summary, "X-Evolution: %s\n", ctx->exev ? ctx->exev : "None");
+	g_mime_stream_reset (ctx->structure);
+	g_mime_stream_write_to_stream (ctx->structure, ctx->summary);
+	g_mime_stream_write (ctx->summary, "\n", 1);
+	g_object_unref (ctx->structure);
+	ctx->structure = NULL;
+	g_free (ctx->exev);
+	ctx->exev = NULL;
+	g_free (from);
+}
+
+static GMimeParserCallbacks event_callbacks = {
+	event_start_part,
+	event_header,
+	event_end_headers,
+	NULL,
+	event_end_part
+};
+
+static void
+test_event_parser (GMimeParser *parser, GMimeStream *summary)
+{
+	EventContext ctx = { summary, NULL, -1, NULL, 0 };
+	int nmsg = 0;
+	
+	g_mime_parser_set_callbacks (parser, &event_callbacks, &ctx);
+	
+	while (!g_mime_parser_eos (parser)) {
+		if (!g_mime_parser_parse_message (parser))
+			throw (exception_new ("failed to parse message #%d", nmsg));
+		
+		nmsg++;
+	}
+}
+
+static void
+test_push_parser (GMimeParser *parser, const char *input, GMimeStream *summary)
+{
+	static const size_t chunks[] = { 1, 7, 64, 333, 4096, 10000 };
+	EventContext ctx = { summary, NULL, -1, NULL, 0 };
+	size_t size, n, i = 0;
+	char *buf, *inptr;
+	
+	if (!g_file_get_contents (input, &buf, &size, NULL))
+		throw (exception_new ("could not read `%s'", input));
+	
+	g_mime_parser_set_callbacks (parser, &event_callbacks, &ctx);
+	
+	/* feed it in odd sized chunks to make sure that lines and
+	 * boundaries get split at every possible place */
+	inptr = buf;
+	while (size > 0) {
+		n = MIN (size, chunks[i++ % G_N_ELEMENTS (chunks)]);
+		g_mime_parser_feed (parser, inptr, n);
+		inptr += n;
+		size -= n;
+	}
+	
+	g_mime_parser_feed_end (parser);
+	g_free (buf);
+}
+
+static void
+test_headers_only (GMimeStream *istream, gboolean respect_content_length, gboolean headers_only, GMimeStream *summary)
+{
+	gint64 message_begin, message_end;
+	const char *subject, *exev;
+	GMimeContentType *type;
+	GMimeMessage *message;
+	GMimeParser *parser;
+	int nmsg = 0;
+	char *from;
+	
+	g_mime_stream_reset (istream);
+	parser = g_mime_parser_new_with_stream (istream);
+	g_mime_parser_set_respect_content_length (parser, respect_content_length);
+	g_mime_parser_set_headers_only (parser, headers_only);
+	g_mime_parser_set_scan_from (parser, TRUE);
+	
+	while (!g_mime_parser_eos (parser)) {
+		message_begin = g_mime_parser_tell (parser);
+		if (!(message = g_mime_parser_construct_message (parser))) {
+			g_object_unref (parser);
+			throw (exception_new ("failed to parse message #%d", nmsg));
+		}
+		
+		message_end = g_mime_parser_tell (parser);
+		
+		/* only what a headers-only parse can know about */
+		g_mime_stream_printf (summary, "message offsets: %" G_GINT64_FORMAT ", %" G_GINT64_FORMAT "\n",
+				      message_begin, message_end);
+		g_mime_stream_printf (summary, "header offsets: %" G_GINT64_FORMAT ", %" G_GINT64_FORMAT "\n",
+				      g_mime_parser_get_headers_begin (parser),
+				      g_mime_parser_get_headers_end (parser));
+		
+		from = g_mime_parser_get_from (parser);
+		g_mime_stream_printf (summary, "%s\n", from);
+		subject = g_mime_message_get_subject (message);
+		g_mime_stream_printf (summary, "Subject: %s\n", subject ? subject : "None");
+		exev = g_mime_object_get_header ((GMimeObject *) message, "X-Evolution");
+		g_mime_stream_printf (summary, "X-Evolution: %s\n", exev ? exev : "None");
+		type = g_mime_object_get_content_type (message->mime_part);
+		g_mime_stream_printf (summary, "Content-Type: %s/%s\n\n", type->type, type->subtype);
+		
+		g_object_unref (message);
+		g_free (from);
+		nmsg++;
+	}
+	
+	g_object_unref (parser);
+}
+
 static gboolean
 streams_match (GMimeStream *istream, GMimeStream *ostream)
 {
@@ -232,11 +408,877 @@ streams_match (GMimeStream *istream, GMimeStream *ostream)
 	return FALSE;
 }
 
+static void
+summarize_message (GMimeParser *parser, GMimeMessage *message, gpointer user_data)
+{
+	GMimeStream *summary = user_data;
+	char *from;
+	
+	g_mime_stream_printf (summary, "message offset: %" G_GINT64_FORMAT "\n",
+			      g_mime_parser_get_from_offset (parser));
+	g_mime_stream_printf (summary, "header offsets: %" G_GINT64_FORMAT ", %" G_GINT64_FORMAT "\n",
+			      g_mime_parser_get_headers_begin (parser),
+			      g_mime_parser_get_headers_end (parser));
+	
+	from = g_mime_parser_get_from (parser);
+	g_mime_stream_printf (summary, "%s\n", from);
+	print_mime_struct (summary, message->mime_part, 0);
+	g_mime_stream_write (summary, "\n", 1);
+	g_free (from);
+}
+
+static GMimeContentEncoding
+rescan_best_encoding (GMimePart *part, GMimeEncodingConstraint constraint)
+{
+	GMimeStream *stream, *null;
+	GMimeContentEncoding encoding;
+	GMimeFilter *filter;
+	
+	filter = g_mime_filter_best_new (GMIME_FILTER_BEST_ENCODING);
+	null = g_mime_stream_null_new ();
+	stream = g_mime_stream_filter_new (null);
+	g_mime_stream_filter_add ((GMimeStreamFilter *) stream, filter);
+	g_object_unref (null);
+	
+	g_mime_data_wrapper_write_to_stream (g_mime_part_get_content_object (part), stream);
+	g_mime_stream_flush (stream);
+	g_object_unref (stream);
+	
+	encoding = g_mime_filter_best_encoding ((GMimeFilterBest *) filter, constraint);
+	g_object_unref (filter);
+	
+	return encoding;
+}
+
+static void
+check_content_stats (GMimeObject *parent, GMimeObject *part, gpointer user_data)
+{
+	GMimeEncodingConstraint constraint;
+	gboolean *match = user_data;
+	
+	if (!GMIME_IS_PART (part) || g_mime_part_get_content_object ((GMimePart *) part) == NULL)
+		return;
+	
+	for (constraint = GMIME_ENCODING_CONSTRAINT_7BIT; constraint <= GMIME_ENCODING_CONSTRAINT_BINARY; constraint++) {
+		if (g_mime_part_get_best_content_encoding ((GMimePart *) part, constraint) !=
+		    rescan_best_encoding ((GMimePart *) part, constraint))
+			*match = FALSE;
+	}
+}
+
+static void
+test_content_stats (GMimeStream *istream)
+{
+	GMimeMessage *message;
+	GMimeParser *parser;
+	gboolean match;
+	int persist, n;
+	
+	/* the statistics gathered while parsing must agree with those
+	 * of a second pass over the content, whether the content ends
+	 * up in memory or in a substream */
+	for (persist = 0; persist < 2; persist++) {
+		g_mime_stream_reset (istream);
+		parser = g_mime_parser_new_with_stream (istream);
+		g_mime_parser_set_persist_stream (parser, persist);
+		g_mime_parser_set_content_stats (parser, TRUE);
+		g_mime_parser_set_scan_from (parser, TRUE);
+		
+		match = TRUE;
+		for (n = 0; match && !g_mime_parser_eos (parser); n++) {
+			if (!(message = g_mime_parser_construct_message (parser)))
+				break;
+			
+			g_mime_message_foreach (message, check_content_stats, &match);
+			g_object_unref (message);
+		}
+		
+		g_object_unref (parser);
+		
+		if (!match)
+			throw (exception_new ("content statistics do not match for message %d", n));
+	}
+}
+
+typedef struct {
+	gint64 used;
+	int spilled;
+} MemoryUsage;
+
+static void
+add_memory_usage (GMimeObject *parent, GMimeObject *part, gpointer user_data)
+{
+	MemoryUsage *usage = user_data;
+	GMimeDataWrapper *content;
+	GMimeStream *stream;
+	
+	if (!GMIME_IS_PART (part) || !(content = g_mime_part_get_content_object ((GMimePart *) part)))
+		return;
+	
+	stream = g_mime_data_wrapper_get_stream (content);
+	if (GMIME_IS_STREAM_FS (stream))
+		usage->spilled++;
+	else
+		usage->used += g_mime_stream_length (stream);
+}
+
+static void
+test_memory_limit (GMimeStream *istream)
+{
+	static const gint64 limits[] = { -1, 0, 48, 1024, 16384, 0 };
+	GMimeStream *output[2] = { NULL, NULL };
+	MemoryUsage usage, total[2];
+	GMimeMessage *message;
+	GMimeParser *parser;
+	Exception *ex = NULL;
+	gboolean full;
+#ifdef HAVE_SYS_RESOURCE_H
+	struct rlimit rlim, saved;
+#endif
+	guint i;
+	int n;
+	
+	/* content that does not fit within the limit has to be spilled
+	 * to disk, and must be written out just the same */
+	for (i = 0; i < G_N_ELEMENTS (limits) && ex == NULL; i++) {
+		/* the last time around, the spill files fill up and the
+		 * content has to be kept in memory after all */
+		full = i == G_N_ELEMENTS (limits) - 1;
+		if (full) {
+#ifdef HAVE_SYS_RESOURCE_H
+			if (getrlimit (RLIMIT_FSIZE, &saved) == -1)
+				break;
+			
+			signal (SIGXFSZ, SIG_IGN);
+			rlim = saved;
+			rlim.rlim_cur = 4096;
+			if (setrlimit (RLIMIT_FSIZE, &rlim) == -1)
+				break;
+#else
+			break;
+#endif
+		}
+		
+		g_mime_stream_reset (istream);
+		parser = g_mime_parser_new_with_stream (istream);
+		g_mime_parser_set_persist_stream (parser, FALSE);
+		g_mime_parser_set_memory_limit (parser, limits[i]);
+		g_mime_parser_set_scan_from (parser, TRUE);
+		
+		output[i > 0] = g_mime_stream_mem_new ();
+		memset (&total[i > 0], 0, sizeof (MemoryUsage));
+		
+		for (n = 0; ex == NULL && !g_mime_parser_eos (parser); n++) {
+			if (!(message = g_mime_parser_construct_message (parser)))
+				break;
+			
+			memset (&usage, 0, sizeof (usage));
+			g_mime_message_foreach (message, add_memory_usage, &usage);
+			g_mime_object_write_to_stream ((GMimeObject *) message, output[i > 0]);
+			g_object_unref (message);
+			
+			if (limits[i] != -1 && !full && usage.used > limits[i])
+				ex = exception_new ("message %d keeps %" G_GINT64_FORMAT " bytes in memory with a limit of %"
+						    G_GINT64_FORMAT, n, usage.used, limits[i]);
+			
+			total[i > 0].used += usage.used;
+			total[i > 0].spilled += usage.spilled;
+		}
+		
+		g_object_unref (parser);
+		
+#ifdef HAVE_SYS_RESOURCE_H
+		if (full) {
+			setrlimit (RLIMIT_FSIZE, &saved);
+			signal (SIGXFSZ, SIG_DFL);
+		}
+#endif
+		
+		if (ex == NULL && limits[i] == 0 && !full && total[0].used > 0 && total[1].spilled == 0)
+			ex = exception_new ("nothing was spilled with a limit of 0");
+		
+		if (i > 0) {
+			g_mime_stream_reset (output[0]);
+			g_mime_stream_reset (output[1]);
+			if (ex == NULL && !streams_match (output[0], output[1]))
+				ex = exception_new ("messages do not match with a memory limit of %" G_GINT64_FORMAT, limits[i]);
+			
+			g_object_unref (output[1]);
+		}
+	}
+	
+	g_object_unref (output[0]);
+	
+	if (ex != NULL)
+		throw (ex);
+}
+
+/* a part that is too big for the memory limit, saved from a stream
+ * that isn't parsed in place, and a spill file that can't even take
+ * what was kept in memory when the limit was first hit */
+static void
+test_spill_failure (void)
+{
+#ifdef HAVE_SYS_RESOURCE_H
+	GMimeStream *fstream, *body, *content;
+	struct rlimit rlim, saved;
+	GMimeMessage *message;
+	gboolean match = TRUE;
+	GMimeParser *parser;
+	GMimeObject *part;
+	char *path;
+	int fd, i;
+	
+	body = g_mime_stream_mem_new ();
+	for (i = 0; i < 1200; i++)
+		g_mime_stream_printf (body, "%04d xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx\n", i);
+	
+	if ((fd = g_file_open_tmp ("test-mbox.XXXXXX", &path, NULL)) == -1) {
+		g_object_unref (body);
+		throw (exception_new ("could not create a temporary file"));
+	}
+	
+	fstream = g_mime_stream_fs_new (fd);
+	g_mime_stream_printf (fstream, "Subject: spill\nContent-Type: text/plain\n\n");
+	g_mime_stream_reset (body);
+	g_mime_stream_write_to_stream (body, fstream);
+	g_mime_stream_reset (fstream);
+	
+	if (getrlimit (RLIMIT_FSIZE, &saved) == 0) {
+		signal (SIGXFSZ, SIG_IGN);
+		rlim = saved;
+		rlim.rlim_cur = 1024;
+		
+		if (setrlimit (RLIMIT_FSIZE, &rlim) == 0) {
+			parser = g_mime_parser_new_with_stream (fstream);
+			g_mime_parser_set_persist_stream (parser, FALSE);
+			g_mime_parser_set_memory_limit (parser, 8192);
+			message = g_mime_parser_construct_message (parser);
+			g_object_unref (parser);
+			
+			setrlimit (RLIMIT_FSIZE, &saved);
+			
+			if (message != NULL) {
+				part = g_mime_message_get_mime_part (message);
+				content = g_mime_data_wrapper_get_stream (g_mime_part_get_content_object ((GMimePart *) part));
+				g_mime_stream_reset (content);
+				g_mime_stream_reset (body);
+				match = g_mime_stream_length (content) == g_mime_stream_length (body) &&
+					streams_match (body, content);
+				g_object_unref (message);
+			} else {
+				match = FALSE;
+			}
+		}
+		
+		signal (SIGXFSZ, SIG_DFL);
+	}
+	
+	g_object_unref (fstream);
+	g_object_unref (body);
+	unlink (path);
+	g_free (path);
+	
+	if (!match)
+		throw (exception_new ("content does not match when the spill file fills up"));
+#endif
+}
+
+/* the kB of address space in use, or -1 if that can't be known */
+static gint64
+vm_usage (const char *field)
+{
+	gint64 kb = -1;
+	char *buf, *p;
+	
+	if (!g_file_get_contents ("/proc/self/status", &buf, NULL, NULL))
+		return -1;
+	
+	if ((p = strstr (buf, field)))
+		kb = strtol (p + strlen (field), NULL, 10);
+	
+	g_free (buf);
+	
+	return kb;
+}
+
+static void
+check_bogus_content_length (GMimeObject *parent, GMimeObject *part, gpointer user_data)
+{
+	GMimeDataWrapper *content;
+	gboolean *match = user_data;
+	GMimeStream *stream;
+	
+	if (!GMIME_IS_PART (part) || !(content = g_mime_part_get_content_object ((GMimePart *) part)))
+		return;
+	
+	stream = g_mime_data_wrapper_get_stream (content);
+	if (g_mime_stream_length (stream) != 5)
+		*match = FALSE;
+}
+
+/* a thousand parts that all claim to be 64 MiB long, parsed from a stream whose
+ * length is known and from one whose length isn't */
+static void
+test_bogus_content_length (void)
+{
+	GMimeMessage *message[2] = { NULL, NULL };
+	GMimeStream *mbox, *stream;
+	gint64 size[2], peak[2];
+	GMimeParser *parser;
+	gboolean match = TRUE;
+	GByteArray *buf;
+	int fd[2], i;
+	
+	mbox = g_mime_stream_mem_new ();
+	g_mime_stream_printf (mbox, "Subject: bogus Content-Length\n"
+			      "MIME-Version: 1.0\n"
+			      "Content-Type: multipart/mixed; boundary=\"b\"\n\n");
+	
+	for (i = 0; i < 1000; i++)
+		g_mime_stream_printf (mbox, "--b\nContent-Length: 67108864\n\nhello\n");
+	
+	g_mime_stream_printf (mbox, "--b--\n");
+	
+	size[0] = vm_usage ("VmSize:");
+	peak[0] = vm_usage ("VmPeak:");
+	
+	g_mime_stream_reset (mbox);
+	parser = g_mime_parser_new_with_stream (mbox);
+	g_mime_parser_set_persist_stream (parser, FALSE);
+	message[0] = g_mime_parser_construct_message (parser);
+	g_object_unref (parser);
+	
+	buf = g_mime_stream_mem_get_byte_array ((GMimeStreamMem *) mbox);
+	if (pipe (fd) == 0) {
+		/* it all fits in the pipe's buffer */
+		if (write (fd[1], buf->data, buf->len) == (ssize_t) buf->len) {
+			close (fd[1]);
+			
+			stream = g_mime_stream_pipe_new (fd[0]);
+			parser = g_mime_parser_new_with_stream (stream);
+			g_mime_parser_set_persist_stream (parser, FALSE);
+			message[1] = g_mime_parser_construct_message (parser);
+			g_object_unref (parser);
+			g_object_unref (stream);
+		} else {
+			close (fd[0]);
+			close (fd[1]);
+		}
+	}
+	
+	size[1] = vm_usage ("VmSize:");
+	peak[1] = vm_usage ("VmPeak:");
+	
+	for (i = 0; i < 2; i++) {
+		if (message[i] != NULL) {
+			g_mime_message_foreach (message[i], check_bogus_content_length, &match);
+			g_object_unref (message[i]);
+		} else {
+			match = FALSE;
+		}
+	}
+	
+	g_object_unref (mbox);
+	
+	if (!match)
+		throw (exception_new ("content does not match"));
+	
+	/* neither kept nor even briefly allocated anything like 64 MiB
+	 * for each part */
+	if (size[0] != -1 && (size[1] - size[0] > 16 * 1024 ||
+			      (peak[1] > peak[0] && peak[1] - size[0] > 16 * 1024)))
+		throw (exception_new ("parsing grew the address space from %" G_GINT64_FORMAT " kB to %"
+				      G_GINT64_FORMAT " kB (peak %" G_GINT64_FORMAT " kB)",
+				      size[0], size[1], peak[1]));
+}
+
+/* parts whose statistics sit right on the edge of another encoding */
+#define BODY(text) { text, sizeof (text) - 1 }
+static struct {
+	const char *text;
+	size_t len;
+} stats_bodies[] = {
+	BODY ("short line\n"),
+	BODY ("no newline before the boundary"),
+	BODY ("caf\xe9\n"),
+	BODY ("nul \0 right before the boundary\0"),
+	BODY ("\nFrom the start of a line\n"),
+	BODY ("\r\nCRLF line endings\r\n\r\n"),
+	BODY ("8bit right before the boundary \xe9"),
+	BODY (""),
+};
+
+static GMimeStream *
+content_stats_mbox (void)
+{
+	GMimeStream *stream;
+	GString *body;
+	guint i, j;
+	
+	stream = g_mime_stream_mem_new ();
+	body = g_string_new ("");
+	
+	/* lines of either side of the 998 character limit, and 8bit
+	 * data either side of the 17% base64 threshold, straddling the
+	 * parser's read buffer */
+	for (i = 0; i < 4; i++) {
+		g_string_truncate (body, 0);
+		for (j = 0; j < 4000 + i * 3; j++)
+			g_string_append_c (body, 'x');
+		
+		for (j = 0; j < 997 + i; j++)
+			g_string_append_c (body, (i & 1) && (j % 6) == 0 ? '\xe9' : 'y');
+		
+		g_mime_stream_printf (stream, "From someone@example.com Sat Oct 17 00:00:00 2026\n"
+				      "Subject: straddle %u\n"
+				      "Content-Type: text/plain\n\n%s\n\n", i, body->str);
+	}
+	
+	g_string_free (body, TRUE);
+	
+	for (i = 0; i < G_N_ELEMENTS (stats_bodies); i++) {
+		g_mime_stream_printf (stream, "From someone@example.com Sat Oct 17 00:00:00 2026\n"
+				      "Subject: edge %u\n"
+				      "MIME-Version: 1.0\n"
+				      "Content-Type: multipart/mixed; boundary=\"b\"\n\n"
+				      "--b\n"
+				      "Content-Type: text/plain\n"
+				      "Content-Transfer-Encoding: %s\n\n", i,
+				      i & 1 ? "8bit" : "7bit");
+		
+		g_mime_stream_write (stream, stats_bodies[i].text, stats_bodies[i].len);
+		g_mime_stream_printf (stream, "\n--b\n"
+				      "Content-Type: application/octet-stream\n"
+				      "Content-Transfer-Encoding: binary\n\n");
+		g_mime_stream_write (stream, stats_bodies[i].text, stats_bodies[i].len);
+		g_mime_stream_printf (stream, "\r\n--b--\n\n");
+	}
+	
+	g_mime_stream_reset (stream);
+	
+	return stream;
+}
+
+static void
+serialize_message (GMimeParser *parser, GMimeMessage *message, gpointer user_data)
+{
+	GMimeStream *output = user_data;
+	
+	summarize_message (parser, message, output);
+	g_mime_object_write_to_stream ((GMimeObject *) message, output);
+}
+
+static gboolean
+parallel_parse_matches (GMimeStream *mbox)
+{
+	GMimeStream *output[2];
+	GMimeParser *parser;
+	gboolean match;
+	int i, n[2];
+	
+	for (i = 0; i < 2; i++) {
+		output[i] = g_mime_stream_mem_new ();
+		
+		g_mime_stream_reset (mbox);
+		parser = g_mime_parser_new_with_stream (mbox);
+		g_mime_parser_set_scan_from (parser, TRUE);
+		n[i] = g_mime_parser_construct_messages (parser, i ? 4 : 1, serialize_message, output[i]);
+		g_object_unref (parser);
+		
+		g_mime_stream_reset (output[i]);
+	}
+	
+	match = n[0] == n[1] && streams_match (output[0], output[1]);
+	
+	g_object_unref (output[0]);
+	g_object_unref (output[1]);
+	
+	return match;
+}
+
+static void
+test_parallel_parser (const char *input)
+{
+	GMimeStream *mbox, *fstream;
+	gboolean match = FALSE;
+	char *buf = NULL;
+	char *path;
+	size_t size;
+	int fd;
+	
+	if (!g_file_get_contents (input, &buf, &size, NULL))
+		throw (exception_new ("could not read `%s'", input));
+	
+	/* make it big enough to be split into chunks */
+	mbox = g_mime_stream_mem_new ();
+	while (size > 0 && g_mime_stream_length (mbox) < 2 * 1024 * 1024) {
+		g_mime_stream_write (mbox, buf, size);
+		if (buf[size - 1] != '\n')
+			g_mime_stream_write (mbox, "\n", 1);
+		g_mime_stream_write (mbox, "\n", 1);
+	}
+	
+	g_free (buf);
+	
+	if (!parallel_parse_matches (mbox)) {
+		g_object_unref (mbox);
+		throw (exception_new ("parallel parse does not match for `%s'", input));
+	}
+	
+	/* streams that aren't parsed in place get copied a chunk at a time */
+	if ((fd = g_file_open_tmp ("test-mbox.XXXXXX", &path, NULL)) == -1) {
+		g_object_unref (mbox);
+		throw (exception_new ("could not create a temporary file"));
+	}
+	
+	fstream = g_mime_stream_fs_new (fd);
+	g_mime_stream_reset (mbox);
+	if (g_mime_stream_write_to_stream (mbox, fstream) != -1)
+		match = parallel_parse_matches (fstream);
+	
+	g_object_unref (fstream);
+	g_object_unref (mbox);
+	unlink (path);
+	g_free (path);
+	
+	if (!match)
+		throw (exception_new ("parallel parse of a file does not match for `%s'", input));
+}
+
+/* messages with From-lines in their content that only Content-Length
+ * headers say are not the start of another message */
+static void
+test_parallel_content_length (void)
+{
+	GMimeStream *mbox, *output[2];
+	GMimeParser *parser;
+	gboolean match;
+	GString *body;
+	int i, j, n[2];
+	
+	mbox = g_mime_stream_mem_new ();
+	body = g_string_new ("");
+	
+	for (i = 0; i < 2000; i++) {
+		g_string_printf (body, "the next line is part of message %d\n\n"
+				 "From someone@example.com Sat Oct 17 00:00:00 2026\n", i);
+		for (j = 0; j < 12; j++)
+			g_string_append (body, "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx\n");
+		
+		g_mime_stream_printf (mbox, "From someone@example.com Sat Oct 17 00:00:00 2026\n"
+				      "Subject: message %d\n"
+				      "Content-Length: %u\n\n%s\n", i,
+				      (unsigned int) body->len, body->str);
+	}
+	
+	g_string_free (body, TRUE);
+	
+	for (i = 0; i < 2; i++) {
+		output[i] = g_mime_stream_mem_new ();
+		
+		g_mime_stream_reset (mbox);
+		parser = g_mime_parser_new_with_stream (mbox);
+		g_mime_parser_set_scan_from (parser, TRUE);
+		g_mime_parser_set_respect_content_length (parser, TRUE);
+		g_mime_parser_set_headers_only (parser, TRUE);
+		n[i] = g_mime_parser_construct_messages (parser, i ? 4 : 1, serialize_message, output[i]);
+		g_object_unref (parser);
+		
+		g_mime_stream_reset (output[i]);
+	}
+	
+	match = n[0] == 2000 && n[1] == 2000 && streams_match (output[0], output[1]);
+	
+	g_object_unref (output[0]);
+	g_object_unref (output[1]);
+	g_object_unref (mbox);
+	
+	if (!match)
+		throw (exception_new ("parallel parse does not match (%d messages with one thread, %d with four)", n[0], n[1]));
+}
+
+/* a message that can't be parsed in the middle of an mbox that is big
+ * enough to be split */
+static void
+test_parallel_parse_error (void)
+{
+	GMimeStream *mbox, *output[2];
+	GMimeParser *parser;
+	gint64 offset[2];
+	gboolean match;
+	int i, j, n[2];
+	
+	mbox = g_mime_stream_mem_new ();
+	for (i = 0; i < 6000; i++) {
+		g_mime_stream_printf (mbox, "From someone@example.com Sat Oct 17 00:00:00 2026\n");
+		
+		if (i == 2500) {
+			g_mime_stream_printf (mbox, "this is not a header\n\n");
+			continue;
+		}
+		
+		g_mime_stream_printf (mbox, "Subject: message %d\n\n", i);
+		for (j = 0; j < 4; j++)
+			g_mime_stream_printf (mbox, "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx\n");
+		g_mime_stream_printf (mbox, "\n");
+	}
+	
+	for (i = 0; i < 2; i++) {
+		output[i] = g_mime_stream_mem_new ();
+		
+		g_mime_stream_reset (mbox);
+		parser = g_mime_parser_new_with_stream (mbox);
+		g_mime_parser_set_scan_from (parser, TRUE);
+		n[i] = g_mime_parser_construct_messages (parser, i ? 4 : 1, serialize_message, output[i]);
+		offset[i] = g_mime_parser_tell (parser);
+		g_object_unref (parser);
+		
+		g_mime_stream_reset (output[i]);
+	}
+	
+	match = n[0] == 2500 && n[1] == 2500 && offset[0] == offset[1] &&
+		streams_match (output[0], output[1]);
+	
+	g_object_unref (output[0]);
+	g_object_unref (output[1]);
+	g_object_unref (mbox);
+	
+	if (!match)
+		throw (exception_new ("parallel parse does not stop where a sequential one does (%d messages at %"
+				      G_GINT64_FORMAT " with one thread, %d at %" G_GINT64_FORMAT " with four)",
+				      n[0], offset[0], n[1], offset[1]));
+}
+
+/* a possible boundary line that runs right up to the end of a
+ * stream parsed in place, with nothing after its '\n' to read */
+static void
+test_scan_to_end_of_memory (void)
+{
+	const char *head = "Content-Type: multipart/mixed; boundary=\"b\"\n\n--b\n\nhello\n-";
+	GMimeStream *stream, *content;
+	GMimeMessage *message;
+	GByteArray array, *buf;
+	gboolean match = TRUE;
+	GMimeParser *parser;
+	GMimeObject *part;
+	size_t hlen;
+	int pad;
+	
+	hlen = strlen (head);
+	
+	for (pad = 0; pad < 4 && match; pad++) {
+		/* the stream doesn't own the array, so its memory can end
+		 * exactly where the message does */
+		array.len = hlen + 1000 + pad + 1;
+		array.data = g_malloc (array.len);
+		memcpy (array.data, head, hlen);
+		memset (array.data + hlen, 'x', 1000 + pad);
+		array.data[array.len - 1] = '\n';
+		
+		stream = g_mime_stream_mem_new_with_byte_array (&array);
+		g_mime_stream_mem_set_owner ((GMimeStreamMem *) stream, FALSE);
+		parser = g_mime_parser_new_with_stream (stream);
+		message = g_mime_parser_construct_message (parser);
+		g_object_unref (parser);
+		
+		match = FALSE;
+		if (message != NULL) {
+			part = g_mime_multipart_get_part ((GMimeMultipart *) g_mime_message_get_mime_part (message), 0);
+			content = g_mime_stream_mem_new ();
+			g_mime_data_wrapper_write_to_stream (g_mime_part_get_content_object ((GMimePart *) part), content);
+			buf = g_mime_stream_mem_get_byte_array ((GMimeStreamMem *) content);
+			
+			match = buf->len >= 1000 + pad + 7 &&
+				!memcmp (buf->data, "hello\n-", 7) &&
+				!memcmp (buf->data + 7, array.data + hlen, 1000 + pad);
+			
+			g_object_unref (content);
+			g_object_unref (message);
+		}
+		
+		g_object_unref (stream);
+		g_free (array.data);
+	}
+	
+	if (!match)
+		throw (exception_new ("content does not match when the last line ends the stream's memory"));
+}
+
+static void
+check_mbox_index (GMimeMboxIndex *index, const char *mbox)
+{
+	const GMimeMboxIndexEntry *entry;
+	GMimeMessage *message;
+	GMimeParser *parser;
+	GMimeStream *stream;
+	guint n, count;
+	int fd;
+	
+	if ((fd = open (mbox, O_RDONLY, 0)) == -1)
+		throw (exception_new ("could not open `%s': %s", mbox, g_strerror (errno)));
+	
+	stream = g_mime_stream_fs_new (fd);
+	parser = g_mime_parser_new_with_stream (stream);
+	g_mime_parser_set_scan_from (parser, TRUE);
+	
+	/* the index must agree with a full parse of the mbox... */
+	count = g_mime_mbox_index_get_count (index);
+	for (n = 0; !g_mime_parser_eos (parser); n++) {
+		if (!(message = g_mime_parser_construct_message (parser)))
+			break;
+		
+		g_object_unref (message);
+		
+		if (!(entry = g_mime_mbox_index_get_entry (index, n)) ||
+		    entry->from_offset != g_mime_parser_get_from_offset (parser) ||
+		    entry->headers_begin != g_mime_parser_get_headers_begin (parser) ||
+		    entry->headers_end != g_mime_parser_get_headers_end (parser) ||
+		    entry->body_begin < entry->headers_end ||
+		    entry->body_end != g_mime_parser_tell (parser))
+			break;
+	}
+	
+	if (n != count || !g_mime_parser_eos (parser)) {
+		g_object_unref (parser);
+		g_object_unref (stream);
+		throw (exception_new ("index does not match message %u of `%s'", n, mbox));
+	}
+	
+	/* ...and seeking to message N must find that message */
+	for (n = count; n > 0; n--) {
+		entry = g_mime_mbox_index_get_entry (index, n - 1);
+		
+		if (!g_mime_mbox_index_seek (index, n - 1, parser, stream) ||
+		    !(message = g_mime_parser_construct_message (parser)))
+			break;
+		
+		g_object_unref (message);
+		
+		if (entry->from_offset != g_mime_parser_get_from_offset (parser) ||
+		    entry->body_end != g_mime_parser_tell (parser))
+			break;
+	}
+	
+	g_object_unref (parser);
+	g_object_unref (stream);
+	
+	if (n > 0)
+		throw (exception_new ("could not seek to message %u of `%s'", n - 1, mbox));
+}
+
+static gboolean
+mbox_indexes_match (GMimeMboxIndex *index0, GMimeMboxIndex *index1)
+{
+	const GMimeMboxIndexEntry *entry0, *entry1;
+	guint n, count;
+	
+	if ((count = g_mime_mbox_index_get_count (index0)) != g_mime_mbox_index_get_count (index1))
+		return FALSE;
+	
+	for (n = 0; n < count; n++) {
+		entry0 = g_mime_mbox_index_get_entry (index0, n);
+		entry1 = g_mime_mbox_index_get_entry (index1, n);
+		
+		if (memcmp (entry0, entry1, sizeof (GMimeMboxIndexEntry)) != 0)
+			return FALSE;
+	}
+	
+	return TRUE;
+}
+
+static void
+test_mbox_index (const char *input)
+{
+	GMimeMboxIndex *index, *loaded, *fresh;
+	char *mbox, *idx, *buf = NULL;
+	Exception *ex = NULL;
+	GError *err = NULL;
+	size_t size;
+	int fd;
+	
+	if (!g_file_get_contents (input, &buf, &size, NULL))
+		throw (exception_new ("could not read `%s'", input));
+	
+	mbox = g_build_filename (g_get_tmp_dir (), "gmime-mbox.XXXXXX", NULL);
+	if ((fd = g_mkstemp (mbox)) == -1) {
+		g_free (mbox);
+		g_free (buf);
+		throw (exception_new ("could not create a temporary mbox"));
+	}
+	
+	idx = g_strdup_printf ("%s.idx", mbox);
+	index = g_mime_mbox_index_new ();
+	loaded = NULL;
+	fresh = NULL;
+	
+	if (write (fd, buf, size) != (ssize_t) size) {
+		ex = exception_new ("could not write `%s'", mbox);
+		goto done;
+	}
+	
+	if (!g_mime_mbox_index_update (index, mbox, &err) ||
+	    !g_mime_mbox_index_save (index, idx, &err) ||
+	    !(loaded = g_mime_mbox_index_load (idx, &err))) {
+		ex = exception_new ("%s", err->message);
+		g_error_free (err);
+		goto done;
+	}
+	
+	if (!mbox_indexes_match (index, loaded) || !g_mime_mbox_index_is_valid (loaded, mbox)) {
+		ex = exception_new ("saved index does not match for `%s'", input);
+		goto done;
+	}
+	
+	/* append the mbox to itself and update the saved index */
+	if ((size > 0 && buf[size - 1] != '\n' && write (fd, "\n", 1) != 1) ||
+	    write (fd, "\n", 1) != 1 || write (fd, buf, size) != (ssize_t) size) {
+		ex = exception_new ("could not write `%s'", mbox);
+		goto done;
+	}
+	
+	if (g_mime_mbox_index_is_valid (loaded, mbox)) {
+		ex = exception_new ("index is still valid after appending to `%s'", input);
+		goto done;
+	}
+	
+	fresh = g_mime_mbox_index_new ();
+	g_mime_mbox_index_update (loaded, mbox, NULL);
+	g_mime_mbox_index_update (fresh, mbox, NULL);
+	
+	if (!mbox_indexes_match (loaded, fresh)) {
+		ex = exception_new ("updated index does not match for `%s'", input);
+		goto done;
+	}
+	
+	try {
+		check_mbox_index (fresh, mbox);
+	} catch (e) {
+		ex = exception_new ("%s", e->message);
+	} finally;
+	
+ done:
+	if (fresh != NULL)
+		g_mime_mbox_index_destroy (fresh);
+	if (loaded != NULL)
+		g_mime_mbox_index_destroy (loaded);
+	g_mime_mbox_index_destroy (index);
+	close (fd);
+	unlink (mbox);
+	unlink (idx);
+	g_free (mbox);
+	g_free (idx);
+	g_free (buf);
+	
+	if (ex != NULL)
+		throw (ex);
+}
+
 int main (int argc, char **argv)
 {
 	const char *datadir = "data/mbox";
 	char input[256], output[256], *tmp, *p, *q;
-	GMimeStream *istream, *ostream, *mstream, *pstream;
+	GMimeStream *istream, *ostream, *mstream, *pstream, *hstream;
 	GMimeParser *parser;
 	const char *dent;
 	const char *path;
@@ -268,6 +1310,16 @@ int main (int argc, char **argv)
 	
 	if (S_ISDIR (st.st_mode)) {
 		/* automated testsuite */
+		
+		/* first, while the address space hasn't peaked yet */
+		testsuite_check ("bogus Content-Length");
+		try {
+			test_bogus_content_length ();
+			testsuite_check_passed ();
+		} catch (ex) {
+			testsuite_check_failed ("bogus Content-Length: %s", ex->message);
+		} finally;
+		
 		p = g_stpcpy (input, path);
 		*p++ = G_DIR_SEPARATOR;
 		p = g_stpcpy (p, "input");
@@ -297,6 +1349,7 @@ int main (int argc, char **argv)
 			ostream = NULL;
 			mstream = NULL;
 			pstream = NULL;
+			hstream = NULL;
 			
 			testsuite_check ("%s", dent);
 			try {
@@ -347,6 +1400,104 @@ int main (int argc, char **argv)
 				if (!streams_match (ostream, pstream))
 					throw (exception_new ("summaries do not match for `%s'", dent));
 				
+				/* parse it again, this time without building the tree */
+				g_object_unref (parser);
+				g_object_unref (pstream);
+				pstream = NULL;
+				
+				g_mime_stream_reset (istream);
+				parser = g_mime_parser_new_with_stream (istream);
+				g_mime_parser_set_scan_from (parser, TRUE);
+				
+				if (strstr (dent, "content-length") != NULL)
+					g_mime_parser_set_respect_content_length (parser, TRUE);
+				
+				pstream = g_mime_stream_mem_new ();
+				g_mime_parser_set_header_regex (parser, "^Subject$", header_cb, pstream);
+				test_event_parser (parser, pstream);
+				
+				g_mime_stream_reset (ostream);
+				g_mime_stream_reset (pstream);
+				if (!streams_match (ostream, pstream))
+					throw (exception_new ("summaries do not match for events of `%s'", dent));
+				
+				/* and again, this time in push mode (which
+				 * does not respect Content-Length headers) */
+				if (strstr (dent, "content-length") == NULL) {
+					g_object_unref (parser);
+					g_object_unref (pstream);
+					pstream = NULL;
+					
+					parser = g_mime_parser_new ();
+					g_mime_parser_set_scan_from (parser, TRUE);
+					
+					pstream = g_mime_stream_mem_new ();
+					g_mime_parser_set_header_regex (parser, "^Subject$", header_cb, pstream);
+					test_push_parser (parser, input, pstream);
+					
+					g_mime_stream_reset (ostream);
+					g_mime_stream_reset (pstream);
+					if (!streams_match (ostream, pstream))
+						throw (exception_new ("summaries do not match for pushed `%s'", dent));
+				}
+				
+				/* a headers-only parse must find the same messages */
+				g_object_unref (pstream);
+				pstream = g_mime_stream_mem_new ();
+				test_headers_only (istream, strstr (dent, "content-length") != NULL, FALSE, pstream);
+				
+				hstream = g_mime_stream_mem_new ();
+				test_headers_only (istream, strstr (dent, "content-length") != NULL, TRUE, hstream);
+				
+				g_mime_stream_reset (hstream);
+				g_mime_stream_reset (pstream);
+				if (!streams_match (pstream, hstream))
+					throw (exception_new ("summaries do not match for headers of `%s'", dent));
+					
+				/* and with content statistics */
+				test_content_stats (istream);
+				
+				/* and with a memory limit */
+				test_memory_limit (istream);
+				
+				/* and index it */
+				test_mbox_index (input);
+				
+#ifdef HAVE_MMAP
+				/* parse it again, this time in place */
+				g_object_unref (parser);
+				g_object_unref (pstream);
+				parser = NULL;
+				pstream = NULL;
+				
+				if ((fd = open (input, O_RDONLY, 0)) == -1) {
+					throw (exception_new ("could not open `%s': %s",
+							      input, g_strerror (errno)));
+				}
+				
+				g_object_unref (istream);
+				if (!(istream = g_mime_stream_mmap_new (fd, PROT_READ, MAP_PRIVATE))) {
+					close (fd);
+					throw (exception_new ("could not mmap `%s'", input));
+				}
+				
+				parser = g_mime_parser_new_with_stream (istream);
+				g_mime_parser_set_persist_stream (parser, TRUE);
+				g_mime_parser_set_scan_from (parser, TRUE);
+				
+				if (strstr (dent, "content-length") != NULL)
+					g_mime_parser_set_respect_content_length (parser, TRUE);
+				
+				pstream = g_mime_stream_mem_new ();
+				g_mime_parser_set_header_regex (parser, "^Subject$", header_cb, pstream);
+				test_parser (parser, NULL, pstream);
+				
+				g_mime_stream_reset (ostream);
+				g_mime_stream_reset (pstream);
+				if (!streams_match (ostream, pstream))
+					throw (exception_new ("summaries do not match for mmapped `%s'", dent));
+#endif /* HAVE_MMAP */
+				
 				testsuite_check_passed ();
 				
 #ifdef ENABLE_MBOX_MATCH
@@ -365,6 +1516,9 @@ int main (int argc, char **argv)
 			if (pstream != NULL)
 				g_object_unref (pstream);
 			
+			if (hstream != NULL)
+				g_object_unref (hstream);
+			
 			if (istream != NULL)
 				g_object_unref (istream);
 			
@@ -375,9 +1529,55 @@ int main (int argc, char **argv)
 				g_object_unref (parser);
 			
 			g_free (tmp);
+			
+			testsuite_check ("%s split across threads", dent);
+			try {
+				test_parallel_parser (input);
+				testsuite_check_passed ();
+			} catch (ex) {
+				testsuite_check_failed ("%s split across threads: %s", dent, ex->message);
+			} finally;
 		}
 		
 		g_dir_close (dir);
+		
+		istream = content_stats_mbox ();
+		
+		testsuite_check ("parallel parse with Content-Length");
+		try {
+			test_parallel_content_length ();
+			testsuite_check_passed ();
+		} catch (ex) {
+			testsuite_check_failed ("parallel parse with Content-Length: %s", ex->message);
+		} finally;
+		
+		testsuite_check ("parallel parse of a broken message");
+		try {
+			test_parallel_parse_error ();
+			testsuite_check_passed ();
+		} catch (ex) {
+			testsuite_check_failed ("parallel parse of a broken message: %s", ex->message);
+		} finally;
+		
+		testsuite_check ("parsing in place up to the end of memory");
+		try {
+			test_scan_to_end_of_memory ();
+			testsuite_check_passed ();
+		} catch (ex) {
+			testsuite_check_failed ("parsing in place up to the end of memory: %s", ex->message);
+		} finally;
+		
+		testsuite_check ("content statistics and memory limit");
+		try {
+			test_content_stats (istream);
+			test_memory_limit (istream);
+			test_spill_failure ();
+			testsuite_check_passed ();
+		} catch (ex) {
+			testsuite_check_failed ("content statistics and memory limit: %s", ex->message);
+		} finally;
+		
+		g_object_unref (istream);
 	} else if (S_ISREG (st.st_mode)) {
 		/* manually run test on a single file */
 		if ((fd = open (path, O_RDONLY, 0)) == -1)
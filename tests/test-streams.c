@@ -197,6 +197,180 @@ test_stream_buffer_gets (const char *filename)
 	g_object_unref (stream);
 }
 
+#ifdef HAVE_PREAD
+#define NUM_SUBSTREAMS 16
+
+typedef struct {
+	GMimeStream *stream;
+	const char *expected;
+	size_t len;
+	gboolean ok;
+} SubstreamReader;
+
+/* reads the substream over and over with varying buffer sizes, so that
+ * its reads interleave with those of the other threads */
+static void
+read_substream (gpointer data, gpointer user_data)
+{
+	SubstreamReader *reader = data;
+	size_t chunk, total;
+	char buf[4096];
+	ssize_t n;
+	int pass;
+	
+	reader->ok = TRUE;
+	
+	for (pass = 0; pass < 64 && reader->ok; pass++) {
+		g_mime_stream_reset (reader->stream);
+		chunk = 1 + (pass * 509) % sizeof (buf);
+		total = 0;
+		
+		while ((n = g_mime_stream_read (reader->stream, buf, chunk)) > 0) {
+			if (total + n > reader->len || memcmp (buf, reader->expected + total, n) != 0) {
+				reader->ok = FALSE;
+				break;
+			}
+			
+			total += n;
+		}
+		
+		if (total != reader->len)
+			reader->ok = FALSE;
+	}
+}
+
+static void
+test_stream_fs_threads (const char *filename)
+{
+	SubstreamReader readers[NUM_SUBSTREAMS];
+	GMimeStream *stream;
+	GThreadPool *pool;
+	gint64 start, end;
+	char *content;
+	gsize len;
+	int fd, i;
+	
+	if (!g_file_get_contents (filename, &content, &len, NULL))
+		return;
+	
+	if ((fd = open (filename, O_RDONLY, 0)) == -1) {
+		v(fprintf (stderr, "failed to open %s", filename));
+		g_free (content);
+		return;
+	}
+	
+	stream = g_mime_stream_fs_new (fd);
+	
+	/* overlapping substreams, all sharing the same fd */
+	for (i = 0; i < NUM_SUBSTREAMS; i++) {
+		start = (len * i) / (NUM_SUBSTREAMS * 2);
+		end = i % 4 == 0 ? -1 : start + len / 2;
+		
+		readers[i].stream = g_mime_stream_substream (stream, start, end);
+		readers[i].expected = content + start;
+		readers[i].len = (end == -1 ? (gint64) len : end) - start;
+	}
+	
+	testsuite_check ("GMimeStreamFs::read() from concurrent threads");
+	try {
+		pool = g_thread_pool_new (read_substream, NULL, NUM_SUBSTREAMS / 2, FALSE, NULL);
+		for (i = 0; i < NUM_SUBSTREAMS; i++)
+			g_thread_pool_push (pool, &readers[i], NULL);
+		g_thread_pool_free (pool, FALSE, TRUE);
+		
+		for (i = 0; i < NUM_SUBSTREAMS; i++) {
+			if (!readers[i].ok)
+				throw (exception_new ("substream %d did not match", i));
+		}
+		
+		testsuite_check_passed ();
+	} catch (ex) {
+		testsuite_check_failed ("GMimeStreamFs::read() from concurrent threads failed: %s",
+					ex->message);
+	} finally;
+	
+	for (i = 0; i < NUM_SUBSTREAMS; i++)
+		g_object_unref (readers[i].stream);
+	
+	g_object_unref (stream);
+	g_free (content);
+}
+#endif /* HAVE_PREAD */
+
+static void
+test_stream_fs_writev (const char *filename)
+{
+	GMimeStreamIOVector *vector, block;
+	GMimeStream *stream, *sub;
+	GArray *array;
+	char *content, *output;
+	gsize len, outlen;
+	size_t n, i, half;
+	gint64 offset;
+	char *path;
+	int fd;
+	
+	if (!g_file_get_contents (filename, &content, &len, NULL))
+		return;
+	
+	if ((fd = g_file_open_tmp ("test-streams.XXXXXX", &path, NULL)) == -1) {
+		g_free (content);
+		return;
+	}
+	
+	/* blocks of all sorts of sizes, including empty ones, and more
+	 * of them than fit into a single writev() */
+	array = g_array_new (FALSE, FALSE, sizeof (GMimeStreamIOVector));
+	for (i = 0, n = 0; i < len; i += block.len, n++) {
+		block.data = content + i;
+		block.len = MIN ((n * 37) % 301, len - i);
+		g_array_append_val (array, block);
+	}
+	
+	vector = (GMimeStreamIOVector *) array->data;
+	half = n / 2;
+	for (i = 0, offset = 0; i < half; i++)
+		offset += vector[i].len;
+	
+	stream = g_mime_stream_fs_new (fd);
+	sub = g_mime_stream_substream (stream, offset, -1);
+	output = NULL;
+	
+	testsuite_check ("GMimeStreamFs::writev()");
+	try {
+		/* the second half goes in first, through a substream */
+		if (g_mime_stream_writev (sub, vector + half, n - half) != (ssize_t) (len - offset))
+			throw (exception_new ("writev to substream failed: %s", g_strerror (errno)));
+		
+		if (g_mime_stream_tell (sub) != (gint64) len)
+			throw (exception_new ("substream is at the wrong position"));
+		
+		if (g_mime_stream_writev (stream, vector, half) != (ssize_t) offset)
+			throw (exception_new ("writev failed: %s", g_strerror (errno)));
+		
+		if (g_mime_stream_tell (stream) != offset)
+			throw (exception_new ("stream is at the wrong position"));
+		
+		if (!g_file_get_contents (path, &output, &outlen, NULL))
+			throw (exception_new ("could not read back `%s'", path));
+		
+		if (outlen != len || memcmp (output, content, len) != 0)
+			throw (exception_new ("output does not match `%s'", filename));
+		
+		testsuite_check_passed ();
+	} catch (ex) {
+		testsuite_check_failed ("GMimeStreamFs::writev() failed: %s", ex->message);
+	} finally;
+	
+	g_object_unref (sub);
+	g_object_unref (stream);
+	unlink (path);
+	g_array_free (array, TRUE);
+	g_free (output);
+	g_free (content);
+	g_free (path);
+}
+
 
 #if 0
 static void
@@ -444,6 +618,71 @@ check_stream_gio (const char *input, const char *output, const char *filename, g
 	return TRUE;
 }
 
+static gboolean
+check_stream_parsed (const char *input, const char *output, const char *filename, gint64 start, gint64 end)
+{
+	GMimeStream *streams[2], *stream;
+	GMimeDataWrapper *content;
+	Exception *ex = NULL;
+	GMimeParser *parser;
+	GMimeObject *part;
+	gint64 len;
+	int fd[2];
+	
+	if ((fd[0] = open (input, O_RDONLY, 0)) == -1)
+		return FALSE;
+	
+	if ((fd[1] = open (output, O_RDONLY, 0)) == -1) {
+		close (fd[0]);
+		return FALSE;
+	}
+	
+	/* the parser saves the content of a part it does not persist
+	 * the stream for, pre-sized from its Content-Length; only give
+	 * it half of the length so that the rest has to be appended */
+	streams[0] = g_mime_stream_fs_new (fd[0]);
+	len = g_mime_stream_length (streams[0]);
+	stream = g_mime_stream_mem_new ();
+	g_mime_stream_printf (stream, "Content-Type: application/octet-stream\n"
+			      "Content-Length: %" G_GINT64_FORMAT "\n\n", len / 2);
+	g_mime_stream_write_to_stream (streams[0], stream);
+	g_mime_stream_reset (stream);
+	g_object_unref (streams[0]);
+	
+	parser = g_mime_parser_new_with_stream (stream);
+	g_mime_parser_set_persist_stream (parser, FALSE);
+	part = g_mime_parser_construct_part (parser);
+	g_object_unref (parser);
+	g_object_unref (stream);
+	
+	if (!GMIME_IS_PART (part)) {
+		if (part != NULL)
+			g_object_unref (part);
+		close (fd[1]);
+		
+		throw (exception_new ("could not parse `%s'", filename));
+	}
+	
+	/* the substream has to outlive the part */
+	content = g_mime_part_get_content_object ((GMimePart *) part);
+	stream = g_mime_data_wrapper_get_stream (content);
+	streams[0] = g_mime_stream_substream (stream, start, end);
+	g_object_unref (part);
+	
+	streams[1] = g_mime_stream_fs_new (fd[1]);
+	
+	if (!streams_match (streams, filename))
+		ex = exception_new ("parsed content streams did not match for `%s'", filename);
+	
+	g_object_unref (streams[0]);
+	g_object_unref (streams[1]);
+	
+	if (ex != NULL)
+		throw (ex);
+	
+	return TRUE;
+}
+
 
 typedef gboolean (* checkFunc) (const char *, const char *, const char *, gint64, gint64);
 
@@ -459,6 +698,7 @@ static struct {
 	{ "GMimeStreamBuffer (block mode)", check_stream_buffer_block },
 	{ "GMimeStreamBuffer (cache mode)", check_stream_buffer_cache },
 	{ "GMimeStreamGIO",                 check_stream_gio          },
+	{ "Parsed content",                 check_stream_parsed       },
 };
 
 static void
@@ -619,6 +859,473 @@ gen_test_data (const char *datadir, char **stream_name)
 	return 0;
 }
 
+static void
+test_stream_fs_copy (const char *filename)
+{
+	GMimeStream *stream, *sub, *ostream;
+	char *content, *output = NULL;
+	gsize len, outlen;
+	gint64 start, end;
+	GString *expected;
+	char *path;
+	int fd;
+	
+	if (!g_file_get_contents (filename, &content, &len, NULL))
+		return;
+	
+	if ((fd = open (filename, O_RDONLY, 0)) == -1) {
+		g_free (content);
+		return;
+	}
+	
+	stream = g_mime_stream_fs_new (fd);
+	
+	if ((fd = g_file_open_tmp ("test-streams.XXXXXX", &path, NULL)) == -1) {
+		g_object_unref (stream);
+		g_free (content);
+		return;
+	}
+	
+	ostream = g_mime_stream_fs_new (fd);
+	
+	start = len / 3;
+	end = start + len / 3;
+	sub = g_mime_stream_substream (stream, start, end);
+	
+	expected = g_string_new ("prefix\n");
+	g_string_append_len (expected, content + start, end - start);
+	g_string_append_len (expected, content, len);
+	
+	testsuite_check ("GMimeStreamFs to GMimeStreamFs copy");
+	try {
+		if (g_mime_stream_write_string (ostream, "prefix\n") == -1)
+			throw (exception_new ("could not write prefix: %s", g_strerror (errno)));
+		
+		if (g_mime_stream_write_to_stream (sub, ostream) != end - start)
+			throw (exception_new ("substream copy failed"));
+		
+		if (g_mime_stream_tell (sub) != end || !g_mime_stream_eos (sub))
+			throw (exception_new ("substream is at the wrong position"));
+		
+		if (g_mime_stream_write_to_stream (stream, ostream) != (ssize_t) len)
+			throw (exception_new ("stream copy failed"));
+		
+		if (g_mime_stream_tell (ostream) != (gint64) expected->len)
+			throw (exception_new ("output stream is at the wrong position"));
+		
+		if (!g_file_get_contents (path, &output, &outlen, NULL))
+			throw (exception_new ("could not read back `%s'", path));
+		
+		if (outlen != expected->len || memcmp (output, expected->str, outlen) != 0)
+			throw (exception_new ("output does not match `%s'", filename));
+		
+		testsuite_check_passed ();
+	} catch (ex) {
+		testsuite_check_failed ("GMimeStreamFs to GMimeStreamFs copy failed: %s", ex->message);
+	} finally;
+	
+	g_string_free (expected, TRUE);
+	g_object_unref (ostream);
+	g_object_unref (stream);
+	g_object_unref (sub);
+	unlink (path);
+	g_free (content);
+	g_free (output);
+	g_free (path);
+}
+
+#define NUM_FILTER_CHAINS 4
+
+static void
+add_filter_chain (GMimeStreamFilter *stream, int chain)
+{
+	GMimeFilter *filters[3];
+	int i, n = 0;
+	
+	switch (chain) {
+	case 0:
+		/* works in place */
+		filters[n++] = g_mime_filter_crlf_new (FALSE, FALSE);
+		break;
+	case 1:
+		/* pass-through filters around one that works in place */
+		filters[n++] = g_mime_filter_md5_new ();
+		filters[n++] = g_mime_filter_crlf_new (FALSE, FALSE);
+		filters[n++] = g_mime_filter_best_new (GMIME_FILTER_BEST_CHARSET | GMIME_FILTER_BEST_ENCODING);
+		break;
+	case 2:
+		/* ends with a filter that grows its input */
+		filters[n++] = g_mime_filter_crlf_new (FALSE, FALSE);
+		filters[n++] = g_mime_filter_basic_new (GMIME_CONTENT_ENCODING_QUOTEDPRINTABLE, TRUE);
+		break;
+	default:
+		/* backs up data in front of one that works in place */
+		filters[n++] = g_mime_filter_basic_new (GMIME_CONTENT_ENCODING_QUOTEDPRINTABLE, FALSE);
+		filters[n++] = g_mime_filter_crlf_new (FALSE, FALSE);
+		break;
+	}
+	
+	for (i = 0; i < n; i++) {
+		g_mime_stream_filter_add (stream, filters[i]);
+		g_object_unref (filters[i]);
+	}
+}
+
+static GByteArray *
+filter_chain_write (GByteArray *input, int chain)
+{
+	GMimeStream *stream, *filtered;
+	GByteArray *output;
+	
+	output = g_byte_array_new ();
+	stream = g_mime_stream_mem_new_with_byte_array (output);
+	g_mime_stream_mem_set_owner ((GMimeStreamMem *) stream, FALSE);
+	
+	filtered = g_mime_stream_filter_new (stream);
+	add_filter_chain ((GMimeStreamFilter *) filtered, chain);
+	
+	g_mime_stream_write (filtered, (const char *) input->data, input->len);
+	g_mime_stream_flush (filtered);
+	
+	g_object_unref (filtered);
+	g_object_unref (stream);
+	
+	return output;
+}
+
+static GByteArray *
+filter_chain_read (GByteArray *input, int chain, size_t chunksize, size_t readsize)
+{
+	GMimeStream *stream, *filtered;
+	GByteArray *output;
+	char *buf;
+	ssize_t n;
+	
+	stream = g_mime_stream_mem_new_with_buffer ((const char *) input->data, input->len);
+	filtered = g_mime_stream_filter_new (stream);
+	g_mime_stream_filter_set_chunk_size ((GMimeStreamFilter *) filtered, chunksize);
+	add_filter_chain ((GMimeStreamFilter *) filtered, chain);
+	
+	output = g_byte_array_new ();
+	buf = g_malloc (readsize);
+	
+	while ((n = g_mime_stream_read (filtered, buf, readsize)) > 0)
+		g_byte_array_append (output, (guint8 *) buf, n);
+	
+	g_object_unref (filtered);
+	g_object_unref (stream);
+	g_free (buf);
+	
+	return output;
+}
+
+/* streams that don't own their fd have to leave its offset where they
+ * stopped writing, so that whoever else writes to it carries on from
+ * there rather than overwriting what they wrote */
+static void
+test_stream_fs_shared (void)
+{
+	static const char expected[] = "before\none\ntwo\nthree\nfour\nafter\n";
+	GMimeStreamIOVector vector[2];
+	GMimeStream *stream;
+	char *output = NULL;
+	gsize outlen;
+	char *path;
+	int fd;
+	
+	if ((fd = g_file_open_tmp ("test-streams.XXXXXX", &path, NULL)) == -1)
+		return;
+	
+	testsuite_check ("GMimeStreamFs on a shared fd");
+	try {
+		if (write (fd, "before\n", 7) != 7)
+			throw (exception_new ("could not write to `%s'", path));
+		
+		stream = g_mime_stream_fs_new (fd);
+		g_mime_stream_fs_set_owner ((GMimeStreamFs *) stream, FALSE);
+		g_mime_stream_write_string (stream, "one\n");
+		g_object_unref (stream);
+		
+		if (write (fd, "two\n", 4) != 4)
+			throw (exception_new ("could not write to `%s'", path));
+		
+		stream = g_mime_stream_fs_new (fd);
+		g_mime_stream_fs_set_owner ((GMimeStreamFs *) stream, FALSE);
+		vector[0].data = "three\n";
+		vector[0].len = 6;
+		vector[1].data = "four\n";
+		vector[1].len = 5;
+		g_mime_stream_writev (stream, vector, 2);
+		
+		/* while the stream is still around */
+		if (write (fd, "after\n", 6) != 6) {
+			g_object_unref (stream);
+			throw (exception_new ("could not write to `%s'", path));
+		}
+		
+		g_object_unref (stream);
+		
+		if (!g_file_get_contents (path, &output, &outlen, NULL))
+			throw (exception_new ("could not read back `%s'", path));
+		
+		if (outlen != strlen (expected) || memcmp (output, expected, outlen) != 0)
+			throw (exception_new ("wrote `%.*s'", (int) outlen, output));
+		
+		testsuite_check_passed ();
+	} catch (ex) {
+		testsuite_check_failed ("GMimeStreamFs on a shared fd: %s", ex->message);
+	} finally;
+	
+	close (fd);
+	unlink (path);
+	g_free (output);
+	g_free (path);
+}
+
+static void
+test_stream_filter_chunks (void)
+{
+	static const char alphabet[] = "abc=\r\r\n\n. ";
+	size_t chunksizes[] = { 16, 4096, 65536 };
+	size_t readsizes[] = { 1, 13, 4096, 65536 };
+	GByteArray *input, *expected, *output;
+	size_t i, j, k, n;
+	int chain;
+	char c;
+	
+	/* lots of CRs, so that some are left pending at the end of a chunk */
+	input = g_byte_array_new ();
+	for (i = 0; i < 200000; i++) {
+		c = alphabet[(int) ((sizeof (alphabet) - 1) * (rand () / (RAND_MAX + 1.0)))];
+		g_byte_array_append (input, (guint8 *) &c, 1);
+	}
+	
+	for (chain = 0; chain < NUM_FILTER_CHAINS; chain++) {
+		/* reading (which lets the filters work in place) must
+		 * give the same result as writing (which does not),
+		 * however the data is chunked */
+		expected = filter_chain_write (input, chain);
+		
+		for (i = 0; i < G_N_ELEMENTS (chunksizes); i++) {
+			for (j = 0; j < G_N_ELEMENTS (readsizes); j++) {
+				testsuite_check ("GMimeStreamFilter chain %d read (chunk size %u, read size %u)",
+						 chain, (unsigned int) chunksizes[i], (unsigned int) readsizes[j]);
+				
+				output = filter_chain_read (input, chain, chunksizes[i], readsizes[j]);
+				
+				for (k = 0, n = MIN (output->len, expected->len); k < n; k++) {
+					if (output->data[k] != expected->data[k])
+						break;
+				}
+				
+				if (output->len != expected->len || k < n)
+					testsuite_check_failed ("GMimeStreamFilter chain %d read (chunk size %u, read size %u) failed: "
+								"output differs at offset %u",
+								chain, (unsigned int) chunksizes[i], (unsigned int) readsizes[j],
+								(unsigned int) k);
+				else
+					testsuite_check_passed ();
+				
+				g_byte_array_free (output, TRUE);
+			}
+		}
+		
+		g_byte_array_free (expected, TRUE);
+	}
+	
+	g_byte_array_free (input, TRUE);
+}
+
+static GByteArray *
+base64_encode_pieces (GByteArray *input, size_t piecelen)
+{
+	GMimeStream *stream, *filtered;
+	GMimeFilter *filter;
+	GByteArray *output;
+	size_t i, n;
+	
+	output = g_byte_array_new ();
+	stream = g_mime_stream_mem_new_with_byte_array (output);
+	g_mime_stream_mem_set_owner ((GMimeStreamMem *) stream, FALSE);
+	
+	/* each piece is encoded on its own, so that the output has
+	 * padding in the middle of it unless piecelen is a multiple of 3 */
+	for (i = 0; i < input->len; i += n) {
+		n = MIN (piecelen, input->len - i);
+		
+		filtered = g_mime_stream_filter_new (stream);
+		filter = g_mime_filter_basic_new (GMIME_CONTENT_ENCODING_BASE64, TRUE);
+		g_mime_stream_filter_add ((GMimeStreamFilter *) filtered, filter);
+		g_object_unref (filter);
+		
+		g_mime_stream_write (filtered, (const char *) input->data + i, n);
+		g_mime_stream_flush (filtered);
+		g_object_unref (filtered);
+	}
+	
+	g_object_unref (stream);
+	
+	return output;
+}
+
+static void
+base64_stream_compare (GMimeStream *stream, GByteArray *expected, gint64 offset, size_t len)
+{
+	char *buf;
+	ssize_t n;
+	
+	buf = g_malloc (len + 1);
+	
+	if (g_mime_stream_seek (stream, offset, GMIME_STREAM_SEEK_SET) != offset) {
+		g_free (buf);
+		throw (exception_new ("could not seek to %" G_GINT64_FORMAT, offset));
+	}
+	
+	n = g_mime_stream_read (stream, buf, len + 1);
+	len = MIN (len + 1, expected->len - offset);
+	
+	if (n != (ssize_t) len || memcmp (buf, expected->data + offset, len) != 0) {
+		g_free (buf);
+		throw (exception_new ("read of %u bytes at %" G_GINT64_FORMAT " does not match",
+				      (unsigned int) len, offset));
+	}
+	
+	g_free (buf);
+}
+
+static struct {
+	const char *what;
+	size_t piecelen;
+	gboolean stray;
+} base64_inputs[] = {
+	{ "one piece",           0,      FALSE },
+	{ "1-byte pieces",       1,      FALSE },
+	{ "1000-byte pieces",    1000,   FALSE },
+	{ "57000-byte pieces",   57000,  FALSE },
+	{ "100000-byte pieces",  100000, FALSE },
+	{ "stray padding",       0,      TRUE  },
+};
+
+static void
+test_stream_base64 (void)
+{
+	GMimeStream *source, *stream, *sub;
+	GMimeDataWrapper *wrapper;
+	GByteArray *input, *encoded, *expected, *padded;
+	guint8 pad = '=';
+	size_t k;
+	gint64 offset;
+	int state, i, j;
+	guint32 save;
+	size_t len;
+	char *buf;
+	ssize_t n;
+	
+	input = g_byte_array_new ();
+	for (i = 0; i < 600000; i++) {
+		guint8 c = (guint8) (256 * (rand () / (RAND_MAX + 1.0)));
+		g_byte_array_append (input, &c, 1);
+	}
+	
+	for (i = 0; i < (int) G_N_ELEMENTS (base64_inputs); i++) {
+		encoded = base64_encode_pieces (input, base64_inputs[i].piecelen ? base64_inputs[i].piecelen : input->len);
+		
+		if (base64_inputs[i].stray) {
+			/* '=' where it does not belong, anywhere in a quad */
+			padded = g_byte_array_sized_new (encoded->len + encoded->len / 10);
+			for (k = 0; k < encoded->len; k++) {
+				if (rand () % 20 == 0)
+					g_byte_array_append (padded, &pad, 1);
+				g_byte_array_append (padded, encoded->data + k, 1);
+			}
+			
+			g_byte_array_free (encoded, TRUE);
+			encoded = padded;
+		}
+		
+		/* what decoding all of it in a single step gives */
+		expected = g_byte_array_new ();
+		g_byte_array_set_size (expected, encoded->len);
+		state = 0;
+		save = 0;
+		expected->len = g_mime_encoding_base64_decode_step (encoded->data, encoded->len,
+								    expected->data, &state, &save);
+		
+		testsuite_check ("GMimeStreamBase64 (%s)", base64_inputs[i].what);
+		source = g_mime_stream_mem_new_with_buffer ((const char *) encoded->data, encoded->len);
+		stream = g_mime_stream_base64_new (source);
+		g_object_unref (source);
+		sub = g_mime_stream_substream (stream, 123456, 345678);
+		try {
+			/* jump straight to the end before anything is decoded */
+			if (g_mime_stream_seek (stream, -100, GMIME_STREAM_SEEK_END) != (gint64) expected->len - 100)
+				throw (exception_new ("could not seek to the end"));
+			
+			base64_stream_compare (stream, expected, expected->len - 100, 100);
+			
+			if (g_mime_stream_length (stream) != (gint64) expected->len)
+				throw (exception_new ("wrong length"));
+			
+			base64_stream_compare (stream, expected, 0, expected->len);
+			
+			for (j = 0; j < 200; j++) {
+				offset = (gint64) (expected->len * (rand () / (RAND_MAX + 1.0)));
+				len = (size_t) (70000 * (rand () / (RAND_MAX + 1.0)));
+				base64_stream_compare (stream, expected, offset, len);
+			}
+			
+			/* a substream decodes independently of its parent */
+			if (g_mime_stream_length (sub) != 345678 - 123456)
+				throw (exception_new ("wrong substream length"));
+			
+			buf = g_malloc (345678 - 123456);
+			n = g_mime_stream_read (sub, buf, 345678 - 123456);
+			if (n != 345678 - 123456 || memcmp (buf, expected->data + 123456, n) != 0) {
+				g_free (buf);
+				throw (exception_new ("substream does not match"));
+			}
+			g_free (buf);
+			
+			if (g_mime_stream_write (stream, "abc", 3) != -1)
+				throw (exception_new ("stream is writable"));
+			
+			testsuite_check_passed ();
+		} catch (ex) {
+			testsuite_check_failed ("GMimeStreamBase64 (%s) failed: %s",
+						base64_inputs[i].what, ex->message);
+		} finally;
+		
+		g_object_unref (sub);
+		g_object_unref (stream);
+		
+		testsuite_check ("GMimeDataWrapper::get_decoded_stream() (%s)",
+				 base64_inputs[i].what);
+		source = g_mime_stream_mem_new_with_buffer ((const char *) encoded->data, encoded->len);
+		wrapper = g_mime_data_wrapper_new_with_stream (source, GMIME_CONTENT_ENCODING_BASE64);
+		g_object_unref (source);
+		stream = g_mime_data_wrapper_get_decoded_stream (wrapper);
+		try {
+			if (!GMIME_IS_STREAM_BASE64 (stream))
+				throw (exception_new ("not a GMimeStreamBase64"));
+			
+			base64_stream_compare (stream, expected, 456789, 4096);
+			base64_stream_compare (stream, expected, 1, 4096);
+			
+			testsuite_check_passed ();
+		} catch (ex) {
+			testsuite_check_failed ("GMimeDataWrapper::get_decoded_stream() (%s) failed: %s",
+						base64_inputs[i].what, ex->message);
+		} finally;
+		
+		g_object_unref (stream);
+		g_object_unref (wrapper);
+		g_byte_array_free (expected, TRUE);
+		g_byte_array_free (encoded, TRUE);
+	}
+	
+	g_byte_array_free (input, TRUE);
+}
+
 int main (int argc, char **argv)
 {
 	const char *datadir = "data/streams";
@@ -692,8 +1399,17 @@ int main (int argc, char **argv)
 		
 		strcpy (p, dent);
 		test_stream_buffer_gets (path);
+#ifdef HAVE_PREAD
+		test_stream_fs_threads (path);
+#endif
+		test_stream_fs_writev (path);
+		test_stream_fs_copy (path);
 	}
 	
+	test_stream_fs_shared ();
+	test_stream_filter_chunks ();
+	test_stream_base64 ();
+	
 	if (gen_data && stream_name && testsuite_total_errors () == 0) {
 		/* since all tests were successful, unlink the generated test data */
 		strcpy (p, stream_name);